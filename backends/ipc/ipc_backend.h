@@ -0,0 +1,52 @@
+#ifndef IPC_BACKEND_H
+#define IPC_BACKEND_H
+
+#include <string>
+#include "backend.h"
+
+namespace rwkvmobile {
+
+// prefix of the backend name that selects this backend: "ipc:<socket path>"
+const std::string ipc_backend_prefix = "ipc:";
+
+// forwards evaluation to a rwkv_mobile_daemon that owns the model, so that several
+// processes on a host share one copy of the weights. tokenizer, sampling and
+// penalties stay in the calling process.
+class ipc_backend : public execution_provider {
+public:
+    ~ipc_backend() { release(); }
+    // extra: the daemon's socket path (const char *)
+    int init(void * extra) override;
+    int load_model(std::string model_path) override;
+    int eval(int id, std::vector<float> &logits) override;
+    int eval(std::vector<int> ids, std::vector<float> &logits) override;
+    int eval_half(int id, std::vector<uint16_t> &logits, int precision) override;
+    int eval_half(std::vector<int> ids, std::vector<uint16_t> &logits, int precision) override;
+    int eval_target_logprobs(const std::vector<int> &ids, const std::vector<int> &targets, int vocab_size, std::vector<float> &logprobs) override;
+    int get_state(std::vector<float> &state) override;
+    int set_state(std::vector<float> state) override;
+    int clear_state() override;
+    int release_model() override;
+    int release() override;
+    bool is_available() override;
+
+private:
+    // sends the request and waits for the response; fd receives a passed descriptor, if any
+    int call(uint32_t op, uint32_t n_tokens, uint32_t n_floats, const std::string &path,
+        struct ipc_response &response, int * fd = nullptr, uint32_t precision = 0);
+    // logits: n_logits floats with RWKV_LOGITS_FP32, uint16 bits otherwise
+    int eval_chunk(const int * ids, size_t n, int precision, void * logits, size_t n_logits);
+    template <typename T>
+    int eval_chunks(const std::vector<int> &ids, int precision, std::vector<T> &logits);
+
+    int _socket = -1;
+    int _shm_fd = -1;
+    uint8_t * _shm = nullptr;
+    size_t _shm_size = 0;
+    size_t _vocab_size = 0;
+    size_t _state_size = 0;
+};
+
+}
+
+#endif
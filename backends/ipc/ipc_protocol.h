@@ -0,0 +1,78 @@
+#ifndef IPC_PROTOCOL_H
+#define IPC_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+// wire protocol between ipc_backend (client) and rwkv_mobile_daemon.
+// the unix socket only carries fixed-size request/response headers; token ids,
+// logits and states go through a shared memory region that the daemon creates
+// per connection and hands to the client (SCM_RIGHTS) when the model is loaded.
+
+namespace rwkvmobile {
+
+const uint32_t ipc_protocol_version = 2;
+
+enum {
+    // payload: model path (path_len bytes) after the request;
+    // response carries the shm fd, vocab size and state size
+    IPC_OP_LOAD_MODEL = 0,
+    // tokens[0, n_tokens) -> floats[0, vocab_size) logits
+    IPC_OP_EVAL,
+    // tokens[0, n_tokens), targets[0, n_tokens) -> floats[0, n_tokens) log-probs
+    IPC_OP_TARGET_LOGPROBS,
+    // -> floats[0, state_size)
+    IPC_OP_GET_STATE,
+    // floats[0, n_floats) -> state
+    IPC_OP_SET_STATE,
+    IPC_OP_CLEAR_STATE,
+    // tokens[0, n_tokens) -> uint16[0, vocab_size) logits as raw bits of the request's
+    // precision (RWKV_LOGITS_FP16 / RWKV_LOGITS_BF16), half the bytes of IPC_OP_EVAL
+    IPC_OP_EVAL_HALF,
+};
+
+struct ipc_request {
+    uint32_t version;
+    uint32_t op;
+    uint32_t n_tokens;
+    uint32_t n_floats;
+    uint32_t path_len;
+    // IPC_OP_EVAL_HALF only
+    uint32_t precision;
+};
+
+struct ipc_response {
+    int32_t status;
+    // floats, or half values for IPC_OP_EVAL_HALF
+    uint32_t n_floats;
+    uint32_t vocab_size;
+    uint32_t state_size;
+    uint64_t shm_size;
+};
+
+// tokens per request; longer prompts are sent in chunks
+const uint32_t ipc_token_capacity = 16384;
+
+// shm layout: tokens, targets (int32 x ipc_token_capacity each), then floats
+struct ipc_shm_layout {
+    size_t tokens_offset;
+    size_t targets_offset;
+    size_t floats_offset;
+    size_t float_capacity;
+    size_t size;
+
+    ipc_shm_layout(size_t vocab_size, size_t state_size) {
+        tokens_offset = 0;
+        targets_offset = tokens_offset + ipc_token_capacity * sizeof(int32_t);
+        floats_offset = targets_offset + ipc_token_capacity * sizeof(int32_t);
+        float_capacity = vocab_size > state_size ? vocab_size : state_size;
+        if (float_capacity < ipc_token_capacity) {
+            float_capacity = ipc_token_capacity;
+        }
+        size = floats_offset + float_capacity * sizeof(float);
+    }
+};
+
+}
+
+#endif
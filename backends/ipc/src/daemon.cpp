@@ -0,0 +1,273 @@
+// rwkv_mobile_daemon: loads one model and serves ipc_backend clients over a unix socket,
+// so that processes on the same host share a single copy of the weights.
+// every connection gets its own session (state) on the shared model.
+
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "commondef.h"
+#include "half.h"
+#include "runtime.h"
+#include "ipc_protocol.h"
+
+using namespace rwkvmobile;
+
+static bool send_all(int fd, const void * data, size_t len, int passed_fd = -1) {
+    const char * p = static_cast<const char *>(data);
+    while (len > 0) {
+        struct iovec iov = {const_cast<char *>(p), len};
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (passed_fd >= 0) {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+        }
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        // the descriptor goes with the first chunk only
+        passed_fd = -1;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, void * data, size_t len) {
+    char * p = static_cast<char *>(data);
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+struct daemon_model {
+    std::shared_ptr<model> shared;
+    std::string path;
+    size_t vocab_size;
+    size_t state_size;
+};
+
+static void serve(int client, const daemon_model &served) {
+    runtime session(served.shared);
+    ipc_shm_layout layout(served.vocab_size, served.state_size);
+    int shm_fd = -1;
+    uint8_t * shm = nullptr;
+
+    std::vector<int> ids, targets;
+    std::vector<float> logits(served.vocab_size), floats;
+    std::string path;
+    while (true) {
+        ipc_request request;
+        if (!recv_all(client, &request, sizeof(request))) {
+            break;
+        }
+        // path_len comes from the client; a longer path can't name the served model
+        if (request.path_len > PATH_MAX) {
+            break;
+        }
+        path.resize(request.path_len);
+        if (!recv_all(client, &path[0], path.size())) {
+            break;
+        }
+
+        ipc_response response = {};
+        int passed_fd = -1;
+        if (request.version != ipc_protocol_version) {
+            response.status = RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+        } else if (request.op != IPC_OP_LOAD_MODEL && shm == nullptr) {
+            response.status = RWKV_ERROR_BACKEND | RWKV_ERROR_MODEL;
+        } else if (request.n_tokens > ipc_token_capacity || request.n_floats > layout.float_capacity) {
+            response.status = RWKV_ERROR_BACKEND | RWKV_ERROR_INVALID_PARAMETERS;
+        } else {
+            const int32_t * shm_tokens = shm == nullptr ? nullptr : (const int32_t *)(shm + layout.tokens_offset);
+            const int32_t * shm_targets = shm == nullptr ? nullptr : (const int32_t *)(shm + layout.targets_offset);
+            float * shm_floats = shm == nullptr ? nullptr : (float *)(shm + layout.floats_offset);
+            switch (request.op) {
+                case IPC_OP_LOAD_MODEL: {
+                    if (path != served.path) {
+                        response.status = RWKV_ERROR_MODEL | RWKV_ERROR_INVALID_PARAMETERS;
+                        break;
+                    }
+                    if (shm == nullptr) {
+                        shm_fd = memfd_create("rwkv_mobile_ipc", MFD_CLOEXEC);
+                        void * mapped = MAP_FAILED;
+                        if (shm_fd >= 0 && ftruncate(shm_fd, layout.size) == 0) {
+                            mapped = mmap(nullptr, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+                        }
+                        if (mapped == MAP_FAILED) {
+                            response.status = RWKV_ERROR_BACKEND | RWKV_ERROR_ALLOC;
+                            break;
+                        }
+                        shm = static_cast<uint8_t *>(mapped);
+                    }
+                    response.shm_size = layout.size;
+                    response.vocab_size = served.vocab_size;
+                    response.state_size = served.state_size;
+                    passed_fd = shm_fd;
+                    break;
+                }
+                case IPC_OP_EVAL:
+                case IPC_OP_EVAL_HALF:
+                    if (request.op == IPC_OP_EVAL_HALF && request.precision != RWKV_LOGITS_FP16
+                        && request.precision != RWKV_LOGITS_BF16) {
+                        response.status = RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+                        break;
+                    }
+                    if (request.n_tokens == 0) {
+                        response.status = RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+                        break;
+                    }
+                    if (request.n_tokens == 1) {
+                        response.status = session.eval_logits(shm_tokens[0], logits);
+                    } else {
+                        ids.assign(shm_tokens, shm_tokens + request.n_tokens);
+                        response.status = session.eval_logits(ids, logits);
+                    }
+                    if (request.op == IPC_OP_EVAL) {
+                        memcpy(shm_floats, logits.data(), logits.size() * sizeof(float));
+                    } else {
+                        // narrowed here, so the client copies half the bytes
+                        uint16_t * shm_half = (uint16_t *)shm_floats;
+                        for (size_t i = 0; i < logits.size(); i++) {
+                            shm_half[i] = request.precision == RWKV_LOGITS_BF16 ? fp32_to_bf16(logits[i]) : fp32_to_fp16(logits[i]);
+                        }
+                    }
+                    response.n_floats = logits.size();
+                    break;
+                case IPC_OP_TARGET_LOGPROBS:
+                    ids.assign(shm_tokens, shm_tokens + request.n_tokens);
+                    targets.assign(shm_targets, shm_targets + request.n_tokens);
+                    response.status = session.eval_target_logprobs(ids, targets, floats);
+                    if (!response.status) {
+                        memcpy(shm_floats, floats.data(), floats.size() * sizeof(float));
+                        response.n_floats = floats.size();
+                    }
+                    break;
+                case IPC_OP_GET_STATE:
+                    response.status = session.get_state(floats);
+                    if (!response.status && floats.size() > layout.float_capacity) {
+                        response.status = RWKV_ERROR_BACKEND | RWKV_ERROR_ALLOC;
+                    }
+                    if (!response.status) {
+                        memcpy(shm_floats, floats.data(), floats.size() * sizeof(float));
+                        response.n_floats = floats.size();
+                    }
+                    break;
+                case IPC_OP_SET_STATE:
+                    floats.assign(shm_floats, shm_floats + request.n_floats);
+                    response.status = session.set_state(floats);
+                    break;
+                case IPC_OP_CLEAR_STATE:
+                    response.status = session.clear_state();
+                    break;
+                default:
+                    response.status = RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+            }
+        }
+        if (!send_all(client, &response, sizeof(response), passed_fd)) {
+            break;
+        }
+    }
+
+    if (shm != nullptr) {
+        munmap(shm, layout.size);
+    }
+    if (shm_fd >= 0) {
+        close(shm_fd);
+    }
+    close(client);
+}
+
+int main(int argc, char ** argv) {
+    if (argc != 4 && argc != 5) {
+        std::cerr << "Usage: " << argv[0] << " <backend> <model_file> <socket_path> [socket_mode (octal, default 0600)]" << std::endl;
+        return 1;
+    }
+    // whoever can connect can run the model, so by default only the daemon's user can
+    mode_t socket_mode = 0600;
+    if (argc == 5) {
+        char * end = nullptr;
+        long mode = strtol(argv[4], &end, 8);
+        if (end == argv[4] || *end != '\0' || mode < 0 || mode > 0777) {
+            std::cerr << "Invalid socket mode " << argv[4] << std::endl;
+            return 1;
+        }
+        socket_mode = mode;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    daemon_model served;
+    served.shared = std::make_shared<model>();
+    if (served.shared->init(std::string(argv[1])) != RWKV_SUCCESS
+        || served.shared->load_model(argv[2]) != RWKV_SUCCESS) {
+        std::cerr << "Failed to load model " << argv[2] << std::endl;
+        return 1;
+    }
+    std::error_code ec;
+    served.path = std::filesystem::weakly_canonical(argv[2], ec).string();
+    if (ec) {
+        served.path = argv[2];
+    }
+    served.vocab_size = served.shared->get_backend_output_size();
+    {
+        runtime probe(served.shared);
+        std::vector<float> state;
+        probe.get_state(state);
+        served.state_size = state.size();
+    }
+
+    std::string socket_path = argv[3];
+    struct sockaddr_un addr = {};
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Socket path too long" << std::endl;
+        return 1;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socket_path.c_str(), socket_path.size());
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socket_path.c_str());
+    // the socket file is created by bind: keep it private until it has its final mode
+    mode_t old_mask = umask(0177);
+    bool bound = listener >= 0 && bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    umask(old_mask);
+    if (!bound || chmod(socket_path.c_str(), socket_mode) != 0 || listen(listener, 64) != 0) {
+        std::cerr << "Failed to listen on " << socket_path << std::endl;
+        return 1;
+    }
+    std::cout << "Serving " << served.path << " on " << socket_path << std::endl;
+
+    while (true) {
+        int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            continue;
+        }
+        std::thread(serve, client, std::cref(served)).detach();
+    }
+    return 0;
+}
@@ -0,0 +1,333 @@
+#include <cstring>
+#include <filesystem>
+
+#ifdef ENABLE_IPC
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "ipc_backend.h"
+#include "ipc_protocol.h"
+#include "commondef.h"
+
+namespace rwkvmobile {
+
+#ifdef ENABLE_IPC
+
+static bool send_all(int fd, const void * data, size_t len) {
+    const char * p = static_cast<const char *>(data);
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// receives exactly len bytes, plus a descriptor passed with them (if any) into *fd
+static bool recv_all(int fd, void * data, size_t len, int * passed_fd) {
+    char * p = static_cast<char *>(data);
+    while (len > 0) {
+        struct iovec iov = {p, len};
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n <= 0) {
+            return false;
+        }
+        for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                int received;
+                memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+                if (passed_fd != nullptr) {
+                    *passed_fd = received;
+                } else {
+                    close(received);
+                }
+            }
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+int ipc_backend::init(void * extra) {
+    if (extra == nullptr) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    std::string path = static_cast<const char *>(extra);
+    struct sockaddr_un addr = {};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    _socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_socket < 0) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_INIT;
+    }
+    if (connect(_socket, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(_socket);
+        _socket = -1;
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_INIT;
+    }
+    return RWKV_SUCCESS;
+}
+
+int ipc_backend::call(uint32_t op, uint32_t n_tokens, uint32_t n_floats, const std::string &path,
+    struct ipc_response &response, int * fd, uint32_t precision) {
+    if (_socket < 0) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_INIT;
+    }
+    ipc_request request = {ipc_protocol_version, op, n_tokens, n_floats, (uint32_t)path.size(), precision};
+    if (!send_all(_socket, &request, sizeof(request)) || !send_all(_socket, path.data(), path.size())
+        || !recv_all(_socket, &response, sizeof(response), fd)) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_IO;
+    }
+    return response.status;
+}
+
+int ipc_backend::load_model(std::string model_path) {
+    release_model();
+    // the daemon serves one model; it checks that this is the one it loaded
+    std::error_code ec;
+    std::string path = std::filesystem::weakly_canonical(model_path, ec).string();
+    if (ec) {
+        path = model_path;
+    }
+    ipc_response response;
+    int fd = -1;
+    int ret = call(IPC_OP_LOAD_MODEL, 0, 0, path, response, &fd);
+    if (ret) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return ret;
+    }
+    if (fd < 0) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_IO;
+    }
+    void * shm = mmap(nullptr, response.shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+        close(fd);
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_ALLOC;
+    }
+    _shm_fd = fd;
+    _shm = static_cast<uint8_t *>(shm);
+    _shm_size = response.shm_size;
+    _vocab_size = response.vocab_size;
+    _state_size = response.state_size;
+    return RWKV_SUCCESS;
+}
+
+int ipc_backend::eval_chunk(const int * ids, size_t n, int precision, void * logits, size_t n_logits) {
+    if (_shm == nullptr) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_MODEL;
+    }
+    ipc_shm_layout layout(_vocab_size, _state_size);
+    memcpy(_shm + layout.tokens_offset, ids, n * sizeof(int32_t));
+    ipc_response response;
+    const bool half = precision != RWKV_LOGITS_FP32;
+    int ret = call(half ? IPC_OP_EVAL_HALF : IPC_OP_EVAL, n, 0, "", response, nullptr, precision);
+    if (ret) {
+        return ret;
+    }
+    if (n_logits != response.n_floats) {
+        return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    memcpy(logits, _shm + layout.floats_offset, response.n_floats * (half ? sizeof(uint16_t) : sizeof(float)));
+    return RWKV_SUCCESS;
+}
+
+template <typename T>
+int ipc_backend::eval_chunks(const std::vector<int> &ids, int precision, std::vector<T> &logits) {
+    if (ids.empty()) {
+        return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    for (size_t begin = 0; begin < ids.size(); begin += ipc_token_capacity) {
+        size_t n = std::min<size_t>(ipc_token_capacity, ids.size() - begin);
+        int ret = eval_chunk(ids.data() + begin, n, precision, logits.data(), logits.size());
+        if (ret) {
+            return ret;
+        }
+    }
+    return RWKV_SUCCESS;
+}
+
+int ipc_backend::eval(int id, std::vector<float> &logits) {
+    return eval_chunk(&id, 1, RWKV_LOGITS_FP32, logits.data(), logits.size());
+}
+
+int ipc_backend::eval(std::vector<int> ids, std::vector<float> &logits) {
+    return eval_chunks(ids, RWKV_LOGITS_FP32, logits);
+}
+
+int ipc_backend::eval_half(int id, std::vector<uint16_t> &logits, int precision) {
+    if (precision != RWKV_LOGITS_FP16 && precision != RWKV_LOGITS_BF16) {
+        return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    return eval_chunk(&id, 1, precision, logits.data(), logits.size());
+}
+
+int ipc_backend::eval_half(std::vector<int> ids, std::vector<uint16_t> &logits, int precision) {
+    if (precision != RWKV_LOGITS_FP16 && precision != RWKV_LOGITS_BF16) {
+        return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    return eval_chunks(ids, precision, logits);
+}
+
+int ipc_backend::eval_target_logprobs(const std::vector<int> &ids, const std::vector<int> &targets, int vocab_size, std::vector<float> &logprobs) {
+    if (ids.empty() || ids.size() != targets.size()) {
+        return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    if (_shm == nullptr) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_MODEL;
+    }
+    // the daemon checks them too, but a bad id shouldn't cost a round trip
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (ids[i] < 0 || ids[i] >= (int)_vocab_size || targets[i] < 0 || targets[i] >= (int)_vocab_size) {
+            return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+        }
+    }
+    ipc_shm_layout layout(_vocab_size, _state_size);
+    logprobs.resize(ids.size());
+    for (size_t begin = 0; begin < ids.size(); begin += ipc_token_capacity) {
+        size_t n = std::min<size_t>(ipc_token_capacity, ids.size() - begin);
+        memcpy(_shm + layout.tokens_offset, ids.data() + begin, n * sizeof(int32_t));
+        memcpy(_shm + layout.targets_offset, targets.data() + begin, n * sizeof(int32_t));
+        ipc_response response;
+        int ret = call(IPC_OP_TARGET_LOGPROBS, n, 0, "", response);
+        if (ret) {
+            return ret;
+        }
+        memcpy(logprobs.data() + begin, _shm + layout.floats_offset, n * sizeof(float));
+    }
+    return RWKV_SUCCESS;
+}
+
+int ipc_backend::get_state(std::vector<float> &state) {
+    if (_shm == nullptr) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_MODEL;
+    }
+    ipc_response response;
+    int ret = call(IPC_OP_GET_STATE, 0, 0, "", response);
+    if (ret) {
+        return ret;
+    }
+    ipc_shm_layout layout(_vocab_size, _state_size);
+    state.resize(response.n_floats);
+    memcpy(state.data(), _shm + layout.floats_offset, response.n_floats * sizeof(float));
+    return RWKV_SUCCESS;
+}
+
+int ipc_backend::set_state(std::vector<float> state) {
+    if (_shm == nullptr) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_MODEL;
+    }
+    ipc_shm_layout layout(_vocab_size, _state_size);
+    if (state.size() > layout.float_capacity) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    memcpy(_shm + layout.floats_offset, state.data(), state.size() * sizeof(float));
+    ipc_response response;
+    return call(IPC_OP_SET_STATE, 0, state.size(), "", response);
+}
+
+int ipc_backend::clear_state() {
+    ipc_response response;
+    return call(IPC_OP_CLEAR_STATE, 0, 0, "", response);
+}
+
+int ipc_backend::release_model() {
+    if (_shm != nullptr) {
+        munmap(_shm, _shm_size);
+        _shm = nullptr;
+    }
+    if (_shm_fd >= 0) {
+        close(_shm_fd);
+        _shm_fd = -1;
+    }
+    return RWKV_SUCCESS;
+}
+
+int ipc_backend::release() {
+    release_model();
+    if (_socket >= 0) {
+        close(_socket);
+        _socket = -1;
+    }
+    return RWKV_SUCCESS;
+}
+
+bool ipc_backend::is_available() {
+    return _socket >= 0;
+}
+
+#else
+
+int ipc_backend::init(void * extra) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int ipc_backend::load_model(std::string model_path) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int ipc_backend::eval(int id, std::vector<float> &logits) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int ipc_backend::eval(std::vector<int> ids, std::vector<float> &logits) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int ipc_backend::eval_half(int id, std::vector<uint16_t> &logits, int precision) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int ipc_backend::eval_half(std::vector<int> ids, std::vector<uint16_t> &logits, int precision) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int ipc_backend::eval_target_logprobs(const std::vector<int> &ids, const std::vector<int> &targets, int vocab_size, std::vector<float> &logprobs) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int ipc_backend::get_state(std::vector<float> &state) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int ipc_backend::set_state(std::vector<float> state) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int ipc_backend::clear_state() {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int ipc_backend::release_model() {
+    return RWKV_SUCCESS;
+}
+
+int ipc_backend::release() {
+    return RWKV_SUCCESS;
+}
+
+bool ipc_backend::is_available() {
+    return false;
+}
+
+#endif
+
+}
@@ -22,10 +22,13 @@ use web_rwkv::{
         softmax::softmax_one,
         v4, v5, v6, JobRuntime,
     },
+    tensor::{TensorCpu, TensorInit, TensorShape},
     wgpu,
 };
 
 static RUNTIME: RwLock<Option<Runtime>> = RwLock::new(None);
+/// Token ids whose logits the next loaded runtime hands out; empty for the full vocab.
+static OUTPUT_SUBSET: RwLock<Vec<usize>> = RwLock::new(Vec::new());
 
 #[derive(Clone)]
 struct Runtime {
@@ -33,6 +36,28 @@ struct Runtime {
     state: Arc<dyn State + Sync + Send + 'static>,
     context: Context,
     tokio: Arc<tokio::runtime::Runtime>,
+    subset: Arc<Vec<usize>>,
+}
+
+/// Copy a full row of logits into `out`, or only the entries of `subset` if it isn't
+/// empty, so that a restricted output never crosses the FFI at full vocab size.
+fn gather_row(row: &[f32], subset: &[usize], out: &mut [f32]) {
+    if subset.is_empty() {
+        out.copy_from_slice(row);
+    } else {
+        for (out, &id) in out.iter_mut().zip(subset) {
+            *out = row[id];
+        }
+    }
+}
+
+/// Number of logits per row handed out for a model with `vocab` outputs, if the subset fits it.
+fn output_len(subset: &[usize], vocab: usize) -> Option<usize> {
+    match subset.last() {
+        None => Some(vocab),
+        Some(&last) if last < vocab => Some(subset.len()),
+        Some(_) => None,
+    }
 }
 
 async fn create_context(info: &ModelInfo) -> Result<Context> {
@@ -55,6 +80,7 @@ fn load_runtime(
 ) -> Result<Runtime> {
     let tokio = Arc::new(tokio::runtime::Runtime::new()?);
     let _tokio = tokio.clone();
+    let subset = Arc::new(OUTPUT_SUBSET.read().unwrap().clone());
 
     _tokio.block_on(async move {
         let file = File::open(model).await?;
@@ -88,6 +114,7 @@ fn load_runtime(
                     state,
                     context,
                     tokio,
+                    subset,
                 }
             }
             ModelVersion::V5 => {
@@ -100,6 +127,7 @@ fn load_runtime(
                     state,
                     context,
                     tokio,
+                    subset,
                 }
             }
             ModelVersion::V6 => {
@@ -112,6 +140,7 @@ fn load_runtime(
                     state,
                     context,
                     tokio,
+                    subset,
                 }
             }
         };
@@ -183,6 +212,40 @@ pub unsafe extern "C" fn web_rwkv_load_with_rescale(
     }
 }
 
+/// Restrict the logits of the runtimes loaded from now on to `ids` (sorted, distinct),
+/// in that order; `len == 0` restores the full vocab. The head still computes every
+/// row, but only the subset is copied out.
+///
+/// # Safety
+///
+/// The caller must ensure that `ids` is valid for `len` elements.
+#[no_mangle]
+pub unsafe extern "C" fn web_rwkv_set_output_subset(ids: *const u16, len: usize) -> i32 {
+    if ids.is_null() && len > 0 {
+        log::error!("invalid input");
+        return -1;
+    }
+    let ids: &[u16] = match len {
+        0 => &[],
+        _ => unsafe { std::slice::from_raw_parts(ids, len) },
+    };
+    if ids.windows(2).any(|pair| pair[0] >= pair[1]) {
+        log::error!("output subset must be sorted and distinct");
+        return -1;
+    }
+    let mut subset = OUTPUT_SUBSET.write().unwrap();
+    *subset = ids.iter().map(|&id| id as usize).collect();
+    0
+}
+
+/// Drop the loaded runtime: the model, its state and the device context. Calls
+/// still running keep their own reference until they return.
+#[no_mangle]
+pub extern "C" fn web_rwkv_release() {
+    let mut rt = RUNTIME.write().unwrap();
+    rt.take();
+}
+
 /// Clear the model state.
 #[no_mangle]
 pub extern "C" fn web_rwkv_clear_state() {
@@ -198,24 +261,86 @@ pub extern "C" fn web_rwkv_clear_state() {
     let _ = runtime.state.load(tensor, 0);
 }
 
-/// Get the model state.
-// #[no_mangle]
-// pub extern "C" fn get_state(output: *mut f32) -> i32 {
-//     let runtime = {
-//         let runtime = RUNTIME.read().unwrap();
-//         let Some(runtime) = runtime.clone() else {
-//             log::error!("runtime not loaded");
-//             return std::ptr::null_mut();
-//         };
-//         runtime
-//     };
-//     if output.is_null() {
-//         log::error!("output buffer cannot be null");
-//         return -1;
-//     }
-
-
-// }
+/// Get the number of floats in the model state.
+#[no_mangle]
+pub extern "C" fn web_rwkv_get_state_size() -> usize {
+    let runtime = {
+        let runtime = RUNTIME.read().unwrap();
+        let Some(runtime) = runtime.clone() else {
+            log::error!("runtime not loaded");
+            return 0;
+        };
+        runtime
+    };
+    runtime.state.init_shape().len()
+}
+
+/// Copy the model state out to `state`.
+///
+/// # Safety
+///
+/// The caller must ensure that `state` is valid for `len` floats.
+#[no_mangle]
+pub unsafe extern "C" fn web_rwkv_get_state(state: *mut f32, len: usize) -> i32 {
+    let runtime = {
+        let runtime = RUNTIME.read().unwrap();
+        let Some(runtime) = runtime.clone() else {
+            log::error!("runtime not loaded");
+            return -1;
+        };
+        runtime
+    };
+    if state.is_null() || len != runtime.state.init_shape().len() {
+        log::error!("state buffer size mismatch");
+        return -1;
+    }
+
+    let tokio = runtime.tokio.clone();
+    tokio.block_on(async move {
+        let Ok(tensor) = runtime.state.back(0).await else {
+            log::error!("failed to read back state");
+            return -1;
+        };
+        let data = tensor.to_vec();
+        std::ptr::copy_nonoverlapping(data.as_ptr(), state, len);
+        0
+    })
+}
+
+/// Load the model state from `state`.
+///
+/// # Safety
+///
+/// The caller must ensure that `state` is valid for `len` floats.
+#[no_mangle]
+pub unsafe extern "C" fn web_rwkv_set_state(state: *const f32, len: usize) -> i32 {
+    let runtime = {
+        let runtime = RUNTIME.read().unwrap();
+        let Some(runtime) = runtime.clone() else {
+            log::error!("runtime not loaded");
+            return -1;
+        };
+        runtime
+    };
+    let shape = runtime.state.init_shape();
+    if state.is_null() || len != shape.len() {
+        log::error!("state buffer size mismatch");
+        return -1;
+    }
+
+    let data: &[f32] = unsafe { std::slice::from_raw_parts(state, len) };
+    let Ok(tensor) = TensorCpu::from_data(shape, data.to_vec()) else {
+        log::error!("failed to create state tensor");
+        return -1;
+    };
+    match runtime.state.load(tensor, 0) {
+        Ok(_) => 0,
+        Err(err) => {
+            log::error!("{err}");
+            -1
+        }
+    }
+}
 
 /// Generate the next token prediction given the input tokens and a sampler.
 ///
@@ -311,18 +436,165 @@ pub unsafe extern "C" fn web_rwkv_infer_logits(tokens: *const u16, len: usize, l
             }
         };
 
-        if output.size() != (logits_len * 4) {
+        let vocab = output.shape()[0];
+        if output_len(&runtime.subset, vocab) != Some(logits_len) {
             log::error!("output buffer size mismatch");
-            log::error!("expected: {}", logits_len * 4);
-            log::error!("actual: {}", output.size());
+            log::error!("expected: {:?}", output_len(&runtime.subset, vocab));
+            log::error!("actual: {}", logits_len);
             return -1;
         }
 
-        std::ptr::copy_nonoverlapping(output.as_ptr(), logits, logits_len);
+        if runtime.subset.is_empty() {
+            std::ptr::copy_nonoverlapping(output.as_ptr(), logits, logits_len);
+        } else {
+            let logits: &mut [f32] = unsafe { std::slice::from_raw_parts_mut(logits, logits_len) };
+            gather_row(&output.to_vec(), &runtime.subset, logits);
+        }
         return 0;
     })
 }
 
+/// Evaluate `tokens` in one pass and write the logits after every position:
+/// row `i` (`row_len` floats) of `logits` follows `tokens[..=i]`.
+///
+/// # Safety
+///
+/// The caller must ensure that `tokens` is valid for `len` elements and `logits` for `len * row_len`.
+#[no_mangle]
+pub unsafe extern "C" fn web_rwkv_infer_all_logits(
+    tokens: *const u16,
+    len: usize,
+    logits: *mut f32,
+    row_len: usize,
+) -> i32 {
+    let runtime = {
+        let runtime = RUNTIME.read().unwrap();
+        let Some(runtime) = runtime.clone() else {
+            log::error!("runtime not loaded");
+            return -1;
+        };
+        runtime
+    };
+
+    if tokens.is_null() || logits.is_null() || len == 0 {
+        log::error!("invalid input");
+        return -1;
+    }
+    let tokens: &[u16] = unsafe { std::slice::from_raw_parts(tokens, len) };
+    let logits: &mut [f32] = unsafe { std::slice::from_raw_parts_mut(logits, len * row_len) };
+
+    let tokio = runtime.tokio.clone();
+    tokio.block_on(async move {
+        let mut inference = Some(InferInput::new(
+            vec![InferInputBatch {
+                tokens: tokens.to_vec(),
+                option: InferOption::Full,
+            }],
+            128,
+        ));
+        let mut position = 0;
+        while position < len {
+            let input = inference.take().unwrap();
+            let (input, InferOutput(output)) = runtime.runtime.infer(input).await;
+            let output = output[0].0.clone();
+            inference.replace(input);
+
+            if output.size() == 0 {
+                continue;
+            }
+            // [vocab, tokens in this chunk, 1, 1]
+            let vocab = output.shape()[0];
+            if output_len(&runtime.subset, vocab) != Some(row_len) {
+                log::error!("output buffer size mismatch");
+                return -1;
+            }
+            let data = output.to_vec();
+            for row in data.chunks_exact(vocab) {
+                if position >= len {
+                    break;
+                }
+                gather_row(row, &runtime.subset, &mut logits[position * row_len..(position + 1) * row_len]);
+                position += 1;
+            }
+        }
+        0
+    })
+}
+
+/// Evaluate `tokens` in one pass and write, for every position `i`, the log-probability
+/// of `targets[i]` given `tokens[..=i]`. Full logits never leave this function. Returns
+/// -1 if a target is outside the vocabulary.
+///
+/// # Safety
+///
+/// The caller must ensure that `tokens`, `targets` and `logprobs` are valid for `len` elements.
+#[no_mangle]
+pub unsafe extern "C" fn web_rwkv_infer_target_logprobs(
+    tokens: *const u16,
+    targets: *const u16,
+    len: usize,
+    logprobs: *mut f32,
+) -> i32 {
+    let runtime = {
+        let runtime = RUNTIME.read().unwrap();
+        let Some(runtime) = runtime.clone() else {
+            log::error!("runtime not loaded");
+            return -1;
+        };
+        runtime
+    };
+
+    if tokens.is_null() || targets.is_null() || logprobs.is_null() || len == 0 {
+        log::error!("invalid input");
+        return -1;
+    }
+    let tokens: &[u16] = unsafe { std::slice::from_raw_parts(tokens, len) };
+    let targets: &[u16] = unsafe { std::slice::from_raw_parts(targets, len) };
+    let logprobs: &mut [f32] = unsafe { std::slice::from_raw_parts_mut(logprobs, len) };
+
+    let tokio = runtime.tokio.clone();
+    tokio.block_on(async move {
+        let mut inference = Some(InferInput::new(
+            vec![InferInputBatch {
+                tokens: tokens.to_vec(),
+                option: InferOption::Full,
+            }],
+            128,
+        ));
+        let mut position = 0;
+        while position < len {
+            let input = inference.take().unwrap();
+            let (input, InferOutput(output)) = runtime.runtime.infer(input).await;
+            let output = output[0].0.clone();
+            inference.replace(input);
+
+            if output.size() == 0 {
+                continue;
+            }
+            // [vocab, tokens in this chunk, 1, 1]
+            let shape = output.shape();
+            let vocab = shape[0];
+            let data = output.to_vec();
+            for row in data.chunks_exact(vocab) {
+                if position >= len {
+                    break;
+                }
+                let target = targets[position] as usize;
+                if target >= vocab {
+                    // a panic must not unwind across the ffi boundary
+                    log::error!("target {target} out of range for vocab {vocab}");
+                    return -1;
+                }
+                let max = row.iter().copied().fold(f32::NEG_INFINITY, f32::max);
+                let sum: f32 = row.iter().map(|x| (x - max).exp()).sum();
+                logprobs[position] = row[target] - max - sum.ln();
+                position += 1;
+            }
+        }
+        0
+    })
+}
+
 #[repr(C)]
 #[derive(Debug, Clone, Copy)]
 pub struct Sampler {
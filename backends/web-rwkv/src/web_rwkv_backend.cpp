@@ -34,8 +34,8 @@ int web_rwkv_backend::load_model(std::string model_path) {
 }
 
 int web_rwkv_backend::eval(int id, std::vector<float> &logits) {
-    std::vector<uint16_t> ids = {(uint16_t)id};
-    int ret = web_rwkv_infer_logits(ids.data(), ids.size(), logits.data(), logits.size());
+    uint16_t token = id;
+    int ret = web_rwkv_infer_logits(&token, 1, logits.data(), logits.size());
     if (!ret) {
         return RWKV_SUCCESS;
     } else {
@@ -53,6 +53,78 @@ int web_rwkv_backend::eval(std::vector<int> ids, std::vector<float> &logits) {
     }
 }
 
+int web_rwkv_backend::eval_all_logits(const std::vector<int> &ids, std::vector<float> &logits) {
+    if (ids.empty() || logits.size() % ids.size() != 0) {
+        return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    std::vector<uint16_t> ids_u16(ids.begin(), ids.end());
+    int ret = web_rwkv_infer_all_logits(ids_u16.data(), ids_u16.size(), logits.data(), logits.size() / ids.size());
+    if (!ret) {
+        return RWKV_SUCCESS;
+    } else {
+        return RWKV_ERROR_EVAL;
+    }
+}
+
+int web_rwkv_backend::eval_target_logprobs(const std::vector<int> &ids, const std::vector<int> &targets, int vocab_size, std::vector<float> &logprobs) {
+    if (ids.empty() || ids.size() != targets.size()) {
+        return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (ids[i] < 0 || ids[i] >= vocab_size || targets[i] < 0 || targets[i] >= vocab_size) {
+            return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+        }
+    }
+    std::vector<uint16_t> ids_u16(ids.begin(), ids.end());
+    std::vector<uint16_t> targets_u16(targets.begin(), targets.end());
+    logprobs.resize(ids.size());
+    int ret = web_rwkv_infer_target_logprobs(ids_u16.data(), targets_u16.data(), ids_u16.size(), logprobs.data());
+    if (!ret) {
+        return RWKV_SUCCESS;
+    } else {
+        return RWKV_ERROR_EVAL;
+    }
+}
+
+int web_rwkv_backend::get_state(std::vector<float> &state) {
+    state.resize(web_rwkv_get_state_size());
+    if (state.empty() || web_rwkv_get_state(state.data(), state.size())) {
+        return RWKV_ERROR_BACKEND;
+    }
+    return RWKV_SUCCESS;
+}
+
+int web_rwkv_backend::set_state(std::vector<float> state) {
+    if (web_rwkv_set_state(state.data(), state.size())) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    return RWKV_SUCCESS;
+}
+
+int web_rwkv_backend::clear_state() {
+    web_rwkv_clear_state();
+    return RWKV_SUCCESS;
+}
+
+int web_rwkv_backend::set_output_subset(const std::vector<int> &ids) {
+    for (auto id : ids) {
+        if (id < 0 || id > UINT16_MAX) {
+            return RWKV_ERROR_BACKEND | RWKV_ERROR_INVALID_PARAMETERS;
+        }
+    }
+    // picked up by the next load_model, which then hands out ids.size() logits
+    std::vector<uint16_t> ids_u16(ids.begin(), ids.end());
+    if (web_rwkv_set_output_subset(ids_u16.data(), ids_u16.size())) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    return RWKV_SUCCESS;
+}
+
+int web_rwkv_backend::release_model() {
+    web_rwkv_release();
+    return RWKV_SUCCESS;
+}
+
 bool web_rwkv_backend::is_available() {
     // TODO: Detect this
     return true;
@@ -76,10 +148,42 @@ int web_rwkv_backend::eval(std::vector<int> ids, std::vector<float> &logits) {
     return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
 }
 
+int web_rwkv_backend::eval_all_logits(const std::vector<int> &ids, std::vector<float> &logits) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int web_rwkv_backend::eval_target_logprobs(const std::vector<int> &ids, const std::vector<int> &targets, int vocab_size, std::vector<float> &logprobs) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int web_rwkv_backend::get_state(std::vector<float> &state) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int web_rwkv_backend::set_state(std::vector<float> state) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int web_rwkv_backend::clear_state() {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int web_rwkv_backend::set_output_subset(const std::vector<int> &ids) {
+    return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+}
+
+int web_rwkv_backend::release_model() {
+    return RWKV_SUCCESS;
+}
+
 bool web_rwkv_backend::is_available() {
     return false;
 }
 
 #endif
 
-} // namespace rwkvmobile
\ No newline at end of file
+} // namespace rwkvmobile
+
+#ifdef RWKV_BACKEND_PLUGIN
+RWKV_DEFINE_BACKEND_PLUGIN(rwkvmobile::web_rwkv_backend)
+#endif
\ No newline at end of file
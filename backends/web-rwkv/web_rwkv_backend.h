@@ -11,9 +11,14 @@ public:
     int load_model(std::string model_path) override;
     int eval(int id, std::vector<float> &logits) override;
     int eval(std::vector<int> ids, std::vector<float> &logits) override;
+    int eval_all_logits(const std::vector<int> &ids, std::vector<float> &logits) override;
+    int eval_target_logprobs(const std::vector<int> &ids, const std::vector<int> &targets, int vocab_size, std::vector<float> &logprobs) override;
     bool is_available() override;
-    // int get_state(std::vector<float> &state) override;
-    // int set_state(std::vector<float> state) override;
+    int get_state(std::vector<float> &state) override;
+    int set_state(std::vector<float> state) override;
+    int clear_state() override;
+    int set_output_subset(const std::vector<int> &ids) override;
+    int release_model() override;
 };
 
 }
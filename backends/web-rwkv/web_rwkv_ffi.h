@@ -27,9 +27,39 @@ int32_t web_rwkv_load(const char *model, uintptr_t quant, uintptr_t quant_nf4);
 
 int32_t web_rwkv_load_with_rescale(const char *model, uintptr_t quant, uintptr_t quant_nf4, uintptr_t rescale);
 
+/// Restrict the logits of the runtimes loaded from now on to `ids` (sorted, distinct),
+/// in that order; `len == 0` restores the full vocab. The head still computes every
+/// row, but only the subset is copied out.
+///
+/// # Safety
+///
+/// The caller must ensure that `ids` is valid for `len` elements.
+int32_t web_rwkv_set_output_subset(const uint16_t *ids, uintptr_t len);
+
+/// Drop the loaded runtime: the model, its state and the device context. Calls
+/// still running keep their own reference until they return.
+void web_rwkv_release();
+
 /// Clear the model state.
 void web_rwkv_clear_state();
 
+/// Get the number of floats in the model state.
+uintptr_t web_rwkv_get_state_size();
+
+/// Copy the model state out to `state`.
+///
+/// # Safety
+///
+/// The caller must ensure that `state` is valid for `len` floats.
+int32_t web_rwkv_get_state(float *state, uintptr_t len);
+
+/// Load the model state from `state`.
+///
+/// # Safety
+///
+/// The caller must ensure that `state` is valid for `len` floats.
+int32_t web_rwkv_set_state(const float *state, uintptr_t len);
+
 /// Generate the next token prediction given the input tokens and a sampler.
 ///
 /// # Safety
@@ -44,4 +74,27 @@ int32_t web_rwkv_infer_logits(const uint16_t *tokens,
                     float *probs,
                     uintptr_t probs_len);
 
+/// Evaluate `tokens` in one pass and write the logits after every position:
+/// row `i` (`row_len` floats) of `logits` follows `tokens[..=i]`.
+///
+/// # Safety
+///
+/// The caller must ensure that `tokens` is valid for `len` elements and `logits` for `len * row_len`.
+int32_t web_rwkv_infer_all_logits(const uint16_t *tokens,
+                    uintptr_t len,
+                    float *logits,
+                    uintptr_t row_len);
+
+/// Evaluate `tokens` in one pass and write, for every position `i`, the log-probability
+/// of `targets[i]` given `tokens[..=i]`. Full logits never leave this function. Returns
+/// -1 if a target is outside the vocabulary.
+///
+/// # Safety
+///
+/// The caller must ensure that `tokens`, `targets` and `logprobs` are valid for `len` elements.
+int32_t web_rwkv_infer_target_logprobs(const uint16_t *tokens,
+                    const uint16_t *targets,
+                    uintptr_t len,
+                    float *logprobs);
+
 } // extern "C"
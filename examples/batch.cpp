@@ -0,0 +1,578 @@
+// rwkv_mobile_batch: offline generation / scoring over a JSONL file.
+//
+// input, one object per line:
+//   {"id": ..., "prompt": "...", "max_tokens": 256}                 generate
+//   {"id": ..., "prompt": "...", "continuations": ["...", "..."]}   score
+// output, one object per finished input line (in completion order):
+//   {"line": 12, "id": ..., "completion": "...", "tokens": 87}
+//   {"line": 13, "id": ..., "scores": [-3.2, -7.9]}
+// the output file doubles as the checkpoint: rerunning with the same arguments
+// skips every line that already has a result.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "runtime.h"
+
+using namespace rwkvmobile;
+
+struct batch_request {
+    size_t line;
+    // raw json of the "id" field, echoed back as is
+    std::string id;
+    std::string prompt;
+    std::vector<std::string> continuations;
+    bool score = false;
+    int max_tokens;
+};
+
+struct batch_stats {
+    size_t prompts = 0;
+    size_t prompt_tokens = 0;
+    // prompt tokens served from a shared-prefix snapshot instead of being evaluated
+    size_t shared_tokens = 0;
+    size_t generated_tokens = 0;
+    size_t scored_tokens = 0;
+};
+
+// ---- minimal json, enough for the formats above ----
+
+static void skip_ws(const std::string &s, size_t &pos) {
+    while (pos < s.size() && isspace((unsigned char)s[pos])) pos++;
+}
+
+static void append_utf8(std::string &out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += (char)cp;
+    } else if (cp < 0x800) {
+        out += (char)(0xc0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        out += (char)(0xe0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+        out += (char)(0x80 | (cp & 0x3f));
+    } else {
+        out += (char)(0xf0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3f));
+        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+        out += (char)(0x80 | (cp & 0x3f));
+    }
+}
+
+// reads exactly four hex digits at pos
+static bool parse_hex4(const std::string &s, size_t pos, uint32_t &value) {
+    if (pos + 4 > s.size()) return false;
+    value = 0;
+    for (size_t i = pos; i < pos + 4; i++) {
+        if (!isxdigit((unsigned char)s[i])) return false;
+        value = value * 16 + (isdigit((unsigned char)s[i]) ? s[i] - '0' : (tolower((unsigned char)s[i]) - 'a' + 10));
+    }
+    return true;
+}
+
+// parses a non-negative decimal integer that spans all of text
+static bool parse_size(const std::string &text, unsigned long long &value) {
+    if (text.empty() || !isdigit((unsigned char)text[0])) return false;
+    errno = 0;
+    char * end = nullptr;
+    value = std::strtoull(text.c_str(), &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+static bool parse_string(const std::string &s, size_t &pos, std::string &out) {
+    if (pos >= s.size() || s[pos] != '"') return false;
+    pos++;
+    out.clear();
+    while (pos < s.size() && s[pos] != '"') {
+        char c = s[pos++];
+        if (c != '\\') {
+            out += c;
+            continue;
+        }
+        if (pos >= s.size()) return false;
+        c = s[pos++];
+        switch (c) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u': {
+                uint32_t cp, low;
+                if (!parse_hex4(s, pos, cp)) return false;
+                pos += 4;
+                if (cp >= 0xd800 && cp < 0xdc00 && pos + 6 <= s.size() && s[pos] == '\\' && s[pos + 1] == 'u') {
+                    if (!parse_hex4(s, pos + 2, low) || low < 0xdc00 || low >= 0xe000) return false;
+                    pos += 6;
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                }
+                append_utf8(out, cp);
+                break;
+            }
+            default: out += c; break;
+        }
+    }
+    if (pos >= s.size()) return false;
+    pos++;
+    return true;
+}
+
+// skips any value, returning its raw text
+static bool skip_value(const std::string &s, size_t &pos, std::string &raw) {
+    skip_ws(s, pos);
+    size_t begin = pos;
+    if (pos >= s.size()) return false;
+    if (s[pos] == '"') {
+        std::string tmp;
+        if (!parse_string(s, pos, tmp)) return false;
+    } else if (s[pos] == '{' || s[pos] == '[') {
+        int depth = 0;
+        std::string tmp;
+        while (pos < s.size()) {
+            if (s[pos] == '"') {
+                if (!parse_string(s, pos, tmp)) return false;
+                continue;
+            }
+            if (s[pos] == '{' || s[pos] == '[') depth++;
+            if (s[pos] == '}' || s[pos] == ']') depth--;
+            pos++;
+            if (depth == 0) break;
+        }
+        if (depth != 0) return false;
+    } else {
+        while (pos < s.size() && s[pos] != ',' && s[pos] != '}' && s[pos] != ']' && !isspace((unsigned char)s[pos])) pos++;
+    }
+    raw = s.substr(begin, pos - begin);
+    return true;
+}
+
+// calls fn(key, pos) for every member of the object in s; fn must advance pos past the value
+template <typename F>
+static bool parse_object(const std::string &s, F fn) {
+    size_t pos = 0;
+    skip_ws(s, pos);
+    if (pos >= s.size() || s[pos] != '{') return false;
+    pos++;
+    std::string key;
+    while (true) {
+        skip_ws(s, pos);
+        if (pos < s.size() && s[pos] == '}') return true;
+        if (!parse_string(s, pos, key)) return false;
+        skip_ws(s, pos);
+        if (pos >= s.size() || s[pos] != ':') return false;
+        pos++;
+        skip_ws(s, pos);
+        if (!fn(key, pos)) return false;
+        skip_ws(s, pos);
+        if (pos < s.size() && s[pos] == ',') {
+            pos++;
+        } else if (pos < s.size() && s[pos] == '}') {
+            return true;
+        } else {
+            return false;
+        }
+    }
+}
+
+static bool parse_request(const std::string &text, size_t line, int default_max_tokens, batch_request &request) {
+    request = batch_request();
+    request.line = line;
+    request.max_tokens = default_max_tokens;
+    request.id = "null";
+    bool has_prompt = false;
+    bool ok = parse_object(text, [&](const std::string &key, size_t &pos) {
+        std::string raw;
+        if (key == "prompt") {
+            has_prompt = true;
+            return parse_string(text, pos, request.prompt);
+        }
+        if (key == "continuations") {
+            request.score = true;
+            if (text[pos] != '[') return false;
+            pos++;
+            std::string item;
+            while (true) {
+                skip_ws(text, pos);
+                if (pos < text.size() && text[pos] == ']') { pos++; return true; }
+                if (!parse_string(text, pos, item)) return false;
+                request.continuations.push_back(item);
+                skip_ws(text, pos);
+                if (pos < text.size() && text[pos] == ',') pos++;
+            }
+        }
+        if (!skip_value(text, pos, raw)) return false;
+        if (key == "id") request.id = raw;
+        if (key == "max_tokens") request.max_tokens = std::atoi(raw.c_str());
+        return true;
+    });
+    return ok && has_prompt;
+}
+
+static void write_string(std::string &out, const std::string &s) {
+    out += '"';
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+// ---- checkpoint ----
+
+// lines of the input that already have a result. a partially written last
+// result (interrupted run) is cut off so that appending continues cleanly
+static std::set<size_t> load_checkpoint(const std::string &path) {
+    std::set<size_t> done;
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return done;
+    }
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    size_t complete = content.rfind('\n');
+    complete = complete == std::string::npos ? 0 : complete + 1;
+    if (complete != content.size()) {
+        std::filesystem::resize_file(path, complete);
+    }
+    size_t begin = 0;
+    while (begin < complete) {
+        size_t end = content.find('\n', begin);
+        std::string text = content.substr(begin, end - begin);
+        parse_object(text, [&](const std::string &key, size_t &pos) {
+            std::string raw;
+            if (!skip_value(text, pos, raw)) return false;
+            unsigned long long line;
+            if (key == "line" && parse_size(raw, line)) done.insert(line);
+            return true;
+        });
+        begin = end + 1;
+    }
+    return done;
+}
+
+static size_t common_prefix(const std::vector<int> &a, const std::vector<int> &b) {
+    size_t n = std::min(a.size(), b.size());
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+static void usage(const char * argv0) {
+    std::cerr << "Usage: " << argv0 << " <vocab_file> <model_file> <input.jsonl> <output.jsonl> [options]\n"
+        << "  --backend <name>       backend to use (default: auto)\n"
+        << "  --batch <n>            sequences decoded together (default: 8)\n"
+        << "  --max-tokens <n>       default tokens to generate per prompt (default: 256)\n"
+        << "  --temperature <f>      (default: 1.0)\n"
+        << "  --top-k <n>            (default: 128)\n"
+        << "  --top-p <f>            (default: 0.3)\n"
+        << "  --seed <n>             per-prompt streams are seeded with seed + line (default: 0)\n";
+}
+
+int main(int argc, char **argv) {
+    if (argc < 5) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::string vocab_file = argv[1], model_file = argv[2], input_file = argv[3], output_file = argv[4];
+    std::string backend_name = "auto";
+    int batch_size = 8, default_max_tokens = 256;
+    sampler_params params;
+    for (int i = 5; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--backend") backend_name = value;
+        else if (arg == "--batch") batch_size = std::max(1, std::atoi(value.c_str()));
+        else if (arg == "--max-tokens") default_max_tokens = std::atoi(value.c_str());
+        else if (arg == "--temperature") params.temperature = std::atof(value.c_str());
+        else if (arg == "--top-k") params.top_k = std::atoi(value.c_str());
+        else if (arg == "--top-p") params.top_p = std::atof(value.c_str());
+        else if (arg == "--seed") {
+            unsigned long long seed;
+            if (!parse_size(value, seed)) {
+                std::cerr << "Invalid seed " << value << std::endl;
+                return 1;
+            }
+            params.seed = seed;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    runtime rt;
+    if (rt.init(backend_name) != RWKV_SUCCESS || rt.load_tokenizer(vocab_file) != RWKV_SUCCESS
+        || rt.load_model(model_file) != RWKV_SUCCESS) {
+        std::cerr << "Failed to load " << model_file << std::endl;
+        return 1;
+    }
+    const int vocab_size = rt.get_model()->get_vocab_size();
+
+    std::set<size_t> done = load_checkpoint(output_file);
+    std::vector<batch_request> requests;
+    {
+        std::ifstream input(input_file, std::ios::binary);
+        if (!input) {
+            std::cerr << "Failed to open " << input_file << std::endl;
+            return 1;
+        }
+        std::string text;
+        for (size_t line = 0; std::getline(input, text); line++) {
+            if (text.empty() || done.count(line)) {
+                continue;
+            }
+            batch_request request;
+            if (!parse_request(text, line, default_max_tokens, request)) {
+                std::cerr << "Skipping malformed line " << line + 1 << std::endl;
+                continue;
+            }
+            requests.push_back(std::move(request));
+        }
+    }
+    std::cerr << done.size() << " lines done, " << requests.size() << " to go" << std::endl;
+
+    std::ofstream output(output_file, std::ios::binary | std::ios::app);
+    std::string out;
+    auto flush_result = [&]() {
+        out += '\n';
+        output << out;
+        // every result is flushed, so an interrupted run loses at most the in-flight sequences
+        output.flush();
+        out.clear();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    batch_stats stats;
+
+    std::vector<std::string> prompts;
+    for (auto &r : requests) {
+        prompts.push_back(r.prompt);
+    }
+    std::vector<std::vector<int>> tokens = rt.tokenizer_encode_batch(prompts);
+
+    // token-wise lexicographic order puts prompts with a common prefix next to each other
+    std::vector<size_t> order;
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (!requests[i].score) {
+            order.push_back(i);
+        }
+        stats.prompt_tokens += tokens[i].size();
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return tokens[a] < tokens[b]; });
+    stats.prompts = requests.size();
+
+    // scoring already shares the prefix state across continuations
+    for (size_t i = 0; i < requests.size(); i++) {
+        auto &r = requests[i];
+        if (!r.score) {
+            continue;
+        }
+        std::vector<float> scores;
+        std::vector<std::vector<float>> token_logprobs;
+        int ret = rt.score_continuations(r.prompt, r.continuations, scores, token_logprobs);
+        out = "{\"line\": " + std::to_string(r.line) + ", \"id\": " + r.id;
+        if (ret) {
+            out += ", \"error\": " + std::to_string(ret) + "}";
+        } else {
+            out += ", \"scores\": [";
+            for (size_t k = 0; k < scores.size(); k++) {
+                out += (k ? ", " : "") + std::to_string(scores[k]);
+                stats.scored_tokens += token_logprobs[k].size();
+            }
+            out += "]}";
+        }
+        flush_result();
+    }
+
+    // prompts that share a prefix of at least this many tokens with the next one
+    // snapshot the state there, instead of prefilling the prefix again
+    const size_t min_shared_prefix = 8;
+    struct snapshot {
+        std::vector<int> prefix;
+        std::vector<float> state;
+        std::vector<float> logits;
+    };
+    std::vector<snapshot> snapshots;
+
+    struct slot {
+        size_t request;
+        std::vector<float> state;
+        std::vector<float> logits;
+        penalty_table occurences;
+        std::vector<int> generated;
+        sampler_params params;
+    };
+    std::vector<slot> slots;
+    std::vector<float> logits(vocab_size);
+
+    // prefills order[k] into s; returns false on error
+    auto prefill = [&](size_t k, slot &s) {
+        const auto &ids = tokens[order[k]];
+        while (!snapshots.empty() && common_prefix(snapshots.back().prefix, ids) != snapshots.back().prefix.size()) {
+            snapshots.pop_back();
+        }
+        size_t pos = 0;
+        if (!snapshots.empty()) {
+            if (rt.set_state(snapshots.back().state)) {
+                return false;
+            }
+            logits = snapshots.back().logits;
+            pos = snapshots.back().prefix.size();
+            stats.shared_tokens += pos;
+        } else if (rt.clear_state()) {
+            return false;
+        }
+        size_t shared = k + 1 < order.size() ? common_prefix(ids, tokens[order[k + 1]]) : 0;
+        if (shared >= min_shared_prefix && shared > pos) {
+            if (rt.eval_logits(std::vector<int>(ids.begin() + pos, ids.begin() + shared), logits)) {
+                return false;
+            }
+            snapshot snap;
+            snap.prefix.assign(ids.begin(), ids.begin() + shared);
+            if (rt.get_state(snap.state)) {
+                return false;
+            }
+            snap.logits = logits;
+            snapshots.push_back(std::move(snap));
+            pos = shared;
+        }
+        if (pos < ids.size() && rt.eval_logits(std::vector<int>(ids.begin() + pos, ids.end()), logits)) {
+            return false;
+        }
+        s.request = order[k];
+        if (rt.get_state(s.state)) {
+            return false;
+        }
+        s.logits = logits;
+        s.occurences.resize(vocab_size);
+        s.occurences.clear();
+        s.generated.clear();
+        s.params = params;
+        s.params.seed = params.seed + requests[order[k]].line;
+        s.params.counter = 0;
+        return true;
+    };
+
+    auto finish = [&](slot &s, int ret) {
+        auto &r = requests[s.request];
+        out = "{\"line\": " + std::to_string(r.line) + ", \"id\": " + r.id;
+        if (ret) {
+            out += ", \"error\": " + std::to_string(ret) + "}";
+        } else {
+            out += ", \"completion\": ";
+            write_string(out, rt.tokenizer_decode(s.generated));
+            out += ", \"tokens\": " + std::to_string(s.generated.size()) + "}";
+        }
+        flush_result();
+    };
+
+    // continuous batching: a finished sequence's slot is refilled with the next prompt
+    // right away, so sequences of different lengths keep the batch full
+    size_t next = 0;
+    std::vector<float> batch_logits;
+    std::vector<sampler_params> batch_params;
+    std::vector<int> sampled;
+    while (next < order.size() || !slots.empty()) {
+        while ((int)slots.size() < batch_size && next < order.size()) {
+            auto &r = requests[order[next]];
+            slot s;
+            if (tokens[order[next]].empty() || r.max_tokens <= 0) {
+                s.request = order[next++];
+                finish(s, tokens[s.request].empty() ? RWKV_ERROR_TOKENIZER : RWKV_SUCCESS);
+                continue;
+            }
+            if (!prefill(next, s)) {
+                s.request = order[next++];
+                finish(s, RWKV_ERROR_EVAL);
+                continue;
+            }
+            next++;
+            slots.push_back(std::move(s));
+        }
+        if (slots.empty()) {
+            break;
+        }
+
+        batch_logits.resize(slots.size() * vocab_size);
+        batch_params.resize(slots.size());
+        sampled.resize(slots.size());
+        for (size_t i = 0; i < slots.size(); i++) {
+            auto &s = slots[i];
+            s.occurences.apply(s.logits.data(), rt.get_presence_penalty(), rt.get_frequency_penalty(), rt.get_penalty_decay());
+            std::copy(s.logits.begin(), s.logits.end(), batch_logits.begin() + i * vocab_size);
+            batch_params[i] = s.params;
+            s.params.counter++;
+        }
+        rt.sampler_sample_batch(batch_logits.data(), slots.size(), batch_params.data(), sampled.data());
+
+        std::vector<slot> running;
+        std::vector<int> step_ids;
+        for (size_t i = 0; i < slots.size(); i++) {
+            auto &s = slots[i];
+            int token = sampled[i];
+            if (token != 0) {
+                s.generated.push_back(token);
+                s.occurences.add(token);
+                stats.generated_tokens++;
+            }
+            if (token == 0 || (int)s.generated.size() >= requests[s.request].max_tokens) {
+                finish(s, RWKV_SUCCESS);
+            } else {
+                step_ids.push_back(token);
+                running.push_back(std::move(s));
+            }
+        }
+        slots = std::move(running);
+        if (slots.empty()) {
+            continue;
+        }
+
+        std::vector<std::vector<float> *> state_ptrs, logits_ptrs;
+        for (auto &s : slots) {
+            state_ptrs.push_back(&s.state);
+            logits_ptrs.push_back(&s.logits);
+        }
+        if (rt.eval_batch(step_ids, state_ptrs, logits_ptrs)) {
+            for (auto &s : slots) {
+                finish(s, RWKV_ERROR_EVAL);
+            }
+            slots.clear();
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t total = stats.prompt_tokens + stats.generated_tokens;
+    std::cerr << stats.prompts << " prompts in " << seconds << " s\n"
+        << "  prompt tokens:    " << stats.prompt_tokens << " (" << stats.shared_tokens << " from shared prefixes)\n"
+        << "  generated tokens: " << stats.generated_tokens << "\n"
+        << "  scored tokens:    " << stats.scored_tokens << "\n"
+        << "  throughput:       " << (seconds > 0 ? total / seconds : 0) << " tokens/s" << std::endl;
+    return 0;
+}
@@ -12,9 +12,9 @@ int main(int argc, char **argv) {
     }
 
     rwkvmobile::runtime rumtime;
-    ENSURE_SUCCESS_OR_LOG_EXIT(rumtime.init("web-rwkv"), "Failed to initialize runtime");
-    ENSURE_SUCCESS_OR_LOG_EXIT(rumtime.load_tokenizer(argv[1]), "Failed to load tokenizer");
-    ENSURE_SUCCESS_OR_LOG_EXIT(rumtime.load_model(argv[2]), "Failed to load model");
+    ENSURE_SUCCESS_OR_LOG_EXIT(rumtime.load_async("web-rwkv", argv[2], argv[1]), "Failed to start loading");
+    ENSURE_SUCCESS_OR_LOG_EXIT(rumtime.wait_loaded(), "Failed to load model");
+    std::cout << "Ready in " << rumtime.get_load_progress().total_ms << " ms" << std::endl;
 
     std::cout << "Generating demo text..." << std::endl;
     std::string result;
@@ -0,0 +1,159 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "cpu_features.h"
+#include "half.h"
+#include "kernels.h"
+#include "sampler.h"
+
+// times each kernel of every kernel table this cpu can run at vocabulary scale.
+// kernels_test checks them against the generic table, sampler_test checks sampling
+// from fp16/bf16 logits against fp32.
+// the library picks the best level on its own; RWKV_MOBILE_ISA=<name> forces one
+
+using namespace rwkvmobile;
+
+static const size_t bench_size = 65536;
+
+struct test_data {
+    std::vector<float> logits;
+    std::vector<float> activations;
+    std::vector<float> weights;
+    std::vector<int> ids;
+    std::vector<float> counts;
+    std::string text_a;
+    std::string text_b;
+
+    test_data(size_t n, std::mt19937 &rng) {
+        std::normal_distribution<float> normal(0.f, 3.f);
+        std::uniform_real_distribution<float> uniform(0.f, 1.f);
+        logits.resize(n);
+        activations.resize(n);
+        weights.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            logits[i] = normal(rng);
+            float x = normal(rng) - 3.f;
+            activations[i] = x > 0 ? x * x : 0.f;
+            weights[i] = normal(rng);
+        }
+        counts.assign(n, 0);
+        for (size_t i = 0; i < n; i += 1 + rng() % 7) {
+            ids.push_back(i);
+            counts[i] = 1 + rng() % 5;
+        }
+        std::shuffle(ids.begin(), ids.end(), rng);
+        text_a.resize(n);
+        for (auto &c : text_a) {
+            c = 'a' + rng() % 26;
+        }
+        text_b = text_a;
+    }
+};
+
+// microseconds per call, best of 5 runs
+static double time_us(const std::function<void()> &fn, int iterations) {
+    double best = 1e30;
+    for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            fn();
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::micro>(end - start).count() / iterations);
+    }
+    return best;
+}
+
+static volatile float sink_f;
+static volatile size_t sink_n;
+
+static std::vector<double> bench_table(int isa, test_data &d) {
+    const kernel_table &k = *get_kernel_table(isa);
+    const size_t n = bench_size;
+    std::vector<float> out(n), counts = d.counts, logits = d.logits;
+    std::vector<int> index(n);
+    std::vector<uint32_t> idx(n);
+    std::vector<float> val(n);
+    std::vector<uint16_t> fp16(n), bf16(n);
+    for (size_t i = 0; i < n; i++) {
+        fp16[i] = fp32_to_fp16(d.logits[i]);
+        bf16[i] = fp32_to_bf16(d.logits[i]);
+    }
+    const int iters = 200;
+
+    std::vector<double> us;
+    us.push_back(time_us([&]() { sink_f = k.reduce_max(d.logits.data(), n); }, iters));
+    us.push_back(time_us([&]() { sink_f = k.exp_sum(d.logits.data(), out.data(), n, 10.f); }, iters));
+    us.push_back(time_us([&]() { sink_n = k.select_at_least(d.logits.data(), n, 9.f, index.data()); }, iters));
+    us.push_back(time_us([&]() {
+        k.penalty_apply(logits.data(), counts.data(), d.ids.data(), d.ids.size(), 0.5f, 0.25f, 1.f);
+    }, iters));
+    us.push_back(time_us([&]() { sink_n = k.common_prefix(d.text_a.data(), d.text_b.data(), n); }, iters));
+    us.push_back(time_us([&]() { sink_f = k.dot(d.logits.data(), d.weights.data(), n); }, iters));
+    us.push_back(time_us([&]() { k.axpy(out.data(), d.weights.data(), 1e-3f, n); }, iters));
+    us.push_back(time_us([&]() { sink_n = k.compact_nonzero(d.activations.data(), n, idx.data(), val.data()); }, iters));
+    us.push_back(time_us([&]() { k.fp16_to_fp32(fp16.data(), out.data(), n); }, iters));
+    us.push_back(time_us([&]() { k.bf16_to_fp32(bf16.data(), out.data(), n); }, iters));
+
+    // end to end: softmax + top-k + top-p over a vocabulary-sized row
+    set_kernel_isa(isa);
+    sampler s;
+    us.push_back(time_us([&]() { sink_n = s.sample(d.logits.data(), n, 1.f, 128, 0.9f); }, iters));
+    us.push_back(time_us([&]() { sink_n = s.sample(fp16.data(), n, RWKV_LOGITS_FP16, 1.f, 128, 0.9f); }, iters));
+    us.push_back(time_us([&]() { sink_n = s.sample(bf16.data(), n, RWKV_LOGITS_BF16, 1.f, 128, 0.9f); }, iters));
+    return us;
+}
+
+int main() {
+    const cpu_features &f = get_cpu_features();
+    std::cout << "cpu:";
+    for (auto [name, present] : {std::pair{"sse4.2", f.sse42}, {"avx2", f.avx2}, {"fma", f.fma},
+            {"avx512f", f.avx512f}, {"avx512bw", f.avx512bw}, {"neon", f.neon}, {"dotprod", f.dotprod}, {"sve", f.sve}}) {
+        if (present) {
+            std::cout << " " << name;
+        }
+    }
+    std::cout << std::endl;
+    std::cout << "selected: " << kernel_isa_name(get_kernel_isa()) << std::endl;
+
+    std::vector<int> isas;
+    for (int isa = 0; isa < RWKV_ISA_COUNT; isa++) {
+        if (is_kernel_isa_available(isa)) {
+            isas.push_back(isa);
+        }
+    }
+
+    std::mt19937 rng(42);
+    const int selected = get_kernel_isa();
+    test_data d(bench_size, rng);
+    std::vector<std::vector<double>> results;
+    for (int isa : isas) {
+        results.push_back(bench_table(isa, d));
+    }
+    set_kernel_isa(selected);
+
+    const char * rows[] = {"reduce_max", "exp_sum", "select_at_least", "penalty_apply", "common_prefix",
+        "dot", "axpy", "compact_nonzero", "fp16_to_fp32", "bf16_to_fp32", "sample fp32", "sample fp16", "sample bf16"};
+    printf("us per call, n = %zu\n%-18s", bench_size, "");
+    for (int isa : isas) {
+        printf("%10s", kernel_isa_name(isa));
+    }
+    printf("\n");
+    for (size_t r = 0; r < sizeof(rows) / sizeof(rows[0]); r++) {
+        printf("%-18s", rows[r]);
+        for (size_t i = 0; i < isas.size(); i++) {
+            printf("%10.2f", results[i][r]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "commondef.h"
+#include "layer_stream.h"
+
+// weight throughput of layer-sequential passes over a safetensors checkpoint as a
+// function of the resident-layer budget. each layer's "compute" only sums its weights
+// once, so this is an I/O measurement: how many MB/s of weights reach the caller and
+// how much of the file has to be read for it, with and without prefetch. no backend
+// runs on layer_stream yet, so it says nothing about decode tokens/s
+
+static uint64_t touch_layer(rwkvmobile::layer_stream &stream, int layer) {
+    uint64_t sum = 0;
+    for (auto &t : stream.get_layer_tensors(layer)) {
+        const uint64_t * p = (const uint64_t *)stream.data(t);
+        for (size_t i = 0; i < t.size / sizeof(uint64_t); i++) {
+            sum += p[i];
+        }
+    }
+    return sum;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <model.st> <n_passes> [budget_layers...]" << std::endl;
+        std::cerr << "  budget 0 keeps every layer resident; default: 2 4 8 and all" << std::endl;
+        return 1;
+    }
+    std::string path = argv[1];
+    int n_passes = std::stoi(argv[2]);
+    std::vector<int> budgets;
+    for (int i = 3; i < argc; i++) {
+        budgets.push_back(std::stoi(argv[i]));
+    }
+    if (budgets.empty()) {
+        budgets = {2, 4, 8, 0};
+    }
+
+    size_t layer_size;
+    int n_layer;
+    {
+        rwkvmobile::layer_stream stream;
+        if (stream.open(path, 1) != rwkvmobile::RWKV_SUCCESS) {
+            std::cerr << "Failed to open " << path << std::endl;
+            return 1;
+        }
+        layer_size = stream.get_layer_size(0);
+        n_layer = stream.get_n_layer();
+    }
+
+    uint64_t checksum = 0;
+    for (int budget_layers : budgets) {
+        for (int depth : {0, 1 << 30}) {
+#ifdef __linux__
+            // start every run from disk rather than from the page cache of the last one
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd >= 0) {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                close(fd);
+            }
+#endif
+            rwkvmobile::layer_stream stream;
+            stream.set_prefetch_depth(depth);
+            if (stream.open(path, budget_layers * layer_size) != rwkvmobile::RWKV_SUCCESS) {
+                std::cerr << "Failed to open " << path << std::endl;
+                return 1;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            for (int pass = 0; pass < n_passes; pass++) {
+                for (int i = 0; i < n_layer; i++) {
+                    stream.acquire(i);
+                    checksum += touch_layer(stream, i);
+                }
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            auto stats = stream.get_stats();
+            double passed_mb = (double)n_passes * n_layer * layer_size / 1048576.0;
+            printf("budget %2d/%d layers (%6.0f MB)  prefetch %-3s  weights %8.1f MB/s  file reads %8.1f MB/s (%7.0f MB)  stalls %5zu (%8.1f ms)  resident %6.0f MB\n",
+                budget_layers ? budget_layers : n_layer, n_layer, (budget_layers ? budget_layers : n_layer) * layer_size / 1048576.0,
+                depth ? "on" : "off", passed_mb / seconds, stats.bytes_read / 1048576.0 / seconds, stats.bytes_read / 1048576.0,
+                stats.stalls, stats.stall_ms, stats.resident_bytes / 1048576.0);
+        }
+    }
+    // keeps the reads from being optimized away
+    return checksum == 42 ? 2 : 0;
+}
@@ -0,0 +1,207 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "lowrank_head.h"
+#include "sampler.h"
+#include "thread_pool.h"
+
+// measures how well lowrank_head keeps the distribution the sampler draws from, and
+// how much faster it is than the dense head. the head and hidden states either come
+// from dumps (raw fp32: head.weight as [vocab][n_embd], and n_embd floats per token
+// of the hidden state after ln_out) or are synthesized with a decaying spectrum.
+// recall is measured on the set of tokens sampler::probabilities() gives a non-zero
+// probability with the default top_k = 128, top_p = 0.3
+
+struct shortlist_result {
+    double recall;
+    double mass_recall;
+    double total_variation;
+    double head_us;
+};
+
+static bool read_floats(const std::string &path, std::vector<float> &out) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.good()) {
+        return false;
+    }
+    out.resize(file.tellg() / sizeof(float));
+    file.seekg(0);
+    file.read((char *)out.data(), out.size() * sizeof(float));
+    return true;
+}
+
+// rows with a 1 / (1 + c / 16) column spectrum, and hidden states with a few tokens
+// a couple of nats above a noisy background
+static void synth_head(int vocab_size, int n_embd, int n_tokens, std::vector<float> &weight, std::vector<float> &hidden, std::mt19937 &rng) {
+    std::normal_distribution<float> normal(0.f, 1.f);
+    std::vector<float> spectrum(n_embd);
+    for (int c = 0; c < n_embd; c++) {
+        spectrum[c] = 1.f / (1.f + c / 16.f);
+    }
+    weight.resize((size_t)vocab_size * n_embd);
+    for (size_t v = 0; v < (size_t)vocab_size; v++) {
+        for (int c = 0; c < n_embd; c++) {
+            weight[v * n_embd + c] = normal(rng) * spectrum[c];
+        }
+    }
+    hidden.resize((size_t)n_tokens * n_embd);
+    std::vector<float> logits(vocab_size);
+    for (int t = 0; t < n_tokens; t++) {
+        float * h = hidden.data() + (size_t)t * n_embd;
+        for (int c = 0; c < n_embd; c++) {
+            h[c] = normal(rng) * spectrum[c];
+        }
+        // background logits with a standard deviation of 2
+        rwkvmobile::head_dense(weight.data(), h, logits.data(), vocab_size, n_embd);
+        double sq = 0;
+        for (auto l : logits) {
+            sq += l * l;
+        }
+        float scale = 2.f / std::sqrt(sq / vocab_size);
+        for (int c = 0; c < n_embd; c++) {
+            h[c] *= scale;
+        }
+        for (float boost : {7.f, 6.f, 5.f, 4.f}) {
+            const float * row = weight.data() + (size_t)(rng() % vocab_size) * n_embd;
+            double norm = 0;
+            for (int c = 0; c < n_embd; c++) {
+                norm += row[c] * row[c];
+            }
+            for (int c = 0; c < n_embd; c++) {
+                h[c] += boost * row[c] / norm;
+            }
+        }
+    }
+}
+
+static shortlist_result measure(rwkvmobile::lowrank_head &head, const std::vector<float> &weight, const std::vector<float> &hidden,
+                                int n_candidates, rwkvmobile::sampler &s, rwkvmobile::thread_pool * pool) {
+    const int vocab_size = head.get_vocab_size(), n_embd = head.get_n_embd();
+    const int n_tokens = hidden.size() / n_embd;
+    std::vector<float> exact(vocab_size), approx(vocab_size), p_exact(vocab_size), p_approx(vocab_size);
+    std::vector<char> in_shortlist(vocab_size);
+    shortlist_result result = {0, 0, 0, 0};
+    for (int t = 0; t < n_tokens; t++) {
+        const float * h = hidden.data() + (size_t)t * n_embd;
+        rwkvmobile::head_dense(weight.data(), h, exact.data(), vocab_size, n_embd, pool);
+        head.forward(h, approx.data(), n_candidates, pool);
+        s.probabilities(exact.data(), vocab_size, 1.f, 128, 0.3f, p_exact.data());
+        s.probabilities(approx.data(), vocab_size, 1.f, 128, 0.3f, p_approx.data());
+
+        std::fill(in_shortlist.begin(), in_shortlist.end(), 0);
+        for (int id : head.get_last_candidates()) {
+            in_shortlist[id] = 1;
+        }
+        int n_set = 0, n_found = 0;
+        double mass = 0, tv = 0;
+        for (int i = 0; i < vocab_size; i++) {
+            if (p_exact[i] > 0) {
+                n_set++;
+                n_found += in_shortlist[i];
+                mass += in_shortlist[i] ? p_exact[i] : 0;
+            }
+            tv += std::fabs(p_exact[i] - p_approx[i]);
+        }
+        result.recall += (double)n_found / n_set;
+        result.mass_recall += mass;
+        result.total_variation += tv / 2;
+    }
+    result.recall /= n_tokens;
+    result.mass_recall /= n_tokens;
+    result.total_variation /= n_tokens;
+
+    int reps = std::max(1, 64 / n_tokens);
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) {
+        for (int t = 0; t < n_tokens; t++) {
+            head.forward(hidden.data() + (size_t)t * n_embd, approx.data(), n_candidates, pool);
+        }
+    }
+    result.head_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (reps * n_tokens);
+    return result;
+}
+
+static double time_dense(const std::vector<float> &weight, const std::vector<float> &hidden, int vocab_size, int n_embd, rwkvmobile::thread_pool * pool) {
+    const int n_tokens = hidden.size() / n_embd;
+    std::vector<float> logits(vocab_size);
+    int reps = std::max(1, 64 / n_tokens);
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) {
+        for (int t = 0; t < n_tokens; t++) {
+            rwkvmobile::head_dense(weight.data(), hidden.data() + (size_t)t * n_embd, logits.data(), vocab_size, n_embd, pool);
+        }
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (reps * n_tokens);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 5) {
+        std::cerr << "Usage: " << argv[0] << " <vocab_size> <n_embd> <n_layer> <rank> [threads] [head.f32 hidden.f32]" << std::endl;
+        std::cerr << "  e.g. " << argv[0] << " 65536 2048 24 128 (RWKV-7 1.5B)" << std::endl;
+        return 1;
+    }
+    int vocab_size = std::stoi(argv[1]);
+    int n_embd = std::stoi(argv[2]);
+    int n_layer = std::stoi(argv[3]);
+    int rank = std::stoi(argv[4]);
+    int n_threads = argc > 5 ? std::stoi(argv[5]) : 0;
+    std::string head_dump = argc > 7 ? argv[6] : "";
+    std::string hidden_dump = argc > 7 ? argv[7] : "";
+    if (vocab_size <= 0 || n_embd <= 0 || n_layer <= 0 || rank <= 0 || rank > n_embd) {
+        std::cerr << "Invalid shape" << std::endl;
+        return 1;
+    }
+
+    std::vector<float> weight, hidden;
+    if (!head_dump.empty()) {
+        if (!read_floats(head_dump, weight) || weight.size() != (size_t)vocab_size * n_embd) {
+            std::cerr << head_dump << " is not a " << vocab_size << " x " << n_embd << " fp32 head" << std::endl;
+            return 1;
+        }
+        if (!read_floats(hidden_dump, hidden) || hidden.size() < (size_t)n_embd) {
+            std::cerr << "Failed to read hidden states from " << hidden_dump << std::endl;
+            return 1;
+        }
+        hidden.resize(hidden.size() / n_embd * n_embd);
+    } else {
+        std::mt19937 rng(42);
+        synth_head(vocab_size, n_embd, 32, weight, hidden, rng);
+    }
+
+    rwkvmobile::thread_pool pool(n_threads);
+    std::cout << "threads: " << pool.get_thread_count() << ", " << hidden.size() / n_embd << " hidden states" << std::endl;
+
+    rwkvmobile::lowrank_head head;
+    auto start = std::chrono::steady_clock::now();
+    if (head.load(weight.data(), vocab_size, n_embd, rank, &pool) != rwkvmobile::RWKV_SUCCESS) {
+        std::cerr << "Failed to build the low-rank head" << std::endl;
+        return 1;
+    }
+    double load_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "rank " << rank << " factorization built in " << load_s << " s" << std::endl;
+
+    double dense_us = time_dense(weight, hidden, vocab_size, n_embd, &pool);
+    // the rest of a decode step: about 12 * n_embd^2 weights per layer, assumed to
+    // stream at the bandwidth the dense head reached
+    double body_us = dense_us * 12.0 * n_embd * n_layer / vocab_size;
+    printf("dense head %8.1f us; est. decode %6.1f tokens/s with %d layers\n", dense_us, 1e6 / (body_us + dense_us), n_layer);
+
+    rwkvmobile::sampler s;
+    for (int n_candidates : {64, 128, 256, 512, 1024, 2048}) {
+        if (n_candidates > vocab_size) {
+            break;
+        }
+        shortlist_result r = measure(head, weight, hidden, n_candidates, s, &pool);
+        printf("shortlist %5d  recall %6.2f%%  mass %6.2f%%  tv %.4f  head %8.1f us (%5.2fx)  est. decode %6.1f tokens/s (%5.3fx)\n",
+            n_candidates, r.recall * 100, r.mass_recall * 100, r.total_variation, r.head_us, dense_us / r.head_us,
+            1e6 / (body_us + r.head_us), (body_us + dense_us) / (body_us + r.head_us));
+    }
+    return 0;
+}
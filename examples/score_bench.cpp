@@ -0,0 +1,92 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "runtime.h"
+
+// candidates scored per second with runtime::score_continuations, against what callers
+// did before it: restore the prefix state and eval_logits every token of a candidate,
+// taking the log-softmax of the full logits each time
+
+static const char * words[] = {
+    " the", " answer", " is", " blue", " green", " red", " because", " of", " light",
+    " scattering", " in", " air", " water", " and", " sunset", " clouds", " day", " night",
+};
+
+static double log_softmax_at(const std::vector<float> &logits, int id) {
+    float max_logit = logits[0];
+    for (auto logit : logits) {
+        max_logit = std::max(max_logit, logit);
+    }
+    double sum = 0;
+    for (auto logit : logits) {
+        sum += std::exp(logit - max_logit);
+    }
+    return logits[id] - max_logit - std::log(sum);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <backend> <vocab_file> <model_file> [candidates] [words per candidate]" << std::endl;
+        return 1;
+    }
+    int n_candidates = argc > 4 ? std::stoi(argv[4]) : 32;
+    int n_words = argc > 5 ? std::stoi(argv[5]) : 8;
+
+    rwkvmobile::runtime rt;
+    if (rt.init(argv[1]) != rwkvmobile::RWKV_SUCCESS || rt.load_tokenizer(argv[2]) != rwkvmobile::RWKV_SUCCESS
+        || rt.load_model(argv[3]) != rwkvmobile::RWKV_SUCCESS) {
+        std::cerr << "Failed to load " << argv[3] << " with " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::mt19937 rng(0);
+    std::vector<std::string> candidates(n_candidates);
+    size_t n_tokens = 0;
+    for (auto &c : candidates) {
+        for (int w = 0; w < n_words; w++) {
+            c += words[rng() % (sizeof(words) / sizeof(words[0]))];
+        }
+        n_tokens += rt.tokenizer_encode(c).size();
+    }
+    const std::string prefix = "User: Why is the sky blue?\n\nAssistant:";
+
+    std::vector<float> scores;
+    std::vector<std::vector<float>> token_logprobs;
+    auto start = std::chrono::steady_clock::now();
+    if (rt.score_continuations(prefix, candidates, scores, token_logprobs) != rwkvmobile::RWKV_SUCCESS) {
+        std::cerr << "score_continuations failed" << std::endl;
+        return 1;
+    }
+    double scored_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    std::vector<float> logits(rt.get_model()->get_output_size()), prefix_logits, prefix_state;
+    rt.clear_state();
+    rt.eval_logits(rt.tokenizer_encode(prefix), logits);
+    prefix_logits = logits;
+    rt.get_state(prefix_state);
+    double max_diff = 0;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        rt.set_state(prefix_state);
+        logits = prefix_logits;
+        double score = 0;
+        for (int id : rt.tokenizer_encode(candidates[i])) {
+            score += log_softmax_at(logits, id);
+            rt.eval_logits(id, logits);
+        }
+        max_diff = std::max(max_diff, std::fabs(score - scores[i]));
+    }
+    double baseline_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%d candidates, %.1f tokens each\n", n_candidates, (double)n_tokens / n_candidates);
+    printf("score_continuations  %8.1f candidates/s\n", n_candidates / scored_s);
+    printf("token by token       %8.1f candidates/s\n", n_candidates / baseline_s);
+    printf("speedup %.2fx, max score difference %.2e\n", baseline_s / scored_s, max_diff);
+    return 0;
+}
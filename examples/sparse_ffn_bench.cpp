@@ -0,0 +1,132 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "sparse_ffn.h"
+#include "thread_pool.h"
+
+// times sparse_ffn_value against the dense gemv (sparse_ffn_test checks that they agree).
+// activations either come from a dump of real channel-mix activations (raw fp32,
+// n_hidden floats per token, e.g. written from a backend's layer output) or are
+// synthesized as relu(x)^2 at fixed sparsity levels
+
+struct bench_result {
+    double sparse_us;
+    double dense_us;
+    float sparsity;
+};
+
+static std::vector<float> synth_activations(int n_hidden, int n_tokens, float sparsity, std::mt19937 &rng) {
+    std::normal_distribution<float> normal(0.f, 1.f);
+    // relu(x + shift)^2 with x ~ N(0, 1) is zero with probability `sparsity` when
+    // P(x > -shift) = 1 - sparsity; found by bisection on the normal tail
+    float lo = -8, hi = 8;
+    for (int i = 0; i < 60; i++) {
+        float mid = (lo + hi) / 2;
+        float tail = 0.5f * std::erfc(mid / std::sqrt(2.f));
+        (tail < 1 - sparsity ? hi : lo) = mid;
+    }
+    float shift = -lo;
+    std::vector<float> k((size_t)n_hidden * n_tokens);
+    for (auto &v : k) {
+        float x = normal(rng) + shift;
+        v = x > 0 ? x * x : 0.f;
+    }
+    return k;
+}
+
+static bench_result bench(rwkvmobile::sparse_ffn_value &sparse, const std::vector<float> &weight, const std::vector<float> &k, rwkvmobile::thread_pool * pool) {
+    int n_embd = sparse.get_n_embd(), n_hidden = sparse.get_n_hidden();
+    int n_tokens = k.size() / n_hidden;
+    std::vector<float> out(n_embd);
+    int reps = std::max(1, 256 / n_tokens);
+    bench_result result = {0, 0, 0};
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) {
+        for (int t = 0; t < n_tokens; t++) {
+            sparse.forward(k.data() + (size_t)t * n_hidden, out.data(), pool);
+            result.sparsity += sparse.get_last_sparsity();
+        }
+    }
+    result.sparse_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (reps * n_tokens);
+    result.sparsity /= reps * n_tokens;
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) {
+        for (int t = 0; t < n_tokens; t++) {
+            rwkvmobile::ffn_value_dense(weight.data(), k.data() + (size_t)t * n_hidden, out.data(), n_embd, n_hidden, pool);
+        }
+    }
+    result.dense_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (reps * n_tokens);
+    return result;
+}
+
+static void print_result(const bench_result &r, int n_layer) {
+    // tokens/s if the value projection were the only work in each layer
+    printf("sparsity %5.1f%%  sparse %8.1f us  dense %8.1f us  speedup %5.2fx  value-proj tokens/s %7.1f vs %7.1f (%d layers)\n",
+        r.sparsity * 100, r.sparse_us, r.dense_us, r.dense_us / r.sparse_us,
+        1e6 / (r.sparse_us * n_layer), 1e6 / (r.dense_us * n_layer), n_layer);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <n_embd> <n_hidden> <n_layer> [activations.f32] [threads]" << std::endl;
+        std::cerr << "  e.g. " << argv[0] << " 2048 7168 24 (RWKV-7 1.5B)" << std::endl;
+        return 1;
+    }
+    int n_embd = std::stoi(argv[1]);
+    int n_hidden = std::stoi(argv[2]);
+    int n_layer = std::stoi(argv[3]);
+    std::string dump = argc > 4 ? argv[4] : "";
+    int n_threads = argc > 5 ? std::stoi(argv[5]) : 0;
+    if (n_embd <= 0 || n_hidden <= 0 || n_layer <= 0) {
+        std::cerr << "Invalid shape" << std::endl;
+        return 1;
+    }
+
+    std::mt19937 rng(42);
+    std::normal_distribution<float> normal(0.f, 0.02f);
+    std::vector<float> weight((size_t)n_embd * n_hidden);
+    for (auto &w : weight) {
+        w = normal(rng);
+    }
+    rwkvmobile::sparse_ffn_value sparse;
+    if (sparse.load(weight.data(), n_embd, n_hidden) != rwkvmobile::RWKV_SUCCESS) {
+        std::cerr << "Failed to load weights" << std::endl;
+        return 1;
+    }
+    rwkvmobile::thread_pool pool(n_threads);
+    std::cout << "threads: " << pool.get_thread_count() << std::endl;
+
+    if (!dump.empty()) {
+        std::ifstream file(dump, std::ios::binary | std::ios::ate);
+        if (!file.good()) {
+            std::cerr << "Failed to open " << dump << std::endl;
+            return 1;
+        }
+        size_t n_tokens = file.tellg() / (sizeof(float) * n_hidden);
+        if (n_tokens == 0) {
+            std::cerr << "Dump holds less than one activation vector" << std::endl;
+            return 1;
+        }
+        std::vector<float> k(n_tokens * n_hidden);
+        file.seekg(0);
+        file.read((char *)k.data(), k.size() * sizeof(float));
+        std::cout << n_tokens << " recorded activation vectors" << std::endl;
+        print_result(bench(sparse, weight, k, &pool), n_layer);
+        return 0;
+    }
+
+    for (float sparsity : {0.0f, 0.5f, 0.8f, 0.9f, 0.95f, 0.99f}) {
+        auto k = synth_activations(n_hidden, 16, sparsity, rng);
+        print_result(bench(sparse, weight, k, &pool), n_layer);
+    }
+    return 0;
+}
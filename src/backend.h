@@ -1,6 +1,9 @@
 #ifndef BACKEND_H
 #define BACKEND_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -10,14 +13,74 @@ namespace rwkvmobile {
 
 class execution_provider {
 public:
+    virtual ~execution_provider() = default;
     virtual int init(void * extra) { return 0; }
     virtual int init(std::string model_path, void * extra) { return 0; }
     virtual int load_model(std::string model_path) { return RWKV_ERROR_MODEL; }
     virtual int eval(int id, std::vector<float> &logits) { return 0; };
     virtual int eval(std::vector<int> ids, std::vector<float> &logits) { return 0; };
-    virtual int get_state(std::vector<float> &state) { return 0; }
-    virtual int set_state(std::vector<float> state) { return 0; }
-    virtual int clear_state() { return 0; }
+    // the same with the logits written as raw RWKV_LOGITS_FP16 / RWKV_LOGITS_BF16 bits,
+    // for backends that can hand them over at half the size. the default evaluates
+    // nothing and returns RWKV_ERROR_UNSUPPORTED, which the runtime passes on instead
+    // of switching to fp32 behind the caller's back
+    virtual int eval_half(int id, std::vector<uint16_t> &logits, int precision) { return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED; }
+    virtual int eval_half(std::vector<int> ids, std::vector<uint16_t> &logits, int precision) { return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED; }
+    // evaluates ids in one pass; logprobs[i] = log p(targets[i] | ids[0..i]).
+    // vocab_size is the number of logits per eval; targets outside it are rejected.
+    // the default runs token by token; backends should override this to avoid
+    // moving full logits for every position
+    virtual int eval_target_logprobs(const std::vector<int> &ids, const std::vector<int> &targets, int vocab_size, std::vector<float> &logprobs) {
+        if (ids.empty() || ids.size() != targets.size() || vocab_size <= 0) return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+        for (auto target : targets) {
+            if (target < 0 || target >= vocab_size) return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+        }
+        std::vector<float> logits(vocab_size);
+        logprobs.resize(ids.size());
+        for (size_t i = 0; i < ids.size(); i++) {
+            int ret = eval(ids[i], logits);
+            if (ret) return ret;
+            float max_logit = *std::max_element(logits.begin(), logits.end());
+            float sum = 0;
+            for (auto logit : logits) sum += std::exp(logit - max_logit);
+            logprobs[i] = logits[targets[i]] - max_logit - std::log(sum);
+        }
+        return 0;
+    }
+    // evaluates ids in one pass and writes the logits after every position:
+    // row i of logits (sized by the caller to ids.size() rows) follows ids[0..i].
+    // the default runs token by token
+    virtual int eval_all_logits(const std::vector<int> &ids, std::vector<float> &logits) {
+        if (ids.empty() || logits.size() % ids.size() != 0) return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+        const size_t row_size = logits.size() / ids.size();
+        std::vector<float> row(row_size);
+        for (size_t i = 0; i < ids.size(); i++) {
+            int ret = eval(ids[i], row);
+            if (ret) return ret;
+            std::copy(row.begin(), row.end(), logits.begin() + i * row_size);
+        }
+        return 0;
+    }
+    // a backend without its own state support can't be shared between sessions
+    virtual int get_state(std::vector<float> &state) { return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED; }
+    virtual int set_state(std::vector<float> state) { return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED; }
+    // evaluates ids[i] on top of *states[i] for every i, updating the states in place.
+    // the default is a serial fallback (set_state, eval, get_state per sequence) with no
+    // speedup over single-sequence decoding; backends that can batch natively override it
+    virtual int eval_batch(const std::vector<int> &ids, std::vector<std::vector<float> *> &states, std::vector<std::vector<float> *> &logits) {
+        for (size_t i = 0; i < ids.size(); i++) {
+            int ret = set_state(*states[i]);
+            if (!ret) ret = eval(ids[i], *logits[i]);
+            if (!ret) ret = get_state(*states[i]);
+            if (ret) return ret;
+        }
+        return 0;
+    }
+    virtual int clear_state() { return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED; }
+    // makes the next load_model hand out only the logits of ids, ideally from a head
+    // with only those rows, so that eval() produces ids.size() logits (logits[i] is
+    // the logit of ids[i]).
+    // empty ids restores the full vocab
+    virtual int set_output_subset(const std::vector<int> &ids) { return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED; }
     virtual int release_model() { return 0; };
     virtual int release() { return 0; };
     virtual bool is_available() { return false; };
@@ -26,12 +89,31 @@ public:
 enum {
     RWKV_BACKEND_RWKVCPP = 0,
     RWKV_BACKEND_WEBRWKV,
+    // forwards to a rwkv_mobile_daemon; selected with "ipc:<socket path>"
+    RWKV_BACKEND_IPC,
     RWKV_BACKEND_COUNT,
 };
 
 std::string backend_enum_to_str(int backend);
 int backend_str_to_enum(std::string backend);
+// backends compiled into this build or found as libraries on the backend search path
+int get_available_backend_ids(std::vector<int> &backend_ids);
 
 }
 
+// a backend built as a shared library exports rwkv_mobile_backend_abi_version() and
+// rwkv_mobile_backend_create(); the runtime refuses libraries built against another
+// RWKV_BACKEND_ABI_VERSION. bump it whenever execution_provider changes
+#define RWKV_BACKEND_ABI_VERSION 5
+
+#ifdef _WIN32
+#define RWKV_BACKEND_EXPORT extern "C" __declspec(dllexport)
+#else
+#define RWKV_BACKEND_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+#define RWKV_DEFINE_BACKEND_PLUGIN(backend_class) \
+    RWKV_BACKEND_EXPORT int rwkv_mobile_backend_abi_version() { return RWKV_BACKEND_ABI_VERSION; } \
+    RWKV_BACKEND_EXPORT rwkvmobile::execution_provider * rwkv_mobile_backend_create() { return new backend_class; }
+
 #endif
\ No newline at end of file
@@ -0,0 +1,197 @@
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+
+#ifdef ENABLE_BACKEND_PLUGINS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+#endif
+
+#include "backend_registry.h"
+#include "commondef.h"
+#ifdef ENABLE_WEBRWKV
+#include "web_rwkv_backend.h"
+#endif
+
+namespace rwkvmobile {
+
+typedef int (*backend_abi_version_fn)();
+typedef execution_provider * (*backend_create_fn)();
+
+static std::mutex _registry_mutex;
+static std::string _search_path;
+static bool _search_path_set = false;
+// factories of the libraries opened so far; handles are never closed because
+// backends (and threads they start) can outlive any single model
+static backend_create_fn _plugin_factories[RWKV_BACKEND_COUNT] = {};
+
+static execution_provider * create_builtin_backend(int backend_id) {
+#ifdef ENABLE_WEBRWKV
+    if (backend_id == RWKV_BACKEND_WEBRWKV) {
+        return new web_rwkv_backend;
+    }
+#endif
+    return nullptr;
+}
+
+static bool is_builtin_backend(int backend_id) {
+#ifdef ENABLE_WEBRWKV
+    if (backend_id == RWKV_BACKEND_WEBRWKV) {
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string backend_library_name(int backend_id) {
+    std::string name = backend_enum_to_str(backend_id);
+    for (auto &c : name) {
+        if (!isalnum((unsigned char)c)) {
+            c = '_';
+        }
+    }
+#if defined(_WIN32)
+    return "rwkv_mobile_backend_" + name + ".dll";
+#elif defined(__APPLE__)
+    return "librwkv_mobile_backend_" + name + ".dylib";
+#else
+    return "librwkv_mobile_backend_" + name + ".so";
+#endif
+}
+
+static std::string default_search_path() {
+    const char * env = std::getenv("RWKV_MOBILE_BACKEND_PATH");
+    if (env != nullptr && env[0] != '\0') {
+        return env;
+    }
+#ifdef ENABLE_BACKEND_PLUGINS
+#ifdef _WIN32
+    HMODULE module = nullptr;
+    char path[MAX_PATH];
+    if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+            (LPCSTR)&default_search_path, &module)
+        && GetModuleFileNameA(module, path, MAX_PATH) > 0) {
+        return std::filesystem::path(path).parent_path().string();
+    }
+#else
+    Dl_info info;
+    if (dladdr((void *)&default_search_path, &info) && info.dli_fname != nullptr) {
+        std::error_code ec;
+        return std::filesystem::absolute(info.dli_fname, ec).parent_path().string();
+    }
+#endif
+#endif
+    return ".";
+}
+
+void set_backend_search_path(std::string dir) {
+    std::lock_guard<std::mutex> lock(_registry_mutex);
+    _search_path = dir;
+    _search_path_set = true;
+}
+
+static std::string search_path_locked() {
+    if (!_search_path_set) {
+        _search_path = default_search_path();
+        _search_path_set = true;
+    }
+    return _search_path;
+}
+
+std::string get_backend_search_path() {
+    std::lock_guard<std::mutex> lock(_registry_mutex);
+    return search_path_locked();
+}
+
+static std::string backend_library_path_locked(int backend_id) {
+    return (std::filesystem::path(search_path_locked()) / backend_library_name(backend_id)).string();
+}
+
+bool is_backend_registered(int backend_id) {
+    if (backend_id < 0 || backend_id >= RWKV_BACKEND_COUNT) {
+        return false;
+    }
+    if (is_builtin_backend(backend_id)) {
+        return true;
+    }
+#ifdef ENABLE_BACKEND_PLUGINS
+    std::lock_guard<std::mutex> lock(_registry_mutex);
+    if (_plugin_factories[backend_id] != nullptr) {
+        return true;
+    }
+    std::error_code ec;
+    return std::filesystem::exists(backend_library_path_locked(backend_id), ec);
+#else
+    return false;
+#endif
+}
+
+#ifdef ENABLE_BACKEND_PLUGINS
+static backend_create_fn load_plugin_locked(int backend_id) {
+    if (_plugin_factories[backend_id] != nullptr) {
+        return _plugin_factories[backend_id];
+    }
+    std::string path = backend_library_path_locked(backend_id);
+#ifdef _WIN32
+    HMODULE handle = LoadLibraryA(path.c_str());
+    if (handle == nullptr) {
+        return nullptr;
+    }
+    auto abi_version = (backend_abi_version_fn)GetProcAddress(handle, "rwkv_mobile_backend_abi_version");
+    auto create = (backend_create_fn)GetProcAddress(handle, "rwkv_mobile_backend_create");
+    if (abi_version == nullptr || create == nullptr || abi_version() != RWKV_BACKEND_ABI_VERSION) {
+        FreeLibrary(handle);
+        return nullptr;
+    }
+#else
+    void * handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        return nullptr;
+    }
+    auto abi_version = (backend_abi_version_fn)dlsym(handle, "rwkv_mobile_backend_abi_version");
+    auto create = (backend_create_fn)dlsym(handle, "rwkv_mobile_backend_create");
+    if (abi_version == nullptr || create == nullptr || abi_version() != RWKV_BACKEND_ABI_VERSION) {
+        dlclose(handle);
+        return nullptr;
+    }
+#endif
+    _plugin_factories[backend_id] = create;
+    return create;
+}
+#endif
+
+execution_provider * create_backend(int backend_id) {
+    if (backend_id < 0 || backend_id >= RWKV_BACKEND_COUNT) {
+        return nullptr;
+    }
+    if (is_builtin_backend(backend_id)) {
+        return create_builtin_backend(backend_id);
+    }
+#ifdef ENABLE_BACKEND_PLUGINS
+    std::lock_guard<std::mutex> lock(_registry_mutex);
+    auto create = load_plugin_locked(backend_id);
+    if (create != nullptr) {
+        return create();
+    }
+#endif
+    return nullptr;
+}
+
+int get_available_backend_ids(std::vector<int> &backend_ids) {
+    backend_ids = std::vector<int>();
+    for (int id = 0; id < RWKV_BACKEND_COUNT; id++) {
+        // ipc needs a socket path, so it is only ever selected by name
+        // TODO: Detect if the platform has Qualcomm Adreno proprietary vulkan driver
+        // (Doesn't work with WEBRWKV)
+        if (id != RWKV_BACKEND_IPC && is_backend_registered(id)) {
+            backend_ids.push_back(id);
+        }
+    }
+    return RWKV_SUCCESS;
+}
+
+}
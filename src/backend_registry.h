@@ -0,0 +1,30 @@
+#ifndef BACKEND_REGISTRY_H
+#define BACKEND_REGISTRY_H
+
+#include <string>
+#include "backend.h"
+
+namespace rwkvmobile {
+
+// backends linked into the library are created directly. the others live in their
+// own shared library (see RWKV_DEFINE_BACKEND_PLUGIN), which is only opened the first
+// time that backend is created and then stays loaded for the rest of the process.
+
+// file name of the library that provides backend_id, e.g. librwkv_mobile_backend_web_rwkv.so
+std::string backend_library_name(int backend_id);
+
+// directory searched for backend libraries. defaults to $RWKV_MOBILE_BACKEND_PATH,
+// or else the directory of the binary that contains rwkv-mobile
+void set_backend_search_path(std::string dir);
+std::string get_backend_search_path();
+
+// linked in, or its library exists on the search path (the library is not opened)
+bool is_backend_registered(int backend_id);
+
+// nullptr if the backend isn't registered, or its library fails to load or was
+// built against a different RWKV_BACKEND_ABI_VERSION
+execution_provider * create_backend(int backend_id);
+
+}
+
+#endif
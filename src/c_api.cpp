@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 #include "runtime.h"
 #include "commondef.h"
 #include "c_api.h"
+#include "memory_manager.h"
 
 
 namespace rwkvmobile {
@@ -16,6 +21,74 @@ rwkvmobile_runtime_t rwkvmobile_runtime_init_with_name(const char * backend_name
     return rt;
 }
 
+rwkvmobile_model_t rwkvmobile_model_load(const char * backend_name, const char * model_path, const char * vocab_file) {
+    if (backend_name == nullptr || model_path == nullptr || vocab_file == nullptr) {
+        return nullptr;
+    }
+    auto m = std::make_shared<model>();
+    if (m->init(backend_name) != RWKV_SUCCESS
+        || m->load_tokenizer(vocab_file) != RWKV_SUCCESS
+        || m->load_model(model_path) != RWKV_SUCCESS) {
+        return nullptr;
+    }
+    return new std::shared_ptr<model>(m);
+}
+
+int rwkvmobile_model_release(rwkvmobile_model_t handle) {
+    if (handle == nullptr) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    delete static_cast<std::shared_ptr<model> *>(handle);
+    return RWKV_SUCCESS;
+}
+
+rwkvmobile_session_t rwkvmobile_session_create(rwkvmobile_model_t handle) {
+    if (handle == nullptr) {
+        return nullptr;
+    }
+    auto m = static_cast<std::shared_ptr<model> *>(handle);
+    return new runtime(*m);
+}
+
+rwkvmobile_model_t rwkvmobile_runtime_get_model(rwkvmobile_runtime_t handle) {
+    if (handle == nullptr) {
+        return nullptr;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    return new std::shared_ptr<model>(rt->get_model());
+}
+
+int rwkvmobile_session_release(rwkvmobile_session_t handle) {
+    if (handle == nullptr) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    rt->release();
+    delete rt;
+    return RWKV_SUCCESS;
+}
+
+int rwkvmobile_runtime_set_cache_dir(rwkvmobile_runtime_t handle, const char * cache_dir) {
+    if (handle == nullptr || cache_dir == nullptr) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    rt->set_cache_dir(cache_dir);
+    return RWKV_SUCCESS;
+}
+
+int rwkvmobile_runtime_set_thread_params(rwkvmobile_runtime_t handle, int n_threads, const int * cpu_ids, int n_cpu_ids) {
+    if (handle == nullptr || n_cpu_ids < 0) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    std::vector<int> cpu_ids_vec;
+    if (cpu_ids != nullptr) {
+        cpu_ids_vec.assign(cpu_ids, cpu_ids + n_cpu_ids);
+    }
+    return rt->set_thread_params(n_threads, cpu_ids_vec);
+}
+
 int rwkvmobile_runtime_load_model(rwkvmobile_runtime_t handle, const char * model_path) {
     if (handle == nullptr || model_path == nullptr) {
         return RWKV_ERROR_INVALID_PARAMETERS;
@@ -24,6 +97,22 @@ int rwkvmobile_runtime_load_model(rwkvmobile_runtime_t handle, const char * mode
     return rt->load_model(model_path);
 }
 
+int rwkvmobile_runtime_set_output_subset(rwkvmobile_runtime_t handle, const int * ids, int n_ids) {
+    if (handle == nullptr || n_ids < 0 || (ids == nullptr && n_ids > 0)) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    return rt->set_output_subset(std::vector<int>(ids, ids + n_ids));
+}
+
+int rwkvmobile_runtime_set_logits_precision(rwkvmobile_runtime_t handle, int precision) {
+    if (handle == nullptr) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    return rt->set_logits_precision(precision);
+}
+
 int rwkvmobile_runtime_load_tokenizer(rwkvmobile_runtime_t handle, const char * vocab_file) {
     if (handle == nullptr || vocab_file == nullptr) {
         return RWKV_ERROR_INVALID_PARAMETERS;
@@ -32,6 +121,43 @@ int rwkvmobile_runtime_load_tokenizer(rwkvmobile_runtime_t handle, const char *
     return rt->load_tokenizer(vocab_file);
 }
 
+rwkvmobile_runtime_t rwkvmobile_runtime_load_async(const char * backend_name, const char * model_path, const char * vocab_file,
+    const char * warmup_prompt, rwkvmobile_load_callback callback, void * user_data) {
+    if (backend_name == nullptr || model_path == nullptr || vocab_file == nullptr) {
+        return nullptr;
+    }
+    runtime * rt = new runtime();
+    load_callback cb = nullptr;
+    if (callback != nullptr) {
+        cb = [callback, user_data](int stage, int ret) { callback(stage, ret, user_data); };
+    }
+    rt->load_async(backend_name, model_path, vocab_file, warmup_prompt ? warmup_prompt : "", cb);
+    return rt;
+}
+
+int rwkvmobile_runtime_get_load_progress(rwkvmobile_runtime_t handle, int * stages_done, int * finished) {
+    if (handle == nullptr) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    auto progress = rt->get_load_progress();
+    if (stages_done != nullptr) {
+        *stages_done = progress.stages_done;
+    }
+    if (finished != nullptr) {
+        *finished = progress.finished;
+    }
+    return progress.ret;
+}
+
+int rwkvmobile_runtime_wait_loaded(rwkvmobile_runtime_t handle) {
+    if (handle == nullptr) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    return rt->wait_loaded();
+}
+
 int rwkvmobile_runtime_eval_logits(rwkvmobile_runtime_t handle, const int * ids, int ids_len, float * logits, int logits_len) {
     if (handle == nullptr || ids == nullptr || logits == nullptr || ids_len <= 0 || logits_len <= 0) {
         return RWKV_ERROR_INVALID_PARAMETERS;
@@ -68,6 +194,46 @@ int rwkvmobile_runtime_eval_chat(
     return RWKV_SUCCESS;
 }
 
+int rwkvmobile_runtime_set_max_chat_turns(rwkvmobile_runtime_t handle, int max_turns) {
+    if (handle == nullptr) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    return rt->set_max_chat_turns(max_turns);
+}
+
+int rwkvmobile_runtime_get_chat_turn_count(rwkvmobile_runtime_t handle) {
+    if (handle == nullptr) {
+        return -1;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    return rt->get_chat_turn_count();
+}
+
+int rwkvmobile_runtime_rollback_chat_turns(rwkvmobile_runtime_t handle, int n) {
+    if (handle == nullptr) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    return rt->rollback_chat_turns(n);
+}
+
+int rwkvmobile_runtime_regenerate_chat(rwkvmobile_runtime_t handle, char * response, size_t size) {
+    if (handle == nullptr || response == nullptr || size == 0) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    std::string response_str;
+    int ret = rt->regenerate_chat(response_str);
+    if (ret != RWKV_SUCCESS) {
+        return ret;
+    }
+    size_t n = std::min(response_str.size(), size - 1);
+    memcpy(response, response_str.data(), n);
+    response[n] = '\0';
+    return RWKV_SUCCESS;
+}
+
 int rwkvmobile_runtime_gen_completion(
     rwkvmobile_runtime_t handle,
     const char * prompt,
@@ -90,6 +256,117 @@ int rwkvmobile_runtime_gen_completion(
     return RWKV_SUCCESS;
 }
 
+int rwkvmobile_runtime_gen_completion_stream(
+    rwkvmobile_runtime_t handle,
+    const char * prompt,
+    char * completion,
+    const int completion_size,
+    const int length,
+    const char ** stop,
+    const int n_stop,
+    rwkvmobile_token_callback callback,
+    void * user_data) {
+    if (handle == nullptr || prompt == nullptr || completion == nullptr || completion_size <= 0
+        || length <= 0 || n_stop < 0 || (n_stop > 0 && stop == nullptr)) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+
+    auto rt = static_cast<class runtime *>(handle);
+    std::vector<std::string> stop_strs(stop, stop + n_stop);
+    token_callback cb;
+    if (callback != nullptr) {
+        cb = [callback, user_data](const char * text, size_t len) {
+            return callback(text, len, user_data) != 0;
+        };
+    }
+    std::string completion_str;
+    int ret = rt->gen_completion_stream(std::string(prompt), completion_str, length, stop_strs, cb);
+    if (ret != RWKV_SUCCESS) {
+        return ret;
+    }
+    size_t n = std::min<size_t>(completion_str.size(), completion_size - 1);
+    memcpy(completion, completion_str.data(), n);
+    completion[n] = '\0';
+    return RWKV_SUCCESS;
+}
+
+int rwkvmobile_runtime_gen_candidates(
+    rwkvmobile_runtime_t handle,
+    const char * prompt,
+    int n,
+    int max_length,
+    int mode,
+    char ** completions,
+    int completion_size,
+    float * logprobs) {
+    if (handle == nullptr || prompt == nullptr || completions == nullptr || logprobs == nullptr
+        || n <= 0 || max_length <= 0 || completion_size <= 0) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+
+    auto rt = static_cast<class runtime *>(handle);
+    std::vector<candidate> candidates;
+    int ret = rt->gen_candidates(std::string(prompt), n, max_length, mode, candidates);
+    if (ret != RWKV_SUCCESS) {
+        return ret;
+    }
+    for (int i = 0; i < n; i++) {
+        if (completions[i] == nullptr) {
+            continue;
+        }
+        completions[i][0] = '\0';
+        logprobs[i] = -INFINITY;
+        if (i < (int)candidates.size()) {
+            strncpy(completions[i], candidates[i].text.c_str(), completion_size - 1);
+            completions[i][completion_size - 1] = '\0';
+            logprobs[i] = candidates[i].logprob;
+        }
+    }
+    return RWKV_SUCCESS;
+}
+
+int rwkvmobile_runtime_score_continuations(
+    rwkvmobile_runtime_t handle,
+    const char * prefix,
+    const char ** continuations,
+    int n,
+    float * scores,
+    int * num_tokens,
+    float * token_logprobs,
+    int max_tokens) {
+    if (handle == nullptr || prefix == nullptr || continuations == nullptr || scores == nullptr || n <= 0
+        || (token_logprobs != nullptr && max_tokens <= 0)) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    std::vector<std::string> continuations_vec;
+    for (int i = 0; i < n; i++) {
+        if (continuations[i] == nullptr) {
+            return RWKV_ERROR_INVALID_PARAMETERS;
+        }
+        continuations_vec.push_back(continuations[i]);
+    }
+
+    auto rt = static_cast<class runtime *>(handle);
+    std::vector<float> scores_vec;
+    std::vector<std::vector<float>> token_logprobs_vec;
+    int ret = rt->score_continuations(std::string(prefix), continuations_vec, scores_vec, token_logprobs_vec);
+    if (ret != RWKV_SUCCESS) {
+        return ret;
+    }
+    for (int i = 0; i < n; i++) {
+        scores[i] = scores_vec[i];
+        if (num_tokens != nullptr) {
+            num_tokens[i] = token_logprobs_vec[i].size();
+        }
+        if (token_logprobs != nullptr) {
+            for (int j = 0; j < max_tokens; j++) {
+                token_logprobs[i * max_tokens + j] = j < (int)token_logprobs_vec[i].size() ? token_logprobs_vec[i][j] : 0;
+            }
+        }
+    }
+    return RWKV_SUCCESS;
+}
+
 int rwkvmobile_runtime_clear_state(rwkvmobile_runtime_t handle) {
     if (handle == nullptr) {
         return RWKV_ERROR_INVALID_PARAMETERS;
@@ -98,5 +375,80 @@ int rwkvmobile_runtime_clear_state(rwkvmobile_runtime_t handle) {
     return rt->clear_state();
 }
 
+int rwkvmobile_runtime_get_state_compressed(
+    rwkvmobile_runtime_t handle,
+    int format,
+    const unsigned char * base,
+    size_t base_size,
+    unsigned char * buffer,
+    size_t buffer_size,
+    size_t * out_size) {
+    if (handle == nullptr || out_size == nullptr || (base == nullptr && base_size > 0)) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    std::vector<float> base_state;
+    if (base != nullptr) {
+        int ret = state_decode(base, base_size, nullptr, base_state);
+        if (ret) {
+            return ret;
+        }
+    }
+    std::vector<uint8_t> data;
+    int ret = rt->get_state_compressed(format, data, base != nullptr ? &base_state : nullptr);
+    if (ret) {
+        return ret;
+    }
+    *out_size = data.size();
+    if (buffer == nullptr) {
+        return RWKV_SUCCESS;
+    }
+    if (buffer_size < data.size()) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    memcpy(buffer, data.data(), data.size());
+    return RWKV_SUCCESS;
+}
+
+int rwkvmobile_runtime_set_state_compressed(
+    rwkvmobile_runtime_t handle,
+    const unsigned char * data,
+    size_t size,
+    const unsigned char * base,
+    size_t base_size) {
+    if (handle == nullptr || data == nullptr || (base == nullptr && base_size > 0)) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto rt = static_cast<class runtime *>(handle);
+    std::vector<float> base_state;
+    if (base != nullptr) {
+        int ret = state_decode(base, base_size, nullptr, base_state);
+        if (ret) {
+            return ret;
+        }
+    }
+    return rt->set_state_compressed(data, size, base != nullptr ? &base_state : nullptr);
+}
+
+void rwkvmobile_memory_set_budget(size_t bytes) {
+    memory_manager::instance().set_budget(bytes);
+}
+
+size_t rwkvmobile_memory_get_budget() {
+    return memory_manager::instance().get_budget();
+}
+
+size_t rwkvmobile_memory_get_usage() {
+    return memory_manager::instance().get_usage();
+}
+
+size_t rwkvmobile_memory_get_usage_by_category(int category) {
+    return memory_manager::instance().get_usage(category);
+}
+
+size_t rwkvmobile_memory_get_peak() {
+    return memory_manager::instance().get_peak();
+}
+
 } // extern "C"
 } // namespace rwkvmobile
@@ -1,7 +1,13 @@
 #ifndef C_API_H
 #define C_API_H
 
+#include <stddef.h>
+
 typedef void * rwkvmobile_runtime_t;
+typedef void * rwkvmobile_model_t;
+// a session is a runtime that shares its model's weights and tokenizer;
+// every rwkvmobile_runtime_* function accepts a session handle
+typedef rwkvmobile_runtime_t rwkvmobile_session_t;
 
 #ifdef __cplusplus
 extern "C" {
@@ -9,9 +15,74 @@ extern "C" {
 
 // ============================
 // init runtime with backend name
+// note: backend name "auto" defers the backend choice to load_model,
+// where every available backend is benchmarked on the model and the fastest is used
 // returns: runtime handle
 rwkvmobile_runtime_t rwkvmobile_runtime_init_with_name(const char * backend_name);
 
+// ============================
+// load a model (weights + tokenizer) that can be shared by many sessions
+// args: backend name, model file path, vocab file path
+// note: with backend name "auto" the selection cache lives in the working directory
+// returns: model handle, NULL on failure
+rwkvmobile_model_t rwkvmobile_model_load(const char * backend_name, const char * model_path, const char * vocab_file);
+
+// ============================
+// release a model handle
+// note: the weights stay alive until every session created from the model is released
+// returns: Error codes
+int rwkvmobile_model_release(rwkvmobile_model_t model);
+
+// ============================
+// create a session with its own state, sampler and penalties on top of a shared model
+// note: sessions are safe to use from different threads; each only costs one state
+// returns: session handle, NULL on failure
+rwkvmobile_session_t rwkvmobile_session_create(rwkvmobile_model_t model);
+
+// ============================
+// create a model handle sharing the weights of an existing runtime,
+// so that more sessions can be created from it
+// returns: model handle, NULL on failure
+rwkvmobile_model_t rwkvmobile_runtime_get_model(rwkvmobile_runtime_t runtime);
+
+// ============================
+// release a session or runtime handle
+// returns: Error codes
+int rwkvmobile_session_release(rwkvmobile_session_t session);
+
+// ============================
+// set the directory for the backend auto-selection cache
+// args: runtime handle, writable directory path
+// note: should be called before load_model; defaults to the working directory
+// returns: Error codes
+int rwkvmobile_runtime_set_cache_dir(rwkvmobile_runtime_t runtime, const char * cache_dir);
+
+// ============================
+// configure the cpu thread pool used by tokenization, sampling and cpu kernels
+// args: runtime handle, thread count, cpu ids to pin the threads to, length of cpu_ids
+// note: n_threads <= 0 uses one thread per selected cpu;
+// cpu_ids == NULL or n_cpu_ids == 0 pins to the big cores detected on big.LITTLE SoCs
+// returns: Error codes
+int rwkvmobile_runtime_set_thread_params(rwkvmobile_runtime_t runtime, int n_threads, const int * cpu_ids, int n_cpu_ids);
+
+// ============================
+// restrict generation to a subset of token ids (e.g. the few hundred ids an ABC/MIDI model emits)
+// args: runtime handle, token ids, number of ids (0 restores the full vocab)
+// note: the backend still computes every logit and the runtime gathers the subset's, so this
+// saves sampling work, not head compute; include id 0 to allow end-of-sequence.
+// applies to every session sharing the model
+// returns: Error codes
+int rwkvmobile_runtime_set_output_subset(rwkvmobile_runtime_t runtime, const int * ids, int n_ids);
+
+// ============================
+// set the precision the logits are taken from the backend in while generating
+// args: runtime handle, precision (0: fp32, 1: fp16, 2: bf16)
+// note: fp16 / bf16 halve the logits buffer the backend fills and the sampler reads;
+// with a backend without half-precision logits, generating fails with RWKV_ERROR_UNSUPPORTED
+// until the precision is set back to fp32
+// returns: Error codes
+int rwkvmobile_runtime_set_logits_precision(rwkvmobile_runtime_t runtime, int precision);
+
 // ============================
 // load model file
 // args: runtime handle, model file path
@@ -24,6 +95,31 @@ int rwkvmobile_runtime_load_model(rwkvmobile_runtime_t runtime, const char * mod
 // returns: Error codes
 int rwkvmobile_runtime_load_tokenizer(rwkvmobile_runtime_t runtime, const char * vocab_file);
 
+// stage: 0 tokenizer, 1 backend init, 2 model, 3 warm-up, 4 everything finished (ret is the overall result)
+typedef void (*rwkvmobile_load_callback)(int stage, int ret, void * user_data);
+
+// ============================
+// create a runtime and load it in the background: the tokenizer is built while the backend
+// initializes and loads the model, then warmup_prompt (may be NULL) is prefilled
+// args: backend name, model file path, vocab file path, warm-up prompt (e.g. the system prompt),
+//       callback (may be NULL), callback user data
+// note: the callback is called on a background thread and must not release the runtime;
+// only get_load_progress/wait_loaded may be called on the runtime until the load finishes
+// returns: runtime handle, NULL on invalid arguments
+rwkvmobile_runtime_t rwkvmobile_runtime_load_async(const char * backend_name, const char * model_path, const char * vocab_file,
+    const char * warmup_prompt, rwkvmobile_load_callback callback, void * user_data);
+
+// ============================
+// poll an asynchronous load
+// args: runtime handle, bitmask of finished stages (1 << stage), whether the load finished (may be NULL)
+// returns: Error codes of the load so far
+int rwkvmobile_runtime_get_load_progress(rwkvmobile_runtime_t runtime, int * stages_done, int * finished);
+
+// ============================
+// block until an asynchronous load finishes
+// returns: Error codes of the load
+int rwkvmobile_runtime_wait_loaded(rwkvmobile_runtime_t runtime);
+
 // ============================
 // eval logits with token id
 // args: runtime handle, token id, buffer for logits output, logits buffer length
@@ -48,6 +144,33 @@ int rwkvmobile_runtime_eval_logits(rwkvmobile_runtime_t runtime, const int *ids,
 // returns: Error codes
 int rwkvmobile_runtime_eval_chat(rwkvmobile_runtime_t runtime, const char * user_role, const char * response_role, const char * user_input, char * response, const int max_length);
 
+// ============================
+// conversation rollback for rwkvmobile_runtime_eval_chat
+// the state and penalties are checkpointed before each user message, so rolling back
+// or regenerating doesn't prefill the conversation again
+// ============================
+// set how many of the latest turns can be rolled back (default 8, 0 disables checkpoints)
+// note: each checkpoint holds one state; they are dropped by clear_state and when loading a state
+// args: runtime handle, number of turns
+// returns: Error codes
+int rwkvmobile_runtime_set_max_chat_turns(rwkvmobile_runtime_t runtime, int max_turns);
+
+// returns: number of turns that can currently be rolled back, or a negative value on error
+int rwkvmobile_runtime_get_chat_turn_count(rwkvmobile_runtime_t runtime);
+
+// return to the state right before the n-th last user message
+// example: to edit the last message, roll back 1 turn and call rwkvmobile_runtime_eval_chat with the new message
+// args: runtime handle, number of turns
+// returns: Error codes
+int rwkvmobile_runtime_rollback_chat_turns(rwkvmobile_runtime_t runtime, int n);
+
+// roll back the last turn and generate a new response to the same user message
+// args: runtime handle, char buffer for response output, size of the buffer in bytes
+// note: the length limit of the original rwkvmobile_runtime_eval_chat call applies;
+//       the response is truncated to size - 1 bytes and always NUL-terminated
+// returns: Error codes
+int rwkvmobile_runtime_regenerate_chat(rwkvmobile_runtime_t runtime, char * response, size_t size);
+
 // ============================
 // generate completion from prompt
 // args: runtime handle, prompt text, char buffer for completion output, completion length
@@ -61,6 +184,66 @@ int rwkvmobile_runtime_eval_chat(rwkvmobile_runtime_t runtime, const char * user
 // returns: Error codes
 int rwkvmobile_runtime_gen_completion(rwkvmobile_runtime_t runtime, const char * prompt, char * completion, const int length);
 
+// called with the text of each generated token; return 0 to stop generating
+typedef int (*rwkvmobile_token_callback)(const char * text, size_t len, void * user_data);
+
+// ============================
+// pipelined generate completion from prompt
+// args: runtime handle, prompt text, char buffer for completion output, completion buffer size,
+//       completion length (in tokens), stop strings, number of stop strings, token callback (may be NULL), callback user data
+// ============================
+// the prompt is tokenized while earlier parts of it are evaluated, and each generated token is
+// detokenized and passed to the callback while the backend evaluates it.
+// note: the callback is called on a background thread
+// response will stop when these conditions are met:
+// 1. the model generates an end-of-sequence token (id = 0)
+// 2. the completion ends with one of the stop strings
+// 3. the callback returns 0
+// 4. the completion length reaches the limit
+// ============================
+// returns: Error codes
+int rwkvmobile_runtime_gen_completion_stream(rwkvmobile_runtime_t runtime, const char * prompt, char * completion, const int completion_size,
+    const int length, const char ** stop, const int n_stop, rwkvmobile_token_callback callback, void * user_data);
+
+
+// ============================
+// memory accounting (shared by all runtimes in the process)
+// categories for rwkvmobile_memory_get_usage_by_category:
+// 0: model weights, 1: tokenizer tables, 2: logits buffers, 3: saved states, 4: caches
+// ============================
+// set the memory budget in bytes; 0 means unlimited
+// note: loads that would exceed the budget after shedding caches fail with RWKV_ERROR_ALLOC
+void rwkvmobile_memory_set_budget(size_t bytes);
+
+size_t rwkvmobile_memory_get_budget();
+
+// total bytes currently held by all runtimes
+size_t rwkvmobile_memory_get_usage();
+
+size_t rwkvmobile_memory_get_usage_by_category(int category);
+
+// highest total usage observed
+size_t rwkvmobile_memory_get_peak();
+
+// ============================
+// generate multiple candidate completions from one prefill of the prompt
+// args: runtime handle, prompt text, number of candidates, length limit in tokens,
+// mode (0: best-of-n sampling, 1: beam search), array of n char buffers for the completions,
+// size of each completion buffer, array of n floats for the cumulative log-probabilities
+// note: candidates are written best first; completions are null-terminated and truncated to the buffer size
+// the runtime state continues from the best candidate
+// returns: Error codes
+int rwkvmobile_runtime_gen_candidates(rwkvmobile_runtime_t runtime, const char * prompt, int n, int max_length, int mode, char ** completions, int completion_size, float * logprobs);
+
+// ============================
+// score candidate continuations (labels, multiple-choice answers, ...) after a shared prefix
+// args: runtime handle, prefix text, array of n continuation strings, n,
+// output array of n summed log-probabilities,
+// optional output array of n token counts, optional output array of n * max_tokens per-token log-probs
+// (row i holds the first max_tokens token log-probs of continuation i)
+// note: the prefix is prefilled once; the runtime is left in the state right after the prefix
+// returns: Error codes
+int rwkvmobile_runtime_score_continuations(rwkvmobile_runtime_t runtime, const char * prefix, const char ** continuations, int n, float * scores, int * num_tokens, float * token_logprobs, int max_tokens);
 
 // ============================
 // clear state
@@ -68,6 +251,23 @@ int rwkvmobile_runtime_gen_completion(rwkvmobile_runtime_t runtime, const char *
 // returns: Error codes
 int rwkvmobile_runtime_clear_state(rwkvmobile_runtime_t runtime);
 
+// ============================
+// save the state in a compact, versioned format
+// args: runtime handle, format (0: fp32, 1: fp16, 2: bf16, 3: int8 with per-block scales),
+// optional base state previously saved with this function (only the difference to it is stored), base size,
+// output buffer, buffer size, output: bytes needed
+// note: pass a NULL buffer to query the size; the same base has to be passed when loading
+// returns: Error codes
+int rwkvmobile_runtime_get_state_compressed(rwkvmobile_runtime_t runtime, int format, const unsigned char * base, size_t base_size,
+    unsigned char * buffer, size_t buffer_size, size_t * out_size);
+
+// ============================
+// load a state saved with rwkvmobile_runtime_get_state_compressed
+// args: runtime handle, saved state, its size, optional base state, base size
+// returns: Error codes
+int rwkvmobile_runtime_set_state_compressed(rwkvmobile_runtime_t runtime, const unsigned char * data, size_t size,
+    const unsigned char * base, size_t base_size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,172 @@
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <filesystem>
+
+#if !defined(_WIN32)
+#include <sys/utsname.h>
+#endif
+
+#include "calibration.h"
+#include "commondef.h"
+
+namespace rwkvmobile {
+
+static const char * calibration_cache_file = "rwkvmobile_backend_cache.txt";
+
+static const int calibration_prefill_len = 64;
+static const int calibration_decode_len = 16;
+
+static uint64_t fnv1a(uint64_t hash, const void * data, size_t len) {
+    auto bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static std::string device_string() {
+    std::string device;
+#if !defined(_WIN32)
+    struct utsname name;
+    if (uname(&name) == 0) {
+        device += std::string(name.sysname) + "-" + name.machine;
+    }
+#else
+    device += "windows";
+#endif
+    // SoC / CPU model name is what distinguishes phones
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.rfind("Hardware", 0) == 0 || line.rfind("model name", 0) == 0) {
+            device += "-" + line.substr(line.find(':') + 1);
+            break;
+        }
+    }
+    return device;
+}
+
+// hashing a multi-GB model file would defeat the purpose of the cache;
+// size + head + tail is enough to tell model files apart
+static uint64_t model_hash(std::string model_path) {
+    const size_t chunk = 1 << 20;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    std::ifstream file(model_path, std::ios::binary);
+    if (!file.is_open()) {
+        return hash;
+    }
+    file.seekg(0, std::ios::end);
+    uint64_t size = file.tellg();
+    hash = fnv1a(hash, &size, sizeof(size));
+
+    std::vector<char> buffer(chunk);
+    file.seekg(0, std::ios::beg);
+    file.read(buffer.data(), chunk);
+    hash = fnv1a(hash, buffer.data(), file.gcount());
+    if (size > chunk) {
+        file.clear();
+        file.seekg(size - chunk, std::ios::beg);
+        file.read(buffer.data(), chunk);
+        hash = fnv1a(hash, buffer.data(), file.gcount());
+    }
+    return hash;
+}
+
+std::string calibration_cache_key(std::string model_path) {
+    std::string key = device_string() + "|" + RWKV_MOBILE_VERSION;
+    uint64_t hash = fnv1a(0xcbf29ce484222325ULL, key.data(), key.size());
+    uint64_t mhash = model_hash(model_path);
+    hash = fnv1a(hash, &mhash, sizeof(mhash));
+    std::stringstream ss;
+    ss << std::hex << hash;
+    return ss.str();
+}
+
+int calibration_cache_load(std::string cache_dir, std::string key, calibration_result &result) {
+    std::ifstream file(std::filesystem::path(cache_dir) / calibration_cache_file);
+    if (!file.is_open()) {
+        return RWKV_ERROR_IO;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream ss(line);
+        std::string entry_key, backend_name;
+        calibration_result entry;
+        if (!(ss >> entry_key >> backend_name >> entry.prefill_ms >> entry.decode_ms)) {
+            continue;
+        }
+        if (entry_key == key) {
+            entry.backend_id = backend_str_to_enum(backend_name);
+            if (entry.backend_id < 0) {
+                return RWKV_ERROR_BACKEND;
+            }
+            result = entry;
+            return RWKV_SUCCESS;
+        }
+    }
+    return RWKV_ERROR_IO;
+}
+
+int calibration_cache_save(std::string cache_dir, std::string key, const calibration_result &result) {
+    auto path = std::filesystem::path(cache_dir) / calibration_cache_file;
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.rfind(key + " ", 0) != 0) {
+                lines.push_back(line);
+            }
+        }
+    }
+    std::ofstream file(path, std::ios::trunc);
+    if (!file.is_open()) {
+        return RWKV_ERROR_IO;
+    }
+    for (auto &line : lines) {
+        file << line << "\n";
+    }
+    file << key << " " << backend_enum_to_str(result.backend_id) << " "
+         << result.prefill_ms << " " << result.decode_ms << "\n";
+    return RWKV_SUCCESS;
+}
+
+int calibrate_backend(execution_provider * backend, int vocab_size, calibration_result &result) {
+    if (backend == nullptr) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    std::vector<float> logits(vocab_size);
+    std::vector<int> ids(calibration_prefill_len);
+    for (int i = 0; i < calibration_prefill_len; i++) {
+        ids[i] = 1 + i;
+    }
+
+    // warm up, so that pipeline/shader compilation is not counted
+    int ret = backend->eval(ids[0], logits);
+    if (ret) {
+        return ret;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    ret = backend->eval(ids, logits);
+    if (ret) {
+        return ret;
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < calibration_decode_len; i++) {
+        ret = backend->eval(ids[i], logits);
+        if (ret) {
+            return ret;
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    result.prefill_ms = std::chrono::duration<double, std::milli>(mid - start).count();
+    result.decode_ms = std::chrono::duration<double, std::milli>(end - mid).count();
+    return backend->clear_state();
+}
+
+}
@@ -0,0 +1,27 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <string>
+#include "backend.h"
+
+namespace rwkvmobile {
+
+struct calibration_result {
+    int backend_id = -1;
+    double prefill_ms = 0;
+    double decode_ms = 0;
+};
+
+// key = hash(device, model file, library version)
+std::string calibration_cache_key(std::string model_path);
+
+int calibration_cache_load(std::string cache_dir, std::string key, calibration_result &result);
+int calibration_cache_save(std::string cache_dir, std::string key, const calibration_result &result);
+
+// run a short prefill + decode micro-benchmark on a backend with a loaded model
+// the backend state is cleared afterwards
+int calibrate_backend(execution_provider * backend, int vocab_size, calibration_result &result);
+
+}
+
+#endif
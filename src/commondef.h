@@ -1,6 +1,8 @@
 #ifndef COMMONDEF_H
 #define COMMONDEF_H
 
+#define RWKV_MOBILE_VERSION "0.1.0"
+
 namespace rwkvmobile {
 
 enum {
@@ -15,6 +17,15 @@ enum {
     RWKV_ERROR_SAMPLER = 1 << 7,
     RWKV_ERROR_RUNTIME = 1 << 8,
     RWKV_ERROR_UNSUPPORTED = 1 << 9,
+    RWKV_ERROR_ALLOC = 1 << 10,
+};
+
+// precision of the logits a backend hands to the runtime; the half formats are
+// passed around as raw uint16_t bits
+enum {
+    RWKV_LOGITS_FP32 = 0,
+    RWKV_LOGITS_FP16,
+    RWKV_LOGITS_BF16,
 };
 
 } // namespace rwkvmobile
@@ -0,0 +1,94 @@
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPU_FEATURES_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CPU_FEATURES_ARM64
+#if defined(__linux__)
+#include <sys/auxv.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+#endif
+
+#include "cpu_features.h"
+
+namespace rwkvmobile {
+
+#ifdef CPU_FEATURES_X86
+static void cpuid(int leaf, int subleaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for (int i = 0; i < 4; i++) {
+        regs[i] = r[i];
+    }
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// which register files the os saves on context switches
+static unsigned long long xgetbv0() {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+#endif
+
+static cpu_features detect() {
+    cpu_features f;
+#if defined(CPU_FEATURES_X86)
+    unsigned regs[4];
+    cpuid(0, 0, regs);
+    const unsigned max_leaf = regs[0];
+    cpuid(1, 0, regs);
+    f.sse42 = regs[2] & (1u << 20);
+    const bool osxsave = regs[2] & (1u << 27);
+    const bool avx = regs[2] & (1u << 28);
+    const bool fma = regs[2] & (1u << 12);
+    const bool f16c = regs[2] & (1u << 29);
+    const unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+    // xmm + ymm state, plus opmask and zmm state for avx-512
+    const bool ymm_enabled = (xcr0 & 0x6) == 0x6;
+    const bool zmm_enabled = (xcr0 & 0xe6) == 0xe6;
+    if (max_leaf >= 7) {
+        cpuid(7, 0, regs);
+        f.avx2 = avx && ymm_enabled && (regs[1] & (1u << 5));
+        f.avx512f = zmm_enabled && (regs[1] & (1u << 16));
+        f.avx512bw = f.avx512f && (regs[1] & (1u << 30));
+    }
+    f.fma = fma && ymm_enabled;
+    f.f16c = f16c && ymm_enabled;
+#elif defined(CPU_FEATURES_ARM64)
+    // advanced simd is mandatory on armv8-a
+    f.neon = true;
+#if defined(__linux__)
+    // HWCAP_ASIMDDP and HWCAP_SVE, which older headers don't define
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    f.dotprod = hwcap & (1ul << 20);
+    f.sve = hwcap & (1ul << 22);
+#elif defined(__APPLE__)
+    int value = 0;
+    size_t size = sizeof(value);
+    if (sysctlbyname("hw.optional.arm.FEAT_DotProd", &value, &size, nullptr, 0) == 0) {
+        f.dotprod = value != 0;
+    }
+#endif
+#endif
+    return f;
+}
+
+const cpu_features & get_cpu_features() {
+    static const cpu_features features = detect();
+    return features;
+}
+
+}
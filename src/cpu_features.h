@@ -0,0 +1,24 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+namespace rwkvmobile {
+
+// what the cpu and os support, detected once (cpuid + xgetbv on x86,
+// getauxval/sysctl on arm)
+struct cpu_features {
+    bool sse42 = false;
+    bool avx2 = false;
+    bool fma = false;
+    bool f16c = false;
+    bool avx512f = false;
+    bool avx512bw = false;
+    bool neon = false;
+    bool dotprod = false;
+    bool sve = false;
+};
+
+const cpu_features & get_cpu_features();
+
+}
+
+#endif
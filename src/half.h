@@ -0,0 +1,83 @@
+#ifndef HALF_H
+#define HALF_H
+
+// scalar fp16 (ieee binary16) and bf16 conversions, for the tails of the vectorized
+// ones in the kernel tables and for the few values touched one at a time (penalties).
+// static, so that the kernel files compiled with different isa flags each keep their
+// own copy (see kernels_impl.h)
+
+#include <cstdint>
+#include <cstring>
+
+namespace rwkvmobile {
+
+static inline float bits_to_float(uint32_t u) {
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline uint32_t float_to_bits(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+// exponent rebias, with subnormals normalized by an fp32 subtraction
+static inline float fp16_to_fp32(uint16_t h) {
+    const uint32_t shifted_exp = 0x7c00u << 13;
+    uint32_t o = (h & 0x7fffu) << 13;
+    uint32_t exp = o & shifted_exp;
+    o += (127 - 15) << 23;
+    float f;
+    if (exp == shifted_exp) {
+        // inf / nan, with nans made quiet as the hardware conversions do
+        o += (128 - 16) << 23;
+        if (o & 0x7fffffu) {
+            o |= 0x400000u;
+        }
+        f = bits_to_float(o);
+    } else if (exp == 0) {
+        o += 1 << 23;
+        f = bits_to_float(o) - bits_to_float(113u << 23);
+    } else {
+        f = bits_to_float(o);
+    }
+    return bits_to_float(float_to_bits(f) | (uint32_t)(h & 0x8000u) << 16);
+}
+
+// round to nearest even; overflow goes to inf, nan stays nan
+static inline uint16_t fp32_to_fp16(float value) {
+    uint32_t f = float_to_bits(value);
+    const uint32_t sign = (f >> 16) & 0x8000u;
+    f &= 0x7fffffffu;
+    if (f >= 0x47800000u) {
+        // >= 65536 before rounding, inf or nan
+        return sign | (f > 0x7f800000u ? 0x7e00u : 0x7c00u);
+    }
+    if (f < 0x38800000u) {
+        // below the smallest normal half: adding 0.5 makes the fp32 adder round
+        // the mantissa at the half subnormal position
+        float r = bits_to_float(f) + 0.5f;
+        return sign | (uint16_t)(float_to_bits(r) - 0x3f000000u);
+    }
+    uint32_t odd = (f >> 13) & 1;
+    f += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+    return sign | (uint16_t)(f >> 13);
+}
+
+static inline float bf16_to_fp32(uint16_t h) {
+    return bits_to_float((uint32_t)h << 16);
+}
+
+static inline uint16_t fp32_to_bf16(float value) {
+    uint32_t f = float_to_bits(value);
+    if ((f & 0x7fffffffu) > 0x7f800000u) {
+        return (f >> 16) | 0x40;
+    }
+    return (f + 0x7fff + ((f >> 16) & 1)) >> 16;
+}
+
+}
+
+#endif
@@ -0,0 +1,138 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#include "kernels.h"
+#include "kernels_impl.h"
+#include "cpu_features.h"
+#include "commondef.h"
+
+namespace rwkvmobile {
+
+static float reduce_max_generic(const float * x, size_t n) {
+    return reduce_max_scalar(x, n, -INFINITY);
+}
+
+static float exp_sum_generic(const float * x, float * out, size_t n, float shift) {
+    return exp_sum_scalar(x, out, n, shift);
+}
+
+static size_t select_at_least_generic(const float * x, size_t n, float threshold, int * index) {
+    return select_at_least_scalar(x, n, threshold, index, 0);
+}
+
+static size_t common_prefix_generic(const char * a, const char * b, size_t n) {
+    return common_prefix_scalar(a, b, n, 0);
+}
+
+static size_t compact_nonzero_generic(const float * x, size_t n, uint32_t * idx, float * val) {
+    return compact_nonzero_scalar(x, n, idx, val, 0);
+}
+
+static const kernel_table generic_table = {
+    "generic",
+    reduce_max_generic,
+    exp_sum_generic,
+    select_at_least_generic,
+    penalty_apply_scalar,
+    common_prefix_generic,
+    dot_scalar,
+    axpy_scalar,
+    compact_nonzero_generic,
+    fp16_to_fp32_scalar,
+    bf16_to_fp32_scalar,
+};
+
+const kernel_table * kernels_generic() {
+    return &generic_table;
+}
+
+static const char * isa_names[RWKV_ISA_COUNT] = {"generic", "sse4.2", "avx2", "avx512", "neon"};
+
+const char * kernel_isa_name(int isa) {
+    if (isa < 0 || isa >= RWKV_ISA_COUNT) {
+        return "unknown";
+    }
+    return isa_names[isa];
+}
+
+const kernel_table * get_kernel_table(int isa) {
+    switch (isa) {
+        case RWKV_ISA_GENERIC:
+            return kernels_generic();
+        case RWKV_ISA_SSE42:
+            return kernels_sse42();
+        case RWKV_ISA_AVX2:
+            return kernels_avx2();
+        case RWKV_ISA_AVX512:
+            return kernels_avx512();
+        case RWKV_ISA_NEON:
+            return kernels_neon();
+        default:
+            return nullptr;
+    }
+}
+
+bool is_kernel_isa_available(int isa) {
+    if (get_kernel_table(isa) == nullptr) {
+        return false;
+    }
+    const cpu_features &f = get_cpu_features();
+    switch (isa) {
+        case RWKV_ISA_GENERIC:
+            return true;
+        case RWKV_ISA_SSE42:
+            return f.sse42;
+        case RWKV_ISA_AVX2:
+            return f.avx2 && f.fma && f.f16c;
+        case RWKV_ISA_AVX512:
+            return f.avx512f && f.avx512bw;
+        case RWKV_ISA_NEON:
+            return f.neon;
+        default:
+            return false;
+    }
+}
+
+static int select_isa() {
+    const char * env = std::getenv("RWKV_MOBILE_ISA");
+    if (env != nullptr && env[0] != '\0') {
+        for (int isa = 0; isa < RWKV_ISA_COUNT; isa++) {
+            if (strcmp(env, isa_names[isa]) == 0 && is_kernel_isa_available(isa)) {
+                return isa;
+            }
+        }
+    }
+    static const int preferred[] = {RWKV_ISA_AVX512, RWKV_ISA_AVX2, RWKV_ISA_SSE42, RWKV_ISA_NEON};
+    for (int isa : preferred) {
+        if (is_kernel_isa_available(isa)) {
+            return isa;
+        }
+    }
+    return RWKV_ISA_GENERIC;
+}
+
+static std::atomic<int> _isa{-1};
+
+int get_kernel_isa() {
+    int isa = _isa.load(std::memory_order_acquire);
+    if (isa < 0) {
+        isa = select_isa();
+        _isa.store(isa, std::memory_order_release);
+    }
+    return isa;
+}
+
+int set_kernel_isa(int isa) {
+    if (!is_kernel_isa_available(isa)) {
+        return RWKV_ERROR_UNSUPPORTED;
+    }
+    _isa.store(isa, std::memory_order_release);
+    return RWKV_SUCCESS;
+}
+
+const kernel_table & kernels() {
+    return *get_kernel_table(get_kernel_isa());
+}
+
+}
@@ -0,0 +1,67 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rwkvmobile {
+
+enum {
+    RWKV_ISA_GENERIC = 0,
+    RWKV_ISA_SSE42,
+    RWKV_ISA_AVX2,
+    RWKV_ISA_AVX512,
+    RWKV_ISA_NEON,
+    RWKV_ISA_COUNT,
+};
+
+// the cpu hot loops, compiled once per isa level (each in its own translation unit
+// with that level's compiler flags) and picked at startup from the detected cpu
+// features, since the library itself is built for the baseline isa
+struct kernel_table {
+    const char * name;
+    float (*reduce_max)(const float * x, size_t n);
+    // out[i] = exp(x[i] - shift), returns the sum of out
+    float (*exp_sum)(const float * x, float * out, size_t n, float shift);
+    // writes the positions of the elements >= threshold to index, returns their count
+    size_t (*select_at_least)(const float * x, size_t n, float threshold, int * index);
+    // logits[ids[i]] -= frequency_penalty * counts[ids[i]] + presence_penalty, then
+    // counts[ids[i]] *= decay; ids must be unique. scalar in every table for now: the
+    // accesses are random, and avx2/avx512 gather+scatter versions measured no faster
+    void (*penalty_apply)(float * logits, float * counts, const int * ids, size_t n,
+        float frequency_penalty, float presence_penalty, float decay);
+    // number of leading bytes a and b have in common
+    size_t (*common_prefix)(const char * a, const char * b, size_t n);
+    float (*dot)(const float * a, const float * b, size_t n);
+    // y += a * x
+    void (*axpy)(float * y, const float * x, float a, size_t n);
+    // positions and values of the non-zero elements, returns their count
+    size_t (*compact_nonzero)(const float * x, size_t n, uint32_t * idx, float * val);
+    // widen half-precision logits (raw fp16 / bf16 bits)
+    void (*fp16_to_fp32)(const uint16_t * x, float * out, size_t n);
+    void (*bf16_to_fp32)(const uint16_t * x, float * out, size_t n);
+};
+
+// the table in use: the best level this cpu supports, unless overridden by
+// set_kernel_isa() or the RWKV_MOBILE_ISA environment variable (generic, sse4.2,
+// avx2, avx512, neon)
+const kernel_table & kernels();
+
+const char * kernel_isa_name(int isa);
+// compiled in and supported by this cpu
+bool is_kernel_isa_available(int isa);
+int get_kernel_isa();
+// for tests and benchmarks; RWKV_ERROR_UNSUPPORTED if the level isn't available
+int set_kernel_isa(int isa);
+const kernel_table * get_kernel_table(int isa);
+
+// per-isa tables, nullptr when the translation unit was built without that level's flags
+const kernel_table * kernels_generic();
+const kernel_table * kernels_sse42();
+const kernel_table * kernels_avx2();
+const kernel_table * kernels_avx512();
+const kernel_table * kernels_neon();
+
+}
+
+#endif
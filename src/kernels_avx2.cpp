@@ -0,0 +1,207 @@
+// built with -mavx2 -mfma -mf16c (/arch:AVX2); only called after cpuid confirmed them
+
+#include "kernels.h"
+
+// msvc defines neither __FMA__ nor __F16C__, /arch:AVX2 implies both
+#if defined(__AVX2__) && ((defined(__FMA__) && defined(__F16C__)) || defined(_MSC_VER))
+#include <immintrin.h>
+#include "kernels_impl.h"
+
+namespace rwkvmobile {
+
+static inline float hsum(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+static inline float hmax(__m256 v) {
+    __m128 s = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_max_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+static inline __m256 exp_avx2(__m256 x) {
+    const __m256 zero_mask = _mm256_cmp_ps(x, _mm256_set1_ps(exp_min), _CMP_NGE_UQ);
+    x = _mm256_min_ps(x, _mm256_set1_ps(exp_max));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(exp_log2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(exp_ln2_hi), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(exp_ln2_lo), r);
+    __m256 p = _mm256_set1_ps(exp_p0);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p5));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.f)));
+    __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_andnot_ps(zero_mask, _mm256_mul_ps(p, _mm256_castsi256_ps(bits)));
+}
+
+// for every 8-bit mask, the lanes to move to the front. built at compile time: code
+// running at static initialization must not use avx2 on cpus without it
+struct compaction_table {
+    uint32_t lanes[256][8];
+};
+
+static constexpr compaction_table make_compaction_table() {
+    compaction_table table = {};
+    for (int mask = 0; mask < 256; mask++) {
+        int n = 0;
+        for (int i = 0; i < 8; i++) {
+            if (mask & (1 << i)) {
+                table.lanes[mask][n++] = i;
+            }
+        }
+    }
+    return table;
+}
+
+alignas(32) static constexpr compaction_table compaction = make_compaction_table();
+
+static float reduce_max_avx2(const float * x, size_t n) {
+    size_t i = 0;
+    float m = -INFINITY;
+    if (n >= 8) {
+        __m256 acc = _mm256_loadu_ps(x);
+        for (i = 8; i + 8 <= n; i += 8) {
+            acc = _mm256_max_ps(acc, _mm256_loadu_ps(x + i));
+        }
+        m = hmax(acc);
+    }
+    return reduce_max_scalar(x + i, n - i, m);
+}
+
+static float exp_sum_avx2(const float * x, float * out, size_t n, float shift) {
+    size_t i = 0;
+    const __m256 vshift = _mm256_set1_ps(shift);
+    __m256 acc = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        __m256 e = exp_avx2(_mm256_sub_ps(_mm256_loadu_ps(x + i), vshift));
+        _mm256_storeu_ps(out + i, e);
+        acc = _mm256_add_ps(acc, e);
+    }
+    return hsum(acc) + exp_sum_scalar(x + i, out + i, n - i, shift);
+}
+
+static size_t select_at_least_avx2(const float * x, size_t n, float threshold, int * index) {
+    size_t i = 0, count = 0;
+    const __m256 t = _mm256_set1_ps(threshold);
+    __m256i base = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i step = _mm256_set1_epi32(8);
+    // the unmasked stores end at or before index + i + 8
+    for (; i + 8 <= n; i += 8) {
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(x + i), t, _CMP_GE_OQ));
+        if (mask) {
+            __m256i perm = _mm256_load_si256((const __m256i *)compaction.lanes[mask]);
+            _mm256_storeu_si256((__m256i *)(index + count), _mm256_permutevar8x32_epi32(base, perm));
+            count += popcount32(mask);
+        }
+        base = _mm256_add_epi32(base, step);
+    }
+    return count + select_at_least_scalar(x + i, n - i, threshold, index + count, i);
+}
+
+static size_t common_prefix_avx2(const char * a, const char * b, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        uint32_t equal = _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (equal != 0xffffffffu) {
+            return i + ctz32(~equal);
+        }
+    }
+    return common_prefix_scalar(a, b, n, i);
+}
+
+static float dot_avx2(const float * a, const float * b, size_t n) {
+    size_t i = 0;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    return hsum(_mm256_add_ps(acc0, acc1)) + dot_scalar(a + i, b + i, n - i);
+}
+
+static void axpy_avx2(float * y, const float * x, float a, size_t n) {
+    size_t i = 0;
+    const __m256 va = _mm256_set1_ps(a);
+    for (; i + 16 <= n; i += 16) {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+        _mm256_storeu_ps(y + i + 8, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8)));
+    }
+    axpy_scalar(y + i, x + i, a, n - i);
+}
+
+static size_t compact_nonzero_avx2(const float * x, size_t n, uint32_t * idx, float * val) {
+    size_t i = 0, count = 0;
+    const __m256 zero = _mm256_setzero_ps();
+    __m256i base = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i step = _mm256_set1_epi32(8);
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(x + i);
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(v, zero, _CMP_NEQ_UQ));
+        if (mask) {
+            __m256i perm = _mm256_load_si256((const __m256i *)compaction.lanes[mask]);
+            _mm256_storeu_ps(val + count, _mm256_permutevar8x32_ps(v, perm));
+            _mm256_storeu_si256((__m256i *)(idx + count), _mm256_permutevar8x32_epi32(base, perm));
+            count += popcount32(mask);
+        }
+        base = _mm256_add_epi32(base, step);
+    }
+    return count + compact_nonzero_scalar(x + i, n - i, idx + count, val + count, i);
+}
+
+static void fp16_to_fp32_avx2(const uint16_t * x, float * out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x + i))));
+    }
+    fp16_to_fp32_scalar(x + i, out + i, n - i);
+}
+
+static void bf16_to_fp32_avx2(const uint16_t * x, float * out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i h = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(x + i)));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_slli_epi32(h, 16));
+    }
+    bf16_to_fp32_scalar(x + i, out + i, n - i);
+}
+
+static const kernel_table avx2_table = {
+    "avx2",
+    reduce_max_avx2,
+    exp_sum_avx2,
+    select_at_least_avx2,
+    penalty_apply_scalar,
+    common_prefix_avx2,
+    dot_avx2,
+    axpy_avx2,
+    compact_nonzero_avx2,
+    fp16_to_fp32_avx2,
+    bf16_to_fp32_avx2,
+};
+
+const kernel_table * kernels_avx2() {
+    return &avx2_table;
+}
+
+}
+
+#else
+
+namespace rwkvmobile {
+
+const kernel_table * kernels_avx2() {
+    return nullptr;
+}
+
+}
+
+#endif
@@ -0,0 +1,166 @@
+// built with -mavx512f -mavx512bw -mfma (/arch:AVX512); only called after cpuid confirmed them
+
+#include "kernels.h"
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+#include <immintrin.h>
+#include "kernels_impl.h"
+
+namespace rwkvmobile {
+
+static inline __m512 exp_avx512(__m512 x) {
+    const __mmask16 keep = _mm512_cmp_ps_mask(x, _mm512_set1_ps(exp_min), _CMP_GE_OQ);
+    x = _mm512_min_ps(x, _mm512_set1_ps(exp_max));
+    __m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(exp_log2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(exp_ln2_hi), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(exp_ln2_lo), r);
+    __m512 p = _mm512_set1_ps(exp_p0);
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p1));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p2));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p3));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p4));
+    p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p5));
+    p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.f)));
+    __m512i bits = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23);
+    return _mm512_maskz_mul_ps(keep, p, _mm512_castsi512_ps(bits));
+}
+
+static float reduce_max_avx512(const float * x, size_t n) {
+    size_t i = 0;
+    float m = -INFINITY;
+    if (n >= 16) {
+        __m512 acc = _mm512_loadu_ps(x);
+        for (i = 16; i + 16 <= n; i += 16) {
+            acc = _mm512_max_ps(acc, _mm512_loadu_ps(x + i));
+        }
+        m = _mm512_reduce_max_ps(acc);
+    }
+    return reduce_max_scalar(x + i, n - i, m);
+}
+
+static float exp_sum_avx512(const float * x, float * out, size_t n, float shift) {
+    size_t i = 0;
+    const __m512 vshift = _mm512_set1_ps(shift);
+    __m512 acc = _mm512_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        __m512 e = exp_avx512(_mm512_sub_ps(_mm512_loadu_ps(x + i), vshift));
+        _mm512_storeu_ps(out + i, e);
+        acc = _mm512_add_ps(acc, e);
+    }
+    return _mm512_reduce_add_ps(acc) + exp_sum_scalar(x + i, out + i, n - i, shift);
+}
+
+static size_t select_at_least_avx512(const float * x, size_t n, float threshold, int * index) {
+    size_t i = 0, count = 0;
+    const __m512 t = _mm512_set1_ps(threshold);
+    __m512i base = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i step = _mm512_set1_epi32(16);
+    for (; i + 16 <= n; i += 16) {
+        __mmask16 mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(x + i), t, _CMP_GE_OQ);
+        if (mask) {
+            _mm512_mask_compressstoreu_epi32(index + count, mask, base);
+            count += popcount32(mask);
+        }
+        base = _mm512_add_epi32(base, step);
+    }
+    return count + select_at_least_scalar(x + i, n - i, threshold, index + count, i);
+}
+
+static size_t common_prefix_avx512(const char * a, const char * b, size_t n) {
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __mmask64 differ = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        if (differ) {
+            return i + ctz64(differ);
+        }
+    }
+    return common_prefix_scalar(a, b, n, i);
+}
+
+static float dot_avx512(const float * a, const float * b, size_t n) {
+    size_t i = 0;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1)) + dot_scalar(a + i, b + i, n - i);
+}
+
+static void axpy_avx512(float * y, const float * x, float a, size_t n) {
+    size_t i = 0;
+    const __m512 va = _mm512_set1_ps(a);
+    for (; i + 32 <= n; i += 32) {
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+        _mm512_storeu_ps(y + i + 16, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16)));
+    }
+    axpy_scalar(y + i, x + i, a, n - i);
+}
+
+static size_t compact_nonzero_avx512(const float * x, size_t n, uint32_t * idx, float * val) {
+    size_t i = 0, count = 0;
+    const __m512 zero = _mm512_setzero_ps();
+    __m512i base = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i step = _mm512_set1_epi32(16);
+    for (; i + 16 <= n; i += 16) {
+        __m512 v = _mm512_loadu_ps(x + i);
+        __mmask16 mask = _mm512_cmp_ps_mask(v, zero, _CMP_NEQ_UQ);
+        if (mask) {
+            _mm512_mask_compressstoreu_ps(val + count, mask, v);
+            _mm512_mask_compressstoreu_epi32(idx + count, mask, base);
+            count += popcount32(mask);
+        }
+        base = _mm512_add_epi32(base, step);
+    }
+    return count + compact_nonzero_scalar(x + i, n - i, idx + count, val + count, i);
+}
+
+static void fp16_to_fp32_avx512(const uint16_t * x, float * out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(out + i, _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(x + i))));
+    }
+    fp16_to_fp32_scalar(x + i, out + i, n - i);
+}
+
+static void bf16_to_fp32_avx512(const uint16_t * x, float * out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i h = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(x + i)));
+        _mm512_storeu_si512(out + i, _mm512_slli_epi32(h, 16));
+    }
+    bf16_to_fp32_scalar(x + i, out + i, n - i);
+}
+
+static const kernel_table avx512_table = {
+    "avx512",
+    reduce_max_avx512,
+    exp_sum_avx512,
+    select_at_least_avx512,
+    penalty_apply_scalar,
+    common_prefix_avx512,
+    dot_avx512,
+    axpy_avx512,
+    compact_nonzero_avx512,
+    fp16_to_fp32_avx512,
+    bf16_to_fp32_avx512,
+};
+
+const kernel_table * kernels_avx512() {
+    return &avx512_table;
+}
+
+}
+
+#else
+
+namespace rwkvmobile {
+
+const kernel_table * kernels_avx512() {
+    return nullptr;
+}
+
+}
+
+#endif
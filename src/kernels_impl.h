@@ -0,0 +1,172 @@
+#ifndef KERNELS_IMPL_H
+#define KERNELS_IMPL_H
+
+// scalar building blocks shared by the per-isa kernel files, for the generic table and
+// for the tails of the vector loops. everything here is static so that the copies
+// compiled with different isa flags never get merged by the linker; for the same
+// reason the isa files don't use std:: templates (std::min etc.), whose instantiations
+// are shared between translation units
+
+#include <cmath>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "kernels.h"
+#include "half.h"
+
+namespace rwkvmobile {
+
+// exp(x) as a degree-6 polynomial on x - n * ln2 times 2^n (cephes expf), the same in
+// every variant so that their results agree to rounding. 0 below exp_min
+static const float exp_min = -87.3f;
+static const float exp_max = 88.3f;
+static const float exp_log2e = 1.44269504088896341f;
+static const float exp_ln2_hi = 0.693359375f;
+static const float exp_ln2_lo = -2.12194440e-4f;
+static const float exp_p0 = 1.9875691500e-4f;
+static const float exp_p1 = 1.3981999507e-3f;
+static const float exp_p2 = 8.3334519073e-3f;
+static const float exp_p3 = 4.1665795894e-2f;
+static const float exp_p4 = 1.6666665459e-1f;
+static const float exp_p5 = 5.0000001201e-1f;
+
+static inline float min_scalar(float a, float b) {
+    return a < b ? a : b;
+}
+
+static inline float max_scalar(float a, float b) {
+    return a > b ? a : b;
+}
+
+static inline float exp_scalar(float x) {
+    if (!(x >= exp_min)) {
+        return 0.f;
+    }
+    x = min_scalar(x, exp_max);
+    float n = nearbyintf(x * exp_log2e);
+    float r = x - n * exp_ln2_hi - n * exp_ln2_lo;
+    float p = exp_p0;
+    p = p * r + exp_p1;
+    p = p * r + exp_p2;
+    p = p * r + exp_p3;
+    p = p * r + exp_p4;
+    p = p * r + exp_p5;
+    p = p * r * r + r + 1.f;
+    int32_t bits = ((int32_t)n + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+static inline float reduce_max_scalar(const float * x, size_t n, float m) {
+    for (size_t i = 0; i < n; i++) {
+        m = max_scalar(m, x[i]);
+    }
+    return m;
+}
+
+static inline float exp_sum_scalar(const float * x, float * out, size_t n, float shift) {
+    float sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = exp_scalar(x[i] - shift);
+        sum += out[i];
+    }
+    return sum;
+}
+
+// base: position of x[0] in the whole array
+static inline size_t select_at_least_scalar(const float * x, size_t n, float threshold, int * index, size_t base) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        index[count] = base + i;
+        count += x[i] >= threshold;
+    }
+    return count;
+}
+
+static inline void penalty_apply_scalar(float * logits, float * counts, const int * ids, size_t n,
+    float frequency_penalty, float presence_penalty, float decay) {
+    for (size_t i = 0; i < n; i++) {
+        int id = ids[i];
+        logits[id] -= frequency_penalty * counts[id] + presence_penalty;
+        counts[id] *= decay;
+    }
+}
+
+static inline size_t common_prefix_scalar(const char * a, const char * b, size_t n, size_t i) {
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+static inline float dot_scalar(const float * a, const float * b, size_t n) {
+    float sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static inline void axpy_scalar(float * y, const float * x, float a, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+static inline size_t compact_nonzero_scalar(const float * x, size_t n, uint32_t * idx, float * val, size_t base) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (x[i] != 0.f) {
+            idx[count] = base + i;
+            val[count] = x[i];
+            count++;
+        }
+    }
+    return count;
+}
+
+static inline int ctz32(uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return index;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+static inline int ctz64(uint64_t x) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return index;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+static inline int popcount32(uint32_t x) {
+#ifdef _MSC_VER
+    return __popcnt(x);
+#else
+    return __builtin_popcount(x);
+#endif
+}
+
+static inline void fp16_to_fp32_scalar(const uint16_t * x, float * out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = fp16_to_fp32(x[i]);
+    }
+}
+
+static inline void bf16_to_fp32_scalar(const uint16_t * x, float * out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = bf16_to_fp32(x[i]);
+    }
+}
+
+}
+
+#endif
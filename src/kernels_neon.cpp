@@ -0,0 +1,178 @@
+// advanced simd is part of armv8-a, so this needs no extra flags on arm64
+
+#include "kernels.h"
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#include "kernels_impl.h"
+
+namespace rwkvmobile {
+
+static inline float32x4_t exp_neon(float32x4_t x) {
+    const uint32x4_t keep = vcgeq_f32(x, vdupq_n_f32(exp_min));
+    x = vminq_f32(x, vdupq_n_f32(exp_max));
+    float32x4_t n = vrndnq_f32(vmulq_n_f32(x, exp_log2e));
+    float32x4_t r = vfmsq_f32(x, n, vdupq_n_f32(exp_ln2_hi));
+    r = vfmsq_f32(r, n, vdupq_n_f32(exp_ln2_lo));
+    float32x4_t p = vdupq_n_f32(exp_p0);
+    p = vfmaq_f32(vdupq_n_f32(exp_p1), p, r);
+    p = vfmaq_f32(vdupq_n_f32(exp_p2), p, r);
+    p = vfmaq_f32(vdupq_n_f32(exp_p3), p, r);
+    p = vfmaq_f32(vdupq_n_f32(exp_p4), p, r);
+    p = vfmaq_f32(vdupq_n_f32(exp_p5), p, r);
+    p = vfmaq_f32(vaddq_f32(r, vdupq_n_f32(1.f)), p, vmulq_f32(r, r));
+    int32x4_t bits = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127)), 23);
+    float32x4_t result = vmulq_f32(p, vreinterpretq_f32_s32(bits));
+    return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(result), keep));
+}
+
+// one bit per lane of a comparison result
+static inline uint32_t lane_mask(uint32x4_t m) {
+    static const uint32_t bits[4] = {1, 2, 4, 8};
+    return vaddvq_u32(vandq_u32(m, vld1q_u32(bits)));
+}
+
+static float reduce_max_neon(const float * x, size_t n) {
+    size_t i = 0;
+    float m = -INFINITY;
+    if (n >= 4) {
+        float32x4_t acc = vld1q_f32(x);
+        for (i = 4; i + 4 <= n; i += 4) {
+            acc = vmaxq_f32(acc, vld1q_f32(x + i));
+        }
+        m = vmaxvq_f32(acc);
+    }
+    return reduce_max_scalar(x + i, n - i, m);
+}
+
+static float exp_sum_neon(const float * x, float * out, size_t n, float shift) {
+    size_t i = 0;
+    const float32x4_t vshift = vdupq_n_f32(shift);
+    float32x4_t acc = vdupq_n_f32(0);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t e = exp_neon(vsubq_f32(vld1q_f32(x + i), vshift));
+        vst1q_f32(out + i, e);
+        acc = vaddq_f32(acc, e);
+    }
+    return vaddvq_f32(acc) + exp_sum_scalar(x + i, out + i, n - i, shift);
+}
+
+static size_t select_at_least_neon(const float * x, size_t n, float threshold, int * index) {
+    size_t i = 0, count = 0;
+    const float32x4_t t = vdupq_n_f32(threshold);
+    for (; i + 8 <= n; i += 8) {
+        uint32x4_t m0 = vcgeq_f32(vld1q_f32(x + i), t);
+        uint32x4_t m1 = vcgeq_f32(vld1q_f32(x + i + 4), t);
+        // most groups have nothing above the threshold
+        if (vmaxvq_u32(vorrq_u32(m0, m1)) == 0) {
+            continue;
+        }
+        uint32_t mask = lane_mask(m0) | lane_mask(m1) << 4;
+        while (mask) {
+            index[count++] = i + ctz32(mask);
+            mask &= mask - 1;
+        }
+    }
+    return count + select_at_least_scalar(x + i, n - i, threshold, index + count, i);
+}
+
+static size_t common_prefix_neon(const char * a, const char * b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t equal = vceqq_u8(vld1q_u8((const uint8_t *)a + i), vld1q_u8((const uint8_t *)b + i));
+        if (vminvq_u8(equal) != 0xff) {
+            break;
+        }
+    }
+    return common_prefix_scalar(a, b, n, i);
+}
+
+static float dot_neon(const float * a, const float * b, size_t n) {
+    size_t i = 0;
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    return vaddvq_f32(vaddq_f32(acc0, acc1)) + dot_scalar(a + i, b + i, n - i);
+}
+
+static void axpy_neon(float * y, const float * x, float a, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        vst1q_f32(y + i, vfmaq_n_f32(vld1q_f32(y + i), vld1q_f32(x + i), a));
+        vst1q_f32(y + i + 4, vfmaq_n_f32(vld1q_f32(y + i + 4), vld1q_f32(x + i + 4), a));
+    }
+    axpy_scalar(y + i, x + i, a, n - i);
+}
+
+static size_t compact_nonzero_neon(const float * x, size_t n, uint32_t * idx, float * val) {
+    size_t i = 0, count = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint32x4_t m0 = vmvnq_u32(vceqzq_f32(vld1q_f32(x + i)));
+        uint32x4_t m1 = vmvnq_u32(vceqzq_f32(vld1q_f32(x + i + 4)));
+        if (vmaxvq_u32(vorrq_u32(m0, m1)) == 0) {
+            continue;
+        }
+        uint32_t mask = lane_mask(m0) | lane_mask(m1) << 4;
+        while (mask) {
+            int j = ctz32(mask);
+            idx[count] = i + j;
+            val[count] = x[i + j];
+            count++;
+            mask &= mask - 1;
+        }
+    }
+    return count + compact_nonzero_scalar(x + i, n - i, idx + count, val + count, i);
+}
+
+static void fp16_to_fp32_neon(const uint16_t * x, float * out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(out + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(x + i))));
+    }
+    fp16_to_fp32_scalar(x + i, out + i, n - i);
+}
+
+static void bf16_to_fp32_neon(const uint16_t * x, float * out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_u32((uint32_t *)(out + i), vshll_n_u16(vld1_u16(x + i), 16));
+    }
+    bf16_to_fp32_scalar(x + i, out + i, n - i);
+}
+
+// no sve or dotprod tables: shipping sve cores implement 128-bit vectors, the same
+// width as neon, and none of these kernels works on int8
+static const kernel_table neon_table = {
+    "neon",
+    reduce_max_neon,
+    exp_sum_neon,
+    select_at_least_neon,
+    penalty_apply_scalar,
+    common_prefix_neon,
+    dot_neon,
+    axpy_neon,
+    compact_nonzero_neon,
+    fp16_to_fp32_neon,
+    bf16_to_fp32_neon,
+};
+
+const kernel_table * kernels_neon() {
+    return &neon_table;
+}
+
+}
+
+#else
+
+namespace rwkvmobile {
+
+const kernel_table * kernels_neon() {
+    return nullptr;
+}
+
+}
+
+#endif
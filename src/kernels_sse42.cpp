@@ -0,0 +1,192 @@
+// built with -msse4.2 (x64 msvc needs no flag); only called after cpuid confirmed it
+
+#include "kernels.h"
+
+#if defined(__SSE4_2__) || (defined(_MSC_VER) && defined(_M_X64))
+#include <nmmintrin.h>
+#include "kernels_impl.h"
+
+namespace rwkvmobile {
+
+static inline float hsum(__m128 s) {
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+static inline float hmax(__m128 s) {
+    s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_max_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+static inline __m128 exp_sse42(__m128 x) {
+    const __m128 zero_mask = _mm_cmpnge_ps(x, _mm_set1_ps(exp_min));
+    x = _mm_min_ps(x, _mm_set1_ps(exp_max));
+    __m128 n = _mm_round_ps(_mm_mul_ps(x, _mm_set1_ps(exp_log2e)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(exp_ln2_hi)));
+    r = _mm_sub_ps(r, _mm_mul_ps(n, _mm_set1_ps(exp_ln2_lo)));
+    __m128 p = _mm_set1_ps(exp_p0);
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(exp_p1));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(exp_p2));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(exp_p3));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(exp_p4));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(exp_p5));
+    p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)), r), _mm_set1_ps(1.f));
+    __m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+    return _mm_andnot_ps(zero_mask, _mm_mul_ps(p, _mm_castsi128_ps(bits)));
+}
+
+static float reduce_max_sse42(const float * x, size_t n) {
+    size_t i = 0;
+    float m = -INFINITY;
+    if (n >= 4) {
+        __m128 acc = _mm_loadu_ps(x);
+        for (i = 4; i + 4 <= n; i += 4) {
+            acc = _mm_max_ps(acc, _mm_loadu_ps(x + i));
+        }
+        m = hmax(acc);
+    }
+    return reduce_max_scalar(x + i, n - i, m);
+}
+
+static float exp_sum_sse42(const float * x, float * out, size_t n, float shift) {
+    size_t i = 0;
+    const __m128 vshift = _mm_set1_ps(shift);
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        __m128 e = exp_sse42(_mm_sub_ps(_mm_loadu_ps(x + i), vshift));
+        _mm_storeu_ps(out + i, e);
+        acc = _mm_add_ps(acc, e);
+    }
+    return hsum(acc) + exp_sum_scalar(x + i, out + i, n - i, shift);
+}
+
+static size_t select_at_least_sse42(const float * x, size_t n, float threshold, int * index) {
+    size_t i = 0, count = 0;
+    const __m128 t = _mm_set1_ps(threshold);
+    // 8 elements per test, since most of them are below the threshold
+    for (; i + 8 <= n; i += 8) {
+        int mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(x + i), t))
+            | _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(x + i + 4), t)) << 4;
+        while (mask) {
+            index[count++] = i + ctz32(mask);
+            mask &= mask - 1;
+        }
+    }
+    return count + select_at_least_scalar(x + i, n - i, threshold, index + count, i);
+}
+
+static size_t common_prefix_sse42(const char * a, const char * b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        uint32_t equal = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        if (equal != 0xffff) {
+            return i + ctz32(~equal);
+        }
+    }
+    return common_prefix_scalar(a, b, n, i);
+}
+
+static float dot_sse42(const float * a, const float * b, size_t n) {
+    size_t i = 0;
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    return hsum(_mm_add_ps(acc0, acc1)) + dot_scalar(a + i, b + i, n - i);
+}
+
+static void axpy_sse42(float * y, const float * x, float a, size_t n) {
+    size_t i = 0;
+    const __m128 va = _mm_set1_ps(a);
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+        _mm_storeu_ps(y + i + 4, _mm_add_ps(_mm_loadu_ps(y + i + 4), _mm_mul_ps(va, _mm_loadu_ps(x + i + 4))));
+    }
+    axpy_scalar(y + i, x + i, a, n - i);
+}
+
+static size_t compact_nonzero_sse42(const float * x, size_t n, uint32_t * idx, float * val) {
+    size_t i = 0, count = 0;
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        int mask = _mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(x + i), zero))
+            | _mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(x + i + 4), zero)) << 4;
+        while (mask) {
+            int j = ctz32(mask);
+            idx[count] = i + j;
+            val[count] = x[i + j];
+            count++;
+            mask &= mask - 1;
+        }
+    }
+    return count + compact_nonzero_scalar(x + i, n - i, idx + count, val + count, i);
+}
+
+// no f16c: fp16_to_fp32 with integer ops, four at a time
+static void fp16_to_fp32_sse42(const uint16_t * x, float * out, size_t n) {
+    size_t i = 0;
+    const __m128i shifted_exp = _mm_set1_epi32(0x7c00 << 13);
+    const __m128 denorm_magic = _mm_castsi128_ps(_mm_set1_epi32(113 << 23));
+    for (; i + 4 <= n; i += 4) {
+        __m128i h = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(x + i)));
+        __m128i o = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7fff)), 13);
+        __m128i exp = _mm_and_si128(o, shifted_exp);
+        o = _mm_add_epi32(o, _mm_set1_epi32((127 - 15) << 23));
+        __m128i inf_nan = _mm_cmpeq_epi32(exp, shifted_exp);
+        o = _mm_add_epi32(o, _mm_and_si128(inf_nan, _mm_set1_epi32((128 - 16) << 23)));
+        __m128i nan = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(o, _mm_set1_epi32(0x7fffff)), _mm_setzero_si128()), inf_nan);
+        o = _mm_or_si128(o, _mm_and_si128(nan, _mm_set1_epi32(0x400000)));
+        __m128 subnormal = _mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(o, _mm_set1_epi32(1 << 23))), denorm_magic);
+        __m128 r = _mm_blendv_ps(_mm_castsi128_ps(o), subnormal, _mm_castsi128_ps(_mm_cmpeq_epi32(exp, _mm_setzero_si128())));
+        __m128i sign = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16);
+        _mm_storeu_ps(out + i, _mm_or_ps(r, _mm_castsi128_ps(sign)));
+    }
+    fp16_to_fp32_scalar(x + i, out + i, n - i);
+}
+
+static void bf16_to_fp32_sse42(const uint16_t * x, float * out, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i h = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(x + i)));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_slli_epi32(h, 16));
+    }
+    bf16_to_fp32_scalar(x + i, out + i, n - i);
+}
+
+static const kernel_table sse42_table = {
+    "sse4.2",
+    reduce_max_sse42,
+    exp_sum_sse42,
+    select_at_least_sse42,
+    penalty_apply_scalar,
+    common_prefix_sse42,
+    dot_sse42,
+    axpy_sse42,
+    compact_nonzero_sse42,
+    fp16_to_fp32_sse42,
+    bf16_to_fp32_sse42,
+};
+
+const kernel_table * kernels_sse42() {
+    return &sse42_table;
+}
+
+}
+
+#else
+
+namespace rwkvmobile {
+
+const kernel_table * kernels_sse42() {
+    return nullptr;
+}
+
+}
+
+#endif
@@ -0,0 +1,487 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "layer_stream.h"
+#include "memory_manager.h"
+#include "commondef.h"
+
+namespace rwkvmobile {
+
+static const size_t page_size = 4096;
+
+// just enough json for a safetensors header: an object of objects holding strings
+// and arrays of integers
+struct header_parser {
+    const char * p;
+    const char * end;
+
+    void skip_ws() {
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+            p++;
+        }
+    }
+
+    bool expect(char c) {
+        skip_ws();
+        if (p < end && *p == c) {
+            p++;
+            return true;
+        }
+        return false;
+    }
+
+    bool string(std::string &out) {
+        if (!expect('"')) {
+            return false;
+        }
+        out.clear();
+        while (p < end && *p != '"') {
+            if (*p == '\\' && p + 1 < end) {
+                p++;
+            }
+            out += *p++;
+        }
+        return expect('"');
+    }
+
+    bool integers(std::vector<int64_t> &out) {
+        if (!expect('[')) {
+            return false;
+        }
+        out.clear();
+        if (expect(']')) {
+            return true;
+        }
+        do {
+            skip_ws();
+            char * num_end;
+            long long value = strtoll(p, &num_end, 10);
+            if (num_end == p) {
+                return false;
+            }
+            p = num_end;
+            out.push_back(value);
+        } while (expect(','));
+        return expect(']');
+    }
+
+    // skips any value, for __metadata__
+    bool skip_value() {
+        skip_ws();
+        if (p >= end) {
+            return false;
+        }
+        if (*p == '"') {
+            std::string s;
+            return string(s);
+        }
+        if (*p == '{' || *p == '[') {
+            int depth = 0;
+            bool in_string = false;
+            for (; p < end; p++) {
+                if (in_string) {
+                    if (*p == '\\') {
+                        p++;
+                    } else if (*p == '"') {
+                        in_string = false;
+                    }
+                } else if (*p == '"') {
+                    in_string = true;
+                } else if (*p == '{' || *p == '[') {
+                    depth++;
+                } else if ((*p == '}' || *p == ']') && --depth == 0) {
+                    p++;
+                    return true;
+                }
+            }
+            return false;
+        }
+        while (p < end && *p != ',' && *p != '}' && *p != ']') {
+            p++;
+        }
+        return true;
+    }
+
+    bool tensor(stream_tensor &t) {
+        if (!expect('{')) {
+            return false;
+        }
+        std::vector<int64_t> offsets;
+        do {
+            std::string key;
+            if (!string(key) || !expect(':')) {
+                return false;
+            }
+            bool ok;
+            if (key == "dtype") {
+                ok = string(t.dtype);
+            } else if (key == "shape") {
+                ok = integers(t.shape);
+            } else if (key == "data_offsets") {
+                ok = integers(offsets);
+            } else {
+                ok = skip_value();
+            }
+            if (!ok) {
+                return false;
+            }
+        } while (expect(','));
+        if (offsets.size() != 2 || offsets[0] < 0 || offsets[1] < offsets[0]) {
+            return false;
+        }
+        t.offset = offsets[0];
+        t.size = offsets[1] - offsets[0];
+        return expect('}');
+    }
+};
+
+layer_stream::~layer_stream() {
+    close();
+}
+
+int layer_stream::open(const std::string &path, size_t budget_bytes) {
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return RWKV_ERROR_MODEL | RWKV_ERROR_IO;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &size)) {
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        return RWKV_ERROR_MODEL | RWKV_ERROR_IO;
+    }
+    _file = file;
+    _mapping = mapping;
+    _mapped_size = size.QuadPart;
+    _base = (uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+    _fd = ::open(path.c_str(), O_RDONLY);
+    if (_fd < 0) {
+        return RWKV_ERROR_MODEL | RWKV_ERROR_IO;
+    }
+    struct stat st;
+    if (fstat(_fd, &st) == 0 && st.st_size > 0) {
+        _mapped_size = st.st_size;
+        void * addr = mmap(nullptr, _mapped_size, PROT_READ, MAP_SHARED, _fd, 0);
+        _base = addr == MAP_FAILED ? nullptr : (uint8_t *)addr;
+    }
+#endif
+    if (_base == nullptr) {
+        close();
+        return RWKV_ERROR_MODEL | RWKV_ERROR_IO;
+    }
+    int ret = parse_header(_mapped_size);
+    if (ret) {
+        close();
+        return ret;
+    }
+    _budget = budget_bytes;
+    _current = 0;
+    _stop = false;
+    _stats = layer_stream_stats();
+    _io_thread = std::thread(&layer_stream::io_loop, this);
+    return RWKV_SUCCESS;
+}
+
+int layer_stream::parse_header(size_t file_size) {
+    if (file_size < 8) {
+        return RWKV_ERROR_MODEL;
+    }
+    uint64_t header_size = 0;
+    for (int i = 0; i < 8; i++) {
+        header_size |= (uint64_t)_base[i] << (8 * i);
+    }
+    if (header_size > file_size - 8) {
+        return RWKV_ERROR_MODEL;
+    }
+    const size_t data_start = 8 + header_size;
+
+    header_parser parser = {(const char *)_base + 8, (const char *)_base + data_start};
+    if (!parser.expect('{')) {
+        return RWKV_ERROR_MODEL;
+    }
+    if (parser.expect('}')) {
+        return RWKV_ERROR_MODEL;
+    }
+    do {
+        stream_tensor t;
+        if (!parser.string(t.name) || !parser.expect(':')) {
+            return RWKV_ERROR_MODEL;
+        }
+        if (t.name == "__metadata__") {
+            if (!parser.skip_value()) {
+                return RWKV_ERROR_MODEL;
+            }
+            continue;
+        }
+        if (!parser.tensor(t) || data_start + t.offset + t.size > file_size) {
+            return RWKV_ERROR_MODEL;
+        }
+        t.offset += data_start;
+
+        // blocks.<n>.<rest>
+        int index = -1;
+        if (t.name.compare(0, 7, "blocks.") == 0) {
+            index = atoi(t.name.c_str() + 7);
+        }
+        if (index < 0) {
+            _globals.push_back(std::move(t));
+            continue;
+        }
+        if (index >= (int)_layers.size()) {
+            _layers.resize(index + 1);
+        }
+        _layers[index].tensors.push_back(std::move(t));
+    } while (parser.expect(','));
+    if (!parser.expect('}') || _layers.empty()) {
+        return RWKV_ERROR_MODEL;
+    }
+
+    for (auto &l : _layers) {
+        if (l.tensors.empty()) {
+            return RWKV_ERROR_MODEL;
+        }
+        l.begin = SIZE_MAX;
+        for (auto &t : l.tensors) {
+            l.begin = std::min(l.begin, t.offset);
+            l.end = std::max(l.end, t.offset + t.size);
+        }
+    }
+    return RWKV_SUCCESS;
+}
+
+void layer_stream::close() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+    if (_io_thread.joinable()) {
+        _io_thread.join();
+    }
+    for (auto &l : _layers) {
+        if (l.accounted) {
+            memory_manager::instance().release(RWKV_MEMORY_WEIGHTS, l.end - l.begin);
+        }
+    }
+    _layers.clear();
+    _globals.clear();
+    _resident_bytes = 0;
+#ifdef _WIN32
+    if (_base != nullptr) {
+        UnmapViewOfFile(_base);
+    }
+    if (_mapping != nullptr) {
+        CloseHandle((HANDLE)_mapping);
+    }
+    if (_file != nullptr) {
+        CloseHandle((HANDLE)_file);
+    }
+    _file = _mapping = nullptr;
+#else
+    if (_base != nullptr) {
+        munmap(_base, _mapped_size);
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+    _fd = -1;
+#endif
+    _base = nullptr;
+    _mapped_size = 0;
+}
+
+size_t layer_stream::get_layer_size(int layer) {
+    return _layers[layer].end - _layers[layer].begin;
+}
+
+void layer_stream::set_budget(size_t budget_bytes) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _budget = budget_bytes;
+    }
+    _cv.notify_all();
+}
+
+void layer_stream::set_prefetch_depth(int depth) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _prefetch_depth = std::max(depth, 0);
+    }
+    _cv.notify_all();
+}
+
+void layer_stream::acquire(int layer) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (layer < 0 || layer >= (int)_layers.size()) {
+        return;
+    }
+    _current = layer;
+    if (_layers[layer].resident) {
+        _stats.hits++;
+        lock.unlock();
+        _cv.notify_all();
+        return;
+    }
+    _stats.stalls++;
+    auto start = std::chrono::steady_clock::now();
+    lock.unlock();
+    _cv.notify_all();
+    lock.lock();
+    _loaded_cv.wait(lock, [&] { return _layers[layer].resident || _stop; });
+    _stats.stall_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+layer_stream_stats layer_stream::get_stats() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    layer_stream_stats stats = _stats;
+    stats.resident_bytes = _resident_bytes;
+    return stats;
+}
+
+int layer_stream::distance(int layer) {
+    int n = _layers.size();
+    return (layer - _current + n) % n;
+}
+
+int layer_stream::pick_prefetch_locked(std::vector<int> &evict, bool &accounted) {
+    const int n = _layers.size();
+    const size_t budget = _budget ? _budget : SIZE_MAX;
+    const int depth = std::min(n - 1, _prefetch_depth);
+    evict.clear();
+    for (int d = 0; d <= depth; d++) {
+        int j = (_current + d) % n;
+        if (_layers[j].resident || _layers[j].loading) {
+            continue;
+        }
+        size_t need = get_layer_size(j);
+        // free the layers used furthest in the future, but only those needed later than j
+        std::vector<int> candidates;
+        for (int k = 0; k < n; k++) {
+            if (_layers[k].resident && distance(k) > d) {
+                candidates.push_back(k);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [&](int a, int b) { return distance(a) > distance(b); });
+        size_t resident = _resident_bytes;
+        for (int k : candidates) {
+            if (resident + need <= budget) {
+                break;
+            }
+            evict.push_back(k);
+            resident -= get_layer_size(k);
+        }
+        // the current layer and the next one are read regardless of the budget
+        if (resident + need > budget && d >= 2) {
+            evict.clear();
+            return -1;
+        }
+        // give the evicted layers' bytes back before asking for the new layer's, or the
+        // process budget would have to hold both
+        for (int k : evict) {
+            _layers[k].resident = false;
+            _resident_bytes -= get_layer_size(k);
+            if (_layers[k].accounted) {
+                memory_manager::instance().release(RWKV_MEMORY_WEIGHTS, get_layer_size(k));
+                _layers[k].accounted = false;
+            }
+        }
+        // when the process budget is exhausted only the current and next layers are still
+        // read, without being counted. the evictions stand either way: those layers are
+        // used after j, which can't be read now
+        accounted = memory_manager::instance().reserve(RWKV_MEMORY_WEIGHTS, need) == RWKV_SUCCESS;
+        if (!accounted && d >= 2) {
+            return -1;
+        }
+        return j;
+    }
+    return -1;
+}
+
+void layer_stream::load(int layer) {
+    auto &l = _layers[layer];
+#ifndef _WIN32
+    size_t begin = l.begin / page_size * page_size;
+    madvise(_base + begin, l.end - begin, MADV_WILLNEED);
+#endif
+    // madvise only hints; touching every page makes sure it's resident when acquire() returns
+    volatile uint8_t sink = 0;
+    for (auto &t : l.tensors) {
+        for (size_t offset = 0; offset < t.size; offset += page_size) {
+            sink = sink + _base[t.offset + offset];
+        }
+    }
+    (void)sink;
+}
+
+void layer_stream::evict(int layer) {
+    auto &l = _layers[layer];
+    // only whole pages inside the layer, the ones at the edges may be shared with a neighbour
+    size_t begin = (l.begin + page_size - 1) / page_size * page_size;
+    size_t end = l.end / page_size * page_size;
+    if (end <= begin) {
+        return;
+    }
+#ifdef _WIN32
+    // unlocking pages that aren't locked drops them from the working set
+    VirtualUnlock(_base + begin, end - begin);
+#else
+    madvise(_base + begin, end - begin, MADV_DONTNEED);
+#if defined(__linux__)
+    // the mapping is clean, so the page cache can drop it as well
+    posix_fadvise(_fd, begin, end - begin, POSIX_FADV_DONTNEED);
+#endif
+#endif
+}
+
+void layer_stream::io_loop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::vector<int> evicted;
+    while (!_stop) {
+        bool accounted = false;
+        int j = pick_prefetch_locked(evicted, accounted);
+        if (j < 0 && evicted.empty()) {
+            _cv.wait(lock);
+            continue;
+        }
+        if (j >= 0) {
+            _layers[j].loading = true;
+            _layers[j].accounted = accounted;
+            _resident_bytes += get_layer_size(j);
+        }
+        lock.unlock();
+
+        for (int k : evicted) {
+            evict(k);
+        }
+        if (j >= 0) {
+            load(j);
+        }
+
+        lock.lock();
+        if (j >= 0) {
+            _layers[j].loading = false;
+            _layers[j].resident = true;
+            _stats.bytes_read += get_layer_size(j);
+            _loaded_cv.notify_all();
+        }
+    }
+}
+
+}
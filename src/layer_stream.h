@@ -0,0 +1,118 @@
+#ifndef LAYER_STREAM_H
+#define LAYER_STREAM_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rwkvmobile {
+
+struct stream_tensor {
+    std::string name;
+    // safetensors dtype, e.g. "F16"
+    std::string dtype;
+    std::vector<int64_t> shape;
+    // into the mapped file
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+struct layer_stream_stats {
+    // acquire() calls that found the layer already resident
+    size_t hits = 0;
+    // acquire() calls that had to wait for the layer to be read
+    size_t stalls = 0;
+    double stall_ms = 0;
+    size_t bytes_read = 0;
+    size_t resident_bytes = 0;
+};
+
+// keeps only a window of the layers of a safetensors checkpoint resident so that
+// models larger than the available memory can run. the file is mmap'd; a background
+// thread faults in the layers that come next while the caller computes the current
+// one and evicts the layers that are needed furthest in the future to stay within
+// the budget. since rwkv runs its layers strictly in order (0..n-1, then 0 again for
+// the next token), the window can always be filled ahead of the compute.
+// tensor pointers stay valid while the stream is open; an evicted layer is only slower
+// to read, never wrong.
+class layer_stream {
+public:
+    layer_stream() = default;
+    ~layer_stream();
+    layer_stream(const layer_stream &) = delete;
+    layer_stream & operator=(const layer_stream &) = delete;
+
+    // budget_bytes: resident bytes for blocks.* tensors, 0 for no limit. the current
+    // layer and the next one are read even if they don't fit.
+    // tensors outside of blocks.* (emb, head, ln_out) stay resident and aren't counted
+    int open(const std::string &path, size_t budget_bytes);
+    void close();
+
+    int get_n_layer() { return _layers.size(); }
+    size_t get_layer_size(int layer);
+    const std::vector<stream_tensor> & get_layer_tensors(int layer) { return _layers[layer].tensors; }
+    const std::vector<stream_tensor> & get_global_tensors() { return _globals; }
+    const uint8_t * data(const stream_tensor &tensor) { return _base + tensor.offset; }
+
+    void set_budget(size_t budget_bytes);
+    // number of layers ahead of the current one to read in advance, bounded by the budget;
+    // 0 reads each layer only once it is acquired
+    void set_prefetch_depth(int depth);
+
+    // blocks until `layer` is resident, makes it the current layer and wakes the
+    // prefetcher for the ones after it
+    void acquire(int layer);
+
+    layer_stream_stats get_stats();
+
+private:
+    struct layer {
+        std::vector<stream_tensor> tensors;
+        size_t begin = 0;
+        size_t end = 0;
+        bool resident = false;
+        bool loading = false;
+        // reported to memory_manager
+        bool accounted = false;
+    };
+
+    int parse_header(size_t file_size);
+    // position of `layer` in the access order starting at the current layer
+    int distance(int layer);
+    // next layer to read (-1 for none) and the layers to evict for it, which are already
+    // dropped from the bookkeeping and only need evict(); _mutex held
+    int pick_prefetch_locked(std::vector<int> &evict, bool &accounted);
+    void load(int layer);
+    void evict(int layer);
+    void io_loop();
+
+    uint8_t * _base = nullptr;
+    size_t _mapped_size = 0;
+#ifdef _WIN32
+    void * _file = nullptr;
+    void * _mapping = nullptr;
+#else
+    int _fd = -1;
+#endif
+
+    std::vector<layer> _layers;
+    std::vector<stream_tensor> _globals;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::condition_variable _loaded_cv;
+    int _current = 0;
+    size_t _budget = 0;
+    int _prefetch_depth = 1 << 30;
+    size_t _resident_bytes = 0;
+    layer_stream_stats _stats;
+    bool _stop = false;
+    std::thread _io_thread;
+};
+
+}
+
+#endif
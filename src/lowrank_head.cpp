@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include "lowrank_head.h"
+#include "kernels.h"
+#include "commondef.h"
+
+namespace rwkvmobile {
+
+// rounds of W^T * W applied to the random start; two are enough for the decaying
+// spectrum of a trained head
+static const int power_iterations = 2;
+
+void head_dense(const float * weight, const float * hidden, float * logits, int vocab_size, int n_embd, thread_pool * pool) {
+    const kernel_table &kt = kernels();
+    auto rows = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            logits[i] = kt.dot(weight + i * n_embd, hidden, n_embd);
+        }
+    };
+    if (pool != nullptr) {
+        pool->parallel_for(0, vocab_size, 64, rows);
+    } else {
+        rows(0, vocab_size);
+    }
+}
+
+// modified gram-schmidt over the rows, run twice so that the basis stays orthogonal
+// to rounding. a row that is (numerically) in the span of the previous ones is zeroed
+static void orthonormalize_rows(float * rows, int n_rows, int n_cols) {
+    const kernel_table &kt = kernels();
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < n_rows; i++) {
+            float * row = rows + (size_t)i * n_cols;
+            for (int j = 0; j < i; j++) {
+                const float * prev = rows + (size_t)j * n_cols;
+                kt.axpy(row, prev, -kt.dot(row, prev, n_cols), n_cols);
+            }
+            float norm = std::sqrt(kt.dot(row, row, n_cols));
+            float scale = norm > 1e-20f ? 1.f / norm : 0.f;
+            for (int c = 0; c < n_cols; c++) {
+                row[c] *= scale;
+            }
+        }
+    }
+}
+
+int lowrank_head::load(const float * weight, int vocab_size, int n_embd, int rank, thread_pool * pool) {
+    if (weight == nullptr || vocab_size <= 0 || n_embd <= 0 || rank <= 0 || rank > n_embd) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    size_t bytes = ((size_t)vocab_size * rank + (size_t)rank * n_embd) * sizeof(float);
+    if (_reservation.reserve(RWKV_MEMORY_WEIGHTS, bytes)) {
+        return RWKV_ERROR_ALLOC;
+    }
+    const kernel_table &kt = kernels();
+    const size_t d = n_embd, r = rank;
+    _basis.resize(r * d);
+    _scores_weight.resize((size_t)vocab_size * r);
+
+    std::mt19937 rng(0);
+    std::normal_distribution<float> normal(0.f, 1.f);
+    for (auto &v : _basis) {
+        v = normal(rng);
+    }
+    orthonormalize_rows(_basis.data(), r, d);
+
+    float * basis = _basis.data();
+    float * projected = _scores_weight.data();
+    std::vector<float> next(r * d);
+    // projected = W * Q, one row of W against every basis vector
+    auto project = [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            for (size_t j = 0; j < r; j++) {
+                projected[v * r + j] = kt.dot(weight + v * d, basis + j * d, d);
+            }
+        }
+    };
+    // next^T = W^T * projected, split over columns so that W is still read only once
+    // and no two threads write the same part of next
+    auto back_project = [&](size_t begin, size_t end) {
+        for (size_t j = 0; j < r; j++) {
+            std::memset(next.data() + j * d + begin, 0, (end - begin) * sizeof(float));
+        }
+        for (size_t v = 0; v < (size_t)vocab_size; v++) {
+            for (size_t j = 0; j < r; j++) {
+                kt.axpy(next.data() + j * d + begin, weight + v * d + begin, projected[v * r + j], end - begin);
+            }
+        }
+    };
+    auto run = [&](size_t n, size_t grain, auto &fn) {
+        if (pool != nullptr) {
+            pool->parallel_for(0, n, grain, fn);
+        } else {
+            fn(0, n);
+        }
+    };
+    for (int it = 0; it <= power_iterations; it++) {
+        run(vocab_size, 256, project);
+        run(d, 256, back_project);
+        orthonormalize_rows(next.data(), r, d);
+        std::swap(_basis, next);
+        basis = _basis.data();
+    }
+    run(vocab_size, 256, project);
+
+    _weight = weight;
+    _vocab_size = vocab_size;
+    _n_embd = n_embd;
+    _rank = rank;
+    _projected.resize(r);
+    _index.resize(vocab_size);
+    _candidates.reserve(vocab_size);
+    return RWKV_SUCCESS;
+}
+
+// the positions of the (about) m largest elements of x, in no particular order
+static size_t select_top(const float * x, size_t n, size_t m, int * index) {
+    const kernel_table &kt = kernels();
+    // guess a threshold that about 2 * m elements pass from a strided sample, then
+    // only those have to be partitioned
+    const size_t sample_size = 512;
+    size_t rank = 2 * m * sample_size / n + 2;
+    size_t count = 0;
+    if (n >= 4 * sample_size && rank < sample_size) {
+        float sample[sample_size];
+        const size_t stride = n / sample_size;
+        for (size_t i = 0; i < sample_size; i++) {
+            sample[i] = x[i * stride];
+        }
+        std::nth_element(sample, sample + rank, sample + sample_size, std::greater<float>());
+        count = kt.select_at_least(x, n, sample[rank], index);
+    }
+    if (count < m) {
+        for (size_t i = 0; i < n; i++) {
+            index[i] = i;
+        }
+        count = n;
+    }
+    if (count > m) {
+        std::nth_element(index, index + m, index + count, [&](int a, int b) { return x[a] > x[b]; });
+    }
+    return m;
+}
+
+int lowrank_head::forward(const float * hidden, float * logits, int n_candidates, thread_pool * pool) {
+    if (_weight == nullptr || hidden == nullptr || logits == nullptr || n_candidates <= 0) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    const kernel_table &kt = kernels();
+    const size_t d = _n_embd, r = _rank;
+    for (size_t j = 0; j < r; j++) {
+        _projected[j] = kt.dot(_basis.data() + j * d, hidden, d);
+    }
+
+    const float * scores_weight = _scores_weight.data();
+    const float * projected = _projected.data();
+    auto score = [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            logits[v] = kt.dot(scores_weight + v * r, projected, r);
+        }
+    };
+    if (pool != nullptr) {
+        pool->parallel_for(0, _vocab_size, 1024, score);
+    } else {
+        score(0, _vocab_size);
+    }
+
+    size_t m = select_top(logits, _vocab_size, std::min(n_candidates, _vocab_size), _index.data());
+    _candidates.assign(_index.begin(), _index.begin() + m);
+
+    const int * candidates = _candidates.data();
+    auto exact = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            logits[candidates[i]] = kt.dot(_weight + (size_t)candidates[i] * d, hidden, d);
+        }
+    };
+    if (pool != nullptr) {
+        pool->parallel_for(0, m, 16, exact);
+    } else {
+        exact(0, m);
+    }
+    return RWKV_SUCCESS;
+}
+
+}
@@ -0,0 +1,58 @@
+#ifndef LOWRANK_HEAD_H
+#define LOWRANK_HEAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "memory_manager.h"
+#include "thread_pool.h"
+
+namespace rwkvmobile {
+
+// logits = weight * hidden with weight in the checkpoint layout, [vocab_size][n_embd]
+// row-major. the dense reference for lowrank_head
+void head_dense(const float * weight, const float * hidden, float * logits, int vocab_size, int n_embd, thread_pool * pool = nullptr);
+
+// a two-stage output head. the head is the largest gemv of a decode step, yet top-k and
+// top-p keep only a handful of its logits. at load time the dominant rank-r right
+// subspace Q of the head is found (randomized range finder with power iterations), and
+// U = W * Q is kept, so that U * (Q^T * hidden) scores every token while reading
+// vocab_size * r instead of vocab_size * n_embd floats. only the best-scoring tokens
+// then get their exact logit from the full rows
+class lowrank_head {
+public:
+    // weight: [vocab_size][n_embd] row-major, as head.weight is stored; it is not copied
+    // and has to outlive this object. takes a few passes over the head
+    int load(const float * weight, int vocab_size, int n_embd, int rank, thread_pool * pool = nullptr);
+
+    // writes all vocab_size logits: exact for the n_candidates tokens with the best
+    // low-rank score, the low-rank estimate for the others (so that the softmax
+    // normalization still sees the whole vocab)
+    int forward(const float * hidden, float * logits, int n_candidates, thread_pool * pool = nullptr);
+
+    // the tokens that got exact logits in the last forward(), unordered
+    const std::vector<int> & get_last_candidates() { return _candidates; }
+
+    int get_vocab_size() { return _vocab_size; }
+    int get_n_embd() { return _n_embd; }
+    int get_rank() { return _rank; }
+
+private:
+    const float * _weight = nullptr;
+    int _vocab_size = 0;
+    int _n_embd = 0;
+    int _rank = 0;
+    // Q^T, [rank][n_embd], orthonormal rows
+    std::vector<float> _basis;
+    // U = W * Q, [vocab_size][rank]
+    std::vector<float> _scores_weight;
+    memory_reservation _reservation;
+
+    std::vector<float> _projected;
+    std::vector<int> _index;
+    std::vector<int> _candidates;
+};
+
+}
+
+#endif
@@ -0,0 +1,107 @@
+#include <algorithm>
+
+#include "memory_manager.h"
+#include "commondef.h"
+
+namespace rwkvmobile {
+
+memory_manager & memory_manager::instance() {
+    static memory_manager manager;
+    return manager;
+}
+
+size_t memory_manager::get_usage() {
+    size_t total = 0;
+    for (int i = 0; i < RWKV_MEMORY_CATEGORY_COUNT; i++) {
+        total += _usage[i].load();
+    }
+    return total;
+}
+
+size_t memory_manager::get_usage(int category) {
+    if (category < 0 || category >= RWKV_MEMORY_CATEGORY_COUNT) {
+        return 0;
+    }
+    return _usage[category].load();
+}
+
+int memory_manager::reserve(int category, size_t bytes) {
+    if (category < 0 || category >= RWKV_MEMORY_CATEGORY_COUNT) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    std::lock_guard<std::mutex> lock(_reserve_mutex);
+    size_t budget = _budget;
+    if (budget != 0) {
+        size_t usage = get_usage();
+        if (usage + bytes > budget) {
+            shrink(usage + bytes - budget);
+            if (get_usage() + bytes > budget) {
+                return RWKV_ERROR_ALLOC;
+            }
+        }
+    }
+    _usage[category] += bytes;
+
+    size_t usage = get_usage();
+    size_t peak = _peak;
+    while (usage > peak && !_peak.compare_exchange_weak(peak, usage));
+    return RWKV_SUCCESS;
+}
+
+void memory_manager::release(int category, size_t bytes) {
+    if (category < 0 || category >= RWKV_MEMORY_CATEGORY_COUNT) {
+        return;
+    }
+    _usage[category] -= bytes;
+}
+
+int memory_manager::register_shrinker(shrinker fn) {
+    std::lock_guard<std::mutex> lock(_shrinker_mutex);
+    int id = _next_shrinker_id++;
+    _shrinkers[id] = fn;
+    return id;
+}
+
+void memory_manager::unregister_shrinker(int id) {
+    std::lock_guard<std::mutex> lock(_shrinker_mutex);
+    _shrinkers.erase(id);
+}
+
+size_t memory_manager::shrink(size_t bytes_wanted) {
+    // the shrinkers run with the lock held, so that unregister_shrinker() can't return
+    // (and their owner go away) while one of them is running. release() is lock-free
+    std::lock_guard<std::mutex> lock(_shrinker_mutex);
+    size_t freed = 0;
+    for (auto &[id, fn] : _shrinkers) {
+        if (freed >= bytes_wanted) {
+            break;
+        }
+        freed += fn(bytes_wanted - freed);
+    }
+    return freed;
+}
+
+int memory_reservation::reserve(int category, size_t bytes) {
+    reset();
+    int ret = memory_manager::instance().reserve(category, bytes);
+    if (ret == RWKV_SUCCESS) {
+        _category = category;
+        _bytes = bytes;
+    }
+    return ret;
+}
+
+void memory_reservation::shrink(size_t bytes) {
+    bytes = std::min(bytes, _bytes);
+    memory_manager::instance().release(_category, bytes);
+    _bytes -= bytes;
+}
+
+void memory_reservation::reset() {
+    if (_bytes) {
+        memory_manager::instance().release(_category, _bytes);
+        _bytes = 0;
+    }
+}
+
+}
@@ -0,0 +1,88 @@
+#ifndef MEMORY_MANAGER_H
+#define MEMORY_MANAGER_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+
+namespace rwkvmobile {
+
+enum {
+    RWKV_MEMORY_WEIGHTS = 0,
+    RWKV_MEMORY_TOKENIZER,
+    RWKV_MEMORY_LOGITS,
+    RWKV_MEMORY_STATES,
+    RWKV_MEMORY_CACHES,
+    RWKV_MEMORY_CATEGORY_COUNT,
+};
+
+// process-wide accounting of the memory held by runtimes.
+// components report what they allocate; when a reservation would exceed the
+// budget, registered shrinkers are asked to free memory first.
+// reservations are serialized, so that concurrent ones can't overshoot the budget
+// together; releases only ever lower the usage and don't take a lock.
+class memory_manager {
+public:
+    // shrinker(bytes_wanted) frees what it can (calling release() for it)
+    // and returns the number of bytes freed. it runs under the manager's locks, so it
+    // must not reserve or (un)register shrinkers itself
+    using shrinker = std::function<size_t(size_t)>;
+
+    static memory_manager & instance();
+
+    // 0: unlimited
+    void set_budget(size_t bytes) { _budget = bytes; }
+    size_t get_budget() { return _budget; }
+
+    size_t get_usage();
+    size_t get_usage(int category);
+    size_t get_peak() { return _peak; }
+
+    // returns RWKV_ERROR_ALLOC if the budget can't be met even after shrinking
+    int reserve(int category, size_t bytes);
+    void release(int category, size_t bytes);
+
+    int register_shrinker(shrinker fn);
+    // waits for a running call of the shrinker to return, so that whatever it
+    // captured can be destroyed right after
+    void unregister_shrinker(int id);
+
+private:
+    size_t shrink(size_t bytes_wanted);
+
+    std::atomic<size_t> _budget{0};
+    std::atomic<size_t> _peak{0};
+    std::atomic<size_t> _usage[RWKV_MEMORY_CATEGORY_COUNT] = {};
+
+    // held from the budget check to the add, shrinking included
+    std::mutex _reserve_mutex;
+    // held while shrinkers run
+    std::mutex _shrinker_mutex;
+    std::map<int, shrinker> _shrinkers;
+    int _next_shrinker_id = 0;
+};
+
+// releases its accounted bytes when destroyed
+class memory_reservation {
+public:
+    memory_reservation() = default;
+    ~memory_reservation() { reset(); }
+    memory_reservation(const memory_reservation &) = delete;
+    memory_reservation & operator=(const memory_reservation &) = delete;
+
+    int reserve(int category, size_t bytes);
+    // gives back part of the reservation, e.g. after shedding a cache
+    void shrink(size_t bytes);
+    void reset();
+    size_t size() { return _bytes; }
+
+private:
+    int _category = RWKV_MEMORY_CACHES;
+    size_t _bytes = 0;
+};
+
+}
+
+#endif
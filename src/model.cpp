@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+
+#include "model.h"
+#include "calibration.h"
+#include "backend_registry.h"
+#include "ipc_backend.h"
+
+namespace rwkvmobile {
+
+// web-rwkv keeps a single model per process: a second load would replace the first
+// one's weights and releasing either would drop both. the model that loaded it owns it
+static std::atomic<model *> web_rwkv_owner{nullptr};
+
+static bool claim_web_rwkv(model * m) {
+    model * expected = nullptr;
+    return web_rwkv_owner.compare_exchange_strong(expected, m) || expected == m;
+}
+
+static void unclaim_web_rwkv(model * m) {
+    model * expected = m;
+    web_rwkv_owner.compare_exchange_strong(expected, nullptr);
+}
+
+int model::init(std::string backend_name) {
+    if (backend_name == "auto") {
+        _auto_backend = true;
+        return RWKV_SUCCESS;
+    }
+    if (backend_name.rfind(ipc_backend_prefix, 0) == 0) {
+        std::string socket_path = backend_name.substr(ipc_backend_prefix.size());
+        _backend = std::unique_ptr<execution_provider>(new ipc_backend);
+        _backend_id = RWKV_BACKEND_IPC;
+        return _backend->init((void *)socket_path.c_str());
+    }
+    int backend_id = backend_str_to_enum(backend_name);
+    if (backend_id < 0) {
+        return RWKV_ERROR_BACKEND;
+    }
+    return init(backend_id);
+}
+
+int model::init(int backend_id) {
+    _backend = std::unique_ptr<execution_provider>(create_backend(backend_id));
+    if (_backend == nullptr) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+    }
+    _backend_id = backend_id;
+    int ret = _backend->init(nullptr);
+    if (ret == RWKV_SUCCESS && !_output_subset.empty()) {
+        _native_subset = _backend->set_output_subset(_output_subset) == RWKV_SUCCESS;
+    }
+    return ret;
+}
+
+int model::set_output_subset(std::vector<int> ids) {
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    if (!ids.empty() && (ids.front() < 0 || ids.back() >= _vocab_size)) {
+        return RWKV_ERROR_MODEL | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    if (_loaded && _native_subset && ids != _output_subset) {
+        // the head was built for the previous subset
+        return RWKV_ERROR_MODEL | RWKV_ERROR_UNSUPPORTED;
+    }
+    if (_loaded && _native_subset) {
+        return RWKV_SUCCESS;
+    }
+    _output_subset = ids;
+    _output_index.clear();
+    if (!ids.empty()) {
+        _output_index.assign(_vocab_size, -1);
+        for (size_t i = 0; i < ids.size(); i++) {
+            _output_index[ids[i]] = i;
+        }
+    }
+    _native_subset = false;
+    if (!_loaded && _backend != nullptr) {
+        int ret = _backend->set_output_subset(ids);
+        _native_subset = !ids.empty() && ret == RWKV_SUCCESS;
+    }
+    return RWKV_SUCCESS;
+}
+
+int model::select_backend(std::string model_path) {
+    std::string key = calibration_cache_key(model_path);
+    calibration_result best;
+    // web-rwkv is only a candidate while no other model holds it
+    const bool web_rwkv_free = claim_web_rwkv(this);
+    if (calibration_cache_load(_cache_dir, key, best) == RWKV_SUCCESS
+        && (best.backend_id != RWKV_BACKEND_WEBRWKV || web_rwkv_free)) {
+        int ret = init(best.backend_id);
+        if (ret == RWKV_SUCCESS) {
+            ret = _backend->load_model(model_path);
+        }
+        if (ret == RWKV_SUCCESS) {
+            return RWKV_SUCCESS;
+        }
+        // cached backend no longer works (e.g. driver update), probe again. release
+        // whatever it got through first (a device context, partly uploaded weights)
+        if (_backend != nullptr) {
+            _backend->release_model();
+            _backend->release();
+        }
+        _backend = nullptr;
+        _backend_id = -1;
+        _native_subset = false;
+    }
+
+    std::vector<int> backend_ids;
+    get_available_backend_ids(backend_ids);
+    best = calibration_result();
+    bool best_native = false;
+    for (auto id : backend_ids) {
+        if (id == RWKV_BACKEND_WEBRWKV && !web_rwkv_free) {
+            continue;
+        }
+        auto backend = std::unique_ptr<execution_provider>(create_backend(id));
+        if (backend == nullptr || backend->init(nullptr) != RWKV_SUCCESS || !backend->is_available()) {
+            continue;
+        }
+        bool native = !_output_subset.empty() && backend->set_output_subset(_output_subset) == RWKV_SUCCESS;
+        if (backend->load_model(model_path) != RWKV_SUCCESS) {
+            continue;
+        }
+        calibration_result result;
+        int output_size = native ? _output_subset.size() : _vocab_size;
+        if (backend_ids.size() > 1 && calibrate_backend(backend.get(), output_size, result) != RWKV_SUCCESS) {
+            backend->release_model();
+            backend->release();
+            continue;
+        }
+        result.backend_id = id;
+        if (_backend == nullptr || result.prefill_ms + result.decode_ms < best.prefill_ms + best.decode_ms) {
+            if (_backend != nullptr) {
+                _backend->release_model();
+                _backend->release();
+            }
+            _backend = std::move(backend);
+            best = result;
+            best_native = native;
+        } else {
+            backend->release_model();
+            backend->release();
+        }
+    }
+
+    if (_backend == nullptr) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+    }
+    _backend_id = best.backend_id;
+    _native_subset = best_native;
+    calibration_cache_save(_cache_dir, key, best);
+    return RWKV_SUCCESS;
+}
+
+int model::load_model(std::string model_path) {
+    if (_backend == nullptr && !_auto_backend) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+
+    // the weights end up in (unified) device memory roughly the size of the file,
+    // except with ipc, where they live in the daemon
+    if (_backend_id != RWKV_BACKEND_IPC) {
+        std::error_code ec;
+        auto model_size = std::filesystem::file_size(model_path, ec);
+        if (ec) {
+            return RWKV_ERROR_MODEL | RWKV_ERROR_IO;
+        }
+        if (_weights_memory.reserve(RWKV_MEMORY_WEIGHTS, model_size) != RWKV_SUCCESS) {
+            return RWKV_ERROR_MODEL | RWKV_ERROR_ALLOC;
+        }
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    int ret;
+    if (_backend == nullptr) {
+        ret = select_backend(model_path);
+    } else if (_backend_id == RWKV_BACKEND_WEBRWKV && !claim_web_rwkv(this)) {
+        ret = RWKV_ERROR_MODEL | RWKV_ERROR_UNSUPPORTED;
+    } else {
+        ret = _backend->load_model(model_path);
+    }
+    if (ret != RWKV_SUCCESS || _backend_id != RWKV_BACKEND_WEBRWKV) {
+        unclaim_web_rwkv(this);
+    }
+    if (ret != RWKV_SUCCESS) {
+        _weights_memory.reset();
+    }
+    _loaded = ret == RWKV_SUCCESS;
+    _active_session = nullptr;
+    return ret;
+}
+
+int model::load_tokenizer(std::string vocab_file) {
+    if (_tokenizer != nullptr) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    _tokenizer = std::unique_ptr<tokenizer_base>(new trie_tokenizer);
+    if (_tokenizer == nullptr) {
+        return RWKV_ERROR_TOKENIZER;
+    }
+    return _tokenizer->load(vocab_file);
+}
+
+int model::release() {
+    std::lock_guard<std::recursive_mutex> lock(_mutex);
+    _active_session = nullptr;
+    _loaded = false;
+    if (_backend == nullptr) {
+        return RWKV_SUCCESS;
+    }
+    int ret = RWKV_SUCCESS;
+    // a rejected web-rwkv load must not release the owner's model
+    if (_backend_id != RWKV_BACKEND_WEBRWKV || web_rwkv_owner == this) {
+        ret = _backend->release_model();
+    }
+    if (ret != RWKV_SUCCESS) {
+        return ret;
+    }
+    unclaim_web_rwkv(this);
+    _weights_memory.reset();
+    ret = _backend->release();
+    _backend = nullptr;
+    return ret;
+}
+
+}
@@ -0,0 +1,84 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include "backend.h"
+#include "tokenizer.h"
+#include "memory_manager.h"
+
+namespace rwkvmobile {
+
+class runtime;
+
+// weights + tokenizer, shared by every runtime (session) created from it.
+// the backend holds a single recurrent state; sessions swap their own state
+// in under the model lock when they need the backend.
+class model {
+public:
+    model() {};
+    ~model() { release(); };
+    model(const model &) = delete;
+    model & operator=(const model &) = delete;
+
+    // backend_name "auto": the backend is picked in load_model() by benchmarking
+    // every available backend on the model (results are cached in cache_dir)
+    int init(std::string backend_name);
+    int init(int backend_id);
+    int load_model(std::string model_path);
+    int load_tokenizer(std::string vocab_file);
+    int release();
+
+    execution_provider * get_backend() { return _backend.get(); }
+    tokenizer_base * get_tokenizer() { return _tokenizer.get(); }
+    inline int get_backend_id() { return _backend_id; }
+    inline int get_vocab_size() { return _vocab_size; }
+
+    // restricts the logits to a subset of token ids (sorted and deduplicated).
+    // the runtime gathers them from the full logits, unless the subset is set before
+    // load_model on a backend that hands out only the subset itself (web-rwkv gathers
+    // them before they cross the ffi; see execution_provider::set_output_subset).
+    // empty ids restores the full vocab
+    int set_output_subset(std::vector<int> ids);
+    inline const std::vector<int> & get_output_subset() { return _output_subset; }
+    // logits per eval after gathering: the subset size, or the vocab size without one
+    inline int get_output_size() { return _output_subset.empty() ? _vocab_size : _output_subset.size(); }
+    // logits the backend itself produces per eval
+    inline int get_backend_output_size() { return _native_subset ? _output_subset.size() : _vocab_size; }
+    // position in the logits -> token id
+    inline int output_token(int index) { return _output_subset.empty() ? index : _output_subset[index]; }
+
+    inline void set_cache_dir(std::string cache_dir) { _cache_dir = cache_dir; }
+    inline std::string get_cache_dir() { return _cache_dir; }
+
+private:
+    friend class runtime;
+
+    int select_backend(std::string model_path);
+
+    std::unique_ptr<execution_provider> _backend;
+    std::unique_ptr<tokenizer_base> _tokenizer;
+
+    int _vocab_size = 65536;
+    int _backend_id = -1;
+    bool _auto_backend = false;
+    std::string _cache_dir = ".";
+    bool _loaded = false;
+
+    std::vector<int> _output_subset;
+    // token id -> position in _output_subset, -1 outside; empty without a subset
+    std::vector<int> _output_index;
+    // the backend only hands out the logits of _output_subset
+    bool _native_subset = false;
+
+    memory_reservation _weights_memory;
+
+    std::recursive_mutex _mutex;
+    // session whose state is currently loaded in the backend
+    runtime * _active_session = nullptr;
+};
+
+}
+
+#endif
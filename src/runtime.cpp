@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+
 #include "runtime.h"
 #include "backend.h"
-#include "web_rwkv_backend.h"
 
 namespace rwkvmobile {
 
@@ -10,6 +15,8 @@ std::string backend_enum_to_str(int backend) {
             return "rwkv.cpp";
         case RWKV_BACKEND_WEBRWKV:
             return "web-rwkv";
+        case RWKV_BACKEND_IPC:
+            return "ipc";
         default:
             return "unknown";
     }
@@ -24,12 +31,58 @@ int backend_str_to_enum(std::string backend) {
     return -1;
 }
 
+runtime::runtime(std::shared_ptr<class model> shared_model) : _model(shared_model) {
+    _sampler = std::unique_ptr<sampler>(new sampler);
+    _sampler->set_thread_pool(_thread_pool);
+    _logits.resize(_vocab_size);
+    _logits_memory.reserve(RWKV_MEMORY_LOGITS, _vocab_size * sizeof(float));
+    _occurences.resize(_vocab_size);
+}
+
+runtime::~runtime() {
+    if (_load_thread.joinable()) {
+        _load_thread.join();
+    }
+    release_draft_model();
+    std::lock_guard<std::recursive_mutex> lock(_model->_mutex);
+    if (_model->_active_session == this) {
+        _model->_active_session = nullptr;
+    }
+}
+
+std::unique_lock<std::recursive_mutex> runtime::acquire_backend() {
+    std::unique_lock<std::recursive_mutex> lock(_model->_mutex);
+    // the output head may have been restricted since (set_output_subset)
+    _logits.resize(_model->get_backend_output_size());
+    if (_logits_precision != RWKV_LOGITS_FP32) {
+        _half_logits.resize(_logits.size());
+    }
+    runtime * active = _model->_active_session;
+    if (active == this || backend() == nullptr) {
+        return lock;
+    }
+    // park the previous session's state in its own buffer, then load ours
+    if (active != nullptr) {
+        // an empty state would make the next swap-in a no-op, sharing our state with it
+        active->_state_valid = backend()->get_state(active->_state) == RWKV_SUCCESS && !active->_state.empty();
+        active->_state_memory.reserve(RWKV_MEMORY_STATES, active->_state.size() * sizeof(float));
+    }
+    if (!_state_valid || backend()->set_state(_state) != RWKV_SUCCESS) {
+        backend()->clear_state();
+    }
+    _state_valid = false;
+    _state_memory.reset();
+    _model->_active_session = this;
+    return lock;
+}
+
 int runtime::init(std::string backend_name) {
-    int backend_id = backend_str_to_enum(backend_name);
-    if (backend_id < 0) {
-        return RWKV_ERROR_BACKEND;
+    _sampler = std::unique_ptr<sampler>(new sampler);
+    if (_sampler == nullptr) {
+        return RWKV_ERROR_SAMPLER;
     }
-    return init(backend_id);
+    _sampler->set_thread_pool(_thread_pool);
+    return _model->init(backend_name);
 }
 
 int runtime::init(int backend_id) {
@@ -37,47 +90,232 @@ int runtime::init(int backend_id) {
     if (_sampler == nullptr) {
         return RWKV_ERROR_SAMPLER;
     }
+    _sampler->set_thread_pool(_thread_pool);
+    return _model->init(backend_id);
+}
 
-    if (backend_id == RWKV_BACKEND_WEBRWKV) {
-        _backend = std::unique_ptr<execution_provider>(new web_rwkv_backend);
-    } else {
-        return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+int runtime::set_thread_params(int n_threads, std::vector<int> cpu_ids) {
+    int n_cpus = std::thread::hardware_concurrency();
+    for (auto id : cpu_ids) {
+        if (id < 0 || (n_cpus > 0 && id >= n_cpus)) {
+            return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+        }
     }
-    return _backend->init(nullptr);
+    _thread_pool = std::make_shared<thread_pool>(n_threads, cpu_ids);
+    if (_sampler != nullptr) {
+        _sampler->set_thread_pool(_thread_pool);
+    }
+    return RWKV_SUCCESS;
 }
 
 int runtime::load_model(std::string model_path) {
-    if (_backend == nullptr) {
+    if (_logits_memory.reserve(RWKV_MEMORY_LOGITS, _vocab_size * sizeof(float)) != RWKV_SUCCESS) {
+        return RWKV_ERROR_MODEL | RWKV_ERROR_ALLOC;
+    }
+    _logits.resize(_vocab_size);
+    _state_valid = false;
+    _state_memory.reset();
+
+    int ret = _model->load_model(model_path);
+    if (ret != RWKV_SUCCESS) {
+        _logits_memory.reset();
+        std::vector<float>().swap(_logits);
+    }
+    return ret;
+}
+
+int runtime::set_logits_precision(int precision) {
+    if (precision < RWKV_LOGITS_FP32 || precision > RWKV_LOGITS_BF16) {
         return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
     }
-    return _backend->load_model(model_path);
+    if (precision == RWKV_LOGITS_FP32) {
+        _half_logits_memory.reset();
+        std::vector<uint16_t>().swap(_half_logits);
+    } else {
+        if (_half_logits_memory.reserve(RWKV_MEMORY_LOGITS, _vocab_size * sizeof(uint16_t)) != RWKV_SUCCESS) {
+            return RWKV_ERROR_RUNTIME | RWKV_ERROR_ALLOC;
+        }
+        _half_logits.resize(_vocab_size);
+    }
+    _logits_precision = precision;
+    return RWKV_SUCCESS;
 }
 
 int runtime::load_tokenizer(std::string vocab_file) {
-    if (_tokenizer != nullptr) {
+    return _model->load_tokenizer(vocab_file);
+}
+
+int runtime::load_async(std::string backend_name, std::string model_path, std::string vocab_file,
+    std::string warmup_prompt, load_callback callback) {
+    std::lock_guard<std::mutex> lock(_load_mutex);
+    if (_loading) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    if (_load_thread.joinable()) {
+        _load_thread.join();
+    }
+    _loading = true;
+    _load_progress = load_progress();
+    _load_thread = std::thread(&runtime::load_pipeline, this, backend_name, model_path, vocab_file, warmup_prompt, callback);
+    return RWKV_SUCCESS;
+}
+
+load_progress runtime::get_load_progress() {
+    std::lock_guard<std::mutex> lock(_load_mutex);
+    return _load_progress;
+}
+
+int runtime::wait_loaded() {
+    std::unique_lock<std::mutex> lock(_load_mutex);
+    _load_cv.wait(lock, [this] { return !_loading; });
+    return _load_progress.ret;
+}
+
+// reads the file through once so that the backend's own read hits the page cache
+static void read_ahead(const std::string &path, const std::atomic<bool> &stop) {
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> buffer(4 << 20);
+    while (!stop && file.read(buffer.data(), buffer.size())) {
+    }
+}
+
+void runtime::load_pipeline(std::string backend_name, std::string model_path, std::string vocab_file,
+    std::string warmup_prompt, load_callback callback) {
+    auto start = std::chrono::steady_clock::now();
+    auto finish_stage = [&](int stage, int ret) {
+        {
+            std::lock_guard<std::mutex> lock(_load_mutex);
+            _load_progress.stages_done |= 1 << stage;
+            _load_progress.stage_ms[stage] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (ret != RWKV_SUCCESS && _load_progress.ret == RWKV_SUCCESS) {
+                _load_progress.ret = ret;
+            }
+        }
+        if (callback) {
+            callback(stage, ret);
+        }
+    };
+
+    // the trie doesn't depend on the backend, so it's built alongside
+    std::thread tokenizer_thread([&] {
+        finish_stage(RWKV_LOAD_STAGE_TOKENIZER, load_tokenizer(vocab_file));
+    });
+    std::atomic<bool> stop_read_ahead{false};
+    std::thread read_ahead_thread([&] {
+        read_ahead(model_path, stop_read_ahead);
+    });
+
+    int ret = init(backend_name);
+    finish_stage(RWKV_LOAD_STAGE_BACKEND, ret);
+    if (ret == RWKV_SUCCESS) {
+        ret = load_model(model_path);
+    }
+    finish_stage(RWKV_LOAD_STAGE_MODEL, ret);
+    stop_read_ahead = true;
+    read_ahead_thread.join();
+    tokenizer_thread.join();
+
+    ret = RWKV_SUCCESS;
+    if (get_load_progress().ret == RWKV_SUCCESS && !warmup_prompt.empty()) {
+        std::vector<int> ids = tokenizer_encode(warmup_prompt);
+        ret = ids.empty() ? RWKV_ERROR_TOKENIZER : prefill(ids);
+    }
+    finish_stage(RWKV_LOAD_STAGE_WARMUP, ret);
+
+    int result;
+    {
+        std::lock_guard<std::mutex> lock(_load_mutex);
+        _load_progress.finished = true;
+        _load_progress.total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        result = _load_progress.ret;
+        _loading = false;
+    }
+    _load_cv.notify_all();
+    if (callback) {
+        callback(RWKV_LOAD_STAGE_COUNT, result);
+    }
+}
+
+int runtime::release() {
+    wait_loaded();
+    if (backend() == nullptr) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    _logits_memory.reset();
+    std::vector<float>().swap(_logits);
+    _half_logits_memory.reset();
+    std::vector<uint16_t>().swap(_half_logits);
+    _state_valid = false;
+    _state_memory.reset();
+    std::vector<float>().swap(_state);
+    drop_chat_turns();
+    release_draft_model();
+    // other sessions still use the weights
+    if (_model.use_count() > 1) {
+        std::lock_guard<std::recursive_mutex> lock(_model->_mutex);
+        if (_model->_active_session == this) {
+            _model->_active_session = nullptr;
+        }
+        return RWKV_SUCCESS;
+    }
+    return _model->release();
+}
+
+int runtime::get_state(std::vector<float> &state) {
+    if (backend() == nullptr) {
         return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
     }
-    _tokenizer = std::unique_ptr<tokenizer_base>(new trie_tokenizer);
-    if (_tokenizer == nullptr) {
-        return RWKV_ERROR_TOKENIZER;
+    auto lock = acquire_backend();
+    return backend()->get_state(state);
+}
+
+int runtime::set_state(std::vector<float> state) {
+    if (backend() == nullptr) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto lock = acquire_backend();
+    drop_chat_turns();
+    if (_draft != nullptr) {
+        // the draft can't follow an arbitrary state; it only costs acceptance rate
+        _draft->clear_state();
+    }
+    return backend()->set_state(state);
+}
+
+int runtime::clear_state() {
+    if (backend() == nullptr) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto lock = acquire_backend();
+    _occurences.clear();
+    drop_chat_turns();
+    if (_draft != nullptr) {
+        _draft->clear_state();
+    }
+    return backend()->clear_state();
+}
+
+int runtime::get_state_compressed(int format, std::vector<uint8_t> &data, const std::vector<float> * base) {
+    std::vector<float> state;
+    int ret = get_state(state);
+    if (ret) {
+        return ret;
+    }
+    ret = state_encode(state, format, base, data);
+    return ret ? RWKV_ERROR_RUNTIME | ret : RWKV_SUCCESS;
+}
+
+int runtime::set_state_compressed(const uint8_t * data, size_t size, const std::vector<float> * base) {
+    std::vector<float> state;
+    int ret = state_decode(data, size, base, state);
+    if (ret) {
+        return RWKV_ERROR_RUNTIME | ret;
     }
-    return _tokenizer->load(vocab_file);
+    return set_state(std::move(state));
 }
 
 int runtime::get_available_backend_ids(std::vector<int> &backend_ids) {
-    backend_ids = std::vector<int>();
-
-#ifdef ENABLE_RWKVCPP
-    // should work on all available platforms
-    backend_ids.push_back(RWKV_BACKEND_RWKVCPP);
-#endif
-
-#ifdef ENABLE_WEBRWKV
-    // TODO: Detect if the platform has Qualcomm Adreno proprietary vulkan driver
-    // (Doesn't work with WEBRWKV)
-    backend_ids.push_back(RWKV_BACKEND_WEBRWKV);
-#endif
-    return RWKV_SUCCESS;
+    return rwkvmobile::get_available_backend_ids(backend_ids);
 }
 
 std::string runtime::get_available_backends_str() {
@@ -90,48 +328,157 @@ std::string runtime::get_available_backends_str() {
     return ret;
 }
 
+// tokens of generated text reserved up front (see reserve_output)
+static const int output_reserve_tokens = 1024;
+
+void runtime::reserve_output(std::string &text, int length) {
+    text.clear();
+    const size_t max_length = tokenizer() == nullptr ? 1 : tokenizer()->max_token_length();
+    text.reserve(std::min(std::max(length, 0), output_reserve_tokens) * max_length + max_length);
+}
+
+void runtime::append_token(std::string &text, int id) {
+    size_t size = text.size();
+    text.resize(size + tokenizer()->max_token_length());
+    text.resize(size + tokenizer()->decode_into(id, &text[size], text.size() - size));
+}
+
 int runtime::eval_logits(int id, std::vector<float> &logits) {
-    if (_backend == nullptr) {
+    if (backend() == nullptr) {
         return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
     }
-    return _backend->eval(id, logits);
+    auto lock = acquire_backend();
+    int ret = backend()->eval(id, logits);
+    if (!ret) {
+        gather_output(logits);
+    }
+    if (&logits == &_logits) {
+        _next_precision = RWKV_LOGITS_FP32;
+    }
+    return ret;
 }
 
 int runtime::eval_logits(std::vector<int> ids, std::vector<float> &logits) {
-    if (_backend == nullptr) {
+    if (backend() == nullptr) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto lock = acquire_backend();
+    int ret = backend()->eval(ids, logits);
+    if (!ret) {
+        gather_output(logits);
+    }
+    if (&logits == &_logits) {
+        _next_precision = RWKV_LOGITS_FP32;
+    }
+    return ret;
+}
+
+int runtime::eval_target_logprobs(const std::vector<int> &ids, const std::vector<int> &targets, std::vector<float> &logprobs) {
+    if (backend() == nullptr) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    if (!_model->get_output_subset().empty()) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_UNSUPPORTED;
+    }
+    // ids and targets may come straight from a client (c api, ipc daemon)
+    if (ids.empty() || ids.size() != targets.size()) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (ids[i] < 0 || ids[i] >= _vocab_size || targets[i] < 0 || targets[i] >= _vocab_size) {
+            return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+        }
+    }
+    auto lock = acquire_backend();
+    return backend()->eval_target_logprobs(ids, targets, _vocab_size, logprobs);
+}
+
+int runtime::eval_batch(const std::vector<int> &ids, std::vector<std::vector<float> *> &states, std::vector<std::vector<float> *> &logits) {
+    if (backend() == nullptr || ids.size() != states.size() || ids.size() != logits.size()) {
         return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
     }
-    return _backend->eval(ids, logits);
+    auto lock = acquire_backend();
+    int ret = backend()->eval_batch(ids, states, logits);
+    if (!ret) {
+        for (auto l : logits) {
+            gather_output(*l);
+        }
+    }
+    return ret;
+}
+
+template <typename T>
+void runtime::gather_output(std::vector<T> &logits) {
+    if (_model->_native_subset) {
+        return;
+    }
+    // ascending ids, so subset[i] >= i and this can be done in place
+    const auto &subset = _model->_output_subset;
+    for (size_t i = 0; i < subset.size(); i++) {
+        logits[i] = logits[subset[i]];
+    }
+}
+
+template <typename T>
+int runtime::eval_next(const T &ids) {
+    if (backend() == nullptr) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto lock = acquire_backend();
+    if (_logits_precision != RWKV_LOGITS_FP32) {
+        // a backend with only fp32 logits returns RWKV_ERROR_UNSUPPORTED without
+        // evaluating anything; the caller decides whether to switch to fp32
+        int ret = backend()->eval_half(ids, _half_logits, _logits_precision);
+        if (!ret) {
+            gather_output(_half_logits);
+        }
+        _next_precision = _logits_precision;
+        return ret;
+    }
+    int ret = backend()->eval(ids, _logits);
+    if (!ret) {
+        gather_output(_logits);
+    }
+    _next_precision = RWKV_LOGITS_FP32;
+    return ret;
+}
+
+int runtime::sample_next() {
+    const size_t size = _model->get_output_size();
+    if (_next_precision != RWKV_LOGITS_FP32) {
+        _occurences.apply(_half_logits.data(), _next_precision, _presence_penalty, _frequency_penalty, _penalty_decay, output_index());
+        return _model->output_token(_sampler->sample(_half_logits.data(), size, _next_precision, _temperature, _top_k, _top_p));
+    }
+    _occurences.apply(_logits.data(), _presence_penalty, _frequency_penalty, _penalty_decay, output_index());
+    return _model->output_token(_sampler->sample(_logits.data(), size, _temperature, _top_k, _top_p));
 }
 
 int runtime::chat(std::string user_role, std::string response_role, std::string user_input, std::string &response, const int max_length) {
-    if (_backend == nullptr || _tokenizer == nullptr) {
+    if (backend() == nullptr || tokenizer() == nullptr) {
         return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
     }
+    push_chat_turn(user_role, response_role, user_input, max_length);
     std::string prompt = user_role + ": " + user_input + "\n\n" + response_role + ":";
-    std::vector<int> ids = _tokenizer->encode(prompt);
-    std::vector<float> logits(_vocab_size);
-    response = "";
-    int ret = eval_logits(ids, logits);
+    std::vector<int> ids = tokenizer()->encode(prompt);
+    // everything the decode loop needs is sized here, so that it doesn't allocate per token
+    reserve_output(response, max_length);
+    if (use_draft()) {
+        return speculative_generate(ids, response, max_length, true);
+    }
+    int ret = eval_next(ids);
     if (ret) {
         return ret;
     }
 
     for (int i = 0; i < max_length; i++) {
-        for (auto &[id, occurence] : _occurences) {
-            logits[id] -=
-                _frequency_penalty * occurence + _presence_penalty;
-            occurence *= _penalty_decay;
-        }
-
-        int idx = _sampler->sample(logits.data(), logits.size(), _temperature, _top_k, _top_p);
+        int idx = sample_next();
         if (idx == 0) {
             break;
         }
-        _occurences[idx]++;
+        _occurences.add(idx);
 
-        response += _tokenizer->decode(idx);
-        ret = eval_logits(idx, logits);
+        append_token(response, idx);
+        ret = eval_next(idx);
         if (response.c_str()[response.size() - 1] == '\n' && response.c_str()[response.size() - 2] == '\n') {
             break;
         }
@@ -143,38 +490,715 @@ int runtime::chat(std::string user_role, std::string response_role, std::string
     return RWKV_SUCCESS;
 }
 
+void runtime::push_chat_turn(const std::string &user_role, const std::string &response_role, const std::string &user_input, int max_length) {
+    if (_max_chat_turns <= 0) {
+        return;
+    }
+    chat_turn turn;
+    if (get_state(turn.state) != RWKV_SUCCESS) {
+        return;
+    }
+    turn.user_role = user_role;
+    turn.response_role = response_role;
+    turn.user_input = user_input;
+    turn.max_length = max_length;
+    turn.occurences = _occurences.entries();
+    if (_draft != nullptr) {
+        _draft->get_state(turn.draft_state);
+    }
+    _chat_turns.push_back(std::move(turn));
+    trim_chat_turns();
+}
+
+void runtime::trim_chat_turns() {
+    while ((int)_chat_turns.size() > _max_chat_turns) {
+        _chat_turns.pop_front();
+    }
+    // over budget, older checkpoints go first; rolling back is only an optimization,
+    // so this never fails the chat
+    while (!_chat_turns.empty() && _chat_turns_memory.reserve(RWKV_MEMORY_STATES,
+        _chat_turns.size() * _chat_turns.back().state.size() * sizeof(float)) != RWKV_SUCCESS) {
+        _chat_turns.pop_front();
+    }
+    if (_chat_turns.empty()) {
+        _chat_turns_memory.reset();
+    }
+}
+
+void runtime::drop_chat_turns() {
+    _chat_turns.clear();
+    _chat_turns_memory.reset();
+}
+
+int runtime::set_max_chat_turns(int max_turns) {
+    if (max_turns < 0) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    _max_chat_turns = max_turns;
+    trim_chat_turns();
+    return RWKV_SUCCESS;
+}
+
+int runtime::rollback_chat_turns(int n) {
+    if (backend() == nullptr || n <= 0 || n > (int)_chat_turns.size()) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    chat_turn &turn = _chat_turns[_chat_turns.size() - n];
+    {
+        auto lock = acquire_backend();
+        int ret = backend()->set_state(turn.state);
+        if (ret) {
+            return ret;
+        }
+    }
+    _occurences.assign(turn.occurences);
+    if (_draft != nullptr) {
+        if (turn.draft_state.empty()) {
+            _draft->clear_state();
+        } else {
+            auto lock = _draft->acquire_backend();
+            _draft->backend()->set_state(turn.draft_state);
+        }
+    }
+    _chat_turns.erase(_chat_turns.end() - n, _chat_turns.end());
+    trim_chat_turns();
+    return RWKV_SUCCESS;
+}
+
+int runtime::regenerate_chat(std::string &response) {
+    if (_chat_turns.empty()) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    std::string user_role = _chat_turns.back().user_role;
+    std::string response_role = _chat_turns.back().response_role;
+    std::string user_input = _chat_turns.back().user_input;
+    int max_length = _chat_turns.back().max_length;
+    int ret = rollback_chat_turns(1);
+    if (ret) {
+        return ret;
+    }
+    return chat(user_role, response_role, user_input, response, max_length);
+}
+
+int runtime::load_draft_model(std::string backend_name, std::string model_path, int draft_length) {
+    if (backend() == nullptr || draft_length <= 0) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    // web-rwkv holds one model per process: a draft there would replace this model
+    if (_model->get_backend_id() == RWKV_BACKEND_WEBRWKV && backend_str_to_enum(backend_name) == RWKV_BACKEND_WEBRWKV) {
+        return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+    }
+    auto draft = std::unique_ptr<runtime>(new runtime);
+    int ret = draft->init(backend_name);
+    if (ret == RWKV_SUCCESS) {
+        ret = draft->load_model(model_path);
+    }
+    if (ret != RWKV_SUCCESS) {
+        return ret;
+    }
+    if (draft->get_model()->get_vocab_size() != _vocab_size) {
+        draft->release();
+        return RWKV_ERROR_MODEL | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    _draft = std::move(draft);
+    _draft_logits.resize(_vocab_size);
+    _spec_stats = speculative_stats();
+    _spec_stats.draft_length = draft_length;
+    return RWKV_SUCCESS;
+}
+
+int runtime::release_draft_model() {
+    if (_draft == nullptr) {
+        return RWKV_SUCCESS;
+    }
+    int ret = _draft->release();
+    _draft = nullptr;
+    std::vector<float>().swap(_draft_logits);
+    std::vector<float>().swap(_draft_probs);
+    std::vector<float>().swap(_verify_logits);
+    std::vector<float>().swap(_verify_probs);
+    return ret;
+}
+
+// longest draft proposed at once
+static const int max_draft_length = 16;
+
+int runtime::speculative_generate(const std::vector<int> &ids, std::string &text, int length, bool stop_at_blank_line) {
+    auto start = std::chrono::steady_clock::now();
+    const size_t vocab = _vocab_size;
+    int ret = eval_logits(ids, _logits);
+    if (ret) {
+        return ret;
+    }
+    ret = _draft->eval_logits(ids, _draft_logits);
+    if (ret) {
+        return ret;
+    }
+
+    auto stopped = [&]() {
+        return stop_at_blank_line && text.size() >= 2 && text[text.size() - 1] == '\n' && text[text.size() - 2] == '\n';
+    };
+
+    // the first token comes straight from the model
+    if (length <= 0) {
+        return RWKV_SUCCESS;
+    }
+    _occurences.apply(_logits.data(), _presence_penalty, _frequency_penalty, _penalty_decay);
+    int pending = _sampler->sample(_logits.data(), vocab, _temperature, _top_k, _top_p);
+    if (pending == 0) {
+        return RWKV_SUCCESS;
+    }
+    _occurences.add(pending);
+    append_token(text, pending);
+    int generated = 1;
+
+    // neither model has consumed pending yet. per round: the draft proposes k tokens
+    // d[0..k) after pending, the model evaluates [pending, d...] in one pass, accepts a
+    // prefix of d and samples one more token, which becomes the next pending
+    std::vector<int> proposal, emitted, consumed, needed;
+    std::vector<float> target_state, draft_state;
+    if (generated >= length || stopped()) {
+        ret = eval_logits(pending, _logits);
+        if (!ret) ret = _draft->eval_logits(pending, _draft_logits);
+        return ret;
+    }
+    bool finished = false;
+    while (!finished) {
+        int k = std::min(_spec_stats.draft_length, length - generated - 1);
+        k = std::max(k, 0);
+
+        ret = get_state(target_state);
+        if (!ret) ret = _draft->get_state(draft_state);
+        if (ret) {
+            return ret;
+        }
+
+        // draft: q_i over the token after [pending, d_0..d_i)
+        _draft_probs.resize(std::max<size_t>(k, 1) * vocab);
+        proposal.clear();
+        auto saved = _occurences.entries();
+        ret = _draft->eval_logits(pending, _draft_logits);
+        for (int i = 0; !ret && i < k; i++) {
+            float * q = &_draft_probs[i * vocab];
+            _occurences.apply(_draft_logits.data(), _presence_penalty, _frequency_penalty, _penalty_decay);
+            _sampler->probabilities(_draft_logits.data(), vocab, _temperature, _top_k, _top_p, q);
+            int d = _sampler->sample_weights(q, vocab);
+            proposal.push_back(d);
+            _occurences.add(d);
+            if (i + 1 < k) {
+                ret = _draft->eval_logits(d, _draft_logits);
+            }
+        }
+        if (ret) {
+            return ret;
+        }
+        _occurences.assign(saved);
+        // the draft has consumed [pending, d_0..d_{k-2}]
+        std::vector<int> draft_consumed = {pending};
+        draft_consumed.insert(draft_consumed.end(), proposal.begin(), proposal.end() - (k > 0 ? 1 : 0));
+
+        // model: logits after each of [pending, d_0..d_{k-1}] in one pass
+        consumed = {pending};
+        consumed.insert(consumed.end(), proposal.begin(), proposal.end());
+        _verify_logits.resize(consumed.size() * vocab);
+        _verify_probs.resize(vocab);
+        {
+            auto lock = acquire_backend();
+            ret = backend()->eval_all_logits(consumed, _verify_logits);
+        }
+        if (ret) {
+            return ret;
+        }
+        _spec_stats.verify_passes++;
+        _spec_stats.drafted += k;
+
+        // speculative sampling: accept d_i with probability min(1, p(d_i) / q(d_i)),
+        // otherwise sample from max(0, p - q) and end the round. tokens are committed one
+        // by one, so that penalties and stop conditions see exactly what the plain decode
+        // loop would
+        emitted.clear();
+        int accepted = 0;
+        for (int i = 0; i <= k; i++) {
+            float * logits = &_verify_logits[i * vocab];
+            float * p = _verify_probs.data();
+            _occurences.apply(logits, _presence_penalty, _frequency_penalty, _penalty_decay);
+            _sampler->probabilities(logits, vocab, _temperature, _top_k, _top_p, p);
+            int token;
+            bool draft_accepted = false;
+            if (i == k) {
+                token = _sampler->sample_weights(p, vocab);
+            } else {
+                const float * q = &_draft_probs[i * vocab];
+                token = proposal[i];
+                draft_accepted = _sampler->uniform() * q[token] <= p[token];
+                if (draft_accepted) {
+                    accepted++;
+                } else {
+                    float residual = 0;
+                    for (size_t t = 0; t < vocab; t++) {
+                        p[t] = std::max(p[t] - q[t], 0.f);
+                        residual += p[t];
+                    }
+                    if (residual <= 0) {
+                        // p == q up to rounding
+                        _sampler->probabilities(logits, vocab, _temperature, _top_k, _top_p, p);
+                    }
+                    token = _sampler->sample_weights(p, vocab);
+                }
+            }
+            if (token == 0) {
+                finished = true;
+                break;
+            }
+            _occurences.add(token);
+            emitted.push_back(token);
+            append_token(text, token);
+            generated++;
+            if (generated >= length || stopped()) {
+                finished = true;
+                break;
+            }
+            if (!draft_accepted) {
+                break;
+            }
+        }
+        _spec_stats.accepted += accepted;
+
+        // both models have to end up having consumed [pending] + emitted,
+        // except for the new pending token when continuing
+        needed = {pending};
+        needed.insert(needed.end(), emitted.begin(), emitted.end() - (finished ? 0 : 1));
+        auto prefix_of = [](const std::vector<int> &a, const std::vector<int> &b) {
+            return a.size() <= b.size() && std::equal(a.begin(), a.end(), b.begin());
+        };
+        if (needed == consumed) {
+            std::copy(_verify_logits.end() - vocab, _verify_logits.end(), _logits.begin());
+        } else if (prefix_of(consumed, needed)) {
+            ret = eval_logits(std::vector<int>(needed.begin() + consumed.size(), needed.end()), _logits);
+        } else {
+            {
+                auto lock = acquire_backend();
+                ret = backend()->set_state(target_state);
+            }
+            if (!ret) ret = eval_logits(needed, _logits);
+        }
+        if (ret) {
+            return ret;
+        }
+        if (needed != draft_consumed) {
+            if (prefix_of(draft_consumed, needed)) {
+                ret = _draft->eval_logits(std::vector<int>(needed.begin() + draft_consumed.size(), needed.end()), _draft_logits);
+            } else {
+                {
+                    auto lock = _draft->acquire_backend();
+                    ret = _draft->backend()->set_state(draft_state);
+                }
+                if (!ret) ret = _draft->eval_logits(needed, _draft_logits);
+            }
+            if (ret) {
+                return ret;
+            }
+        }
+        if (!finished) {
+            pending = emitted.back();
+        }
+
+        // grow the draft while everything is accepted, shrink it when most is rejected
+        if (k > 0 && accepted == k) {
+            _spec_stats.draft_length = std::min(_spec_stats.draft_length + 1, max_draft_length);
+        } else if (k > 0 && accepted * 2 < k) {
+            _spec_stats.draft_length = std::max(_spec_stats.draft_length - 1, 1);
+        }
+    }
+
+    _spec_stats.generated += generated;
+    _spec_stats.decode_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return ret;
+}
+
 int runtime::gen_completion(std::string prompt, std::string &completion, int length) {
-    if (_backend == nullptr || _tokenizer == nullptr) {
+    if (backend() == nullptr || tokenizer() == nullptr) {
         return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
     }
-    std::vector<int> ids = _tokenizer->encode(prompt);
-    std::vector<float> logits(_vocab_size);
-    completion = "";
-    int ret = eval_logits(ids, logits);
+    std::vector<int> ids = tokenizer()->encode(prompt);
+    // everything the decode loop needs is sized here, so that it doesn't allocate per token
+    reserve_output(completion, length);
+    if (use_draft()) {
+        return speculative_generate(ids, completion, length, false);
+    }
+    int ret = eval_next(ids);
     if (ret) {
         return ret;
     }
 
     for (int i = 0; i < length; i++) {
-        for (auto &[id, occurence] : _occurences) {
-            logits[id] -=
-                _frequency_penalty * occurence + _presence_penalty;
-            occurence *= _penalty_decay;
+        int idx = sample_next();
+        if (idx == 0) {
+            break;
+        }
+        _occurences.add(idx);
+
+        append_token(completion, idx);
+        ret = eval_next(idx);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return RWKV_SUCCESS;
+}
+
+int runtime::prefill(const std::vector<int> &ids) {
+    if (ids.empty()) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    return eval_next(ids);
+}
+
+int runtime::decode_step(int &token) {
+    if (backend() == nullptr) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    token = sample_next();
+    if (token == 0) {
+        return RWKV_SUCCESS;
+    }
+    _occurences.add(token);
+    return eval_next(token);
+}
+
+// prompt bytes per chunk when prefilling in gen_completion_stream
+static const size_t prompt_chunk_bytes = 1024;
+
+// encodes the tokens of text starting in [begin, begin + prompt_chunk_bytes), which are
+// those of encode(text) (see tokenizer_base::encode_range). returns where the next chunk begins
+static size_t encode_chunk(const tokenizer_base * tok, const std::string &text, size_t begin, std::vector<int> &ids) {
+    ids.clear();
+    return tok->encode_range(text, begin, std::min(text.size(), begin + prompt_chunk_bytes), ids);
+}
+
+int runtime::gen_completion_stream(std::string prompt, std::string &completion, int length,
+    const std::vector<std::string> &stop, const token_callback &callback) {
+    if (backend() == nullptr || tokenizer() == nullptr) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    if (_stream_worker == nullptr) {
+        _stream_worker = std::unique_ptr<async_worker>(new async_worker);
+    }
+    tokenizer_base * tok = tokenizer();
+    auto lock = acquire_backend();
+
+    // prefill: chunk k + 1 is encoded while chunk k is evaluated
+    std::vector<int> chunk_ids, next_ids;
+    size_t next_begin = encode_chunk(tok, prompt, 0, next_ids);
+    auto encode_next = [&]() {
+        next_begin = encode_chunk(tok, prompt, next_begin, next_ids);
+    };
+    int ret;
+    while (true) {
+        chunk_ids.swap(next_ids);
+        bool last = next_begin >= prompt.size();
+        if (!last) {
+            _stream_worker->submit(encode_next);
+        }
+        ret = eval_next(chunk_ids);
+        _stream_worker->wait();
+        if (ret) {
+            return ret;
         }
+        if (last) {
+            break;
+        }
+    }
 
-        int idx = _sampler->sample(logits.data(), logits.size(), _temperature, _top_k, _top_p);
+    reserve_output(completion, length);
+    int token = 0;
+    bool stopped = false;
+    auto post_process = [&]() {
+        size_t size = completion.size();
+        append_token(completion, token);
+        if (callback && !callback(completion.data() + size, completion.size() - size)) {
+            stopped = true;
+        }
+        for (auto &s : stop) {
+            if (!s.empty() && completion.size() >= s.size()
+                && completion.compare(completion.size() - s.size(), s.size(), s) == 0) {
+                stopped = true;
+            }
+        }
+    };
+    for (int i = 0; i < length; i++) {
+        int idx = sample_next();
         if (idx == 0) {
             break;
         }
-        _occurences[idx]++;
+        _occurences.add(idx);
+
+        token = idx;
+        _stream_worker->submit(post_process);
+        ret = eval_next(idx);
+        _stream_worker->wait();
+        if (ret) {
+            return ret;
+        }
+        if (stopped) {
+            break;
+        }
+    }
+
+    return RWKV_SUCCESS;
+}
+
+namespace {
+
+// a generation branch. state and logits are shared with the parent branch
+// until this branch evaluates a token of its own
+struct branch {
+    std::shared_ptr<std::vector<float>> state;
+    std::shared_ptr<const std::vector<float>> logits;
+    std::vector<std::pair<int, float>> occurences;
+    std::vector<int> ids;
+    float logprob = 0;
+    bool finished = false;
+};
+
+}
+
+static void log_softmax(const std::vector<float> &logits, std::vector<float> &out) {
+    out.resize(logits.size());
+    const float max_logit = *std::max_element(logits.begin(), logits.end());
+    float sum = 0;
+    for (auto logit : logits) {
+        sum += std::exp(logit - max_logit);
+    }
+    const float log_sum = max_logit + std::log(sum);
+    for (size_t i = 0; i < logits.size(); i++) {
+        out[i] = logits[i] - log_sum;
+    }
+}
+
+int runtime::gen_candidates(std::string prompt, int n, int max_length, int mode, std::vector<candidate> &candidates) {
+    if (backend() == nullptr || tokenizer() == nullptr) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    if (!_model->get_output_subset().empty()) {
+        // needs the full distribution
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_UNSUPPORTED;
+    }
+    if (n <= 0 || max_length <= 0 || (mode != RWKV_SEARCH_BEST_OF_N && mode != RWKV_SEARCH_BEAM)) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+
+    // branches swap states through the backend, keep other sessions out meanwhile
+    auto lock = acquire_backend();
+    std::vector<int> ids = tokenizer()->encode(prompt);
+    int ret = eval_logits(ids, _logits);
+    if (ret) {
+        return ret;
+    }
+    auto prefill_state = std::make_shared<std::vector<float>>();
+    ret = backend()->get_state(*prefill_state);
+    if (ret) {
+        return ret;
+    }
+
+    // at most n live branches plus the states their parents still hold
+    memory_reservation states_memory;
+    ret = states_memory.reserve(RWKV_MEMORY_STATES, 2 * n * prefill_state->size() * sizeof(float));
+    if (ret) {
+        return RWKV_ERROR_RUNTIME | ret;
+    }
+
+    // the branches overwrite _occurences while they apply their own penalties
+    const auto saved_occurences = _occurences.entries();
+    std::vector<branch> branches;
+    {
+        branch root;
+        root.state = std::move(prefill_state);
+        root.logits = std::make_shared<std::vector<float>>(_logits);
+        root.occurences = saved_occurences;
+        branches.assign(mode == RWKV_SEARCH_BEAM ? 1 : n, root);
+    }
+    std::vector<branch> finished;
+
+    std::vector<float> penalized, logprobs;
+    for (int step = 0; step < max_length && !branches.empty(); step++) {
+        std::vector<branch> next;
+        for (auto &b : branches) {
+            penalized = *b.logits;
+            _occurences.assign(b.occurences);
+            _occurences.apply(penalized.data(), _presence_penalty, _frequency_penalty, _penalty_decay);
+            b.occurences = _occurences.entries();
+            log_softmax(penalized, logprobs);
+
+            if (mode == RWKV_SEARCH_BEST_OF_N) {
+                int idx = _sampler->sample(penalized.data(), penalized.size(), _temperature, _top_k, _top_p);
+                branch child = b;
+                child.logprob += logprobs[idx];
+                child.finished = idx == 0;
+                if (!child.finished) {
+                    child.ids.push_back(idx);
+                    _occurences.add(idx);
+                    child.occurences = _occurences.entries();
+                }
+                next.push_back(std::move(child));
+            } else {
+                int k = std::min<int>(n, logprobs.size());
+                std::vector<int> top(logprobs.size());
+                for (size_t i = 0; i < top.size(); i++) top[i] = i;
+                std::partial_sort(top.begin(), top.begin() + k, top.end(),
+                    [&](int i, int j) { return logprobs[i] > logprobs[j]; });
+                for (int i = 0; i < k; i++) {
+                    branch child;
+                    child.state = b.state;
+                    child.logits = b.logits;
+                    child.logprob = b.logprob + logprobs[top[i]];
+                    child.finished = top[i] == 0;
+                    child.ids = b.ids;
+                    child.occurences = b.occurences;
+                    if (!child.finished) {
+                        child.ids.push_back(top[i]);
+                        _occurences.assign(b.occurences);
+                        _occurences.add(top[i]);
+                        child.occurences = _occurences.entries();
+                    }
+                    next.push_back(std::move(child));
+                }
+            }
+        }
+
+        if (mode == RWKV_SEARCH_BEAM) {
+            std::sort(next.begin(), next.end(), [](const branch &a, const branch &b) { return a.logprob > b.logprob; });
+            next.resize(std::min<size_t>(next.size(), n - finished.size()));
+        }
+
+        branches.clear();
+        for (auto &b : next) {
+            if (b.finished) {
+                finished.push_back(std::move(b));
+            } else {
+                branches.push_back(std::move(b));
+            }
+        }
+        next.clear();
+        if ((int)finished.size() >= n || branches.empty()) {
+            break;
+        }
+
+        std::vector<int> step_ids;
+        std::vector<std::vector<float>> step_states, step_logits;
+        for (auto &b : branches) {
+            // copy-on-write: the shared parent state is copied only here, and
+            // taken over by the last branch still holding it
+            step_ids.push_back(b.ids.back());
+            if (b.state.use_count() == 1) {
+                step_states.push_back(std::move(*b.state));
+            } else {
+                step_states.push_back(*b.state);
+            }
+            b.state = nullptr;
+            step_logits.emplace_back(_vocab_size);
+        }
 
-        completion += _tokenizer->decode(idx);
-        ret = eval_logits(idx, logits);
+        std::vector<std::vector<float> *> state_ptrs, logits_ptrs;
+        for (size_t i = 0; i < branches.size(); i++) {
+            state_ptrs.push_back(&step_states[i]);
+            logits_ptrs.push_back(&step_logits[i]);
+        }
+        ret = backend()->eval_batch(step_ids, state_ptrs, logits_ptrs);
         if (ret) {
+            _occurences.assign(saved_occurences);
             return ret;
         }
+        for (size_t i = 0; i < branches.size(); i++) {
+            branches[i].state = std::make_shared<std::vector<float>>(std::move(step_states[i]));
+            branches[i].logits = std::make_shared<const std::vector<float>>(std::move(step_logits[i]));
+        }
+    }
+
+    for (auto &b : branches) {
+        finished.push_back(std::move(b));
+    }
+    std::sort(finished.begin(), finished.end(), [](const branch &a, const branch &b) { return a.logprob > b.logprob; });
+    if (finished.size() > (size_t)n) {
+        finished.resize(n);
     }
 
+    candidates.clear();
+    for (auto &b : finished) {
+        candidate c;
+        c.ids = b.ids;
+        c.text = tokenizer()->decode(b.ids);
+        c.logprob = b.logprob;
+        candidates.push_back(std::move(c));
+    }
+
+    const branch &best = finished.front();
+    _occurences.assign(best.occurences);
+    _logits = *best.logits;
+    _next_precision = RWKV_LOGITS_FP32;
+    return backend()->set_state(*best.state);
+}
+
+int runtime::score_continuations(std::string prefix, const std::vector<std::string> &continuations,
+    std::vector<float> &scores, std::vector<std::vector<float>> &token_logprobs) {
+    if (backend() == nullptr || tokenizer() == nullptr) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    if (!_model->get_output_subset().empty()) {
+        // needs the full distribution
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_UNSUPPORTED;
+    }
+    auto lock = acquire_backend();
+    std::vector<int> prefix_ids = tokenizer()->encode(prefix);
+    if (prefix_ids.empty()) {
+        return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    int ret = eval_logits(prefix_ids, _logits);
+    if (ret) {
+        return ret;
+    }
+    std::vector<float> prefix_state;
+    ret = backend()->get_state(prefix_state);
+    if (ret) {
+        return ret;
+    }
+    // the first token of every continuation is predicted by the prefix logits
+    std::vector<float> prefix_logprobs;
+    log_softmax(_logits, prefix_logprobs);
+
+    scores.assign(continuations.size(), 0);
+    token_logprobs.assign(continuations.size(), {});
+    bool state_dirty = false;
+    for (size_t i = 0; i < continuations.size(); i++) {
+        std::vector<int> ids = tokenizer()->encode(continuations[i]);
+        if (ids.empty()) {
+            continue;
+        }
+        auto &logprobs = token_logprobs[i];
+        if (ids.size() > 1) {
+            if (state_dirty) {
+                ret = backend()->set_state(prefix_state);
+                if (ret) {
+                    return ret;
+                }
+            }
+            std::vector<int> inputs(ids.begin(), ids.end() - 1);
+            std::vector<int> targets(ids.begin() + 1, ids.end());
+            ret = backend()->eval_target_logprobs(inputs, targets, _vocab_size, logprobs);
+            if (ret) {
+                return ret;
+            }
+            state_dirty = true;
+        }
+        logprobs.insert(logprobs.begin(), prefix_logprobs[ids[0]]);
+        for (auto logprob : logprobs) {
+            scores[i] += logprob;
+        }
+    }
+    if (state_dirty) {
+        return backend()->set_state(prefix_state);
+    }
     return RWKV_SUCCESS;
 }
 
@@ -2,46 +2,192 @@
 #define RUNTIME_H
 
 #include <string>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "backend.h"
 #include "tokenizer.h"
 #include "sampler.h"
+#include "thread_pool.h"
+#include "memory_manager.h"
+#include "model.h"
+#include "state_codec.h"
 
 namespace rwkvmobile {
 
+enum {
+    RWKV_SEARCH_BEST_OF_N = 0,
+    RWKV_SEARCH_BEAM,
+};
+
+struct candidate {
+    std::string text;
+    std::vector<int> ids;
+    float logprob = 0;
+};
+
+struct speculative_stats {
+    // tokens proposed by the draft model, and how many of them the model accepted
+    size_t drafted = 0;
+    size_t accepted = 0;
+    // multi-token verification passes of the model
+    size_t verify_passes = 0;
+    size_t generated = 0;
+    double decode_ms = 0;
+    // current draft length
+    int draft_length = 0;
+};
+
+enum {
+    RWKV_LOAD_STAGE_TOKENIZER = 0,
+    RWKV_LOAD_STAGE_BACKEND,
+    RWKV_LOAD_STAGE_MODEL,
+    RWKV_LOAD_STAGE_WARMUP,
+    RWKV_LOAD_STAGE_COUNT,
+};
+
+struct load_progress {
+    // bit (1 << stage) per finished RWKV_LOAD_STAGE_*
+    int stages_done = 0;
+    bool finished = false;
+    // the first error of any stage
+    int ret = 0;
+    // from the start of the load to the end of each stage
+    double stage_ms[RWKV_LOAD_STAGE_COUNT] = {};
+    double total_ms = 0;
+};
+
+// called on a loader thread as each stage finishes, then once more with
+// RWKV_LOAD_STAGE_COUNT and the overall result when the runtime is ready.
+// the runtime must not be destroyed from the callback
+typedef std::function<void(int stage, int ret)> load_callback;
+
+// called with the text of each generated token; return false to stop generating
+typedef std::function<bool(const char * text, size_t len)> token_callback;
+
+// a session: recurrent state, sampler and penalty table on top of a model.
+// a default-constructed runtime owns its model; runtimes constructed from
+// another runtime's get_model() share the weights and tokenizer, and may be
+// used from different threads.
 class runtime {
 public:
-    runtime() {};
-    ~runtime() {};
+    runtime() : runtime(std::make_shared<class model>()) {};
+    runtime(std::shared_ptr<class model> shared_model);
+    ~runtime();
+    runtime(const runtime &) = delete;
+    runtime & operator=(const runtime &) = delete;
+
+    // backend_name "auto": the backend is picked in load_model() by benchmarking
+    // every available backend on the model (results are cached in cache_dir)
     int init(std::string backend_name);
     int init(int backend_id);
     int load_model(std::string model_path);
     int load_tokenizer(std::string vocab_file);
+
+    // init + load_tokenizer + load_model in the background, returning right away.
+    // the tokenizer is built while the backend initializes and loads the weights, and the
+    // model file is read ahead into the page cache meanwhile. with a warmup_prompt (e.g. the
+    // system prompt) it is prefilled once everything is loaded, which also gets the
+    // backend's first-eval setup out of the way; the session is left in its state.
+    // nothing but get_load_progress/wait_loaded may be called until the load finishes
+    int load_async(std::string backend_name, std::string model_path, std::string vocab_file,
+        std::string warmup_prompt = "", load_callback callback = nullptr);
+    load_progress get_load_progress();
+    // returns the load's result
+    int wait_loaded();
+
     int eval_logits(int id, std::vector<float> &logits);
     int eval_logits(std::vector<int> ids, std::vector<float> &logits);
+    // see execution_provider::eval_target_logprobs
+    int eval_target_logprobs(const std::vector<int> &ids, const std::vector<int> &targets, std::vector<float> &logprobs);
+    // evaluates ids[i] on top of *states[i] for every i, updating the states in place
+    // (see execution_provider::eval_batch). the session's own state is undefined afterwards
+    int eval_batch(const std::vector<int> &ids, std::vector<std::vector<float> *> &states, std::vector<std::vector<float> *> &logits);
     int chat(std::string user_role, std::string response_role, std::string user_input, std::string &response, const int max_length);
     int gen_completion(std::string prompt, std::string &completion, int length);
 
+    // attaches a smaller model with the same vocab (e.g. 0.1B next to 1.6B) that proposes
+    // draft_length tokens at a time for chat() and gen_completion(); the model verifies them
+    // in one pass and speculative sampling keeps the output distribution unchanged.
+    // the draft length adapts to the acceptance rate. not used with an output subset.
+    // web-rwkv holds one model per process, so a web-rwkv draft next to a web-rwkv model
+    // is rejected (RWKV_ERROR_UNSUPPORTED); use another backend for the draft, e.g.
+    // "ipc:<socket path>" to a daemon serving the draft model
+    int load_draft_model(std::string backend_name, std::string model_path, int draft_length = 4);
+    int release_draft_model();
+    inline speculative_stats get_speculative_stats() { return _spec_stats; }
+
+    // chat() checkpoints the state and penalties before each user message, keeping the
+    // last max_turns of them (0 disables checkpoints), so that the conversation can be
+    // rolled back without prefilling it again. clear_state/set_state drop the checkpoints
+    int set_max_chat_turns(int max_turns);
+    inline int get_chat_turn_count() { return _chat_turns.size(); }
+    // returns to the state right before the n-th last chat() user message
+    int rollback_chat_turns(int n);
+    // rolls back the last turn and answers the same user message again
+    int regenerate_chat(std::string &response);
+
+    // pipelined gen_completion. the prompt is tokenized chunk by chunk on a background
+    // thread while the previous chunk is evaluated, and each generated token is
+    // detokenized, matched against stop and passed to callback on that thread while the
+    // backend evaluates it (so callback doesn't run on the calling thread).
+    // stops at the end-of-sequence token, after length tokens, when the completion ends
+    // with one of stop, or when callback returns false
+    int gen_completion_stream(std::string prompt, std::string &completion, int length,
+        const std::vector<std::string> &stop, const token_callback &callback);
+
+    // building blocks for generations that are interleaved with other sessions'
+    // (see scheduler). prefill evaluates ids and keeps the logits; decode_step samples
+    // the next token from them with this session's sampler and penalties and evaluates it.
+    // token is 0 at the end of sequence, in which case nothing is evaluated
+    int prefill(const std::vector<int> &ids);
+    int decode_step(int &token);
+
+    // prefills the prompt once, then forks the state into n branches that share
+    // state storage until they diverge. best-of-n samples each branch independently,
+    // beam search keeps the n best expansions per step. candidates are returned
+    // sorted by cumulative log-probability, and the runtime continues from the best one.
+    int gen_candidates(std::string prompt, int n, int max_length, int mode, std::vector<candidate> &candidates);
+
+    // log-likelihood of each continuation after prefix. the prefix is prefilled once and
+    // each continuation is evaluated in one pass from the saved prefix state, returning only
+    // target-token log-probs. scores[i] is the sum of token_logprobs[i].
+    // the runtime is left in the state right after the prefix
+    int score_continuations(std::string prefix, const std::vector<std::string> &continuations,
+        std::vector<float> &scores, std::vector<std::vector<float>> &token_logprobs);
+
+    // restricts generation to a subset of token ids (include 0 to allow end-of-sequence).
+    // applies to every session of the model (see model::set_output_subset).
+    // with a subset, eval_logits writes the subset's logits to the front of logits,
+    // in ascending token id order
+    inline int set_output_subset(std::vector<int> ids) { return _model->set_output_subset(ids); }
+
+    // precision the decode loops (chat, gen_completion, gen_completion_stream and
+    // prefill / decode_step) take the logits in, one of RWKV_LOGITS_*. with fp16 or bf16
+    // a backend that supports it hands them over at half the size, and the penalties
+    // and the sampler read them as they are. with a backend that doesn't, they fail with
+    // RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED and the precision is left as set.
+    // eval_logits, speculative decoding and scoring always use fp32
+    int set_logits_precision(int precision);
+    inline int get_logits_precision() { return _logits_precision; }
+
     int get_state(std::vector<float> &state);
     int set_state(std::vector<float> state);
-    int clear_state() {
-        if (_backend == nullptr) {
-            return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
-        }
-        _occurences.clear();
-        return _backend->clear_state();
-    }
+    int clear_state();
 
-    int release() {
-        if (_backend == nullptr) {
-            return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
-        }
-        int ret = _backend->release_model();
-        if (ret != RWKV_SUCCESS) {
-            return ret;
-        }
-        return _backend->release();
-    }
+    // the state serialized with the state codec in one of RWKV_STATE_FORMAT_*;
+    // base, if given, is the state to store the delta against and must be passed back to set
+    int get_state_compressed(int format, std::vector<uint8_t> &data, const std::vector<float> * base = nullptr);
+    int set_state_compressed(const uint8_t * data, size_t size, const std::vector<float> * base = nullptr);
+
+    // releases the model too when no other session shares it
+    int release();
+
+    std::shared_ptr<class model> get_model() { return _model; }
 
     inline int set_seed(int64_t seed) {
         if (_sampler == nullptr) {
@@ -54,6 +200,14 @@ public:
 
     inline int64_t get_seed() { return _seed; }
 
+    // n_threads <= 0: one thread per cpu; cpu_ids empty: big cores detected from sysfs
+    int set_thread_params(int n_threads, std::vector<int> cpu_ids);
+    inline int get_thread_count() { return _thread_pool->get_thread_count(); }
+
+    inline void set_cache_dir(std::string cache_dir) { _model->set_cache_dir(cache_dir); }
+    inline std::string get_cache_dir() { return _model->get_cache_dir(); }
+    inline int get_backend_id() { return _model->get_backend_id(); }
+
     inline void set_sampler_params(float temperature, int top_k, float top_p) {
         _temperature = temperature;
         _top_k = top_k;
@@ -83,24 +237,52 @@ public:
     }
 
     std::vector<int> tokenizer_encode(std::string text) {
-        if (_tokenizer == nullptr) {
+        if (tokenizer() == nullptr) {
+            return {};
+        }
+        return tokenizer()->encode(text);
+    }
+
+    // clears text and reserves it for the first length generated tokens, but for no more
+    // than 1024 of them: the decode loops don't allocate per token up to there and then
+    // grow text geometrically, and a large length doesn't reserve memory the generation
+    // may never use
+    void reserve_output(std::string &text, int length);
+
+    // returns the number of tokens in state.ids that are unchanged, so only the rest needs prefill
+    size_t tokenizer_encode_incremental(incremental_encoding &state, std::string_view text) {
+        if (tokenizer() == nullptr) {
+            return 0;
+        }
+        return tokenizer()->encode_incremental(state, text);
+    }
+
+    std::vector<std::vector<int>> tokenizer_encode_batch(const std::vector<std::string> &texts) {
+        if (tokenizer() == nullptr) {
             return {};
         }
-        return _tokenizer->encode(text);
+        return tokenizer()->encode_batch(texts, _thread_pool.get());
     }
 
     std::string tokenizer_decode(std::vector<int> ids) {
-        if (_tokenizer == nullptr) {
+        if (tokenizer() == nullptr) {
             return "";
         }
-        return _tokenizer->decode(ids);
+        return tokenizer()->decode(ids);
     }
 
     std::string tokenizer_decode(int id) {
-        if (_tokenizer == nullptr) {
+        if (tokenizer() == nullptr) {
             return "";
         }
-        return _tokenizer->decode(id);
+        return tokenizer()->decode(id);
+    }
+
+    size_t tokenizer_decode_into(const std::vector<int> &ids, char * buf, size_t cap) {
+        if (tokenizer() == nullptr) {
+            return 0;
+        }
+        return tokenizer()->decode_into(ids, buf, cap);
     }
 
     int sampler_sample(std::vector<float> logits) {
@@ -110,10 +292,38 @@ public:
         return _sampler->sample(logits.data(), logits.size(), _temperature, _top_k, _top_p);
     }
 
+    int sampler_sample_batch(const float * logits, int batch, const sampler_params * params, int * out) {
+        if (_sampler == nullptr) {
+            return RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS;
+        }
+        return _sampler->sample_batch(logits, batch, _vocab_size, params, out);
+    }
+
 private:
-    std::unique_ptr<execution_provider> _backend;
-    std::unique_ptr<tokenizer_base> _tokenizer;
+    execution_provider * backend() { return _model->get_backend(); }
+    tokenizer_base * tokenizer() { return _model->get_tokenizer(); }
+    // locks the model and makes sure the backend holds this session's state
+    // (and that _logits fits the backend's output)
+    std::unique_lock<std::recursive_mutex> acquire_backend();
+    // moves the logits of the output subset to the front when the backend computed all of them
+    template <typename T>
+    void gather_output(std::vector<T> &logits);
+    // eval for the decode loops: into _half_logits with a half _logits_precision, into
+    // _logits otherwise (see set_logits_precision)
+    template <typename T>
+    int eval_next(const T &ids);
+    // applies the penalties to the logits of the last eval_next and samples from them
+    int sample_next();
+    const int * output_index() { return _model->_output_index.empty() ? nullptr : _model->_output_index.data(); }
+    // decodes id onto the end of text; doesn't allocate while text has
+    // max_token_length() bytes of spare capacity
+    void append_token(std::string &text, int id);
+
+    std::shared_ptr<class model> _model;
     std::unique_ptr<sampler> _sampler;
+    std::shared_ptr<thread_pool> _thread_pool = thread_pool::global();
+    // created on the first gen_completion_stream
+    std::unique_ptr<async_worker> _stream_worker;
 
     int _vocab_size = 65536;
 
@@ -125,7 +335,59 @@ private:
     float _penalty_decay = 0.996;
     int64_t _seed = 0;
 
-    std::map<int, float> _occurences;
+    penalty_table _occurences;
+
+    std::vector<float> _logits;
+    memory_reservation _logits_memory;
+    int _logits_precision = RWKV_LOGITS_FP32;
+    // precision of the logits the last eval_next left, in _half_logits unless fp32
+    int _next_precision = RWKV_LOGITS_FP32;
+    std::vector<uint16_t> _half_logits;
+    memory_reservation _half_logits_memory;
+
+    bool use_draft() { return _draft != nullptr && _model->get_output_subset().empty(); }
+    // decodes up to length tokens after prefilling ids, with the draft model proposing.
+    // stop_at_blank_line: stop once text ends with "\n\n" (chat)
+    int speculative_generate(const std::vector<int> &ids, std::string &text, int length, bool stop_at_blank_line);
+
+    std::unique_ptr<runtime> _draft;
+    // the draft's logits, its proposal distributions and the model's logits per verified position
+    std::vector<float> _draft_logits;
+    std::vector<float> _draft_probs;
+    std::vector<float> _verify_logits;
+    std::vector<float> _verify_probs;
+    speculative_stats _spec_stats;
+
+    struct chat_turn {
+        std::string user_role;
+        std::string response_role;
+        std::string user_input;
+        int max_length;
+        // before the user message
+        std::vector<float> state;
+        std::vector<float> draft_state;
+        std::vector<std::pair<int, float>> occurences;
+    };
+    void push_chat_turn(const std::string &user_role, const std::string &response_role, const std::string &user_input, int max_length);
+    // drops the oldest checkpoints beyond _max_chat_turns or the memory budget
+    void trim_chat_turns();
+    void drop_chat_turns();
+    std::deque<chat_turn> _chat_turns;
+    int _max_chat_turns = 8;
+    memory_reservation _chat_turns_memory;
+
+    void load_pipeline(std::string backend_name, std::string model_path, std::string vocab_file,
+        std::string warmup_prompt, load_callback callback);
+    std::thread _load_thread;
+    std::mutex _load_mutex;
+    std::condition_variable _load_cv;
+    load_progress _load_progress;
+    bool _loading = false;
+
+    // this session's state while another session has the backend
+    std::vector<float> _state;
+    bool _state_valid = false;
+    memory_reservation _state_memory;
 };
 
 }
@@ -1,38 +1,231 @@
 #include "sampler.h"
+#include "kernels.h"
+#include "half.h"
 
 namespace rwkvmobile {
 
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+// Stateless: the output only depends on (key, counter), so a stream's draws
+// don't depend on which other streams were sampled before or alongside it.
+static void philox4x32_10(uint32_t counter[4], uint32_t key[2]) {
+    const uint32_t m0 = 0xD2511F53, m1 = 0xCD9E8D57;
+    const uint32_t w0 = 0x9E3779B9, w1 = 0xBB67AE85;
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)m0 * counter[0];
+        uint64_t p1 = (uint64_t)m1 * counter[2];
+        uint32_t c0 = (uint32_t)(p1 >> 32) ^ counter[1] ^ k0;
+        uint32_t c1 = (uint32_t)p1;
+        uint32_t c2 = (uint32_t)(p0 >> 32) ^ counter[3] ^ k1;
+        uint32_t c3 = (uint32_t)p0;
+        counter[0] = c0; counter[1] = c1; counter[2] = c2; counter[3] = c3;
+        k0 += w0; k1 += w1;
+    }
+}
+
+float philox_uniform(uint64_t seed, uint64_t counter) {
+    uint32_t ctr[4] = {(uint32_t)counter, (uint32_t)(counter >> 32), 0, 0};
+    uint32_t key[2] = {(uint32_t)seed, (uint32_t)(seed >> 32)};
+    philox4x32_10(ctr, key);
+    // 24 random bits -> [0, 1)
+    return (ctr[0] >> 8) * (1.f / 16777216.f);
+}
+
 sampler::sampler() {
     _generator.seed(std::random_device()());
 }
 
-int sampler::sample(const float* logits, const size_t size, float temperature, int top_k, float top_p) {
+void penalty_table::resize(int vocab_size) {
+    _counts.assign(vocab_size, 0);
+    _seen.assign(vocab_size, false);
+    _ids.clear();
+    _ids.reserve(vocab_size);
+}
+
+void penalty_table::clear() {
+    for (auto id : _ids) {
+        _counts[id] = 0;
+        _seen[id] = false;
+    }
+    _ids.clear();
+}
+
+void penalty_table::add(int id) {
+    if (id < 0 || id >= (int)_counts.size()) {
+        return;
+    }
+    if (!_seen[id]) {
+        _seen[id] = true;
+        _ids.push_back(id);
+    }
+    _counts[id]++;
+}
+
+void penalty_table::apply(float * logits, float presence_penalty, float frequency_penalty, float penalty_decay, const int * index) {
+    if (index == nullptr) {
+        kernels().penalty_apply(logits, _counts.data(), _ids.data(), _ids.size(), frequency_penalty, presence_penalty, penalty_decay);
+        return;
+    }
+    for (auto id : _ids) {
+        int i = index[id];
+        if (i >= 0) {
+            logits[i] -= frequency_penalty * _counts[id] + presence_penalty;
+        }
+        _counts[id] *= penalty_decay;
+    }
+}
+
+void penalty_table::apply(uint16_t * logits, int precision, float presence_penalty, float frequency_penalty, float penalty_decay, const int * index) {
+    // only the seen ids are touched, so these are converted one at a time
+    const bool bf16 = precision == RWKV_LOGITS_BF16;
+    for (auto id : _ids) {
+        int i = index == nullptr ? id : index[id];
+        if (i >= 0) {
+            float logit = bf16 ? bf16_to_fp32(logits[i]) : fp16_to_fp32(logits[i]);
+            logit -= frequency_penalty * _counts[id] + presence_penalty;
+            logits[i] = bf16 ? fp32_to_bf16(logit) : fp32_to_fp16(logit);
+        }
+        _counts[id] *= penalty_decay;
+    }
+}
+
+std::vector<std::pair<int, float>> penalty_table::entries() const {
+    std::vector<std::pair<int, float>> result;
+    result.reserve(_ids.size());
+    for (auto id : _ids) {
+        result.emplace_back(id, _counts[id]);
+    }
+    return result;
+}
+
+void penalty_table::assign(const std::vector<std::pair<int, float>> &entries) {
+    clear();
+    for (auto &[id, count] : entries) {
+        if (id < 0 || id >= (int)_counts.size()) {
+            continue;
+        }
+        if (!_seen[id]) {
+            _seen[id] = true;
+            _ids.push_back(id);
+        }
+        _counts[id] = count;
+    }
+}
+
+// logits as the backend produced them: float, or raw fp16/bf16 bits
+struct logits_view {
+    const void * data;
+    int precision;
+};
+
+// widens logits[begin, end) into out[begin, end)
+static void widen(const kernel_table &k, logits_view logits, size_t begin, size_t end, float * out) {
+    const uint16_t * half = (const uint16_t *)logits.data + begin;
+    if (logits.precision == RWKV_LOGITS_BF16) {
+        k.bf16_to_fp32(half, out + begin, end - begin);
+    } else {
+        k.fp16_to_fp32(half, out + begin, end - begin);
+    }
+}
+
+// probs is a scratch buffer of `size` elements
+static int argmax(logits_view logits, const size_t size, float *probs) {
+    const float * values = (const float *)logits.data;
+    if (logits.precision != RWKV_LOGITS_FP32) {
+        widen(kernels(), logits, 0, size, probs);
+        values = probs;
+    }
+    return std::max_element(values, values + size) - values;
+}
+
+// index and probs are scratch buffers of `size` elements. leaves the candidates in
+// index[0, len) with weights probs[index[i]] that sum to total, and returns len
+static int filter_candidates(logits_view logits, const size_t size, float temperature, int top_k, float top_p,
+                             int *index, float *probs, thread_pool *pool, float &total) {
     temperature = std::clamp(temperature, 0.1f, 5.f);
     if (top_k >= size)
         top_k = size;
 
-    if (top_k == 0 || top_k == 1)
-        return std::max_element(logits, logits + size) - logits;
+    if (top_k == 0 || top_k == 1) {
+        index[0] = argmax(logits, size, probs);
+        probs[index[0]] = 1;
+        total = 1;
+        return 1;
+    }
 
-    // softmax
+    // softmax. half-precision logits are widened into probs chunk by chunk and
+    // exponentiated in place, so the backend's buffer is only read at half width
+    const kernel_table &k = kernels();
+    const bool half = logits.precision != RWKV_LOGITS_FP32;
+    const float * values = half ? probs : (const float *)logits.data;
     float sum = 0;
-    int *index = new int[size];
-    float *probs = new float[size];
 
-    const float max_logit = *std::max_element(logits, logits + size);
+    // at most 64 chunks, one partial result each. the pool is handed chunk indices, not
+    // elements: it may run any range of them in one call (inline on a 1-thread pool, in a
+    // pool worker or when another caller holds it), and every chunk still gets its own
+    // partial, so the result doesn't depend on how the work was split
+    const size_t grain = std::max<size_t>(8192, (size + 63) / 64);
+    const size_t n_chunks = (size + grain - 1) / grain;
+    float partials[64] = {0};
+    auto for_chunks = [&](auto &&fn) {
+        auto run = [&](size_t chunk_begin, size_t chunk_end) {
+            for (size_t c = chunk_begin; c < chunk_end; c++) {
+                fn(c, c * grain, std::min(size, (c + 1) * grain));
+            }
+        };
+        if (pool != nullptr) {
+            pool->parallel_for(0, n_chunks, 1, run);
+        } else {
+            run(0, n_chunks);
+        }
+    };
 
-    for (int i = 0; i < size; i++) {
-        probs[i] = std::exp(logits[i] - max_logit);
-        sum += probs[i];
-        index[i] = i;
+    float max_logit;
+    if (half) {
+        for_chunks([&](size_t c, size_t begin, size_t end) {
+            widen(k, logits, begin, end, probs);
+            partials[c] = k.reduce_max(probs + begin, end - begin);
+        });
+        max_logit = *std::max_element(partials, partials + n_chunks);
+    } else {
+        max_logit = k.reduce_max(values, size);
+    }
+    for_chunks([&](size_t c, size_t begin, size_t end) {
+        partials[c] = k.exp_sum(values + begin, probs + begin, end - begin, max_logit);
+    });
+    for (size_t i = 0; i < n_chunks; i++) {
+        sum += partials[i];
     }
 
-    if (top_k != size)
-        std::nth_element(index, index + top_k,
-                index + size,
-                [&](int i, int j) { return probs[i] > probs[j]; });
-    std::sort(index, index + top_k,
-            [&](int i, int j) { return probs[i] > probs[j]; });
+    auto by_prob = [&](int i, int j) { return probs[i] > probs[j]; };
+    size_t n_candidates = size;
+    if (top_k != size) {
+        // guess a threshold that about 2 * top_k tokens pass from a strided
+        // sample, so that nth_element only has to partition those
+        const size_t sample_size = 512;
+        float sample[sample_size];
+        size_t rank = 2 * top_k * sample_size / size + 2;
+        n_candidates = 0;
+        if (size >= 4 * sample_size && rank < sample_size) {
+            const size_t stride = size / sample_size;
+            for (size_t i = 0; i < sample_size; i++) {
+                sample[i] = probs[i * stride];
+            }
+            std::nth_element(sample, sample + rank, sample + sample_size, std::greater<float>());
+            n_candidates = k.select_at_least(probs, size, sample[rank], index);
+        }
+        if (n_candidates < (size_t)top_k) {
+            n_candidates = size;
+        }
+    }
+    if (n_candidates == size) {
+        for (size_t i = 0; i < size; i++) {
+            index[i] = i;
+        }
+    }
+    if ((size_t)top_k != n_candidates)
+        std::nth_element(index, index + top_k, index + n_candidates, by_prob);
+    std::sort(index, index + top_k, by_prob);
 
     int len = top_k;
 
@@ -55,13 +248,24 @@ int sampler::sample(const float* logits, const size_t size, float temperature, i
             cumsum += probs[index[i]];
         }
     }
+    total = cumsum;
+    return len;
+}
+
+template <typename uniform_fn>
+static int sample_with_scratch(logits_view logits, const size_t size, float temperature, int top_k, float top_p,
+                               uniform_fn &&uniform, int *index, float *probs, thread_pool *pool) {
+    if (top_k == 0 || top_k == 1)
+        return argmax(logits, size, probs);
+
+    float total;
+    int len = filter_candidates(logits, size, temperature, top_k, top_p, index, probs, pool, total);
 
     // random choice
-    float random_value = 1. * (_generator() - _generator.min()) /
-                        (_generator.max() - _generator.min()) * cumsum;
-    
+    float random_value = uniform() * total;
+
     int ret = -1;
-    cumsum = 0;
+    float cumsum = 0;
     for (int i = 0; i < len; i++) {
         cumsum += probs[index[i]];
         if (cumsum >= random_value) {
@@ -69,14 +273,106 @@ int sampler::sample(const float* logits, const size_t size, float temperature, i
             break;
         }
     }
-    
-    delete[] index;
-    delete[] probs;
     return ret;
 }
 
+int sampler::sample(const float* logits, const size_t size, float temperature, int top_k, float top_p) {
+    if (_index.size() < size) {
+        _index.resize(size);
+        _probs.resize(size);
+    }
+    return sample_with_scratch({logits, RWKV_LOGITS_FP32}, size, temperature, top_k, top_p, [&]() {
+        return uniform();
+    }, _index.data(), _probs.data(), _thread_pool.get());
+}
+
+int sampler::sample(const uint16_t* logits, const size_t size, int precision, float temperature, int top_k, float top_p) {
+    if (_index.size() < size) {
+        _index.resize(size);
+        _probs.resize(size);
+    }
+    return sample_with_scratch({logits, precision}, size, temperature, top_k, top_p, [&]() {
+        return uniform();
+    }, _index.data(), _probs.data(), _thread_pool.get());
+}
+
+int sampler::sample_batch(const float* logits, const int batch, const size_t size, const sampler_params *params, int *out) {
+    if (logits == nullptr || params == nullptr || out == nullptr || batch <= 0 || size == 0) {
+        return RWKV_ERROR_SAMPLER | RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    auto sample_rows = [&](size_t begin, size_t end) {
+        std::vector<int> index(size);
+        std::vector<float> probs(size);
+        for (size_t row = begin; row < end; row++) {
+            const sampler_params &p = params[row];
+            out[row] = sample_with_scratch({logits + row * size, RWKV_LOGITS_FP32}, size, p.temperature, p.top_k, p.top_p, [&]() {
+                return philox_uniform(p.seed, p.counter);
+            }, index.data(), probs.data(), nullptr);
+        }
+    };
+    if (_thread_pool != nullptr) {
+        _thread_pool->parallel_for(0, batch, 1, sample_rows);
+    } else {
+        sample_rows(0, batch);
+    }
+    return RWKV_SUCCESS;
+}
+
+// the distribution sample_with_scratch draws from, as dense probabilities
+static void distribution(logits_view logits, const size_t size, float temperature, int top_k, float top_p,
+                         int *index, float *probs, thread_pool *pool, float *out) {
+    float total;
+    int len = filter_candidates(logits, size, temperature, top_k, top_p, index, probs, pool, total);
+    std::fill(out, out + size, 0.f);
+    for (int i = 0; i < len; i++) {
+        out[index[i]] = probs[index[i]] / total;
+    }
+}
+
+void sampler::probabilities(const float* logits, const size_t size, float temperature, int top_k, float top_p, float *out) {
+    if (_index.size() < size) {
+        _index.resize(size);
+        _probs.resize(size);
+    }
+    distribution({logits, RWKV_LOGITS_FP32}, size, temperature, top_k, top_p, _index.data(), _probs.data(), _thread_pool.get(), out);
+}
+
+void sampler::probabilities(const uint16_t* logits, const size_t size, int precision, float temperature, int top_k, float top_p, float *out) {
+    if (_index.size() < size) {
+        _index.resize(size);
+        _probs.resize(size);
+    }
+    distribution({logits, precision}, size, temperature, top_k, top_p, _index.data(), _probs.data(), _thread_pool.get(), out);
+}
+
+float sampler::uniform() {
+    return 1. * (_generator() - _generator.min()) / (_generator.max() - _generator.min());
+}
+
+int sampler::sample_weights(const float* weights, const size_t size) {
+    float total = 0;
+    for (size_t i = 0; i < size; i++) {
+        total += weights[i];
+    }
+    float random_value = uniform() * total;
+    float cumsum = 0;
+    int last = -1;
+    for (size_t i = 0; i < size; i++) {
+        if (weights[i] <= 0) {
+            continue;
+        }
+        last = i;
+        cumsum += weights[i];
+        if (cumsum >= random_value) {
+            return i;
+        }
+    }
+    // rounding left random_value just above the sum
+    return last;
+}
+
 void sampler::set_seed(int seed) {
     _generator.seed(seed);
 }
 
-}
\ No newline at end of file
+}
@@ -3,20 +3,84 @@
 
 #include <random>
 #include <algorithm>
+#include <functional>
 #include <vector>
+#include <memory>
+#include "commondef.h"
+#include "thread_pool.h"
 
 namespace rwkvmobile {
 
+// per-stream parameters for sample_batch.
+// the random draw for a row depends only on (seed, counter): advance counter
+// by one per generated token to get a reproducible stream regardless of batching.
+struct sampler_params {
+    float temperature = 1.0;
+    int top_k = 128;
+    float top_p = 0.3;
+    uint64_t seed = 0;
+    uint64_t counter = 0;
+};
+
+// counter-based (Philox4x32-10) uniform draw in [0, 1)
+float philox_uniform(uint64_t seed, uint64_t counter);
+
+// token occurence counts for the presence/frequency penalties.
+// storage is sized once for the vocab, so updating it never allocates
+class penalty_table {
+public:
+    void resize(int vocab_size);
+    void clear();
+    void add(int id);
+    // logits[id] -= frequency_penalty * count + presence_penalty for every seen id,
+    // then decays the counts. with index, logits only holds a subset of the vocab
+    // and index[id] is the position of id in it (-1 outside the subset)
+    void apply(float * logits, float presence_penalty, float frequency_penalty, float penalty_decay, const int * index = nullptr);
+    // the same on RWKV_LOGITS_FP16 / RWKV_LOGITS_BF16 logits
+    void apply(uint16_t * logits, int precision, float presence_penalty, float frequency_penalty, float penalty_decay, const int * index = nullptr);
+
+    std::vector<std::pair<int, float>> entries() const;
+    void assign(const std::vector<std::pair<int, float>> &entries);
+
+private:
+    std::vector<float> _counts;
+    std::vector<int> _ids;
+    std::vector<bool> _seen;
+};
+
 class sampler {
 public:
     sampler();
 
     int sample(const float* logits, const size_t size, float temperature, int top_k, float top_p);
+    // logits in RWKV_LOGITS_FP16 or RWKV_LOGITS_BF16, widened inside the softmax pass
+    // instead of being converted to a float copy first
+    int sample(const uint16_t* logits, const size_t size, int precision, float temperature, int top_k, float top_p);
+
+    // logits: [batch x size] row-major; out: one token id per row
+    // rows are sampled in parallel on the thread pool
+    int sample_batch(const float* logits, const int batch, const size_t size, const sampler_params *params, int *out);
+
+    // the distribution sample() draws from: probabilities after top-k, top-p and
+    // temperature, zero for the tokens they exclude
+    void probabilities(const float* logits, const size_t size, float temperature, int top_k, float top_p, float *out);
+    void probabilities(const uint16_t* logits, const size_t size, int precision, float temperature, int top_k, float top_p, float *out);
+    // draws an index with probability proportional to weights (non-negative, not all zero)
+    int sample_weights(const float* weights, const size_t size);
+    // uniform in [0, 1] from this sampler's generator
+    float uniform();
 
     void set_seed(int seed);
+
+    void set_thread_pool(std::shared_ptr<thread_pool> pool) { _thread_pool = pool; }
 private:
     std::minstd_rand0 _generator;
+    std::shared_ptr<thread_pool> _thread_pool;
+
+    // scratch for sample(), grown to the largest vocab seen
+    std::vector<int> _index;
+    std::vector<float> _probs;
 };
 
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,221 @@
+#include <algorithm>
+
+#include "scheduler.h"
+#include "commondef.h"
+
+namespace rwkvmobile {
+
+// ttft samples kept per priority class for the percentiles
+static const size_t ttft_window = 1024;
+
+struct scheduler::job {
+    int64_t id;
+    generation_request request;
+    std::chrono::steady_clock::time_point submitted;
+    std::vector<int> prompt_ids;
+    size_t prefilled = 0;
+    bool started = false;
+    bool cancelled = false;
+    int generated = 0;
+    std::string completion;
+};
+
+scheduler::scheduler(std::shared_ptr<class model> shared_model, int prefill_chunk)
+    : _model(shared_model), _prefill_chunk(std::max(prefill_chunk, 1)) {
+    _thread = std::thread(&scheduler::worker_loop, this);
+}
+
+scheduler::~scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto &j : _jobs) {
+            j->cancelled = true;
+        }
+    }
+    wait_idle();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+    _thread.join();
+}
+
+int64_t scheduler::submit(generation_request request) {
+    if (request.priority < 0 || request.priority >= RWKV_PRIORITY_COUNT || _model->get_tokenizer() == nullptr) {
+        return -1;
+    }
+    auto j = std::make_shared<job>();
+    j->request = std::move(request);
+    j->submitted = std::chrono::steady_clock::now();
+    if (j->request.session == nullptr) {
+        j->request.session = std::make_shared<runtime>(_model);
+    }
+    int64_t id;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        id = j->id = _next_id++;
+        _jobs.push_back(std::move(j));
+    }
+    _cv.notify_one();
+    return id;
+}
+
+void scheduler::cancel(int64_t id) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto &j : _jobs) {
+        if (j->id == id) {
+            j->cancelled = true;
+        }
+    }
+}
+
+void scheduler::wait_idle() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle_cv.wait(lock, [this] { return _jobs.empty() && !_running; });
+}
+
+scheduler_stats scheduler::get_stats(int priority) {
+    scheduler_stats result;
+    if (priority < 0 || priority >= RWKV_PRIORITY_COUNT) {
+        return result;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto &stats = _stats[priority];
+    result.completed = stats.completed;
+    result.preemptions = stats.preemptions;
+    if (!stats.ttft_ms.empty()) {
+        std::vector<double> sorted = stats.ttft_ms;
+        std::sort(sorted.begin(), sorted.end());
+        result.ttft_p50_ms = sorted[(sorted.size() - 1) / 2];
+        result.ttft_p99_ms = sorted[(sorted.size() - 1) * 99 / 100];
+    }
+    return result;
+}
+
+std::shared_ptr<scheduler::job> scheduler::pick_locked() {
+    auto more_urgent = [](const std::shared_ptr<job> &a, const std::shared_ptr<job> &b) {
+        // cancelled jobs go first so that they are cleaned up right away
+        if (a->cancelled != b->cancelled) {
+            return a->cancelled;
+        }
+        if (a->request.priority != b->request.priority) {
+            return a->request.priority < b->request.priority;
+        }
+        if (a->request.deadline != b->request.deadline) {
+            return a->request.deadline < b->request.deadline;
+        }
+        return a->id < b->id;
+    };
+    return *std::min_element(_jobs.begin(), _jobs.end(), more_urgent);
+}
+
+void scheduler::worker_loop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _cv.wait(lock, [this] { return _stop || !_jobs.empty(); });
+        if (_stop) {
+            return;
+        }
+        auto j = pick_locked();
+        if (_last != nullptr && _last != j && std::find(_jobs.begin(), _jobs.end(), _last) != _jobs.end()) {
+            _stats[_last->request.priority].preemptions++;
+        }
+        _last = j;
+        bool cancelled = j->cancelled;
+        _running = true;
+        lock.unlock();
+
+        bool done;
+        if (cancelled) {
+            finish(*j, RWKV_ERROR_RUNTIME);
+            done = true;
+        } else {
+            done = step(*j);
+        }
+
+        lock.lock();
+        _running = false;
+        if (done) {
+            _jobs.erase(std::find(_jobs.begin(), _jobs.end(), j));
+            _last = nullptr;
+        }
+        if (_jobs.empty()) {
+            _idle_cv.notify_all();
+        }
+    }
+}
+
+bool scheduler::step(job &j) {
+    runtime &session = *j.request.session;
+    if (!j.started) {
+        j.started = true;
+        j.prompt_ids = session.tokenizer_encode(j.request.prompt);
+        if (j.prompt_ids.empty()) {
+            finish(j, RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS);
+            return true;
+        }
+        session.reserve_output(j.completion, j.request.length);
+    }
+
+    if (j.prefilled < j.prompt_ids.size()) {
+        size_t end = std::min(j.prompt_ids.size(), j.prefilled + _prefill_chunk);
+        std::vector<int> chunk(j.prompt_ids.begin() + j.prefilled, j.prompt_ids.begin() + end);
+        int ret = session.prefill(chunk);
+        if (ret) {
+            finish(j, ret);
+            return true;
+        }
+        j.prefilled = end;
+        return false;
+    }
+
+    if (j.generated >= j.request.length) {
+        finish(j, RWKV_SUCCESS);
+        return true;
+    }
+    int token;
+    int ret = session.decode_step(token);
+    if (ret || token == 0) {
+        finish(j, ret);
+        return true;
+    }
+    if (j.generated++ == 0) {
+        auto ttft = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - j.submitted).count();
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto &samples = _stats[j.request.priority].ttft_ms;
+        if (samples.size() >= ttft_window) {
+            samples.erase(samples.begin(), samples.begin() + ttft_window / 2);
+        }
+        samples.push_back(ttft);
+    }
+
+    std::string text = session.tokenizer_decode(token);
+    j.completion += text;
+    bool stopped = j.request.on_token && !j.request.on_token(text.data(), text.size());
+    for (auto &s : j.request.stop) {
+        if (!s.empty() && j.completion.size() >= s.size()
+            && j.completion.compare(j.completion.size() - s.size(), s.size(), s) == 0) {
+            stopped = true;
+        }
+    }
+    if (stopped) {
+        finish(j, RWKV_SUCCESS);
+        return true;
+    }
+    return false;
+}
+
+void scheduler::finish(job &j, int ret) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (ret == RWKV_SUCCESS) {
+            _stats[j.request.priority].completed++;
+        }
+    }
+    if (j.request.on_done) {
+        j.request.on_done(ret, j.completion);
+    }
+}
+
+}
@@ -0,0 +1,106 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "runtime.h"
+
+namespace rwkvmobile {
+
+enum {
+    RWKV_PRIORITY_INTERACTIVE = 0,
+    RWKV_PRIORITY_NORMAL,
+    RWKV_PRIORITY_BATCH,
+    RWKV_PRIORITY_COUNT,
+};
+
+struct generation_request {
+    std::string prompt;
+    int length = 256;
+    std::vector<std::string> stop;
+    int priority = RWKV_PRIORITY_NORMAL;
+    // within a priority class the earliest deadline runs first
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    // session to generate on (keeps its state, sampler and penalty settings);
+    // a fresh session on the scheduler's model if null
+    std::shared_ptr<runtime> session;
+    // called on the scheduler thread with the text of each token; return false to stop
+    token_callback on_token;
+    // called on the scheduler thread when the request finishes, fails or is cancelled
+    std::function<void(int ret, const std::string &completion)> on_done;
+};
+
+struct scheduler_stats {
+    size_t completed = 0;
+    // times a request of this class was paused for a more urgent one
+    size_t preemptions = 0;
+    // time to first token from submit, over the most recent requests
+    double ttft_p50_ms = 0;
+    double ttft_p99_ms = 0;
+};
+
+// runs generation requests on sessions of one model, one step (a prefill chunk or a
+// token) at a time, always stepping the most urgent request: lower priority class
+// first, then earlier deadline, then earlier submit. a request that loses the backend
+// to a more urgent one is paused at the step boundary; its recurrent state is swapped
+// out to host memory by the session switch, and its sampler and penalty table stay
+// in its session, so it resumes exactly where it stopped.
+class scheduler {
+public:
+    // prefill_chunk: prompt tokens evaluated per step, which bounds how long an
+    // urgent request can wait behind a prefill
+    scheduler(std::shared_ptr<class model> shared_model, int prefill_chunk = 64);
+    ~scheduler();
+    scheduler(const scheduler &) = delete;
+    scheduler & operator=(const scheduler &) = delete;
+
+    // returns a request id for cancel(), or -1 if the request is invalid
+    int64_t submit(generation_request request);
+    // on_done gets RWKV_ERROR_RUNTIME if the request hadn't finished
+    void cancel(int64_t id);
+    // blocks until every submitted request has finished
+    void wait_idle();
+
+    scheduler_stats get_stats(int priority);
+
+private:
+    struct job;
+
+    void worker_loop();
+    // the most urgent job; _mutex held
+    std::shared_ptr<job> pick_locked();
+    // one prefill chunk or decode step; returns true when the job is finished
+    bool step(job &j);
+    void finish(job &j, int ret);
+
+    std::shared_ptr<class model> _model;
+    int _prefill_chunk;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::condition_variable _idle_cv;
+    std::vector<std::shared_ptr<job>> _jobs;
+    int64_t _next_id = 0;
+    bool _stop = false;
+    bool _running = false;
+    // the job stepped last, to count preemptions
+    std::shared_ptr<job> _last;
+
+    struct class_stats {
+        size_t completed = 0;
+        size_t preemptions = 0;
+        std::vector<double> ttft_ms;
+    } _stats[RWKV_PRIORITY_COUNT];
+
+    std::thread _thread;
+};
+
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <cstring>
+
+#include "sparse_ffn.h"
+#include "kernels.h"
+#include "commondef.h"
+
+namespace rwkvmobile {
+
+// output columns per parallel_for chunk; the output slice stays in L1 while
+// the gathered rows stream through
+static const size_t column_grain = 256;
+
+size_t compact_nonzero(const float * x, size_t n, uint32_t * idx, float * val) {
+    return kernels().compact_nonzero(x, n, idx, val);
+}
+
+void ffn_value_dense(const float * weight, const float * k, float * out, int n_embd, int n_hidden, thread_pool * pool) {
+    const kernel_table &kt = kernels();
+    auto rows = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            out[i] = kt.dot(weight + i * n_hidden, k, n_hidden);
+        }
+    };
+    if (pool != nullptr) {
+        pool->parallel_for(0, n_embd, 16, rows);
+    } else {
+        rows(0, n_embd);
+    }
+}
+
+int sparse_ffn_value::load(const float * weight, int n_embd, int n_hidden) {
+    if (weight == nullptr || n_embd <= 0 || n_hidden <= 0) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    size_t bytes = (size_t)n_embd * n_hidden * sizeof(float);
+    if (_reservation.reserve(RWKV_MEMORY_WEIGHTS, bytes)) {
+        return RWKV_ERROR_ALLOC;
+    }
+    _rows.resize((size_t)n_embd * n_hidden);
+    // transpose in tiles so that neither side is walked with a large stride
+    const int tile = 32;
+    for (int i0 = 0; i0 < n_embd; i0 += tile) {
+        for (int j0 = 0; j0 < n_hidden; j0 += tile) {
+            for (int i = i0; i < std::min(i0 + tile, n_embd); i++) {
+                for (int j = j0; j < std::min(j0 + tile, n_hidden); j++) {
+                    _rows[(size_t)j * n_embd + i] = weight[(size_t)i * n_hidden + j];
+                }
+            }
+        }
+    }
+    _n_embd = n_embd;
+    _n_hidden = n_hidden;
+    _idx.resize(n_hidden);
+    _val.resize(n_hidden);
+    return RWKV_SUCCESS;
+}
+
+int sparse_ffn_value::forward(const float * k, float * out, thread_pool * pool) {
+    if (_rows.empty() || k == nullptr || out == nullptr) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    const kernel_table &kt = kernels();
+    const size_t count = kt.compact_nonzero(k, _n_hidden, _idx.data(), _val.data());
+    _last_nonzero = count;
+
+    const uint32_t * idx = _idx.data();
+    const float * val = _val.data();
+    const float * rows = _rows.data();
+    const size_t n_embd = _n_embd;
+    auto columns = [&](size_t begin, size_t end) {
+        std::memset(out + begin, 0, (end - begin) * sizeof(float));
+        for (size_t r = 0; r < count; r++) {
+            kt.axpy(out + begin, rows + idx[r] * n_embd + begin, val[r], end - begin);
+        }
+    };
+    if (pool != nullptr) {
+        pool->parallel_for(0, n_embd, column_grain, columns);
+    } else {
+        columns(0, n_embd);
+    }
+    return RWKV_SUCCESS;
+}
+
+}
@@ -0,0 +1,51 @@
+#ifndef SPARSE_FFN_H
+#define SPARSE_FFN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "memory_manager.h"
+#include "thread_pool.h"
+
+namespace rwkvmobile {
+
+// writes the positions and values of the non-zero elements of x; returns their count.
+// idx and val need room for n elements
+size_t compact_nonzero(const float * x, size_t n, uint32_t * idx, float * val);
+
+// out = weight * k with weight in the checkpoint layout, [n_embd][n_hidden] row-major.
+// the dense reference for sparse_ffn_value
+void ffn_value_dense(const float * weight, const float * k, float * out, int n_embd, int n_hidden, thread_pool * pool = nullptr);
+
+// the value projection of the channel mix, out = W_v * k with k = relu(W_k * x)^2.
+// at decode time most of k is exactly zero, so instead of streaming all of W_v only
+// the columns for the non-zero activations are read. W_v is kept transposed,
+// [n_hidden][n_embd], so that each of those columns is one contiguous row
+class sparse_ffn_value {
+public:
+    // weight: [n_embd][n_hidden] row-major, as ffn.value.weight is stored
+    int load(const float * weight, int n_embd, int n_hidden);
+
+    // k: n_hidden activations, out: n_embd outputs
+    int forward(const float * k, float * out, thread_pool * pool = nullptr);
+
+    // fraction of zero activations in the last forward()
+    float get_last_sparsity() { return _n_hidden ? 1.f - (float)_last_nonzero / _n_hidden : 0.f; }
+
+    int get_n_embd() { return _n_embd; }
+    int get_n_hidden() { return _n_hidden; }
+
+private:
+    int _n_embd = 0;
+    int _n_hidden = 0;
+    std::vector<float> _rows;
+    memory_reservation _reservation;
+
+    std::vector<uint32_t> _idx;
+    std::vector<float> _val;
+    size_t _last_nonzero = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "state_codec.h"
+
+namespace rwkvmobile {
+
+static const char state_magic[4] = {'R', 'W', 'S', 'T'};
+static const uint16_t state_version = 1;
+static const uint8_t state_flag_delta = 1 << 0;
+
+// stored little-endian, field by field
+struct state_header {
+    uint16_t version;
+    uint8_t format;
+    uint8_t flags;
+    uint32_t block_size;
+    uint64_t n_elements;
+    // identifies the base state of a delta, 0 otherwise
+    uint64_t base_hash;
+};
+
+static const size_t state_header_size = 4 + 2 + 1 + 1 + 4 + 8 + 8;
+
+static void put(uint8_t * data, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        data[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static uint64_t get(const uint8_t * data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t)data[i] << (8 * i);
+    }
+    return value;
+}
+
+static uint32_t float_bits(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    return x;
+}
+
+static float bits_float(uint32_t x) {
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+// fnv-1a over 32-bit words; states are MBs, so byte-wise would dominate delta coding
+static uint64_t hash_state(const std::vector<float> &state) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (float v : state) {
+        hash ^= float_bits(v);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash | 1;
+}
+
+// round-to-nearest-even, without relying on F16C / NEON fp16 support
+static uint16_t fp32_to_fp16(float f) {
+    uint32_t x = float_bits(f);
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+    if (abs >= 0x7f800000) {
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    }
+    if (abs >= 0x477ff000) {
+        // rounds past 65504
+        return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {
+        // subnormal: units of 2^-24
+        return sign | (uint16_t)std::nearbyint(bits_float(abs) * 16777216.f);
+    }
+    uint32_t h = ((abs >> 23) - 127 + 15) << 10 | ((abs >> 13) & 0x3ff);
+    uint32_t rem = abs & 0x1fff;
+    // branchless: the rounding direction is a coin flip on real data
+    h += (rem > 0x1000) | ((rem == 0x1000) & h);
+    return sign | h;
+}
+
+static float fp16_to_fp32(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    if (exp == 0) {
+        return bits_float(sign | float_bits(mant * (1.f / 16777216.f)));
+    }
+    if (exp == 31) {
+        return bits_float(sign | 0x7f800000 | (mant << 13));
+    }
+    return bits_float(sign | (exp - 15 + 127) << 23 | (mant << 13));
+}
+
+static uint16_t fp32_to_bf16(float f) {
+    uint32_t x = float_bits(f);
+    if ((x & 0x7fffffff) > 0x7f800000) {
+        return (x >> 16) | 0x40;
+    }
+    return (x + 0x7fff + ((x >> 16) & 1)) >> 16;
+}
+
+static float bf16_to_fp32(uint16_t h) {
+    return bits_float((uint32_t)h << 16);
+}
+
+static size_t payload_size(int format, uint64_t n) {
+    switch (format) {
+        case RWKV_STATE_FORMAT_FP32:
+            return n * 4;
+        case RWKV_STATE_FORMAT_FP16:
+        case RWKV_STATE_FORMAT_BF16:
+            return n * 2;
+        case RWKV_STATE_FORMAT_INT8:
+            return n + (n + state_codec_block_size - 1) / state_codec_block_size * 4;
+    }
+    return 0;
+}
+
+int state_encode(const std::vector<float> &state, int format, const std::vector<float> * base, std::vector<uint8_t> &data) {
+    if (format < 0 || format >= RWKV_STATE_FORMAT_COUNT || (base != nullptr && base->size() != state.size())) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    const size_t n = state.size();
+    auto value = [&](size_t i) {
+        return base == nullptr ? state[i] : state[i] - (*base)[i];
+    };
+
+    data.clear();
+    data.resize(state_header_size + payload_size(format, n));
+    memcpy(data.data(), state_magic, 4);
+    put(data.data() + 4, state_version, 2);
+    put(data.data() + 6, format, 1);
+    put(data.data() + 7, base != nullptr ? state_flag_delta : 0, 1);
+    put(data.data() + 8, state_codec_block_size, 4);
+    put(data.data() + 12, n, 8);
+    put(data.data() + 20, base != nullptr ? hash_state(*base) : 0, 8);
+
+    // the payload is written in host order; every supported target is little-endian
+    uint8_t * out = data.data() + state_header_size;
+    switch (format) {
+        case RWKV_STATE_FORMAT_FP32:
+            for (size_t i = 0; i < n; i++) {
+                float v = value(i);
+                memcpy(out + 4 * i, &v, 4);
+            }
+            break;
+        case RWKV_STATE_FORMAT_FP16:
+            for (size_t i = 0; i < n; i++) {
+                uint16_t v = fp32_to_fp16(value(i));
+                memcpy(out + 2 * i, &v, 2);
+            }
+            break;
+        case RWKV_STATE_FORMAT_BF16:
+            for (size_t i = 0; i < n; i++) {
+                uint16_t v = fp32_to_bf16(value(i));
+                memcpy(out + 2 * i, &v, 2);
+            }
+            break;
+        case RWKV_STATE_FORMAT_INT8:
+            for (size_t begin = 0; begin < n; begin += state_codec_block_size) {
+                size_t end = std::min<size_t>(n, begin + state_codec_block_size);
+                float max_abs = 0;
+                for (size_t i = begin; i < end; i++) {
+                    max_abs = std::max(max_abs, std::fabs(value(i)));
+                }
+                float scale = max_abs / 127.f;
+                float inv_scale = scale > 0 ? 1.f / scale : 0.f;
+                memcpy(out, &scale, 4);
+                out += 4;
+                for (size_t i = begin; i < end; i++) {
+                    *out++ = (uint8_t)(int8_t)std::lrint(value(i) * inv_scale);
+                }
+            }
+            break;
+    }
+    return RWKV_SUCCESS;
+}
+
+int state_decode(const uint8_t * data, size_t size, const std::vector<float> * base, std::vector<float> &state) {
+    if (data == nullptr || size < state_header_size || memcmp(data, state_magic, 4) != 0) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    state_header header;
+    header.version = get(data + 4, 2);
+    header.format = get(data + 6, 1);
+    header.flags = get(data + 7, 1);
+    header.block_size = get(data + 8, 4);
+    header.n_elements = get(data + 12, 8);
+    header.base_hash = get(data + 20, 8);
+    if (header.version > state_version || header.format >= RWKV_STATE_FORMAT_COUNT) {
+        return RWKV_ERROR_UNSUPPORTED;
+    }
+    // n_elements comes from the data: bound it before payload_size can wrap around
+    if (header.n_elements > (SIZE_MAX - state_header_size) / 4) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    if (header.block_size != state_codec_block_size
+        || size != state_header_size + payload_size(header.format, header.n_elements)) {
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+    bool delta = header.flags & state_flag_delta;
+    if (delta && (base == nullptr || base->size() != header.n_elements || hash_state(*base) != header.base_hash)) {
+        // a delta is meaningless against any other base
+        return RWKV_ERROR_INVALID_PARAMETERS;
+    }
+
+    const size_t n = header.n_elements;
+    const uint8_t * payload = data + state_header_size;
+    state.resize(n);
+    switch (header.format) {
+        case RWKV_STATE_FORMAT_FP32:
+            memcpy(state.data(), payload, n * 4);
+            break;
+        case RWKV_STATE_FORMAT_FP16:
+            for (size_t i = 0; i < n; i++) {
+                uint16_t v;
+                memcpy(&v, payload + 2 * i, 2);
+                state[i] = fp16_to_fp32(v);
+            }
+            break;
+        case RWKV_STATE_FORMAT_BF16:
+            for (size_t i = 0; i < n; i++) {
+                uint16_t v;
+                memcpy(&v, payload + 2 * i, 2);
+                state[i] = bf16_to_fp32(v);
+            }
+            break;
+        case RWKV_STATE_FORMAT_INT8:
+            for (size_t begin = 0; begin < n; begin += state_codec_block_size) {
+                size_t end = std::min<size_t>(n, begin + state_codec_block_size);
+                float scale;
+                memcpy(&scale, payload, 4);
+                payload += 4;
+                for (size_t i = begin; i < end; i++) {
+                    state[i] = (int8_t)*payload++ * scale;
+                }
+            }
+            break;
+    }
+    if (delta) {
+        for (size_t i = 0; i < n; i++) {
+            state[i] += (*base)[i];
+        }
+    }
+    return RWKV_SUCCESS;
+}
+
+}
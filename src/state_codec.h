@@ -0,0 +1,32 @@
+#ifndef STATE_CODEC_H
+#define STATE_CODEC_H
+
+#include <cstdint>
+#include <vector>
+#include "commondef.h"
+
+namespace rwkvmobile {
+
+enum {
+    RWKV_STATE_FORMAT_FP32 = 0,
+    RWKV_STATE_FORMAT_FP16,
+    RWKV_STATE_FORMAT_BF16,
+    // per-block int8 with one fp32 scale per block
+    RWKV_STATE_FORMAT_INT8,
+    RWKV_STATE_FORMAT_COUNT,
+};
+
+// elements per int8 block
+const uint32_t state_codec_block_size = 64;
+
+// serializes a state as a versioned header followed by the payload in `format`.
+// with a base state (e.g. the state after a system prompt) only state - base is stored,
+// which is much smaller in magnitude and so loses less precision;
+// the same base has to be passed to state_decode
+int state_encode(const std::vector<float> &state, int format, const std::vector<float> * base, std::vector<uint8_t> &data);
+
+int state_decode(const uint8_t * data, size_t size, const std::vector<float> * base, std::vector<float> &state);
+
+}
+
+#endif
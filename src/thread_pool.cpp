@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+#if defined(__linux__) || defined(__ANDROID__)
+#include <sched.h>
+#endif
+
+#include "thread_pool.h"
+
+namespace rwkvmobile {
+
+// iterations a worker busy-waits for new work before going to sleep;
+// decode steps come back-to-back, so this keeps wake-up latency low
+static const int spin_iterations = 1 << 14;
+
+static thread_local bool in_pool_worker = false;
+
+std::vector<int> detect_big_cores() {
+    int n_cpus = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> cpus;
+    std::vector<long> freqs;
+    for (int i = 0; i < n_cpus; i++) {
+        std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(i) + "/cpufreq/cpuinfo_max_freq");
+        long freq = 0;
+        if (!(file >> freq)) {
+            freq = 0;
+        }
+        cpus.push_back(i);
+        freqs.push_back(freq);
+    }
+
+    long min_freq = *std::min_element(freqs.begin(), freqs.end());
+    long max_freq = *std::max_element(freqs.begin(), freqs.end());
+    if (min_freq == max_freq) {
+        return cpus;
+    }
+    // drop only the LITTLE tier, so that prime + big clusters are both used
+    std::vector<int> big_cores;
+    for (int i = 0; i < n_cpus; i++) {
+        if (freqs[i] > min_freq) {
+            big_cores.push_back(cpus[i]);
+        }
+    }
+    return big_cores;
+}
+
+static void set_current_thread_affinity(const std::vector<int> &cpu_ids) {
+#if defined(__linux__) || defined(__ANDROID__)
+    if (cpu_ids.empty()) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto id : cpu_ids) {
+        CPU_SET(id, &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+
+thread_pool::thread_pool(int n_threads, std::vector<int> cpu_ids) {
+    _cpu_ids = cpu_ids.empty() ? detect_big_cores() : cpu_ids;
+    _n_threads = n_threads > 0 ? n_threads : std::max<int>(1, _cpu_ids.size());
+    _partitions = std::unique_ptr<partition[]>(new partition[_n_threads]);
+    // the caller of parallel_for acts as thread 0
+    for (int i = 1; i < _n_threads; i++) {
+        _workers.emplace_back(&thread_pool::worker_loop, this, i);
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(_wake_mutex);
+        _stop = true;
+        _generation++;
+    }
+    _wake_cv.notify_all();
+    for (auto &worker : _workers) {
+        worker.join();
+    }
+}
+
+std::shared_ptr<thread_pool> thread_pool::global() {
+    static std::shared_ptr<thread_pool> pool = std::make_shared<thread_pool>();
+    return pool;
+}
+
+void thread_pool::worker_loop(int index) {
+    in_pool_worker = true;
+    if (!_cpu_ids.empty()) {
+        // each worker gets one cpu when there are enough, otherwise the whole set
+        if ((int)_cpu_ids.size() >= _n_threads) {
+            set_current_thread_affinity({_cpu_ids[index]});
+        } else {
+            set_current_thread_affinity(_cpu_ids);
+        }
+    }
+
+    uint64_t seen = 0;
+    while (true) {
+        int spins = 0;
+        while (_generation.load(std::memory_order_acquire) == seen && spins < spin_iterations) {
+            spins++;
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield");
+#endif
+        }
+        if (_generation.load(std::memory_order_acquire) == seen) {
+            std::unique_lock<std::mutex> lock(_wake_mutex);
+            _wake_cv.wait(lock, [&] { return _generation.load() != seen; });
+        }
+        seen = _generation.load(std::memory_order_acquire);
+        if (_stop) {
+            return;
+        }
+        run_partitions(index);
+        _pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void thread_pool::run_partitions(int self) {
+    // drain own partition first, then steal from the others
+    for (int i = 0; i < _n_partitions; i++) {
+        auto &part = _partitions[(self + i) % _n_partitions];
+        while (true) {
+            size_t chunk_begin = part.next.fetch_add(_grain, std::memory_order_relaxed);
+            if (chunk_begin >= part.end) {
+                break;
+            }
+            _fn(_fn_ctx, chunk_begin, std::min(chunk_begin + _grain, part.end));
+        }
+    }
+}
+
+void thread_pool::parallel_for_impl(size_t begin, size_t end, size_t grain, chunk_fn fn, void * ctx) {
+    if (begin >= end) {
+        return;
+    }
+    grain = std::max<size_t>(grain, 1);
+    size_t n_chunks = (end - begin + grain - 1) / grain;
+    if (_n_threads == 1 || n_chunks == 1 || in_pool_worker) {
+        fn(ctx, begin, end);
+        return;
+    }
+    std::unique_lock<std::mutex> submit(_submit_mutex, std::try_to_lock);
+    if (!submit.owns_lock()) {
+        fn(ctx, begin, end);
+        return;
+    }
+
+    _n_partitions = std::min<size_t>(_n_threads, n_chunks);
+    size_t chunks_per_partition = (n_chunks + _n_partitions - 1) / _n_partitions;
+    for (int i = 0; i < _n_partitions; i++) {
+        size_t part_begin = begin + i * chunks_per_partition * grain;
+        _partitions[i].next.store(std::min(part_begin, end), std::memory_order_relaxed);
+        _partitions[i].end = std::min(part_begin + chunks_per_partition * grain, end);
+    }
+    _fn = fn;
+    _fn_ctx = ctx;
+    _grain = grain;
+    _pending.store(_workers.size(), std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(_wake_mutex);
+        _generation.fetch_add(1, std::memory_order_release);
+    }
+    _wake_cv.notify_all();
+
+    in_pool_worker = true;
+    run_partitions(0);
+    in_pool_worker = false;
+    while (_pending.load(std::memory_order_acquire) > 0) {
+        std::this_thread::yield();
+    }
+    _fn = nullptr;
+}
+
+async_worker::async_worker() {
+    _thread = std::thread(&async_worker::worker_loop, this);
+}
+
+async_worker::~async_worker() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+    _thread.join();
+}
+
+void async_worker::submit_impl(job_fn fn, void * ctx) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [&] { return !_busy; });
+    _fn = fn;
+    _ctx = ctx;
+    _busy = true;
+    lock.unlock();
+    _cv.notify_all();
+}
+
+void async_worker::wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [&] { return !_busy; });
+}
+
+void async_worker::worker_loop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true) {
+        _cv.wait(lock, [&] { return _busy || _stop; });
+        if (_busy) {
+            lock.unlock();
+            _fn(_ctx);
+            lock.lock();
+            _busy = false;
+            _cv.notify_all();
+            continue;
+        }
+        return;
+    }
+}
+
+}
@@ -0,0 +1,106 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <type_traits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rwkvmobile {
+
+// cpus with the highest cpuinfo_max_freq tier (i.e. excluding LITTLE cores);
+// all cpus if the topology can't be read
+std::vector<int> detect_big_cores();
+
+class thread_pool {
+public:
+    // n_threads <= 0: one thread per selected cpu
+    // cpu_ids empty: pin to the big cores detected from sysfs
+    thread_pool(int n_threads = 0, std::vector<int> cpu_ids = {});
+    ~thread_pool();
+
+    // process-wide pool used unless a runtime configures its own
+    static std::shared_ptr<thread_pool> global();
+
+    int get_thread_count() { return _n_threads; }
+    const std::vector<int> & get_cpu_ids() { return _cpu_ids; }
+
+    // calls fn(chunk_begin, chunk_end) over [begin, end) in chunks of `grain`.
+    // the calling thread participates; idle threads steal chunks from others.
+    // nested or concurrent calls fall back to running inline.
+    // fn is called through a plain function pointer, so capturing lambdas don't allocate
+    template <typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, F &&fn) {
+        using fn_type = typename std::remove_reference<F>::type;
+        parallel_for_impl(begin, end, grain, [](void * ctx, size_t chunk_begin, size_t chunk_end) {
+            (*static_cast<fn_type *>(ctx))(chunk_begin, chunk_end);
+        }, (void *)&fn);
+    }
+
+private:
+    using chunk_fn = void (*)(void * ctx, size_t chunk_begin, size_t chunk_end);
+
+    void parallel_for_impl(size_t begin, size_t end, size_t grain, chunk_fn fn, void * ctx);
+    struct alignas(64) partition {
+        std::atomic<size_t> next;
+        size_t end;
+    };
+
+    void worker_loop(int index);
+    void run_partitions(int self);
+
+    int _n_threads;
+    std::vector<int> _cpu_ids;
+    std::vector<std::thread> _workers;
+    std::unique_ptr<partition[]> _partitions;
+
+    std::mutex _submit_mutex;
+    std::mutex _wake_mutex;
+    std::condition_variable _wake_cv;
+    std::atomic<uint64_t> _generation{0};
+    std::atomic<int> _pending{0};
+    std::atomic<bool> _stop{false};
+
+    chunk_fn _fn = nullptr;
+    void * _fn_ctx = nullptr;
+    size_t _grain = 1;
+    int _n_partitions = 0;
+};
+
+// a single background thread running one job at a time, used to overlap
+// cpu-side work with backend evaluation on the calling thread
+class async_worker {
+public:
+    async_worker();
+    ~async_worker();
+
+    // runs fn() on the worker; fn must stay alive until wait() returns.
+    // waits for the previous job first
+    template <typename F>
+    void submit(F &fn) {
+        submit_impl([](void * ctx) { (*static_cast<F *>(ctx))(); }, (void *)&fn);
+    }
+
+    void wait();
+
+private:
+    using job_fn = void (*)(void * ctx);
+
+    void submit_impl(job_fn fn, void * ctx);
+    void worker_loop();
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    job_fn _fn = nullptr;
+    void * _ctx = nullptr;
+    bool _busy = false;
+    bool _stop = false;
+    std::thread _thread;
+};
+
+}
+
+#endif
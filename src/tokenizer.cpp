@@ -1,12 +1,108 @@
+#include <algorithm>
+#include <cstring>
+
 #include "tokenizer.h"
+#include "kernels.h"
 #include "trie.hpp"
 
 namespace rwkvmobile {
 
+size_t tokenizer_base::decode_into(const std::vector<int> &ids, char * buf, size_t cap) const {
+    size_t written = 0;
+    for (auto id : ids) {
+        std::string str = decode(id);
+        if (written + str.size() > cap) {
+            break;
+        }
+        memcpy(buf + written, str.data(), str.size());
+        written += str.size();
+    }
+    return written;
+}
+
+size_t tokenizer_base::decode_into(int id, char * buf, size_t cap) const {
+    std::string str = decode(id);
+    if (str.size() > cap) {
+        return 0;
+    }
+    memcpy(buf, str.data(), str.size());
+    return str.size();
+}
+
+std::vector<std::vector<int>> tokenizer_base::encode_batch(const std::vector<std::string> &strs, thread_pool * pool) const {
+    std::vector<std::vector<int>> result(strs.size());
+    auto encode_range = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            result[i] = encode(strs[i]);
+        }
+    };
+    if (pool != nullptr) {
+        pool->parallel_for(0, strs.size(), 1, encode_range);
+    } else {
+        encode_range(0, strs.size());
+    }
+    return result;
+}
+
+size_t tokenizer_base::encode_range(std::string_view text, size_t begin, size_t stop, std::vector<int> &ids, std::vector<size_t> * offsets) const {
+    const size_t end = std::min(text.size(), stop + max_token_length());
+    size_t pos = begin;
+    for (auto id : encode(text.substr(begin, end - begin))) {
+        if (pos >= stop) {
+            break;
+        }
+        ids.push_back(id);
+        if (offsets != nullptr) {
+            offsets->push_back(pos);
+        }
+        pos += token_length(id);
+    }
+    return pos;
+}
+
+size_t tokenizer_base::encode_incremental(incremental_encoding &state, std::string_view text) const {
+    const size_t max_length = max_token_length();
+    size_t common = kernels().common_prefix(state.text.data(), text.data(), std::min(state.text.size(), text.size()));
+    size_t stable = 0;
+    while (stable < state.ids.size() && state.offsets[stable] + max_length <= common) {
+        stable++;
+    }
+    // kept tokens end inside the common prefix, so the suffix starts at a token boundary
+    size_t begin = stable > 0 ? state.offsets[stable - 1] + token_length(state.ids[stable - 1]) : 0;
+
+    state.ids.resize(stable);
+    state.offsets.resize(stable);
+    encode_range(text, begin, text.size(), state.ids, &state.offsets);
+    state.text.assign(text.data(), text.size());
+    return stable;
+}
+
+trie_tokenizer::~trie_tokenizer() {
+    if (_shrinker_id >= 0) {
+        memory_manager::instance().unregister_shrinker(_shrinker_id);
+    }
+    delete _tokenizer;
+}
+
 int trie_tokenizer::load(const std::string vocab_file) {
     _tokenizer = new TRIE_TOKENIZER(vocab_file);
     if (!_tokenizer->inited())
         return RWKV_ERROR_TOKENIZER;
+    _max_token_length = _tokenizer->maxTokenLength();
+
+    if (_tables_memory.reserve(RWKV_MEMORY_TOKENIZER, _tokenizer->memory_usage()) != RWKV_SUCCESS) {
+        // over budget: the construction-only tables are the first thing to go
+        _tokenizer->release_construction_data();
+        if (_tables_memory.reserve(RWKV_MEMORY_TOKENIZER, _tokenizer->memory_usage()) != RWKV_SUCCESS) {
+            return RWKV_ERROR_TOKENIZER | RWKV_ERROR_ALLOC;
+        }
+        return RWKV_SUCCESS;
+    }
+    _shrinker_id = memory_manager::instance().register_shrinker([this](size_t) -> size_t {
+        size_t freed = _tokenizer->release_construction_data();
+        _tables_memory.shrink(freed);
+        return freed;
+    });
     return RWKV_SUCCESS;
 }
 
@@ -15,8 +111,22 @@ std::vector<int> trie_tokenizer::encode(std::string_view str) const {
     return ids;
 }
 
+size_t trie_tokenizer::token_length(int id) const {
+    size_t len;
+    _tokenizer->tokenBytes(id, len);
+    return len;
+}
+
 std::string trie_tokenizer::decode(int id) const {
-    return _tokenizer->decode(std::vector<int>{id});
+    return _tokenizer->decode(id);
+}
+
+size_t trie_tokenizer::decode_into(const std::vector<int> &ids, char * buf, size_t cap) const {
+    return _tokenizer->decodeInto(ids.data(), ids.size(), buf, cap);
+}
+
+size_t trie_tokenizer::decode_into(int id, char * buf, size_t cap) const {
+    return _tokenizer->decodeInto(&id, 1, buf, cap);
 }
 
 std::string trie_tokenizer::decode(const std::vector<int> &ids) const {
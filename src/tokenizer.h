@@ -4,11 +4,21 @@
 #include <string>
 #include <vector>
 #include "commondef.h"
+#include "thread_pool.h"
+#include "memory_manager.h"
 
 class TRIE_TOKENIZER;
 
 namespace rwkvmobile {
 
+// tokenization of a text that grows between calls of encode_incremental
+struct incremental_encoding {
+    std::string text;
+    std::vector<int> ids;
+    // byte offset in text where each token starts
+    std::vector<size_t> offsets;
+};
+
 class tokenizer_base {
 public:
   tokenizer_base(int pad_token_id, int bos_token_id, int eos_token_id)
@@ -17,8 +27,30 @@ public:
   virtual ~tokenizer_base() = default;
   virtual int load(const std::string vocab_file) = 0;
   virtual std::vector<int> encode(std::string_view str) const = 0;
+  // encodes independent strings in parallel on the pool (serially if pool is null)
+  virtual std::vector<std::vector<int>> encode_batch(const std::vector<std::string> &strs, thread_pool * pool) const;
   virtual std::string decode(const std::vector<int> &ids) const = 0;
   virtual std::string decode(int id) const = 0;
+  // appends whole tokens to buf without allocating, stopping at the first one
+  // that doesn't fit; returns the number of bytes written
+  virtual size_t decode_into(const std::vector<int> &ids, char * buf, size_t cap) const;
+  virtual size_t decode_into(int id, char * buf, size_t cap) const;
+  // upper bound on the bytes a single token decodes to
+  virtual size_t max_token_length() const { return 1; }
+  // bytes of the encoded text that token id stands for
+  virtual size_t token_length(int id) const { return decode(id).size(); }
+  // appends the tokens of text that start in [begin, stop), and their byte offsets in text
+  // if offsets isn't null. begin must be a token boundary of encode(text). a greedy
+  // longest-match token only depends on the max_token_length() bytes at its start, so
+  // only text up to stop + max_token_length() is encoded and the tokens are those of
+  // encode(text). returns where the token after the last appended one starts
+  size_t encode_range(std::string_view text, size_t begin, size_t stop, std::vector<int> &ids, std::vector<size_t> * offsets = nullptr) const;
+  // re-encodes text on top of the previous tokenization in state: the tokens whose
+  // max_token_length() window lies inside the part of text shared with state.text are
+  // kept and only the rest is encoded again (see encode_range). the result equals
+  // encode(text). returns the number of leading tokens that were kept; state.ids after
+  // that are the new suffix
+  virtual size_t encode_incremental(incremental_encoding &state, std::string_view text) const;
   const int pad_token_id;
   const int bos_token_id;
   const int eos_token_id;
@@ -27,23 +59,33 @@ public:
 class trie_tokenizer : public tokenizer_base {
 public:
     trie_tokenizer() : tokenizer_base(0, 0, 0) {};
+    ~trie_tokenizer();
     int load(const std::string vocab_file);
     std::vector<int> encode(std::string_view str) const;
     std::string decode(const std::vector<int> &ids) const;
     std::string decode(int id) const;
+    size_t decode_into(const std::vector<int> &ids, char * buf, size_t cap) const;
+    size_t decode_into(int id, char * buf, size_t cap) const;
+    size_t max_token_length() const { return _max_token_length; }
+    size_t token_length(int id) const;
 private:
-    TRIE_TOKENIZER * _tokenizer;
+    TRIE_TOKENIZER * _tokenizer = nullptr;
+    size_t _max_token_length = 0;
+    memory_reservation _tables_memory;
+    int _shrinker_id = -1;
 };
 
 class abc_tokenizer : public tokenizer_base {
 public:
     abc_tokenizer() : tokenizer_base(0, 2, 3) {};
-    int load(const std::string) const {
+    int load(const std::string) {
         return RWKV_SUCCESS;
     };
     std::vector<int> encode(std::string_view str) const;
     std::string decode(const std::vector<int> &ids) const;
     std::string decode(int id) const;
+    // every id stands for one byte, including the special ids that decode to nothing
+    size_t token_length(int) const { return 1; }
 };
 
 
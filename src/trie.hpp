@@ -8,6 +8,8 @@
 #include <set>
 #include <unordered_map>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <functional>
@@ -257,13 +259,27 @@ std::vector<uint8_t> processEscapes(const std::string &input, bool utf8_string =
 class TRIE : public std::enable_shared_from_this<TRIE> {
     private:
         uint8_t ch;
-        std::vector<std::shared_ptr<TRIE>> to;
+        // children sorted by byte; most nodes have only a few, and a dense
+        // 256-entry table per node costs ~500MB over the whole vocab
+        std::vector<std::pair<uint8_t, std::shared_ptr<TRIE>>> to;
         std::unordered_set<int> values; // Store integer values
-        std::shared_ptr<TRIE> front;
+        TRIE * front; // not owning, so that parent/child links don't form a cycle
+        // direct index for the few wide nodes (root, common prefixes)
+        std::unique_ptr<int16_t[]> dense;
+        static const size_t dense_threshold = 8;
+
+        const std::shared_ptr<TRIE> * child(uint8_t uchar) const {
+            if (dense) {
+                return dense[uchar] < 0 ? nullptr : &to[dense[uchar]].second;
+            }
+            auto it = std::lower_bound(to.begin(), to.end(), uchar,
+                [](const std::pair<uint8_t, std::shared_ptr<TRIE>> &c, uint8_t b) { return c.first < b; });
+            return (it != to.end() && it->first == uchar) ? &it->second : nullptr;
+        }
 
     public:
         // Constructor
-        TRIE(std::shared_ptr<TRIE> front = nullptr, uint8_t ch = 0) : front(front), ch(ch), to(256, nullptr) {}
+        TRIE(TRIE * front = nullptr, uint8_t ch = 0) : front(front), ch(ch) {}
 
         // Add a string to the trie
         std::shared_ptr<TRIE> add(const std::vector<uint8_t>& key, size_t idx = 0, int val = -1) {
@@ -278,10 +294,21 @@ class TRIE : public std::enable_shared_from_this<TRIE> {
                 return shared_from_this();
             }
             uint8_t uchar = key[idx];
-            if (!to[uchar]) {
-                to[uchar] = std::make_shared<TRIE>(shared_from_this(), uchar);
+            auto next = child(uchar);
+            if (next == nullptr) {
+                auto it = std::lower_bound(to.begin(), to.end(), uchar,
+                    [](const std::pair<uint8_t, std::shared_ptr<TRIE>> &c, uint8_t b) { return c.first < b; });
+                it = to.insert(it, {uchar, std::make_shared<TRIE>(this, uchar)});
+                next = &it->second;
+                if (to.size() > dense_threshold) {
+                    dense.reset(new int16_t[256]);
+                    std::fill(dense.get(), dense.get() + 256, -1);
+                    for (size_t i = 0; i < to.size(); i++) {
+                        dense[to[i].first] = i;
+                    }
+                }
             }
-            return to[uchar]->add(key, idx + 1, val);
+            return (*next)->add(key, idx + 1, val);
         }
 
         std::tuple<size_t, int> find_longest_fast(const std::vector<uint8_t>& key, size_t idx = 0) {
@@ -291,8 +318,9 @@ class TRIE : public std::enable_shared_from_this<TRIE> {
 
             if (idx < key.size()) {  // Changed from <= to <
                 uint8_t uchar = key[idx];
-                while (u->to[uchar] != nullptr) {
-                    u = u->to[uchar].get();
+                const std::shared_ptr<TRIE> * next;
+                while ((next = u->child(uchar)) != nullptr) {
+                    u = next->get();
                     ++idx;
                     if (!u->values.empty()) {
                         ret = std::make_tuple(idx, *u->values.begin());
@@ -313,8 +341,9 @@ class TRIE : public std::enable_shared_from_this<TRIE> {
 
             if (idx < key.size()) {  // Changed from <= to <
                 uint8_t uchar = key[idx];
-                while (u->to[uchar] != nullptr) {
-                    u = u->to[uchar];
+                const std::shared_ptr<TRIE> * next;
+                while ((next = u->child(uchar)) != nullptr) {
+                    u = *next;
                     ++idx;
                     if (!u->values.empty()) {
                         ret = std::make_tuple(idx, u, u->values);
@@ -330,10 +359,22 @@ class TRIE : public std::enable_shared_from_this<TRIE> {
         }
 
 
+        // rough heap footprint of this subtree: node, shared_ptr control block,
+        // child list, dense index and values set
+        size_t memory_usage() const {
+            size_t total = sizeof(TRIE) + 16 + 64;
+            total += to.capacity() * sizeof(std::pair<uint8_t, std::shared_ptr<TRIE>>);
+            total += dense ? 256 * sizeof(int16_t) : 0;
+            for (const auto &[uchar, next] : to) {
+                total += next->memory_usage();
+            }
+            return total;
+        }
+
         // Represent the TRIE as a string (for debugging purposes)
         std::string to_string() const {
             std::string result;
-            for (auto fr = shared_from_this(); fr != nullptr; fr = fr->front) { // Directly use shared_ptr for parent
+            for (auto fr = this; fr != nullptr; fr = fr->front) {
                 if (fr->ch != 0) {
                     result = std::string(1, static_cast<char>(fr->ch)) + result;
                 }
@@ -353,7 +394,10 @@ class TRIE : public std::enable_shared_from_this<TRIE> {
 
 class TRIE_TOKENIZER {
     private:
-        std::unordered_map<int, std::vector<uint8_t>> idx2token;
+        // all token bytes back to back; token i is
+        // token_bytes[token_offsets[i], token_offsets[i + 1])
+        std::vector<char> token_bytes;
+        std::vector<uint32_t> token_offsets;
         std::unordered_map<std::vector<uint8_t>, int, VectorHash, VectorEqual> token2idx;
         std::shared_ptr<TRIE> root;
 
@@ -374,6 +418,7 @@ class TRIE_TOKENIZER {
             if (!file.is_open()) {
                 return;
             }
+            std::vector<std::pair<int, std::vector<uint8_t>>> tokens;
             std::string line;
             while (getline(file, line)) {
                 size_t firstSpace = line.find(' ');
@@ -383,9 +428,29 @@ class TRIE_TOKENIZER {
                 bool utf8_string = line[firstSpace+1] != 'b';
                 std::vector<uint8_t> x;
                 x = processEscapes(processVocabFormat(line.substr(firstSpace + 1, lastSpace - firstSpace)), utf8_string, utf8_byte_length);
-                idx2token[idx] = x;
                 token2idx[x] = idx;
                 root->add(x, 0, idx);
+                tokens.emplace_back(idx, std::move(x));
+            }
+
+            int max_idx = -1;
+            size_t total_bytes = 0;
+            for (const auto &[idx, bytes] : tokens) {
+                max_idx = std::max(max_idx, idx);
+                total_bytes += bytes.size();
+            }
+            std::sort(tokens.begin(), tokens.end(),
+                [](const auto &a, const auto &b) { return a.first < b.first; });
+            token_bytes.reserve(total_bytes);
+            token_offsets.assign(max_idx + 2, 0);
+            auto it = tokens.begin();
+            for (int idx = 0; idx <= max_idx; idx++) {
+                // ids missing from the vocab decode to nothing
+                if (it != tokens.end() && it->first == idx) {
+                    token_bytes.insert(token_bytes.end(), it->second.begin(), it->second.end());
+                    ++it;
+                }
+                token_offsets[idx + 1] = token_bytes.size();
             }
             _inited = true;
         }
@@ -401,16 +466,56 @@ class TRIE_TOKENIZER {
             std::cout << "String: " << bytesToString(bytes) << std::endl;
         }
 
-        std::vector<uint8_t> decodeBytes(const std::vector<int>& tokens) {
-            std::vector<uint8_t> resultBytes;
-            for (int token : tokens) {
-                auto it = idx2token.find(token);
-                if (it != idx2token.end()) {
-                    const auto& bytes = it->second;
-                    resultBytes.insert(resultBytes.end(), bytes.begin(), bytes.end());
+        // bytes of a single token, pointing into the arena; an empty string for unknown
+        // ids, never null, so that the result can always be passed to memcpy
+        const char * tokenBytes(int token, size_t &len) const {
+            static const char empty[1] = {0};
+            if (token < 0 || token + 1 >= (int)token_offsets.size()) {
+                len = 0;
+                return empty;
+            }
+            len = token_offsets[token + 1] - token_offsets[token];
+            return len == 0 ? empty : token_bytes.data() + token_offsets[token];
+        }
+
+        // appends whole tokens to buf until the next one doesn't fit
+        // returns the number of bytes written
+        size_t decodeInto(const int * tokens, size_t n_tokens, char * buf, size_t cap) const {
+            size_t written = 0;
+            for (size_t i = 0; i < n_tokens; i++) {
+                size_t len;
+                const char * bytes = tokenBytes(tokens[i], len);
+                if (written + len > cap) {
+                    break;
                 }
+                memcpy(buf + written, bytes, len);
+                written += len;
+            }
+            return written;
+        }
+
+        size_t maxTokenLength() const {
+            size_t result = 0;
+            for (size_t i = 0; i + 1 < token_offsets.size(); i++) {
+                result = std::max<size_t>(result, token_offsets[i + 1] - token_offsets[i]);
+            }
+            return result;
+        }
+
+        size_t decodedLength(const int * tokens, size_t n_tokens) const {
+            size_t total = 0;
+            for (size_t i = 0; i < n_tokens; i++) {
+                size_t len;
+                tokenBytes(tokens[i], len);
+                total += len;
             }
-            return resultBytes; // Convert the byte vector back to a string
+            return total;
+        }
+
+        std::vector<uint8_t> decodeBytes(const std::vector<int>& tokens) {
+            std::vector<uint8_t> resultBytes(decodedLength(tokens.data(), tokens.size()));
+            decodeInto(tokens.data(), tokens.size(), reinterpret_cast<char *>(resultBytes.data()), resultBytes.size());
+            return resultBytes;
         }
         
         std::vector<int> encodeBytes(const std::vector<uint8_t>& src) {
@@ -459,13 +564,22 @@ class TRIE_TOKENIZER {
 #endif
 
         std::string decode(const std::vector<int>& tokens) {
-            return bytesToString(decodeBytes(tokens));
+            std::string result(decodedLength(tokens.data(), tokens.size()), '\0');
+            decodeInto(tokens.data(), tokens.size(), result.data(), result.size());
+            return result;
+        }
+
+        std::string decode(int token) {
+            size_t len;
+            const char * bytes = tokenBytes(token, len);
+            return std::string(bytes, len);
         }
 
         void printTokens(const std::vector<int>& tokens) {
             for (auto i : tokens) {
-                auto s = idx2token[i];
-                std::cout << bytesToString(s) << " ";
+                size_t len;
+                const char * bytes = tokenBytes(i, len);
+                std::cout << std::string(bytes, len) << " ";
             }
             std::cout << std::endl;
         }
@@ -473,6 +587,30 @@ class TRIE_TOKENIZER {
         bool inited() {
             return _inited;
         }
+
+        // rough heap footprint of the lookup tables, for memory accounting
+        size_t memory_usage() const {
+            size_t total = token_bytes.capacity() + token_offsets.capacity() * sizeof(uint32_t);
+            total += token2idx_memory_usage();
+            total += root->memory_usage();
+            return total;
+        }
+
+        size_t token2idx_memory_usage() const {
+            size_t total = 0;
+            for (const auto &[bytes, idx] : token2idx) {
+                total += bytes.capacity() + sizeof(bytes) + sizeof(idx) + 2 * sizeof(void *);
+            }
+            return total;
+        }
+
+        // token2idx is only needed while building the vocab; encode uses the TRIE
+        // returns the number of bytes freed
+        size_t release_construction_data() {
+            size_t freed = token2idx_memory_usage();
+            std::unordered_map<std::vector<uint8_t>, int, VectorHash, VectorEqual>().swap(token2idx);
+            return freed;
+        }
     };
 
 #endif // TRIE_HPP
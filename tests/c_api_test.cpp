@@ -0,0 +1,78 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "c_api.h"
+#include "commondef.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+// output buffers sit inside a larger one filled with a guard byte, so that any write
+// past the size handed to the C API shows up
+static const char guard = 0x5a;
+
+static bool untouched_after(const char * buffer, size_t from, size_t size) {
+    for (size_t i = from; i < size; i++) {
+        if (buffer[i] != guard) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_regenerate_chat(rwkvmobile_runtime_t rt) {
+    char response[4096];
+    CHECK(rwkvmobile_runtime_regenerate_chat(rt, response, sizeof(response)) != RWKV_SUCCESS);
+    CHECK(rwkvmobile_runtime_eval_chat(rt, "User", "Assistant", "Tell me a story about a cat.", response, 64) == RWKV_SUCCESS);
+    CHECK(rwkvmobile_runtime_get_chat_turn_count(rt) == 1);
+
+    memset(response, guard, sizeof(response));
+    CHECK(rwkvmobile_runtime_regenerate_chat(rt, response, sizeof(response)) == RWKV_SUCCESS);
+    CHECK(memchr(response, '\0', sizeof(response)) != nullptr);
+    CHECK(strlen(response) > 8);
+    CHECK(rwkvmobile_runtime_get_chat_turn_count(rt) == 1);
+
+    memset(response, guard, sizeof(response));
+    CHECK(rwkvmobile_runtime_regenerate_chat(rt, response, 8) == RWKV_SUCCESS);
+    CHECK(strlen(response) == 7);
+    CHECK(untouched_after(response, 8, sizeof(response)));
+
+    memset(response, guard, sizeof(response));
+    CHECK(rwkvmobile_runtime_regenerate_chat(rt, response, 1) == RWKV_SUCCESS);
+    CHECK(response[0] == '\0');
+    CHECK(untouched_after(response, 1, sizeof(response)));
+
+    CHECK(rwkvmobile_runtime_regenerate_chat(rt, response, 0) != RWKV_SUCCESS);
+    CHECK(rwkvmobile_runtime_regenerate_chat(rt, nullptr, sizeof(response)) != RWKV_SUCCESS);
+    CHECK(rwkvmobile_runtime_regenerate_chat(nullptr, response, sizeof(response)) != RWKV_SUCCESS);
+}
+
+// a backend that can't hand out its state: chat still works, but there is nothing to
+// checkpoint or save, and saying so beats restoring an empty state
+static void test_without_state(rwkvmobile_runtime_t rt) {
+    char response[4096];
+    CHECK(rwkvmobile_runtime_eval_chat(rt, "User", "Assistant", "Tell me a story about a cat.", response, 64) == RWKV_SUCCESS);
+    CHECK(rwkvmobile_runtime_get_chat_turn_count(rt) == 0);
+    CHECK(rwkvmobile_runtime_regenerate_chat(rt, response, sizeof(response)) != RWKV_SUCCESS);
+    size_t size = 0;
+    CHECK(rwkvmobile_runtime_get_state_compressed(rt, 0, nullptr, 0, nullptr, 0, &size) != RWKV_SUCCESS);
+    CHECK(rwkvmobile_runtime_clear_state(rt) == RWKV_SUCCESS);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <vocab_file> <model_file>\n", argv[0]);
+        return 1;
+    }
+    rwkvmobile_runtime_t rt = rwkvmobile_runtime_init_with_name("rwkv.cpp");
+    int ret = rwkvmobile_runtime_load_tokenizer(rt, argv[1]);
+    if (!ret) ret = rwkvmobile_runtime_load_model(rt, argv[2]);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret == RWKV_SUCCESS && std::getenv("MOCK_BACKEND_NO_STATE") != nullptr) {
+        test_without_state(rt);
+    } else if (ret == RWKV_SUCCESS) {
+        test_regenerate_chat(rt);
+    }
+    rwkvmobile_session_release(rt);
+    return TEST_RESULT();
+}
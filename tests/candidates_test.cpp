@@ -0,0 +1,61 @@
+#include <set>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "runtime.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+// gen_candidates on the mock: branches fork one prefill state and take it over once
+// they are its last holder, so a branch must never see another branch's tokens
+
+static const std::string prompt = "User: Tell me a story about a cat.\n\nAssistant:";
+
+// with top_k = 1 every best-of-n branch is the greedy completion
+static void test_greedy_best_of_n(runtime &rt) {
+    rt.set_sampler_params(1.f, 1, 1.f);
+    std::string expected;
+    CHECK(rt.clear_state() == RWKV_SUCCESS);
+    CHECK(rt.gen_completion(prompt, expected, 24) == RWKV_SUCCESS);
+
+    std::vector<candidate> candidates;
+    CHECK(rt.clear_state() == RWKV_SUCCESS);
+    CHECK(rt.gen_candidates(prompt, 4, 24, RWKV_SEARCH_BEST_OF_N, candidates) == RWKV_SUCCESS);
+    CHECK(candidates.size() == 4);
+    for (auto &c : candidates) {
+        CHECK(c.text == expected);
+        CHECK(c.logprob == candidates[0].logprob);
+    }
+}
+
+static void test_beam(runtime &rt) {
+    std::vector<candidate> candidates;
+    CHECK(rt.clear_state() == RWKV_SUCCESS);
+    CHECK(rt.gen_candidates(prompt, 4, 16, RWKV_SEARCH_BEAM, candidates) == RWKV_SUCCESS);
+    CHECK(candidates.size() == 4);
+    std::set<std::vector<int>> distinct;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        CHECK(i == 0 || candidates[i - 1].logprob >= candidates[i].logprob);
+        distinct.insert(candidates[i].ids);
+    }
+    CHECK(distinct.size() == candidates.size());
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <vocab_file> <model_file>\n", argv[0]);
+        return 1;
+    }
+    runtime rt;
+    int ret = rt.init("rwkv.cpp");
+    if (!ret) ret = rt.load_tokenizer(argv[1]);
+    if (!ret) ret = rt.load_model(argv[2]);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret == RWKV_SUCCESS) {
+        test_greedy_best_of_n(rt);
+        test_beam(rt);
+    }
+    return TEST_RESULT();
+}
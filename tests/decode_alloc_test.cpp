@@ -0,0 +1,148 @@
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "runtime.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+// every operator new of the process goes through here; while counting, each one is
+// counted, whichever thread makes it (thread pool workers, the stream worker)
+static std::atomic<bool> counting{false};
+static std::atomic<size_t> allocations{0};
+
+static void * counted_alloc(size_t size) {
+    if (counting.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void * p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void * operator new(size_t size) { return counted_alloc(size); }
+void * operator new[](size_t size) { return counted_alloc(size); }
+void * operator new(size_t size, const std::nothrow_t &) noexcept {
+    try {
+        return counted_alloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+void * operator new[](size_t size, const std::nothrow_t &) noexcept {
+    try {
+        return counted_alloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+void operator delete(void * p) noexcept { std::free(p); }
+void operator delete[](void * p) noexcept { std::free(p); }
+void operator delete(void * p, size_t) noexcept { std::free(p); }
+void operator delete[](void * p, size_t) noexcept { std::free(p); }
+
+static size_t count_allocations(const std::function<void()> &fn) {
+    allocations = 0;
+    counting = true;
+    fn();
+    counting = false;
+    return allocations;
+}
+
+static const std::string prompt = "User: Tell me a story about a cat.\n\nAssistant:";
+
+// prefill once, then every decode_step of the steady state must stay off the heap
+static void test_decode_step(runtime &rt, int precision) {
+    CHECK(rt.set_logits_precision(precision) == RWKV_SUCCESS);
+    rt.clear_state();
+    rt.set_seed(42);
+    CHECK(rt.prefill(rt.tokenizer_encode(prompt)) == RWKV_SUCCESS);
+    int token = 0;
+    // the first token may still size buffers
+    CHECK(rt.decode_step(token) == RWKV_SUCCESS);
+    size_t n = count_allocations([&]() {
+        for (int i = 0; i < 64; i++) {
+            rt.decode_step(token);
+        }
+    });
+    if (n != 0) {
+        fprintf(stderr, "decode_step (precision %d): %zu allocations over 64 tokens\n", precision, n);
+    }
+    CHECK(n == 0);
+}
+
+// whole calls of a generation entry point for two lengths: the per-call setup is the
+// same, so any difference is allocations per generated token
+static void test_entry_point(runtime &rt, const char * name, const std::function<void(int)> &generate) {
+    auto run = [&](int length) {
+        rt.clear_state();
+        rt.set_seed(42);
+        return count_allocations([&]() { generate(length); });
+    };
+    // warm up at the longer length, so that buffers sized on first use (the output
+    // text reserved for length tokens among them) don't count
+    run(72);
+    size_t short_run = run(8);
+    size_t long_run = run(72);
+    if (long_run != short_run) {
+        fprintf(stderr, "%s: %zu allocations for 8 tokens, %zu for 72\n", name, short_run, long_run);
+    }
+    CHECK(long_run == short_run);
+}
+
+// the output reserved up front is bounded whatever length the caller asks for
+static void test_output_reserve_capped(runtime &rt) {
+    const size_t max_token_length = rt.get_model()->get_tokenizer()->max_token_length();
+    std::string text = "stale";
+    rt.reserve_output(text, 16);
+    CHECK(text.empty() && text.capacity() >= 17 * max_token_length);
+    std::string huge;
+    rt.reserve_output(huge, 1 << 30);
+    CHECK(huge.capacity() <= 1025 * max_token_length + 64);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <vocab_file> <model_file>\n", argv[0]);
+        return 1;
+    }
+    runtime rt;
+    int ret = rt.init("rwkv.cpp");
+    if (!ret) ret = rt.load_tokenizer(argv[1]);
+    if (!ret) ret = rt.load_model(argv[2]);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret != RWKV_SUCCESS) {
+        return TEST_RESULT();
+    }
+
+    test_output_reserve_capped(rt);
+    test_decode_step(rt, RWKV_LOGITS_FP32);
+    test_decode_step(rt, RWKV_LOGITS_FP16);
+    test_decode_step(rt, RWKV_LOGITS_BF16);
+    rt.set_logits_precision(RWKV_LOGITS_FP32);
+
+    std::string text;
+    test_entry_point(rt, "gen_completion", [&](int length) {
+        rt.gen_completion(prompt, text, length);
+    });
+    test_entry_point(rt, "chat", [&](int length) {
+        rt.chat("User", "Assistant", "Tell me a story about a cat.", text, length);
+    });
+    const std::vector<std::string> stop = {"\n\nUser:"};
+    size_t callback_bytes = 0;
+    token_callback callback = [&](const char * piece, size_t size) {
+        callback_bytes += size;
+        return true;
+    };
+    test_entry_point(rt, "gen_completion_stream", [&](int length) {
+        rt.gen_completion_stream(prompt, text, length, stop, callback);
+    });
+    return TEST_RESULT();
+}
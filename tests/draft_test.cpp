@@ -0,0 +1,92 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "commondef.h"
+#include "memory_manager.h"
+#include "runtime.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+// everything a runtime and its draft reserved is given back by release(), apart from
+// the tokenizer, which the model keeps until it is destroyed
+static void test_release_frees_draft(const char * vocab_file, const char * model_file) {
+    auto &mm = memory_manager::instance();
+    CHECK(mm.get_usage() == 0);
+    runtime rt;
+    int ret = rt.init("rwkv.cpp");
+    if (!ret) ret = rt.load_tokenizer(vocab_file);
+    if (!ret) ret = rt.load_model(model_file);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret != RWKV_SUCCESS) {
+        return;
+    }
+    size_t model_usage = mm.get_usage();
+    CHECK(rt.load_draft_model("rwkv.cpp", model_file, 4) == RWKV_SUCCESS);
+    std::string text;
+    CHECK(rt.gen_completion("User: Tell me a story about a cat.\n\nAssistant:", text, 32) == RWKV_SUCCESS);
+    CHECK(rt.get_speculative_stats().drafted > 0);
+    CHECK(mm.get_usage() > model_usage);
+
+    CHECK(rt.release() == RWKV_SUCCESS);
+    CHECK(mm.get_usage() == mm.get_usage(RWKV_MEMORY_TOKENIZER));
+    // releasing the draft afterwards is a no-op
+    CHECK(rt.release_draft_model() == RWKV_SUCCESS);
+}
+
+// the destructor alone doesn't leak the draft either
+static void test_destructor_frees_draft(const char * vocab_file, const char * model_file) {
+    auto &mm = memory_manager::instance();
+    {
+        runtime rt;
+        int ret = rt.init("rwkv.cpp");
+        if (!ret) ret = rt.load_tokenizer(vocab_file);
+        if (!ret) ret = rt.load_model(model_file);
+        if (!ret) ret = rt.load_draft_model("rwkv.cpp", model_file, 4);
+        CHECK(ret == RWKV_SUCCESS);
+        std::string text;
+        CHECK(rt.gen_completion("User: Hello\n\nAssistant:", text, 8) == RWKV_SUCCESS);
+    }
+    CHECK(mm.get_usage() == 0);
+}
+
+// with top_k = 1 every token the draft proposes is either the model's own choice or
+// rejected, so speculative decoding must produce exactly what plain decoding does.
+// the mock loads a weaker model from a path containing "draft", so both happen
+static void test_greedy_matches_plain(const char * vocab_file, const char * model_file) {
+    const std::string prompt = "User: Tell me a story about a cat.\n\nAssistant:";
+    const std::string draft_file = (std::filesystem::temp_directory_path() / "rwkv_mobile_test_draft.bin").string();
+    std::ofstream(draft_file) << "draft";
+    runtime rt;
+    int ret = rt.init("rwkv.cpp");
+    if (!ret) ret = rt.load_tokenizer(vocab_file);
+    if (!ret) ret = rt.load_model(model_file);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret != RWKV_SUCCESS) {
+        return;
+    }
+    rt.set_sampler_params(1.f, 1, 1.f);
+    std::string plain, speculative;
+    CHECK(rt.gen_completion(prompt, plain, 200) == RWKV_SUCCESS);
+    CHECK(rt.load_draft_model("rwkv.cpp", draft_file, 4) == RWKV_SUCCESS);
+    CHECK(rt.clear_state() == RWKV_SUCCESS);
+    CHECK(rt.gen_completion(prompt, speculative, 200) == RWKV_SUCCESS);
+    CHECK(speculative == plain);
+    auto stats = rt.get_speculative_stats();
+    CHECK(stats.accepted > 0);
+    CHECK(stats.accepted < stats.drafted);
+    rt.release();
+    std::filesystem::remove(draft_file);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <vocab_file> <model_file>\n", argv[0]);
+        return 1;
+    }
+    test_release_frees_draft(argv[1], argv[2]);
+    test_destructor_frees_draft(argv[1], argv[2]);
+    test_greedy_matches_plain(argv[1], argv[2]);
+    return TEST_RESULT();
+}
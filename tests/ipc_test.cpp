@@ -0,0 +1,196 @@
+// runs rwkv_mobile_daemon over the mock backend and talks to it both through the ipc
+// backend and with hand-made requests
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "commondef.h"
+#include "half.h"
+#include "ipc_protocol.h"
+#include "runtime.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+static int connect_to(const std::string &socket_path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socket_path.c_str(), socket_path.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static pid_t start_daemon(const char * daemon, const char * model_file, const std::string &socket_path, const char * mode) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (mode == nullptr) {
+            execl(daemon, daemon, "rwkv.cpp", model_file, socket_path.c_str(), (char *)nullptr);
+        } else {
+            execl(daemon, daemon, "rwkv.cpp", model_file, socket_path.c_str(), mode, (char *)nullptr);
+        }
+        _exit(127);
+    }
+    // listening once a connection goes through
+    for (int i = 0; i < 1000; i++) {
+        int fd = connect_to(socket_path);
+        if (fd >= 0) {
+            close(fd);
+            return pid;
+        }
+        usleep(10 * 1000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    return -1;
+}
+
+static void stop_daemon(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
+
+static int socket_mode(const std::string &socket_path) {
+    struct stat st;
+    if (stat(socket_path.c_str(), &st) != 0) {
+        return -1;
+    }
+    return st.st_mode & 0777;
+}
+
+// a path length the daemon must not allocate for: it drops the connection instead of
+// waiting for 4 GB of path
+static void test_rejects_long_path(const std::string &socket_path) {
+    int fd = connect_to(socket_path);
+    CHECK(fd >= 0);
+    if (fd < 0) {
+        return;
+    }
+    struct timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ipc_request request = {ipc_protocol_version, IPC_OP_LOAD_MODEL, 0, 0, 0xffffffffu};
+    CHECK(send(fd, &request, sizeof(request), MSG_NOSIGNAL) == (ssize_t)sizeof(request));
+    char byte;
+    CHECK(recv(fd, &byte, 1, 0) == 0);
+    close(fd);
+}
+
+// the daemon evaluates exactly like the backend it serves
+static void test_eval_matches_local(const std::string &socket_path, const char * vocab_file, const char * model_file) {
+    runtime local, remote;
+    int ret = local.init("rwkv.cpp");
+    if (!ret) ret = local.load_tokenizer(vocab_file);
+    if (!ret) ret = local.load_model(model_file);
+    CHECK(ret == RWKV_SUCCESS);
+    ret = remote.init("ipc:" + socket_path);
+    if (!ret) ret = remote.load_tokenizer(vocab_file);
+    if (!ret) ret = remote.load_model(model_file);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret != RWKV_SUCCESS) {
+        return;
+    }
+    std::vector<int> ids = local.tokenizer_encode("User: Tell me a story about a cat.\n\nAssistant:");
+    std::vector<float> local_logits(65536), remote_logits(65536);
+    CHECK(local.eval_logits(ids, local_logits) == RWKV_SUCCESS);
+    CHECK(remote.eval_logits(ids, remote_logits) == RWKV_SUCCESS);
+    CHECK(local_logits == remote_logits);
+    CHECK(local.eval_logits(42, local_logits) == RWKV_SUCCESS);
+    CHECK(remote.eval_logits(42, remote_logits) == RWKV_SUCCESS);
+    CHECK(local_logits == remote_logits);
+    remote.release();
+    local.release();
+}
+
+// half-precision logits come over as the daemon's fp32 logits rounded, and generation
+// from them matches a local backend producing the same half logits
+static void test_half_logits(const std::string &socket_path, const char * vocab_file, const char * model_file) {
+    runtime local, remote;
+    int ret = local.init("rwkv.cpp");
+    if (!ret) ret = local.load_tokenizer(vocab_file);
+    if (!ret) ret = local.load_model(model_file);
+    CHECK(ret == RWKV_SUCCESS);
+    ret = remote.init("ipc:" + socket_path);
+    if (!ret) ret = remote.load_tokenizer(vocab_file);
+    if (!ret) ret = remote.load_model(model_file);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret != RWKV_SUCCESS) {
+        return;
+    }
+    const std::string prompt = "User: Tell me a story about a cat.\n\nAssistant:";
+    std::vector<int> ids = local.tokenizer_encode(prompt);
+    std::vector<float> local_logits(65536);
+    std::vector<uint16_t> remote_logits(65536);
+    auto backend = remote.get_model()->get_backend();
+    for (int precision : {RWKV_LOGITS_FP16, RWKV_LOGITS_BF16}) {
+        CHECK(local.clear_state() == RWKV_SUCCESS);
+        CHECK(backend->clear_state() == RWKV_SUCCESS);
+        CHECK(local.eval_logits(ids, local_logits) == RWKV_SUCCESS);
+        CHECK(backend->eval_half(ids, remote_logits, precision) == RWKV_SUCCESS);
+        size_t mismatches = 0;
+        for (size_t i = 0; i < local_logits.size(); i++) {
+            uint16_t expected = precision == RWKV_LOGITS_BF16 ? fp32_to_bf16(local_logits[i]) : fp32_to_fp16(local_logits[i]);
+            mismatches += remote_logits[i] != expected;
+        }
+        CHECK(mismatches == 0);
+
+        std::string local_text, remote_text;
+        for (auto rt : {&local, &remote}) {
+            CHECK(rt->set_logits_precision(precision) == RWKV_SUCCESS);
+            CHECK(rt->clear_state() == RWKV_SUCCESS);
+            rt->set_seed(7);
+            CHECK(rt->gen_completion(prompt, rt == &local ? local_text : remote_text, 32) == RWKV_SUCCESS);
+        }
+        CHECK(!remote_text.empty());
+        CHECK(local_text == remote_text);
+    }
+    CHECK(backend->eval_half(ids, remote_logits, RWKV_LOGITS_FP32) != RWKV_SUCCESS);
+    remote.release();
+    local.release();
+}
+
+int main(int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s <daemon> <vocab_file> <model_file>\n", argv[0]);
+        return 1;
+    }
+    char dir[] = "/tmp/rwkv_mobile_ipc_test_XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        fprintf(stderr, "Failed to create a directory for the socket\n");
+        return 1;
+    }
+    const std::string socket_path = std::string(dir) + "/daemon.sock";
+
+    pid_t pid = start_daemon(argv[1], argv[3], socket_path, nullptr);
+    CHECK(pid > 0);
+    if (pid > 0) {
+        CHECK(socket_mode(socket_path) == 0600);
+        test_rejects_long_path(socket_path);
+        // still serving other connections
+        test_eval_matches_local(socket_path, argv[2], argv[3]);
+        test_half_logits(socket_path, argv[2], argv[3]);
+        stop_daemon(pid);
+    }
+
+    pid = start_daemon(argv[1], argv[3], socket_path, "0660");
+    CHECK(pid > 0);
+    if (pid > 0) {
+        CHECK(socket_mode(socket_path) == 0660);
+        stop_daemon(pid);
+    }
+
+    unlink(socket_path.c_str());
+    rmdir(dir);
+    return TEST_RESULT();
+}
@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "half.h"
+#include "kernels.h"
+#include "test_common.h"
+
+// every kernel table this cpu can run against the generic one, over sizes that
+// exercise the vector tails, and the scalar half conversions they are built on
+
+using namespace rwkvmobile;
+
+static const size_t large_size = 65536;
+
+static bool close_enough(float expected, float actual, float rel) {
+    return std::fabs(expected - actual) <= rel * std::max(1.f, std::fabs(expected));
+}
+
+struct test_data {
+    std::vector<float> logits;
+    std::vector<float> activations;
+    std::vector<float> weights;
+    std::vector<int> ids;
+    std::vector<float> counts;
+    std::string text_a;
+    std::string text_b;
+
+    test_data(size_t n, std::mt19937 &rng) {
+        std::normal_distribution<float> normal(0.f, 3.f);
+        std::uniform_real_distribution<float> uniform(0.f, 1.f);
+        logits.resize(n);
+        activations.resize(n);
+        weights.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            logits[i] = normal(rng);
+            float x = normal(rng) - 3.f;
+            activations[i] = x > 0 ? x * x : 0.f;
+            weights[i] = normal(rng);
+        }
+        counts.assign(n, 0);
+        for (size_t i = 0; i < n; i += 1 + rng() % 7) {
+            ids.push_back(i);
+            counts[i] = 1 + rng() % 5;
+        }
+        std::shuffle(ids.begin(), ids.end(), rng);
+        text_a.resize(n);
+        for (auto &c : text_a) {
+            c = 'a' + rng() % 26;
+        }
+        text_b = text_a;
+    }
+};
+
+static bool check_table(const kernel_table &ref, const kernel_table &k, std::mt19937 &rng) {
+    std::vector<size_t> sizes;
+    for (size_t n = 0; n <= 80; n++) {
+        sizes.push_back(n);
+    }
+    sizes.push_back(4099);
+    sizes.push_back(large_size + 13);
+
+    bool ok = true;
+    auto fail = [&](const char * kernel, size_t n) {
+        std::cerr << k.name << ": " << kernel << " differs from generic at n = " << n << std::endl;
+        ok = false;
+    };
+
+    for (size_t n : sizes) {
+        test_data d(n, rng);
+
+        if (n > 0 && ref.reduce_max(d.logits.data(), n) != k.reduce_max(d.logits.data(), n)) {
+            fail("reduce_max", n);
+        }
+
+        std::vector<float> e_ref(n), e(n);
+        float shift = n > 0 ? ref.reduce_max(d.logits.data(), n) : 0.f;
+        float sum_ref = ref.exp_sum(d.logits.data(), e_ref.data(), n, shift);
+        float sum = k.exp_sum(d.logits.data(), e.data(), n, shift);
+        // summation order differs, and the generic loop accumulates serially
+        double sum_exact = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum_exact += e_ref[i];
+        }
+        bool exp_ok = close_enough(sum_exact, sum_ref, 1e-4f) && close_enough(sum_exact, sum, 1e-4f);
+        for (size_t i = 0; i < n; i++) {
+            exp_ok &= close_enough(e_ref[i], e[i], 1e-6f)
+                && close_enough(std::exp(d.logits[i] - shift), e[i], 1e-6f);
+        }
+        if (!exp_ok) {
+            fail("exp_sum", n);
+        }
+
+        std::vector<int> s_ref(n), s(n);
+        size_t c_ref = ref.select_at_least(d.logits.data(), n, 2.f, s_ref.data());
+        size_t c = k.select_at_least(d.logits.data(), n, 2.f, s.data());
+        if (c_ref != c || !std::equal(s_ref.begin(), s_ref.begin() + c, s.begin())) {
+            fail("select_at_least", n);
+        }
+
+        std::vector<float> l_ref = d.logits, l = d.logits, n_ref = d.counts, n_k = d.counts;
+        ref.penalty_apply(l_ref.data(), n_ref.data(), d.ids.data(), d.ids.size(), 0.5f, 0.25f, 0.996f);
+        k.penalty_apply(l.data(), n_k.data(), d.ids.data(), d.ids.size(), 0.5f, 0.25f, 0.996f);
+        bool penalty_ok = true;
+        for (size_t i = 0; i < n; i++) {
+            penalty_ok &= close_enough(l_ref[i], l[i], 1e-6f) && close_enough(n_ref[i], n_k[i], 1e-6f);
+        }
+        if (!penalty_ok) {
+            fail("penalty_apply", n);
+        }
+
+        for (size_t at : {(size_t)0, n / 3, n / 2 + 1, n == 0 ? 0 : n - 1, n}) {
+            std::string b = d.text_a;
+            if (at < n) {
+                b[at] ^= 1;
+            }
+            if (ref.common_prefix(d.text_a.data(), b.data(), n) != k.common_prefix(d.text_a.data(), b.data(), n)) {
+                fail("common_prefix", n);
+                break;
+            }
+        }
+
+        float magnitude = 0;
+        for (size_t i = 0; i < n; i++) {
+            magnitude += std::fabs(d.logits[i] * d.weights[i]);
+        }
+        float dot_ref = ref.dot(d.logits.data(), d.weights.data(), n);
+        float dot = k.dot(d.logits.data(), d.weights.data(), n);
+        if (std::fabs(dot_ref - dot) > 1e-5f * std::max(magnitude, 1.f)) {
+            fail("dot", n);
+        }
+
+        std::vector<float> y_ref = d.weights, y = d.weights;
+        ref.axpy(y_ref.data(), d.logits.data(), 0.75f, n);
+        k.axpy(y.data(), d.logits.data(), 0.75f, n);
+        bool axpy_ok = true;
+        for (size_t i = 0; i < n; i++) {
+            axpy_ok &= close_enough(y_ref[i], y[i], 1e-6f);
+        }
+        if (!axpy_ok) {
+            fail("axpy", n);
+        }
+
+        std::vector<uint16_t> half(n);
+        std::vector<float> h_ref(n), h(n);
+        for (size_t i = 0; i < n; i++) {
+            half[i] = rng();
+        }
+        for (auto convert : {&kernel_table::fp16_to_fp32, &kernel_table::bf16_to_fp32}) {
+            (ref.*convert)(half.data(), h_ref.data(), n);
+            (k.*convert)(half.data(), h.data(), n);
+            // bitwise, so that nans compare too
+            if (memcmp(h_ref.data(), h.data(), n * sizeof(float)) != 0) {
+                fail(convert == &kernel_table::fp16_to_fp32 ? "fp16_to_fp32" : "bf16_to_fp32", n);
+            }
+        }
+
+        std::vector<uint32_t> i_ref(n), i_k(n);
+        std::vector<float> v_ref(n), v(n);
+        c_ref = ref.compact_nonzero(d.activations.data(), n, i_ref.data(), v_ref.data());
+        c = k.compact_nonzero(d.activations.data(), n, i_k.data(), v.data());
+        if (c_ref != c || !std::equal(i_ref.begin(), i_ref.begin() + c, i_k.begin())
+            || !std::equal(v_ref.begin(), v_ref.begin() + c, v.begin())) {
+            fail("compact_nonzero", n);
+        }
+    }
+    return ok;
+}
+
+// the scalar conversions the tables are checked against
+static bool check_half() {
+    for (uint32_t h = 0; h < 0x10000; h++) {
+        bool nan = (h & 0x7c00) == 0x7c00 && (h & 0x3ff);
+        if (nan ? !std::isnan(fp16_to_fp32(h)) : fp32_to_fp16(fp16_to_fp32(h)) != h) {
+            std::cerr << "fp16 round trip fails for 0x" << std::hex << h << std::endl;
+            return false;
+        }
+        nan = (h & 0x7f80) == 0x7f80 && (h & 0x7f);
+        if (nan ? !std::isnan(bf16_to_fp32(h)) : fp32_to_bf16(bf16_to_fp32(h)) != h) {
+            std::cerr << "bf16 round trip fails for 0x" << std::hex << h << std::endl;
+            return false;
+        }
+    }
+    struct { float value; uint16_t fp16; uint16_t bf16; } known[] = {
+        {1.f, 0x3c00, 0x3f80}, {-2.f, 0xc000, 0xc000}, {65504.f, 0x7bff, 0x4780}, {65520.f, 0x7c00, 0x4780},
+        {5.96046448e-8f, 0x0001, 0x3380}, {1.f + 1.f / 2048, 0x3c00, 0x3f80}, {1.f + 3.f / 2048, 0x3c02, 0x3f80},
+    };
+    for (auto &c : known) {
+        if (fp32_to_fp16(c.value) != c.fp16 || fp32_to_bf16(c.value) != c.bf16) {
+            std::cerr << "wrong rounding of " << c.value << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    std::mt19937 rng(42);
+    CHECK(check_half());
+    for (int isa = 0; isa < RWKV_ISA_COUNT; isa++) {
+        if (isa != RWKV_ISA_GENERIC && is_kernel_isa_available(isa)) {
+            CHECK(check_table(*kernels_generic(), *get_kernel_table(isa), rng));
+        }
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,123 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "commondef.h"
+#include "layer_stream.h"
+#include "memory_manager.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+static const int n_layer = 8;
+static const size_t layer_bytes = 256 * 1024;
+
+static uint8_t expected_byte(int layer, size_t i) {
+    return (uint8_t)(layer * 31 + i / 4096);
+}
+
+// a safetensors file with one F32 tensor per layer, data page-aligned
+static bool write_checkpoint(const std::string &path) {
+    std::string header = "{\"__metadata__\":{\"format\":\"pt\"}";
+    for (int l = 0; l < n_layer; l++) {
+        header += ",\"blocks." + std::to_string(l) + ".att.weight\":{\"dtype\":\"F32\",\"shape\":["
+            + std::to_string(layer_bytes / 4) + "],\"data_offsets\":[" + std::to_string(l * layer_bytes)
+            + "," + std::to_string((l + 1) * layer_bytes) + "]}";
+    }
+    header += "}";
+    header.resize((header.size() + 8 + 4095) / 4096 * 4096 - 8, ' ');
+
+    FILE * f = fopen(path.c_str(), "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    uint8_t size[8];
+    for (int i = 0; i < 8; i++) {
+        size[i] = (uint64_t)header.size() >> (8 * i);
+    }
+    fwrite(size, 1, 8, f);
+    fwrite(header.data(), 1, header.size(), f);
+    std::vector<uint8_t> data(layer_bytes);
+    for (int l = 0; l < n_layer; l++) {
+        for (size_t i = 0; i < layer_bytes; i++) {
+            data[i] = expected_byte(l, i);
+        }
+        fwrite(data.data(), 1, data.size(), f);
+    }
+    return fclose(f) == 0;
+}
+
+static bool layer_intact(layer_stream &stream, int layer) {
+    auto &tensors = stream.get_layer_tensors(layer);
+    if (tensors.size() != 1 || tensors[0].size != layer_bytes) {
+        return false;
+    }
+    const uint8_t * p = stream.data(tensors[0]);
+    for (size_t i = 0; i < layer_bytes; i += 997) {
+        if (p[i] != expected_byte(layer, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// with the process budget as tight as the stream's, a layer read after an eviction is
+// still counted: the evicted layer's bytes are given back before the new ones are asked for
+static void test_accounting_under_budget(const std::string &path) {
+    auto &mm = memory_manager::instance();
+    mm.set_budget(3 * layer_bytes);
+    {
+        layer_stream stream;
+        // no prefetch: the io thread is idle whenever acquire() has returned
+        stream.set_prefetch_depth(0);
+        CHECK(stream.open(path, 3 * layer_bytes) == RWKV_SUCCESS);
+        CHECK(stream.get_n_layer() == n_layer);
+        for (int pass = 0; pass < 3; pass++) {
+            for (int l = 0; l < n_layer; l++) {
+                stream.acquire(l);
+                CHECK(layer_intact(stream, l));
+                auto stats = stream.get_stats();
+                CHECK(stats.resident_bytes <= 3 * layer_bytes);
+                CHECK(mm.get_usage(RWKV_MEMORY_WEIGHTS) == stats.resident_bytes);
+            }
+        }
+    }
+    CHECK(mm.get_usage(RWKV_MEMORY_WEIGHTS) == 0);
+    mm.set_budget(0);
+}
+
+// with room for every layer, prefetch reads each of them once
+static void test_prefetch_fills_window(const std::string &path) {
+    layer_stream stream;
+    CHECK(stream.open(path, 0) == RWKV_SUCCESS);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int l = 0; l < n_layer; l++) {
+            stream.acquire(l);
+            CHECK(layer_intact(stream, l));
+        }
+    }
+    auto stats = stream.get_stats();
+    CHECK(stats.bytes_read == n_layer * layer_bytes);
+    CHECK(stats.hits + stats.stalls == 2 * n_layer);
+    stream.close();
+    CHECK(memory_manager::instance().get_usage(RWKV_MEMORY_WEIGHTS) == 0);
+}
+
+int main() {
+    char path[] = "/tmp/rwkv_mobile_layer_stream_test_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to create a checkpoint file\n");
+        return 1;
+    }
+    close(fd);
+    CHECK(write_checkpoint(path));
+    test_accounting_under_budget(path);
+    test_prefetch_fills_window(path);
+    unlink(path);
+    return TEST_RESULT();
+}
@@ -0,0 +1,50 @@
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "runtime.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+// half-precision logits with a backend that has them, and with one that only has fp32
+// (MOCK_BACKEND_NO_HALF): there the decode loops fail and leave the precision as set,
+// instead of switching it behind the caller's back
+
+static const std::string prompt = "User: Tell me a story about a cat.\n\nAssistant:";
+
+static void test_precision(runtime &rt, int precision, bool backend_has_half) {
+    CHECK(rt.set_logits_precision(precision) == RWKV_SUCCESS);
+    CHECK(rt.clear_state() == RWKV_SUCCESS);
+    const int expected = backend_has_half ? RWKV_SUCCESS : (RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED);
+    CHECK(rt.prefill(rt.tokenizer_encode(prompt)) == expected);
+    if (backend_has_half) {
+        int token = -1;
+        CHECK(rt.decode_step(token) == RWKV_SUCCESS);
+    }
+    std::string text;
+    CHECK(rt.gen_completion(prompt, text, 16) == expected);
+    CHECK(rt.get_logits_precision() == precision);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <vocab_file> <model_file>\n", argv[0]);
+        return 1;
+    }
+    runtime rt;
+    int ret = rt.init("rwkv.cpp");
+    if (!ret) ret = rt.load_tokenizer(argv[1]);
+    if (!ret) ret = rt.load_model(argv[2]);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret != RWKV_SUCCESS) {
+        return TEST_RESULT();
+    }
+    const bool backend_has_half = std::getenv("MOCK_BACKEND_NO_HALF") == nullptr;
+    test_precision(rt, RWKV_LOGITS_FP16, backend_has_half);
+    test_precision(rt, RWKV_LOGITS_BF16, backend_has_half);
+    // fp32 works with either backend once the caller asks for it
+    test_precision(rt, RWKV_LOGITS_FP32, true);
+    return TEST_RESULT();
+}
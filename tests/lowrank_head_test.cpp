@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "commondef.h"
+#include "lowrank_head.h"
+#include "memory_manager.h"
+#include "test_common.h"
+#include "thread_pool.h"
+
+using namespace rwkvmobile;
+
+// lowrank_head against head_dense: the candidates get the exact logits, and a full-rank
+// basis reproduces every logit
+
+static const int vocab_size = 4099;
+static const int n_embd = 96;
+
+static std::vector<float> make_weight(std::mt19937 &rng) {
+    std::normal_distribution<float> normal(0.f, 0.05f);
+    std::vector<float> weight((size_t)vocab_size * n_embd);
+    for (auto &w : weight) {
+        w = normal(rng);
+    }
+    return weight;
+}
+
+static std::vector<float> make_hidden(std::mt19937 &rng) {
+    std::normal_distribution<float> normal(0.f, 1.f);
+    std::vector<float> hidden(n_embd);
+    for (auto &h : hidden) {
+        h = normal(rng);
+    }
+    return hidden;
+}
+
+static void test_candidates_exact() {
+    std::mt19937 rng(1);
+    const std::vector<float> weight = make_weight(rng);
+    std::vector<std::shared_ptr<thread_pool>> pools = {nullptr, std::make_shared<thread_pool>(1), std::make_shared<thread_pool>(4)};
+    for (auto &pool : pools) {
+        lowrank_head head;
+        CHECK(head.load(weight.data(), vocab_size, n_embd, 16, pool.get()) == RWKV_SUCCESS);
+        CHECK(head.get_rank() == 16);
+        std::vector<float> expected(vocab_size), logits(vocab_size);
+        for (int n_candidates : {1, 64, 500}) {
+            const std::vector<float> hidden = make_hidden(rng);
+            head_dense(weight.data(), hidden.data(), expected.data(), vocab_size, n_embd, nullptr);
+            CHECK(head.forward(hidden.data(), logits.data(), n_candidates, pool.get()) == RWKV_SUCCESS);
+            std::vector<int> candidates = head.get_last_candidates();
+            CHECK((int)candidates.size() == n_candidates);
+            std::sort(candidates.begin(), candidates.end());
+            CHECK(std::unique(candidates.begin(), candidates.end()) == candidates.end());
+            for (int id : candidates) {
+                CHECK(id >= 0 && id < vocab_size);
+                if (id >= 0 && id < vocab_size && logits[id] != expected[id]) {
+                    fprintf(stderr, "candidate %d: %f, dense %f\n", id, logits[id], expected[id]);
+                    CHECK(false);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+static void test_full_rank_reproduces_head() {
+    std::mt19937 rng(2);
+    const std::vector<float> weight = make_weight(rng);
+    lowrank_head head;
+    CHECK(head.load(weight.data(), vocab_size, n_embd, n_embd) == RWKV_SUCCESS);
+    std::vector<float> expected(vocab_size), logits(vocab_size);
+    for (int t = 0; t < 4; t++) {
+        const std::vector<float> hidden = make_hidden(rng);
+        head_dense(weight.data(), hidden.data(), expected.data(), vocab_size, n_embd);
+        // a single candidate, so nearly every logit is the estimate
+        CHECK(head.forward(hidden.data(), logits.data(), 1) == RWKV_SUCCESS);
+        double max_err = 0, max_ref = 0;
+        for (int i = 0; i < vocab_size; i++) {
+            max_err = std::max(max_err, (double)std::fabs(logits[i] - expected[i]));
+            max_ref = std::max(max_ref, (double)std::fabs(expected[i]));
+        }
+        if (max_err > 1e-4 * max_ref) {
+            fprintf(stderr, "full rank: max error %g (max |logit| %g)\n", max_err, max_ref);
+        }
+        CHECK(max_err <= 1e-4 * max_ref);
+    }
+}
+
+static void test_invalid_and_release() {
+    std::mt19937 rng(3);
+    const std::vector<float> weight = make_weight(rng);
+    {
+        lowrank_head head;
+        CHECK(head.load(weight.data(), vocab_size, n_embd, n_embd + 1) != RWKV_SUCCESS);
+        CHECK(head.load(nullptr, vocab_size, n_embd, 8) != RWKV_SUCCESS);
+        CHECK(head.load(weight.data(), vocab_size, n_embd, 8) == RWKV_SUCCESS);
+        CHECK(memory_manager::instance().get_usage(RWKV_MEMORY_WEIGHTS) > 0);
+    }
+    CHECK(memory_manager::instance().get_usage(RWKV_MEMORY_WEIGHTS) == 0);
+}
+
+int main() {
+    test_candidates_exact();
+    test_full_rank_reproduces_head();
+    test_invalid_and_release();
+    return TEST_RESULT();
+}
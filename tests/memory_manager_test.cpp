@@ -0,0 +1,165 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "commondef.h"
+#include "memory_manager.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+static const size_t mb = 1024 * 1024;
+
+// kB value of a /proc/self/status field, 0 where there is none
+static size_t proc_status_kb(const char * field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind(field, 0) == 0) {
+            return std::stoul(line.substr(strlen(field) + 1));
+        }
+    }
+    return 0;
+}
+
+// a cache that gives its memory back when the manager asks. it reserves before taking
+// its lock, since reserving may run its own shrinker
+struct shedding_cache {
+    std::mutex mutex;
+    std::vector<char> data;
+    size_t accounted = 0;
+    int shrinker_id = -1;
+
+    shedding_cache() {
+        shrinker_id = memory_manager::instance().register_shrinker([this](size_t) -> size_t {
+            std::lock_guard<std::mutex> lock(mutex);
+            return drop_locked();
+        });
+    }
+
+    ~shedding_cache() {
+        memory_manager::instance().unregister_shrinker(shrinker_id);
+        std::lock_guard<std::mutex> lock(mutex);
+        drop_locked();
+    }
+
+    size_t drop_locked() {
+        size_t freed = accounted;
+        std::vector<char>().swap(data);
+        memory_manager::instance().release(RWKV_MEMORY_CACHES, accounted);
+        accounted = 0;
+        return freed;
+    }
+
+    void fill(size_t bytes) {
+        if (memory_manager::instance().reserve(RWKV_MEMORY_CACHES, bytes) != RWKV_SUCCESS) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        drop_locked();
+        data.assign(bytes, 1);
+        accounted = bytes;
+    }
+};
+
+// threads allocate (and touch) only what they managed to reserve, while a cache keeps
+// refilling itself; neither the accounted peak nor the resident peak may pass the budget
+static void test_budget_stress() {
+    const size_t budget = 64 * mb;
+    auto &manager = memory_manager::instance();
+    manager.set_budget(budget);
+
+#ifdef __GLIBC__
+    // a fixed threshold keeps these buffers mmapped, so that freeing them returns the
+    // pages right away instead of leaving them cached in a malloc arena
+    mallopt(M_MMAP_THRESHOLD, 256 * 1024);
+#endif
+#ifdef __linux__
+    // resets VmHWM to the current rss
+    std::ofstream("/proc/self/clear_refs") << "5";
+    size_t base_kb = proc_status_kb("VmRSS:");
+#endif
+
+    shedding_cache cache;
+    std::atomic<int> refused{0}, granted{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            for (int i = 0; i < 200; i++) {
+                if (t == 0 && i % 8 == 0) {
+                    cache.fill(24 * mb);
+                }
+                size_t bytes = (1 + rng() % 20) * mb;
+                memory_reservation reservation;
+                if (reservation.reserve(RWKV_MEMORY_STATES, bytes) != RWKV_SUCCESS) {
+                    refused++;
+                    continue;
+                }
+                granted++;
+                std::vector<char> data(bytes, 1);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    CHECK(granted > 0);
+    CHECK(manager.get_peak() <= budget);
+#ifdef __linux__
+    size_t peak_kb = proc_status_kb("VmHWM:");
+    // allocator and thread bookkeeping on top of the budget
+    const size_t slack_kb = 8 * 1024;
+    printf("budget %zu MB, rss peak %.1f MB above start, %d reservations granted, %d refused\n",
+        budget / mb, (peak_kb > base_kb ? peak_kb - base_kb : 0) / 1024.0, granted.load(), refused.load());
+    CHECK(peak_kb <= base_kb + budget / 1024 + slack_kb);
+#endif
+    manager.set_budget(0);
+}
+
+// unregister_shrinker() must not return while the shrinker runs, so that its owner
+// can be destroyed right after
+static void test_shrinker_lifetime() {
+    auto &manager = memory_manager::instance();
+    manager.set_budget(4 * mb);
+    memory_reservation held;
+    CHECK(held.reserve(RWKV_MEMORY_CACHES, 3 * mb) == RWKV_SUCCESS);
+
+    std::atomic<bool> owner_alive{true}, entered{false}, seen_alive{false};
+    int id = manager.register_shrinker([&](size_t) -> size_t {
+        entered = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        seen_alive = owner_alive.load();
+        return 0;
+    });
+    std::thread reserver([&]() {
+        memory_reservation r;
+        // over budget: runs the shrinker, which frees nothing
+        CHECK(r.reserve(RWKV_MEMORY_CACHES, 2 * mb) == RWKV_ERROR_ALLOC);
+    });
+    while (!entered) {
+        std::this_thread::yield();
+    }
+    manager.unregister_shrinker(id);
+    owner_alive = false;
+    reserver.join();
+    CHECK(seen_alive);
+    manager.set_budget(0);
+}
+
+int main() {
+    test_budget_stress();
+    test_shrinker_lifetime();
+    return TEST_RESULT();
+}
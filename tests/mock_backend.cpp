@@ -0,0 +1,233 @@
+// a deterministic stand-in for a real backend, built as a backend plugin so that the
+// tests drive the runtime exactly as with web-rwkv. it is registered under the rwkv.cpp
+// id, which has no in-tree implementation: point RWKV_MOBILE_BACKEND_PATH at its
+// directory and init the runtime with "rwkv.cpp".
+//
+// the state is a hash of the tokens seen so far; the logits are a pseudo-random
+// background with one clear winner per state, so greedy decoding is reproducible.
+// a model path containing "draft" loads a weaker copy, whose winner is off for about a
+// third of the states, to stand in for a draft model.
+// knobs, read from the environment at init:
+//   MOCK_BACKEND_DELAY_US   sleep per eval call (dispatch and readback of an accelerator)
+//   MOCK_BACKEND_TOKEN_US   additional sleep per evaluated token
+//   MOCK_BACKEND_NO_HALF    no eval_half, like a backend with only fp32 logits
+//   MOCK_BACKEND_ONE_PASS   eval_target_logprobs in one call instead of the token by
+//                           token default of execution_provider
+//   MOCK_BACKEND_SUBSET     accepts set_output_subset and then only produces the logits
+//                           of the subset, like a backend with a reduced output head.
+//                           the full vocab is taken to be 65536 then
+//   MOCK_BACKEND_NO_STATE   no get_state/set_state, like a backend that can only reset
+//                           its state
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include "backend.h"
+#include "commondef.h"
+#include "half.h"
+
+namespace {
+
+using namespace rwkvmobile;
+
+static long env_long(const char * name) {
+    const char * value = std::getenv(name);
+    return value == nullptr ? 0 : std::atol(value);
+}
+
+class mock_backend : public execution_provider {
+public:
+    int init(void * extra) override {
+        _delay_us = env_long("MOCK_BACKEND_DELAY_US");
+        _token_us = env_long("MOCK_BACKEND_TOKEN_US");
+        _half = env_long("MOCK_BACKEND_NO_HALF") == 0;
+        _one_pass = env_long("MOCK_BACKEND_ONE_PASS") != 0;
+        _native_subset = env_long("MOCK_BACKEND_SUBSET") != 0;
+        _has_state = env_long("MOCK_BACKEND_NO_STATE") == 0;
+        return RWKV_SUCCESS;
+    }
+
+    int set_output_subset(const std::vector<int> &ids) override {
+        if (!_native_subset) {
+            return execution_provider::set_output_subset(ids);
+        }
+        _subset = ids;
+        return RWKV_SUCCESS;
+    }
+
+    int load_model(std::string model_path) override {
+        _weak = model_path.find("draft") != std::string::npos;
+        return RWKV_SUCCESS;
+    }
+
+    int eval(int id, std::vector<float> &logits) override {
+        wait(1);
+        advance(id);
+        fill(logits.data(), logits.size());
+        return RWKV_SUCCESS;
+    }
+
+    int eval(std::vector<int> ids, std::vector<float> &logits) override {
+        if (ids.empty()) {
+            return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+        }
+        wait(ids.size());
+        for (auto id : ids) {
+            advance(id);
+        }
+        fill(logits.data(), logits.size());
+        return RWKV_SUCCESS;
+    }
+
+    int eval_half(int id, std::vector<uint16_t> &logits, int precision) override {
+        if (!_half) {
+            return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+        }
+        wait(1);
+        advance(id);
+        fill_half(logits, precision);
+        return RWKV_SUCCESS;
+    }
+
+    int eval_half(std::vector<int> ids, std::vector<uint16_t> &logits, int precision) override {
+        if (!_half) {
+            return RWKV_ERROR_BACKEND | RWKV_ERROR_UNSUPPORTED;
+        }
+        if (ids.empty()) {
+            return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+        }
+        wait(ids.size());
+        for (auto id : ids) {
+            advance(id);
+        }
+        fill_half(logits, precision);
+        return RWKV_SUCCESS;
+    }
+
+    int eval_target_logprobs(const std::vector<int> &ids, const std::vector<int> &targets, int vocab_size, std::vector<float> &logprobs) override {
+        if (!_one_pass) {
+            return execution_provider::eval_target_logprobs(ids, targets, vocab_size, logprobs);
+        }
+        if (ids.empty() || ids.size() != targets.size() || vocab_size <= 0) {
+            return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+        }
+        for (auto target : targets) {
+            if (target < 0 || target >= vocab_size) {
+                return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+            }
+        }
+        wait(ids.size());
+        _row.resize(vocab_size);
+        logprobs.resize(ids.size());
+        for (size_t i = 0; i < ids.size(); i++) {
+            advance(ids[i]);
+            fill(_row.data(), _row.size());
+            float max_logit = _row[0];
+            for (auto logit : _row) {
+                max_logit = std::max(max_logit, logit);
+            }
+            double sum = 0;
+            for (auto logit : _row) {
+                sum += std::exp(logit - max_logit);
+            }
+            logprobs[i] = _row[targets[i]] - max_logit - std::log(sum);
+        }
+        return RWKV_SUCCESS;
+    }
+
+    int get_state(std::vector<float> &state) override {
+        if (!_has_state) {
+            return execution_provider::get_state(state);
+        }
+        // 16 bits per float, so that they are exact
+        state.resize(2);
+        state[0] = _hash & 0xffff;
+        state[1] = _hash >> 16;
+        return RWKV_SUCCESS;
+    }
+
+    int set_state(std::vector<float> state) override {
+        if (!_has_state) {
+            return execution_provider::set_state(state);
+        }
+        if (state.size() != 2) {
+            return RWKV_ERROR_BACKEND | RWKV_ERROR_INVALID_PARAMETERS;
+        }
+        _hash = (uint32_t)state[0] | (uint32_t)state[1] << 16;
+        return RWKV_SUCCESS;
+    }
+
+    int clear_state() override {
+        _hash = 0;
+        return RWKV_SUCCESS;
+    }
+
+    bool is_available() override { return true; }
+
+private:
+    void wait(size_t n_tokens) {
+        long us = _delay_us + _token_us * (long)n_tokens;
+        if (us > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(us));
+        }
+    }
+
+    void advance(int id) {
+        _hash = _hash * 2654435761u + (uint32_t)id + 1;
+        _hash ^= _hash >> 15;
+    }
+
+    // logit of token i out of a vocab of n
+    float logit(size_t i, size_t n) {
+        // never token 0, which ends generation
+        uint32_t winner = _weak && (_hash >> 20) % 3 == 0 ? _hash * 7 + 3 : _hash;
+        if (i == 1 + winner % (n - 1)) {
+            return 12.f;
+        }
+        uint32_t x = ((uint32_t)i * 2246822519u) ^ _hash;
+        x ^= x >> 13;
+        return (x % 1024) / 256.f;
+    }
+
+    void fill(float * logits, size_t n) {
+        if (!_subset.empty()) {
+            for (size_t i = 0; i < n && i < _subset.size(); i++) {
+                logits[i] = logit(_subset[i], 65536);
+            }
+            return;
+        }
+        if (n < 2) {
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            logits[i] = logit(i, n);
+        }
+    }
+
+    void fill_half(std::vector<uint16_t> &logits, int precision) {
+        _row.resize(logits.size());
+        fill(_row.data(), _row.size());
+        for (size_t i = 0; i < logits.size(); i++) {
+            logits[i] = precision == RWKV_LOGITS_BF16 ? fp32_to_bf16(_row[i]) : fp32_to_fp16(_row[i]);
+        }
+    }
+
+    uint32_t _hash = 0;
+    long _delay_us = 0;
+    long _token_us = 0;
+    bool _half = true;
+    bool _one_pass = false;
+    bool _native_subset = false;
+    bool _has_state = true;
+    bool _weak = false;
+    std::vector<int> _subset;
+    std::vector<float> _row;
+};
+
+}
+
+RWKV_DEFINE_BACKEND_PLUGIN(mock_backend)
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "runtime.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+// an output subset, set before loading the model: with MOCK_BACKEND_SUBSET the backend
+// computes only those logits, otherwise the runtime gathers them from the full ones.
+// either way the results must be those of the full model restricted to the subset
+
+static const std::string prompt = "User: Tell me a story about a cat.\n\nAssistant:";
+
+static std::vector<int> make_subset() {
+    std::vector<int> ids = {0};
+    for (int id = 40; id < 65536; id += 211) {
+        ids.push_back(id);
+    }
+    return ids;
+}
+
+static int load(runtime &rt, const char * vocab_file, const char * model_file, const std::vector<int> &subset) {
+    int ret = rt.init("rwkv.cpp");
+    if (!ret) ret = rt.load_tokenizer(vocab_file);
+    if (!ret && !subset.empty()) ret = rt.set_output_subset(subset);
+    if (!ret) ret = rt.load_model(model_file);
+    return ret;
+}
+
+static void test_logits_match_full_model(runtime &full, runtime &restricted, const std::vector<int> &subset) {
+    std::vector<int> ids = full.tokenizer_encode(prompt);
+    std::vector<float> full_logits(65536), subset_logits(65536);
+    CHECK(full.eval_logits(ids, full_logits) == RWKV_SUCCESS);
+    CHECK(restricted.eval_logits(ids, subset_logits) == RWKV_SUCCESS);
+    for (size_t i = 0; i < subset.size(); i++) {
+        if (subset_logits[i] != full_logits[subset[i]]) {
+            fprintf(stderr, "logit %zu (token %d): %f, full model %f\n", i, subset[i], subset_logits[i], full_logits[subset[i]]);
+            CHECK(false);
+            break;
+        }
+    }
+}
+
+// with a native subset the backend itself writes only the subset's logits
+static void test_backend_returns_subset(runtime &full, runtime &restricted, const std::vector<int> &subset) {
+    auto full_backend = full.get_model()->get_backend();
+    auto subset_backend = restricted.get_model()->get_backend();
+    std::vector<float> full_logits(65536), subset_logits(subset.size());
+    CHECK(full_backend->clear_state() == RWKV_SUCCESS);
+    CHECK(subset_backend->clear_state() == RWKV_SUCCESS);
+    CHECK(full_backend->eval(full.tokenizer_encode(prompt), full_logits) == RWKV_SUCCESS);
+    CHECK(subset_backend->eval(full.tokenizer_encode(prompt), subset_logits) == RWKV_SUCCESS);
+    CHECK(subset_logits.size() == subset.size());
+    for (size_t i = 0; i < subset.size(); i++) {
+        if (subset_logits[i] != full_logits[subset[i]]) {
+            fprintf(stderr, "backend logit %zu (token %d): %f, full model %f\n", i, subset[i], subset_logits[i], full_logits[subset[i]]);
+            CHECK(false);
+            break;
+        }
+    }
+}
+
+// every sampled token is in the subset, at every logits precision
+static void test_decode_stays_in_subset(runtime &rt, const std::vector<int> &subset) {
+    for (int precision : {RWKV_LOGITS_FP32, RWKV_LOGITS_FP16, RWKV_LOGITS_BF16}) {
+        CHECK(rt.set_logits_precision(precision) == RWKV_SUCCESS);
+        CHECK(rt.clear_state() == RWKV_SUCCESS);
+        rt.set_seed(42);
+        CHECK(rt.prefill(rt.tokenizer_encode(prompt)) == RWKV_SUCCESS);
+        for (int i = 0; i < 64; i++) {
+            int token = -1;
+            CHECK(rt.decode_step(token) == RWKV_SUCCESS);
+            CHECK(std::binary_search(subset.begin(), subset.end(), token));
+            if (token == 0) {
+                break;
+            }
+        }
+    }
+    CHECK(rt.set_logits_precision(RWKV_LOGITS_FP32) == RWKV_SUCCESS);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <vocab_file> <model_file>\n", argv[0]);
+        return 1;
+    }
+    const std::vector<int> subset = make_subset();
+    runtime full, restricted;
+    int ret = load(full, argv[1], argv[2], {});
+    CHECK(ret == RWKV_SUCCESS);
+    ret |= load(restricted, argv[1], argv[2], subset);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret != RWKV_SUCCESS) {
+        return TEST_RESULT();
+    }
+    CHECK(restricted.get_model()->get_output_size() == (int)subset.size());
+    // the path under test is the one taken
+    bool native = std::getenv("MOCK_BACKEND_SUBSET") != nullptr;
+    CHECK(restricted.get_model()->get_backend_output_size() == (native ? (int)subset.size() : 65536));
+
+    test_logits_match_full_model(full, restricted, subset);
+    test_decode_stays_in_subset(restricted, subset);
+    if (native) {
+        test_backend_returns_subset(full, restricted, subset);
+    }
+
+    // the full distribution isn't available with a subset
+    std::vector<float> logprobs;
+    CHECK(restricted.eval_target_logprobs({1, 2}, {3, 4}, logprobs) != RWKV_SUCCESS);
+    return TEST_RESULT();
+}
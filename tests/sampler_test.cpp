@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "commondef.h"
+#include "half.h"
+#include "sampler.h"
+#include "test_common.h"
+#include "thread_pool.h"
+
+using namespace rwkvmobile;
+
+// top-k, then top-p over the full softmax, renormalized; temperature 1
+static std::vector<double> reference(const std::vector<float> &logits, int top_k, float top_p) {
+    const size_t n = logits.size();
+    double max_logit = *std::max_element(logits.begin(), logits.end());
+    std::vector<double> p(n);
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        p[i] = std::exp(logits[i] - max_logit);
+        sum += p[i];
+    }
+    std::vector<int> order(n);
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    std::partial_sort(order.begin(), order.begin() + top_k, order.end(), [&](int a, int b) { return p[a] > p[b]; });
+    std::vector<double> out(n, 0.);
+    double cumsum = 0;
+    for (int i = 0; i < top_k; i++) {
+        out[order[i]] = p[order[i]] / sum;
+        cumsum += out[order[i]];
+        if (cumsum >= top_p) {
+            break;
+        }
+    }
+    for (auto &v : out) {
+        v /= cumsum;
+    }
+    return out;
+}
+
+static std::vector<float> make_logits(size_t n, float offset, std::mt19937 &rng) {
+    std::normal_distribution<float> normal(0.f, 3.f);
+    std::vector<float> logits(n);
+    for (auto &v : logits) {
+        v = normal(rng) + offset;
+    }
+    // a peaked head like a language model's
+    for (int i = 0; i < 8; i++) {
+        logits[rng() % n] += 12.f - i;
+    }
+    return logits;
+}
+
+// compares the kept probabilities as sorted lists: rounded logits tie, and which of the
+// tied tokens at the top-k / top-p boundary is kept is arbitrary
+static double max_difference(const std::vector<double> &expected, const std::vector<float> &actual) {
+    std::vector<double> a, b;
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (expected[i] > 0) {
+            a.push_back(expected[i]);
+        }
+        if (actual[i] > 0) {
+            b.push_back(actual[i]);
+        }
+    }
+    if (a.size() != b.size()) {
+        return 1.;
+    }
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    double diff = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        diff = std::max(diff, std::fabs(a[i] - b[i]));
+    }
+    return diff;
+}
+
+// the distribution must not depend on the pool or how it splits the softmax: no pool,
+// a 1-thread pool (every parallel_for runs inline), and more threads than chunks.
+// all-negative logits catch a max reduction over partials that weren't written
+static void test_pools_match_reference() {
+    std::vector<std::shared_ptr<thread_pool>> pools = {nullptr, std::make_shared<thread_pool>(1), std::make_shared<thread_pool>(4)};
+    std::mt19937 rng(1);
+    for (size_t n : {(size_t)65536, (size_t)100003, (size_t)1000000}) {
+        for (float offset : {0.f, -60.f}) {
+            std::vector<float> logits = make_logits(n, offset, rng);
+            std::vector<uint16_t> fp16(n), bf16(n);
+            std::vector<float> fp16_values(n), bf16_values(n);
+            for (size_t i = 0; i < n; i++) {
+                fp16[i] = fp32_to_fp16(logits[i]);
+                bf16[i] = fp32_to_bf16(logits[i]);
+                fp16_values[i] = fp16_to_fp32(fp16[i]);
+                bf16_values[i] = bf16_to_fp32(bf16[i]);
+            }
+            const std::vector<double> expected = reference(logits, 128, 0.3f);
+            const std::vector<double> expected_fp16 = reference(fp16_values, 128, 0.3f);
+            const std::vector<double> expected_bf16 = reference(bf16_values, 128, 0.3f);
+            std::vector<float> p(n);
+            for (auto &pool : pools) {
+                sampler s;
+                s.set_thread_pool(pool);
+                s.probabilities(logits.data(), n, 1.f, 128, 0.3f, p.data());
+                CHECK(max_difference(expected, p) < 1e-4);
+                s.probabilities(fp16.data(), n, RWKV_LOGITS_FP16, 1.f, 128, 0.3f, p.data());
+                CHECK(max_difference(expected_fp16, p) < 1e-4);
+                s.probabilities(bf16.data(), n, RWKV_LOGITS_BF16, 1.f, 128, 0.3f, p.data());
+                CHECK(max_difference(expected_bf16, p) < 1e-4);
+            }
+        }
+    }
+}
+
+// the same seed draws the same tokens whatever the pool
+static void test_pools_sample_alike() {
+    std::mt19937 rng(2);
+    const size_t n = 65536;
+    std::vector<float> logits = make_logits(n, 0.f, rng);
+    std::vector<uint16_t> fp16(n);
+    for (size_t i = 0; i < n; i++) {
+        fp16[i] = fp32_to_fp16(logits[i]);
+    }
+    std::vector<int> first;
+    for (auto pool : {std::shared_ptr<thread_pool>(), std::make_shared<thread_pool>(1), std::make_shared<thread_pool>(4)}) {
+        sampler s;
+        s.set_thread_pool(pool);
+        s.set_seed(42);
+        std::vector<int> tokens;
+        for (int i = 0; i < 32; i++) {
+            tokens.push_back(s.sample(logits.data(), n, 1.f, 128, 0.9f));
+            tokens.push_back(s.sample(fp16.data(), n, RWKV_LOGITS_FP16, 1.f, 128, 0.9f));
+        }
+        if (first.empty()) {
+            first = tokens;
+        }
+        CHECK(tokens == first);
+    }
+}
+
+// total variation between the distributions for fp32 logits and for the same logits
+// rounded to fp16 / bf16, averaged over rows and sampling settings
+static void test_half_close_to_fp32() {
+    struct params { float temperature; int top_k; float top_p; } configs[] = {
+        {1.f, 128, 0.3f}, {1.f, 128, 0.9f}, {0.7f, 40, 0.9f}, {1.3f, 500, 1.f},
+    };
+    const size_t n = 65536;
+    const int rows = 32;
+    std::mt19937 rng(3);
+    sampler s;
+    std::vector<float> p_ref(n), p(n);
+    std::vector<uint16_t> half(n);
+    for (int precision : {RWKV_LOGITS_FP16, RWKV_LOGITS_BF16}) {
+        double tv_sum = 0;
+        for (int r = 0; r < rows; r++) {
+            std::vector<float> logits = make_logits(n, 0.f, rng);
+            for (size_t i = 0; i < n; i++) {
+                half[i] = precision == RWKV_LOGITS_FP16 ? fp32_to_fp16(logits[i]) : fp32_to_bf16(logits[i]);
+            }
+            for (auto &c : configs) {
+                s.probabilities(logits.data(), n, c.temperature, c.top_k, c.top_p, p_ref.data());
+                s.probabilities(half.data(), n, precision, c.temperature, c.top_k, c.top_p, p.data());
+                double tv = 0;
+                for (size_t i = 0; i < n; i++) {
+                    tv += std::fabs(p_ref[i] - p[i]);
+                }
+                tv_sum += tv / 2;
+            }
+        }
+        double tv_mean = tv_sum / (rows * (sizeof(configs) / sizeof(configs[0])));
+        // one logit ulp at |x| ~ 16 is 1/64 in fp16 and 1/8 in bf16
+        double tolerance = precision == RWKV_LOGITS_FP16 ? 0.01 : 0.05;
+        if (tv_mean > tolerance) {
+            fprintf(stderr, "%s logits: total variation to fp32 %.5f\n", precision == RWKV_LOGITS_FP16 ? "fp16" : "bf16", tv_mean);
+        }
+        CHECK(tv_mean <= tolerance);
+    }
+}
+
+int main() {
+    test_pools_match_reference();
+    test_pools_sample_alike();
+    test_half_close_to_fp32();
+    return TEST_RESULT();
+}
@@ -0,0 +1,254 @@
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "runtime.h"
+#include "scheduler.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+// the scheduler over sessions of one mock model: requests that are paused for more
+// urgent ones must generate what they would have generated alone, and the most
+// urgent request must run first
+
+static const std::string short_prompt = "User: Tell me a story about a cat.\n\nAssistant:";
+
+static std::string long_prompt() {
+    std::string text = "User: ";
+    while (text.size() < 2000) {
+        text += "The cat sat on the mat and looked out of the window. ";
+    }
+    return text + "\n\nAssistant:";
+}
+
+static std::shared_ptr<runtime> make_session(runtime &owner, int64_t seed) {
+    auto session = std::make_shared<runtime>(owner.get_model());
+    session->set_seed(seed);
+    return session;
+}
+
+// what a session generates with nobody else on the model
+static std::string generate_alone(runtime &owner, const std::string &prompt, int length, int64_t seed) {
+    auto session = make_session(owner, seed);
+    std::string text;
+    CHECK(session->gen_completion(prompt, text, length) == RWKV_SUCCESS);
+    return text;
+}
+
+struct result {
+    int ret = -1;
+    std::string completion;
+};
+
+// a batch request preempted by an interactive one that arrives once it is generating
+static void test_preempted_request_resumes(runtime &owner) {
+    const std::string batch_prompt = long_prompt();
+    const std::string batch_expected = generate_alone(owner, batch_prompt, 48, 1);
+    const std::string interactive_expected = generate_alone(owner, short_prompt, 16, 2);
+
+    std::mutex mutex;
+    std::vector<int> done_order;
+    result batch_result, interactive_result;
+    scheduler sched(owner.get_model(), 16);
+
+    generation_request batch;
+    batch.prompt = batch_prompt;
+    batch.length = 48;
+    batch.priority = RWKV_PRIORITY_BATCH;
+    batch.session = make_session(owner, 1);
+    bool started = false, submitted = false;
+    std::condition_variable cv;
+    batch.on_token = [&](const char *, size_t) {
+        // holds the batch request at its first token until the interactive one is queued
+        std::unique_lock<std::mutex> lock(mutex);
+        started = true;
+        cv.notify_all();
+        cv.wait(lock, [&] { return submitted; });
+        return true;
+    };
+    batch.on_done = [&](int ret, const std::string &completion) {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch_result = {ret, completion};
+        done_order.push_back(RWKV_PRIORITY_BATCH);
+    };
+    CHECK(sched.submit(batch) >= 0);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return started; });
+    }
+
+    generation_request interactive;
+    interactive.prompt = short_prompt;
+    interactive.length = 16;
+    interactive.priority = RWKV_PRIORITY_INTERACTIVE;
+    interactive.session = make_session(owner, 2);
+    interactive.on_done = [&](int ret, const std::string &completion) {
+        std::lock_guard<std::mutex> lock(mutex);
+        interactive_result = {ret, completion};
+        done_order.push_back(RWKV_PRIORITY_INTERACTIVE);
+    };
+    CHECK(sched.submit(interactive) >= 0);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        submitted = true;
+    }
+    cv.notify_all();
+    sched.wait_idle();
+
+    CHECK(batch_result.ret == RWKV_SUCCESS);
+    CHECK(interactive_result.ret == RWKV_SUCCESS);
+    CHECK(batch_result.completion == batch_expected);
+    CHECK(interactive_result.completion == interactive_expected);
+    CHECK(done_order == std::vector<int>({RWKV_PRIORITY_INTERACTIVE, RWKV_PRIORITY_BATCH}));
+    CHECK(sched.get_stats(RWKV_PRIORITY_BATCH).preemptions >= 1);
+    CHECK(sched.get_stats(RWKV_PRIORITY_BATCH).completed == 1);
+    CHECK(sched.get_stats(RWKV_PRIORITY_INTERACTIVE).completed == 1);
+    CHECK(sched.get_stats(RWKV_PRIORITY_INTERACTIVE).ttft_p50_ms > 0);
+}
+
+// requests queued behind a busy one finish in order of class, then deadline, then submit.
+// the busy one is the most urgent of all and holds the scheduler at its first token
+// until the rest are queued; greedy sessions, so that it gets to that token
+static void test_urgency_order(runtime &owner) {
+    auto greedy = make_session(owner, 4);
+    greedy->set_sampler_params(1.f, 1, 1.f);
+    std::string text;
+    CHECK(greedy->gen_completion(short_prompt, text, 4) == RWKV_SUCCESS);
+    CHECK(!text.empty());
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool blocked = false, released = false;
+    std::vector<int> done_order;
+    scheduler sched(owner.get_model());
+    const auto now = std::chrono::steady_clock::now();
+    const auto no_deadline = std::chrono::steady_clock::time_point::max();
+
+    auto submit = [&](int tag, int priority, std::chrono::steady_clock::time_point deadline, bool blocking) {
+        generation_request request;
+        request.prompt = short_prompt;
+        request.length = 4;
+        request.priority = priority;
+        request.deadline = deadline;
+        request.session = make_session(owner, 4);
+        request.session->set_sampler_params(1.f, 1, 1.f);
+        if (blocking) {
+            request.on_token = [&](const char *, size_t) {
+                std::unique_lock<std::mutex> lock(mutex);
+                blocked = true;
+                cv.notify_all();
+                cv.wait(lock, [&] { return released; });
+                return true;
+            };
+        }
+        request.on_done = [&, tag](int ret, const std::string &) {
+            CHECK(ret == RWKV_SUCCESS);
+            std::lock_guard<std::mutex> lock(mutex);
+            done_order.push_back(tag);
+        };
+        CHECK(sched.submit(request) >= 0);
+    };
+    submit(0, RWKV_PRIORITY_INTERACTIVE, now, true);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return blocked; });
+    }
+    submit(1, RWKV_PRIORITY_BATCH, no_deadline, false);
+    submit(2, RWKV_PRIORITY_NORMAL, now + std::chrono::seconds(60), false);
+    submit(3, RWKV_PRIORITY_NORMAL, now + std::chrono::seconds(30), false);
+    submit(4, RWKV_PRIORITY_INTERACTIVE, no_deadline, false);
+    submit(5, RWKV_PRIORITY_BATCH, no_deadline, false);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        released = true;
+    }
+    cv.notify_all();
+    sched.wait_idle();
+    CHECK(done_order == std::vector<int>({0, 4, 3, 2, 1, 5}));
+}
+
+// invalid requests, stop strings, a declining callback and cancel
+static void test_stopping(runtime &owner) {
+    const std::string full = generate_alone(owner, short_prompt, 32, 3);
+    scheduler sched(owner.get_model());
+
+    result empty;
+    generation_request no_prompt;
+    no_prompt.on_done = [&](int ret, const std::string &completion) { empty = {ret, completion}; };
+    CHECK(sched.submit(no_prompt) >= 0);
+    sched.wait_idle();
+    CHECK(empty.ret == (RWKV_ERROR_RUNTIME | RWKV_ERROR_INVALID_PARAMETERS));
+
+    generation_request invalid;
+    invalid.prompt = short_prompt;
+    invalid.priority = RWKV_PRIORITY_COUNT;
+    CHECK(sched.submit(invalid) == -1);
+
+    result declined;
+    int calls = 0;
+    generation_request request;
+    request.prompt = short_prompt;
+    request.length = 32;
+    request.session = make_session(owner, 3);
+    request.on_token = [&](const char *, size_t) { return ++calls < 3; };
+    request.on_done = [&](int ret, const std::string &completion) { declined = {ret, completion}; };
+    CHECK(sched.submit(request) >= 0);
+    sched.wait_idle();
+    CHECK(declined.ret == RWKV_SUCCESS);
+    CHECK(calls == 3);
+    CHECK(!declined.completion.empty() && full.compare(0, declined.completion.size(), declined.completion) == 0);
+
+    result stopped;
+    request.session = make_session(owner, 3);
+    request.on_token = nullptr;
+    request.stop = {declined.completion};
+    request.on_done = [&](int ret, const std::string &completion) { stopped = {ret, completion}; };
+    CHECK(sched.submit(request) >= 0);
+    sched.wait_idle();
+    CHECK(stopped.ret == RWKV_SUCCESS);
+    CHECK(stopped.completion == declined.completion);
+
+    result cancelled;
+    int64_t id = -1;
+    std::mutex mutex;
+    request.session = make_session(owner, 3);
+    request.stop.clear();
+    request.length = 1000;
+    request.on_token = [&](const char *, size_t) {
+        std::lock_guard<std::mutex> lock(mutex);
+        sched.cancel(id);
+        return true;
+    };
+    request.on_done = [&](int ret, const std::string &completion) { cancelled = {ret, completion}; };
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        id = sched.submit(request);
+    }
+    CHECK(id >= 0);
+    sched.wait_idle();
+    CHECK(cancelled.ret == RWKV_ERROR_RUNTIME);
+    CHECK(full.compare(0, cancelled.completion.size(), cancelled.completion) == 0);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <vocab_file> <model_file>\n", argv[0]);
+        return 1;
+    }
+    runtime owner;
+    int ret = owner.init("rwkv.cpp");
+    if (!ret) ret = owner.load_tokenizer(argv[1]);
+    if (!ret) ret = owner.load_model(argv[2]);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret != RWKV_SUCCESS) {
+        return TEST_RESULT();
+    }
+    test_preempted_request_resumes(owner);
+    test_urgency_order(owner);
+    test_stopping(owner);
+    return TEST_RESULT();
+}
@@ -0,0 +1,116 @@
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "backend.h"
+#include "commondef.h"
+#include "runtime.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+// logits[i] = i / 10, whatever the input; a vocab of 100, so the old 65536-sized
+// default would misread it
+class small_vocab_backend : public execution_provider {
+public:
+    int eval(int id, std::vector<float> &logits) override {
+        if (logits.size() != 100) {
+            return RWKV_ERROR_EVAL | RWKV_ERROR_INVALID_PARAMETERS;
+        }
+        for (size_t i = 0; i < logits.size(); i++) {
+            logits[i] = i / 10.f;
+        }
+        return RWKV_SUCCESS;
+    }
+};
+
+static void test_default_eval_target_logprobs() {
+    small_vocab_backend backend;
+    double sum = 0;
+    for (int i = 0; i < 100; i++) {
+        sum += std::exp(i / 10.0);
+    }
+    std::vector<float> logprobs;
+    CHECK(backend.eval_target_logprobs({1, 2}, {99, 0}, 100, logprobs) == RWKV_SUCCESS);
+    CHECK(logprobs.size() == 2);
+    if (logprobs.size() == 2) {
+        CHECK(std::fabs(logprobs[0] - (9.9 - std::log(sum))) < 1e-4);
+        CHECK(std::fabs(logprobs[1] - (0.0 - std::log(sum))) < 1e-4);
+    }
+    CHECK(backend.eval_target_logprobs({1}, {100}, 100, logprobs) != RWKV_SUCCESS);
+    CHECK(backend.eval_target_logprobs({1}, {-1}, 100, logprobs) != RWKV_SUCCESS);
+    CHECK(backend.eval_target_logprobs({1, 2}, {3}, 100, logprobs) != RWKV_SUCCESS);
+}
+
+static std::vector<float> log_softmax(const std::vector<float> &logits) {
+    float max_logit = logits[0];
+    for (auto logit : logits) {
+        max_logit = std::max(max_logit, logit);
+    }
+    double sum = 0;
+    for (auto logit : logits) {
+        sum += std::exp(logit - max_logit);
+    }
+    std::vector<float> out(logits.size());
+    for (size_t i = 0; i < logits.size(); i++) {
+        out[i] = logits[i] - max_logit - std::log(sum);
+    }
+    return out;
+}
+
+// score_continuations against token by token evaluation from the prefix state
+static void test_score_continuations(runtime &rt) {
+    const std::string prefix = "Question: what colour is the sky?\n\nAnswer:";
+    const std::vector<std::string> continuations = {" blue", " green, mostly", " It depends on the time of day.", ""};
+    std::vector<float> scores;
+    std::vector<std::vector<float>> token_logprobs;
+    CHECK(rt.score_continuations(prefix, continuations, scores, token_logprobs) == RWKV_SUCCESS);
+    CHECK(scores.size() == continuations.size());
+    std::vector<float> prefix_state;
+    CHECK(rt.get_state(prefix_state) == RWKV_SUCCESS);
+
+    std::vector<float> logits(65536);
+    for (size_t i = 0; i < continuations.size() && i < scores.size(); i++) {
+        std::vector<int> ids = rt.tokenizer_encode(continuations[i]);
+        CHECK(token_logprobs[i].size() == ids.size());
+        CHECK(rt.clear_state() == RWKV_SUCCESS);
+        CHECK(rt.eval_logits(rt.tokenizer_encode(prefix), logits) == RWKV_SUCCESS);
+        double expected = 0;
+        for (size_t t = 0; t < ids.size(); t++) {
+            float logprob = log_softmax(logits)[ids[t]];
+            if (t < token_logprobs[i].size()) {
+                CHECK(std::fabs(token_logprobs[i][t] - logprob) < 1e-3);
+            }
+            expected += logprob;
+            CHECK(rt.eval_logits(ids[t], logits) == RWKV_SUCCESS);
+        }
+        CHECK(std::fabs(scores[i] - expected) < 1e-3 * (1 + ids.size()));
+        // the runtime is left right after the prefix
+        CHECK(rt.set_state(prefix_state) == RWKV_SUCCESS);
+    }
+
+    std::vector<float> logprobs;
+    CHECK(rt.eval_target_logprobs({1, 2}, {3, 65536}, logprobs) != RWKV_SUCCESS);
+    CHECK(rt.eval_target_logprobs({1, 2}, {-3, 4}, logprobs) != RWKV_SUCCESS);
+    CHECK(rt.eval_target_logprobs({70000}, {4}, logprobs) != RWKV_SUCCESS);
+    CHECK(rt.eval_target_logprobs({}, {}, logprobs) != RWKV_SUCCESS);
+    CHECK(rt.eval_target_logprobs({1, 2}, {3, 4}, logprobs) == RWKV_SUCCESS);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <vocab_file> <model_file>\n", argv[0]);
+        return 1;
+    }
+    test_default_eval_target_logprobs();
+
+    runtime rt;
+    int ret = rt.init("rwkv.cpp");
+    if (!ret) ret = rt.load_tokenizer(argv[1]);
+    if (!ret) ret = rt.load_model(argv[2]);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret == RWKV_SUCCESS) {
+        test_score_continuations(rt);
+    }
+    return TEST_RESULT();
+}
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "commondef.h"
+#include "memory_manager.h"
+#include "sparse_ffn.h"
+#include "test_common.h"
+#include "thread_pool.h"
+
+using namespace rwkvmobile;
+
+// sparse_ffn_value against the dense gemv, over shapes that leave vector tails and at
+// sparsity levels from none to all-zero activations
+
+// relu(x + shift)^2 with x ~ N(0, 1), with about `sparsity` of the values zero
+static std::vector<float> make_activations(int n_hidden, float sparsity, std::mt19937 &rng) {
+    std::normal_distribution<float> normal(0.f, 1.f);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    std::vector<float> k(n_hidden);
+    for (auto &v : k) {
+        float x = std::fabs(normal(rng)) + 0.1f;
+        v = uniform(rng) < sparsity ? 0.f : x * x;
+    }
+    return k;
+}
+
+static double max_error(const std::vector<float> &expected, const std::vector<float> &actual) {
+    double max_err = 0, max_ref = 1;
+    for (size_t i = 0; i < expected.size(); i++) {
+        max_err = std::max(max_err, (double)std::fabs(expected[i] - actual[i]));
+        max_ref = std::max(max_ref, (double)std::fabs(expected[i]));
+    }
+    return max_err / max_ref;
+}
+
+static void test_compact_nonzero() {
+    std::vector<float> x = {0.f, 1.f, 0.f, 0.f, 2.5f, 0.f, 3.f};
+    std::vector<uint32_t> idx(x.size());
+    std::vector<float> val(x.size());
+    CHECK(compact_nonzero(x.data(), x.size(), idx.data(), val.data()) == 3);
+    CHECK(idx[0] == 1 && idx[1] == 4 && idx[2] == 6);
+    CHECK(val[0] == 1.f && val[1] == 2.5f && val[2] == 3.f);
+    CHECK(compact_nonzero(x.data(), 1, idx.data(), val.data()) == 0);
+}
+
+static void test_matches_dense() {
+    struct shape { int n_embd, n_hidden; } shapes[] = {{64, 256}, {77, 301}, {512, 1792}};
+    std::vector<std::shared_ptr<thread_pool>> pools = {nullptr, std::make_shared<thread_pool>(1), std::make_shared<thread_pool>(4)};
+    std::mt19937 rng(42);
+    std::normal_distribution<float> normal(0.f, 0.02f);
+    for (auto &s : shapes) {
+        std::vector<float> weight((size_t)s.n_embd * s.n_hidden);
+        for (auto &w : weight) {
+            w = normal(rng);
+        }
+        sparse_ffn_value sparse;
+        CHECK(sparse.load(weight.data(), s.n_embd, s.n_hidden) == RWKV_SUCCESS);
+        CHECK(sparse.get_n_embd() == s.n_embd && sparse.get_n_hidden() == s.n_hidden);
+        std::vector<float> expected(s.n_embd), actual(s.n_embd);
+        for (float sparsity : {0.f, 0.5f, 0.9f, 0.99f, 1.f}) {
+            for (int t = 0; t < 4; t++) {
+                std::vector<float> k = make_activations(s.n_hidden, sparsity, rng);
+                const size_t n_zero = std::count(k.begin(), k.end(), 0.f);
+                ffn_value_dense(weight.data(), k.data(), expected.data(), s.n_embd, s.n_hidden, nullptr);
+                for (auto &pool : pools) {
+                    std::fill(actual.begin(), actual.end(), -1.f);
+                    CHECK(sparse.forward(k.data(), actual.data(), pool.get()) == RWKV_SUCCESS);
+                    CHECK(max_error(expected, actual) < 1e-4);
+                    CHECK(sparse.get_last_sparsity() == 1.f - (float)(s.n_hidden - n_zero) / s.n_hidden);
+                    std::fill(actual.begin(), actual.end(), -1.f);
+                    ffn_value_dense(weight.data(), k.data(), actual.data(), s.n_embd, s.n_hidden, pool.get());
+                    CHECK(max_error(expected, actual) < 1e-4);
+                }
+            }
+        }
+    }
+    // the transposed weights are given back with the object
+    CHECK(memory_manager::instance().get_usage() == 0);
+}
+
+int main() {
+    test_compact_nonzero();
+    test_matches_dense();
+    return TEST_RESULT();
+}
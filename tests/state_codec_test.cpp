@@ -0,0 +1,125 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "commondef.h"
+#include "state_codec.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+static std::vector<float> random_state(size_t n, float scale, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> dist(0.f, scale);
+    std::vector<float> state(n);
+    for (auto &v : state) {
+        v = dist(rng);
+    }
+    return state;
+}
+
+static float max_error(const std::vector<float> &a, const std::vector<float> &b) {
+    float error = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        error = std::max(error, std::fabs(a[i] - b[i]));
+    }
+    return error;
+}
+
+// n is not a multiple of the int8 block, so the short last block is covered too
+static const size_t n = 1000;
+
+static void test_round_trip() {
+    const std::vector<float> state = random_state(n, 1.f, 1);
+    // relative to the largest magnitude (about 4 sigma), per format
+    const float tolerance[RWKV_STATE_FORMAT_COUNT] = {0.f, 4e-3f, 3e-2f, 4e-2f};
+    const size_t payload[RWKV_STATE_FORMAT_COUNT] = {4 * n, 2 * n, 2 * n, n + (n + 63) / 64 * 4};
+    size_t fp32_size = 0;
+    for (int format = 0; format < RWKV_STATE_FORMAT_COUNT; format++) {
+        std::vector<uint8_t> data;
+        std::vector<float> decoded;
+        CHECK(state_encode(state, format, nullptr, data) == RWKV_SUCCESS);
+        CHECK(state_decode(data.data(), data.size(), nullptr, decoded) == RWKV_SUCCESS);
+        CHECK(decoded.size() == n);
+        if (decoded.size() == n) {
+            CHECK(max_error(state, decoded) <= tolerance[format] * 4.f);
+        }
+        if (format == RWKV_STATE_FORMAT_FP32) {
+            fp32_size = data.size();
+        } else {
+            // only the payload shrinks; the header is the same for every format
+            CHECK(fp32_size - data.size() == payload[RWKV_STATE_FORMAT_FP32] - payload[format]);
+        }
+    }
+}
+
+// a delta against a nearby base loses much less than the state itself at int8
+static void test_delta() {
+    const std::vector<float> base = random_state(n, 1.f, 2);
+    std::vector<float> state = base;
+    const std::vector<float> drift = random_state(n, 0.01f, 3);
+    for (size_t i = 0; i < n; i++) {
+        state[i] += drift[i];
+    }
+    std::vector<uint8_t> data;
+    std::vector<float> plain, delta;
+    CHECK(state_encode(state, RWKV_STATE_FORMAT_INT8, nullptr, data) == RWKV_SUCCESS);
+    CHECK(state_decode(data.data(), data.size(), nullptr, plain) == RWKV_SUCCESS);
+    CHECK(state_encode(state, RWKV_STATE_FORMAT_INT8, &base, data) == RWKV_SUCCESS);
+    CHECK(state_decode(data.data(), data.size(), &base, delta) == RWKV_SUCCESS);
+    if (plain.size() == n && delta.size() == n) {
+        CHECK(max_error(state, delta) * 20 < max_error(state, plain));
+    }
+
+    // without the base, or against another one
+    const std::vector<float> other = random_state(n, 1.f, 4);
+    const std::vector<float> shorter(n - 1, 0.f);
+    CHECK(state_decode(data.data(), data.size(), nullptr, delta) != RWKV_SUCCESS);
+    CHECK(state_decode(data.data(), data.size(), &other, delta) != RWKV_SUCCESS);
+    CHECK(state_decode(data.data(), data.size(), &shorter, delta) != RWKV_SUCCESS);
+    CHECK(state_encode(state, RWKV_STATE_FORMAT_INT8, &shorter, data) != RWKV_SUCCESS);
+}
+
+static void set_n_elements(std::vector<uint8_t> &data, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        data[12 + i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static void test_rejects_bad_input() {
+    const std::vector<float> state = random_state(n, 1.f, 5);
+    std::vector<uint8_t> data;
+    std::vector<float> decoded;
+    CHECK(state_encode(state, RWKV_STATE_FORMAT_COUNT, nullptr, data) != RWKV_SUCCESS);
+    CHECK(state_encode(state, RWKV_STATE_FORMAT_FP32, nullptr, data) == RWKV_SUCCESS);
+
+    CHECK(state_decode(nullptr, data.size(), nullptr, decoded) != RWKV_SUCCESS);
+    CHECK(state_decode(data.data(), 10, nullptr, decoded) != RWKV_SUCCESS);
+    CHECK(state_decode(data.data(), data.size() - 1, nullptr, decoded) != RWKV_SUCCESS);
+
+    std::vector<uint8_t> bad = data;
+    bad[0] = 'X';
+    CHECK(state_decode(bad.data(), bad.size(), nullptr, decoded) != RWKV_SUCCESS);
+    bad = data;
+    bad[6] = RWKV_STATE_FORMAT_COUNT;
+    CHECK(state_decode(bad.data(), bad.size(), nullptr, decoded) == RWKV_ERROR_UNSUPPORTED);
+
+    // element counts whose payload size wraps around to the actual size of the data
+    const uint64_t payload = data.size() - 28;
+    for (uint64_t n_elements : {(uint64_t)1 << 62 | payload / 4, (uint64_t)SIZE_MAX / 4 + 1, (uint64_t)-1}) {
+        bad = data;
+        set_n_elements(bad, n_elements);
+        decoded.clear();
+        CHECK(state_decode(bad.data(), bad.size(), nullptr, decoded) == RWKV_ERROR_INVALID_PARAMETERS);
+        CHECK(decoded.empty());
+    }
+}
+
+int main() {
+    test_round_trip();
+    test_delta();
+    test_rejects_bad_input();
+    return TEST_RESULT();
+}
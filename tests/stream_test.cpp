@@ -0,0 +1,111 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "commondef.h"
+#include "runtime.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+// gen_completion_stream against gen_completion: the chunked prompt prefill and the
+// token post-processing on the worker thread must not change what is generated
+
+static std::string short_prompt() {
+    return "User: Tell me a story about a cat.\n\nAssistant:";
+}
+
+// several prompt chunks, with multi-byte characters falling across their boundaries
+static std::string long_prompt() {
+    std::string text = "User: ";
+    for (int i = 0; text.size() < 5000; i++) {
+        text += "The cat sat on the mat, " + std::to_string(i) + " times. 猫が座った。 ";
+    }
+    return text + "\n\nAssistant:";
+}
+
+static std::string generate(runtime &rt, const std::string &prompt, int length) {
+    std::string text;
+    CHECK(rt.clear_state() == RWKV_SUCCESS);
+    rt.set_seed(42);
+    CHECK(rt.gen_completion(prompt, text, length) == RWKV_SUCCESS);
+    return text;
+}
+
+static void test_matches_gen_completion(runtime &rt, const std::string &prompt) {
+    const std::string expected = generate(rt, prompt, 64);
+    CHECK(!expected.empty());
+
+    CHECK(rt.clear_state() == RWKV_SUCCESS);
+    rt.set_seed(42);
+    std::string text, streamed;
+    int calls = 0;
+    bool off_thread = true;
+    const std::thread::id caller = std::this_thread::get_id();
+    CHECK(rt.gen_completion_stream(prompt, text, 64, {}, [&](const char * piece, size_t len) {
+        streamed.append(piece, len);
+        calls++;
+        off_thread &= std::this_thread::get_id() != caller;
+        return true;
+    }) == RWKV_SUCCESS);
+    CHECK(text == expected);
+    CHECK(streamed == text);
+    CHECK(calls > 0);
+    CHECK(off_thread);
+}
+
+// stops right after the token that completes a stop string, or that the callback declines
+static void test_stops(runtime &rt, const std::string &prompt) {
+    std::string full;
+    std::vector<size_t> token_ends;
+    CHECK(rt.clear_state() == RWKV_SUCCESS);
+    rt.set_seed(42);
+    CHECK(rt.gen_completion_stream(prompt, full, 64, {}, [&](const char *, size_t len) {
+        token_ends.push_back((token_ends.empty() ? 0 : token_ends.back()) + len);
+        return true;
+    }) == RWKV_SUCCESS);
+    if (token_ends.size() < 8) {
+        CHECK(false);
+        return;
+    }
+    // the last bytes of a token halfway through: generation stops there, or earlier if
+    // they occur before
+    const size_t end = token_ends[token_ends.size() / 2];
+    const std::string stop = full.substr(end - 3, 3);
+    std::string text;
+    CHECK(rt.clear_state() == RWKV_SUCCESS);
+    rt.set_seed(42);
+    CHECK(rt.gen_completion_stream(prompt, text, 64, {"", stop}, nullptr) == RWKV_SUCCESS);
+    CHECK(text.size() <= end && text.size() >= stop.size());
+    CHECK(text.compare(text.size() - stop.size(), stop.size(), stop) == 0);
+    CHECK(full.compare(0, text.size(), text) == 0);
+
+    int calls = 0;
+    CHECK(rt.clear_state() == RWKV_SUCCESS);
+    rt.set_seed(42);
+    CHECK(rt.gen_completion_stream(prompt, text, 64, {}, [&](const char *, size_t) {
+        return ++calls < 3;
+    }) == RWKV_SUCCESS);
+    CHECK(calls == 3);
+    CHECK(text.size() == token_ends[2]);
+    CHECK(full.compare(0, text.size(), text) == 0);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <vocab_file> <model_file>\n", argv[0]);
+        return 1;
+    }
+    runtime rt;
+    int ret = rt.init("rwkv.cpp");
+    if (!ret) ret = rt.load_tokenizer(argv[1]);
+    if (!ret) ret = rt.load_model(argv[2]);
+    CHECK(ret == RWKV_SUCCESS);
+    if (ret != RWKV_SUCCESS) {
+        return TEST_RESULT();
+    }
+    test_matches_gen_completion(rt, short_prompt());
+    test_matches_gen_completion(rt, long_prompt());
+    test_stops(rt, short_prompt());
+    return TEST_RESULT();
+}
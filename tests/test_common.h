@@ -0,0 +1,20 @@
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <cstdio>
+#include <cstdlib>
+
+// the tests are plain executables registered with add_test; a failed check prints
+// where it failed and makes main() return non-zero through test_failures
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? 0 : (fprintf(stderr, "%d check(s) failed\n", test_failures), 1))
+
+#endif
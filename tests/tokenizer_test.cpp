@@ -0,0 +1,134 @@
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "commondef.h"
+#include "tokenizer.h"
+#include "test_common.h"
+
+using namespace rwkvmobile;
+
+// ids outside the vocab decode to nothing, through every decode entry point
+static void test_unknown_ids(const trie_tokenizer &tok) {
+    const std::vector<int> hello = tok.encode("Hello");
+    CHECK(!hello.empty());
+    CHECK(tok.decode(-1).empty());
+    CHECK(tok.decode(1 << 30).empty());
+
+    std::vector<int> ids = {-1};
+    ids.insert(ids.end(), hello.begin(), hello.end());
+    ids.push_back(1 << 30);
+    CHECK(tok.decode(ids) == "Hello");
+    char buf[16];
+    memset(buf, 'x', sizeof(buf));
+    CHECK(tok.decode_into(ids, buf, sizeof(buf)) == 5);
+    CHECK(std::string(buf, 5) == "Hello" && buf[5] == 'x');
+    CHECK(tok.decode_into(-1, buf, 0) == 0);
+    CHECK(tok.decode_into(-1, nullptr, 0) == 0);
+}
+
+// text with the things greedy matching is sensitive to: long tokens that share
+// prefixes, runs of spaces and newlines, digits and multi-byte characters
+static std::string random_piece(std::mt19937 &rng) {
+    static const char * pieces[] = {
+        "the", " the", " then", " there", " therefore", "Hello", " world", "  ", "   ",
+        "\n", "\n\n", "\t", "1", "23", "456", ".", ",", "!", "User:", " Assistant:",
+        "\xe7\x8c\xab", "\xe3\x81\x8c", "\xf0\x9f\x98\x80", "\xc3\xa9", "abc", "zzz",
+    };
+    std::string piece = pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+    // sometimes only part of it, leaving split characters and unfinished words
+    if (rng() % 4 == 0) {
+        piece.resize(rng() % (piece.size() + 1));
+    }
+    return piece;
+}
+
+static void check_tokenization(const tokenizer_base &tok, const incremental_encoding &state) {
+    CHECK(state.ids == tok.encode(state.text));
+    CHECK(state.offsets.size() == state.ids.size());
+    size_t offset = 0;
+    for (size_t i = 0; i < state.ids.size() && i < state.offsets.size(); i++) {
+        CHECK(state.offsets[i] == offset);
+        offset += tok.token_length(state.ids[i]);
+    }
+    CHECK(offset == state.text.size());
+}
+
+// text grown piece by piece, now and then cut back, must tokenize exactly like
+// encoding the whole text each time
+static void test_incremental_matches_encode(const tokenizer_base &tok, unsigned seed) {
+    std::mt19937 rng(seed);
+    const int failures = test_failures;
+    for (int run = 0; run < 20; run++) {
+        incremental_encoding state;
+        std::string text;
+        for (int step = 0; step < 200; step++) {
+            if (rng() % 8 == 0 && !text.empty()) {
+                text.resize(rng() % text.size());
+            } else {
+                text += random_piece(rng);
+            }
+            size_t kept = tok.encode_incremental(state, text);
+            CHECK(kept <= state.ids.size());
+            check_tokenization(tok, state);
+            if (test_failures > failures) {
+                fprintf(stderr, "seed %u run %d step %d\n", seed, run, step);
+                return;
+            }
+        }
+    }
+}
+
+// encode_range over consecutive windows rebuilds encode of the whole text
+static void test_range_matches_encode(const tokenizer_base &tok) {
+    std::mt19937 rng(7);
+    std::string text;
+    while (text.size() < 4000) {
+        text += random_piece(rng);
+    }
+    const std::vector<int> expected = tok.encode(text);
+    for (size_t window : {1, 7, 64, 1000}) {
+        std::vector<int> ids;
+        std::vector<size_t> offsets;
+        size_t begin = 0;
+        while (begin < text.size()) {
+            size_t next = tok.encode_range(text, begin, std::min(text.size(), begin + window), ids, &offsets);
+            CHECK(next > begin);
+            if (next <= begin) {
+                break;
+            }
+            begin = next;
+        }
+        CHECK(ids == expected);
+        CHECK(begin == text.size());
+    }
+}
+
+// the abc tokenizer's special ids 0-3 decode to nothing but still stand for a byte
+static void test_abc_special_ids() {
+    abc_tokenizer tok;
+    incremental_encoding state;
+    std::string text = "a\x01" "b\x02";
+    text += '\0';
+    tok.encode_incremental(state, text);
+    check_tokenization(tok, state);
+    text += "\x03" "cd";
+    CHECK(tok.encode_incremental(state, text) == 5);
+    check_tokenization(tok, state);
+    test_incremental_matches_encode(tok, 3);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <vocab_file>\n", argv[0]);
+        return 1;
+    }
+    trie_tokenizer tok;
+    CHECK(tok.load(argv[1]) == RWKV_SUCCESS);
+    test_unknown_ids(tok);
+    test_incremental_matches_encode(tok, 1);
+    test_range_matches_encode(tok);
+    test_abc_special_ids();
+    return TEST_RESULT();
+}